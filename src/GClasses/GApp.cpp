@@ -563,7 +563,10 @@ int GApp::systemExecute(const char* szCommand, bool wait, GPipe* pStdOut, GPipe*
 		execvp(argv[0], argv);
 
 		// execvp only returns if there is an error. Otherwise, it replaces the current process.
-		throw Ex("Error calling execvp. errno=", to_str(errno));
+		// (The forked process must not throw or exit normally, because it would unwind the caller's
+		// stack and run static destructors, such as the one that joins the threads of GThreadPool::global(),
+		// and those threads do not exist in the forked process.)
+		_exit(127);
 	}
 	else if(pid > 0) // else if I am the calling process...
 	{
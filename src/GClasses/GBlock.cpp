@@ -45,6 +45,11 @@
 #include <memory>
 #include "GNeuralNet.h"
 #include <iostream>
+#include <string.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define GBLOCK_X86_KERNELS
+#	include <immintrin.h>
+#endif
 
 using std::vector;
 using std::ostream;
@@ -109,6 +114,27 @@ std::string GBlock::to_str() const
 	return os.str();
 }
 
+void GBlock::forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const
+{
+	GAssert(input.rows() == output.rows());
+	for(size_t i = 0; i < input.rows(); i++)
+		forwardProp(ctx, input[i], output[i]);
+}
+
+void GBlock::backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
+{
+	GAssert(outBlame.rows() == inBlame.rows());
+	for(size_t i = 0; i < outBlame.rows(); i++)
+		backProp(ctx, input[i], output[i], outBlame[i], inBlame[i]);
+}
+
+void GBlock::updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const
+{
+	GAssert(input.rows() == outBlame.rows());
+	for(size_t i = 0; i < input.rows(); i++)
+		updateGradient(ctx, input[i], outBlame[i], gradient);
+}
+
 void GBlock::basicTest()
 {
 	// Make a layer
@@ -553,6 +579,32 @@ void GBlockActivation::backProp(GContext& ctx, const GVec& input, const GVec& ou
 		inBlame[i] += outBlame[i] * derivative(input[i], output[i]);
 }
 
+void GBlockActivation::forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const
+{
+	GAssert(input.rows() == output.rows() && input.cols() == m_units && output.cols() == m_units);
+	for(size_t r = 0; r < input.rows(); r++)
+	{
+		const double* pIn = input[r].data();
+		double* pOut = output[r].data();
+		for(size_t i = 0; i < m_units; i++)
+			pOut[i] = eval(pIn[i]);
+	}
+}
+
+void GBlockActivation::backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
+{
+	GAssert(outBlame.rows() == inBlame.rows() && inBlame.cols() == m_units);
+	for(size_t r = 0; r < inBlame.rows(); r++)
+	{
+		const double* pIn = input[r].data();
+		const double* pOut = output[r].data();
+		const double* pOutBlame = outBlame[r].data();
+		double* pInBlame = inBlame[r].data();
+		for(size_t i = 0; i < m_units; i++)
+			pInBlame[i] += pOutBlame[i] * derivative(pIn[i], pOut[i]);
+	}
+}
+
 
 
 
@@ -694,19 +746,371 @@ void GBlockSoftExp::diminishWeights(double amount, bool regularizeBiases)
 
 
 
+// Returns the dot product of n unsigned bytes with n signed bytes. (The sum fits in 32 bits as long as n < 65536.)
+static int32_t GQuantizedWeights_dotPortable(const uint8_t* pIn, const int8_t* pW, size_t n)
+{
+	int32_t sum = 0;
+	for(size_t i = 0; i < n; i++)
+		sum += (int32_t)pIn[i] * (int32_t)pW[i];
+	return sum;
+}
+
+#ifdef GBLOCK_X86_KERNELS
+// These are compiled for their instruction sets with target attributes, and chosen at runtime
+// by GQuantizedWeights_pickDot, so the default build (without -march) uses them too.
+
+__attribute__((target("avx2")))
+static int32_t GQuantizedWeights_sumLanes(__m256i acc)
+{
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+	return _mm_cvtsi128_si32(s);
+}
+
+__attribute__((target("avx2")))
+static int32_t GQuantizedWeights_dotAvx2(const uint8_t* pIn, const int8_t* pW, size_t n)
+{
+	size_t i = 0;
+	__m256i acc = _mm256_setzero_si256();
+	for(; i + 32 <= n; i += 32)
+	{
+		// Widen to 16 bits first, because _mm256_maddubs_epi16 would saturate
+		__m256i a = _mm256_loadu_si256((const __m256i*)(pIn + i));
+		__m256i b = _mm256_loadu_si256((const __m256i*)(pW + i));
+		__m256i a0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a));
+		__m256i a1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1));
+		__m256i b0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(b));
+		__m256i b1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(b, 1));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a0, b0));
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(a1, b1));
+	}
+	return GQuantizedWeights_sumLanes(acc) + GQuantizedWeights_dotPortable(pIn + i, pW + i, n - i);
+}
+
+__attribute__((target("avx2,avx512vnni,avx512vl")))
+static int32_t GQuantizedWeights_dotVnni(const uint8_t* pIn, const int8_t* pW, size_t n)
+{
+	size_t i = 0;
+	__m256i acc = _mm256_setzero_si256();
+	for(; i + 32 <= n; i += 32)
+		acc = _mm256_dpbusd_epi32(acc, _mm256_loadu_si256((const __m256i*)(pIn + i)), _mm256_loadu_si256((const __m256i*)(pW + i)));
+	return GQuantizedWeights_sumLanes(acc) + GQuantizedWeights_dotPortable(pIn + i, pW + i, n - i);
+}
+#endif // GBLOCK_X86_KERNELS
+
+typedef int32_t (*GQuantizedWeights_dotFunc)(const uint8_t* pIn, const int8_t* pW, size_t n);
+
+// Picks the fastest dot product that this CPU supports, and names it in *pszName
+static GQuantizedWeights_dotFunc GQuantizedWeights_pickDot(const char** pszName)
+{
+#ifdef GBLOCK_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512vl"))
+	{
+		*pszName = "avx512vnni";
+		return GQuantizedWeights_dotVnni;
+	}
+	if(__builtin_cpu_supports("avx2"))
+	{
+		*pszName = "avx2";
+		return GQuantizedWeights_dotAvx2;
+	}
+#endif
+	*pszName = "portable";
+	return GQuantizedWeights_dotPortable;
+}
+
+static const char* g_szQuantizedDot = NULL;
+static const GQuantizedWeights_dotFunc g_quantizedDot = GQuantizedWeights_pickDot(&g_szQuantizedDot);
+
+GQuantizedWeights::GQuantizedWeights()
+: m_channels(0), m_length(0), m_stride(0), m_inputScale(1.0)
+{
+}
+
+void GQuantizedWeights::deserialize(GDomNode* pNode)
+{
+	m_channels = (size_t)pNode->field("channels")->asInt();
+	m_length = (size_t)pNode->field("length")->asInt();
+	m_stride = (m_length + 31) / 32 * 32;
+	m_inputScale = pNode->field("inscale")->asDouble();
+	GVec scales(pNode->field("scales"));
+	m_scales.copy(scales);
+	const char* szHex = pNode->field("weights")->asString();
+	if(strlen(szHex) != 2 * m_channels * m_length || m_scales.size() != m_channels)
+		throw Ex("Invalid quantized weights");
+	m_weights.assign(m_channels * m_stride, 0);
+	m_offsets.resize(m_channels);
+	for(size_t c = 0; c < m_channels; c++)
+	{
+		int8_t* pW = m_weights.data() + c * m_stride;
+		int32_t sum = 0;
+		for(size_t i = 0; i < m_length; i++)
+		{
+			pW[i] = (int8_t)GBits::hexToByte(szHex[0], szHex[1]);
+			sum += pW[i];
+			szHex += 2;
+		}
+		m_offsets[c] = 128 * sum;
+	}
+}
+
+GDomNode* GQuantizedWeights::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->addField(pDoc, "channels", pDoc->newInt(m_channels));
+	pNode->addField(pDoc, "length", pDoc->newInt(m_length));
+	pNode->addField(pDoc, "inscale", pDoc->newDouble(m_inputScale));
+	pNode->addField(pDoc, "scales", m_scales.serialize(pDoc));
+	std::string hex(2 * m_channels * m_length, '0');
+	char* pHex = &hex[0];
+	for(size_t c = 0; c < m_channels; c++)
+	{
+		const int8_t* pW = m_weights.data() + c * m_stride;
+		for(size_t i = 0; i < m_length; i++)
+		{
+			GBits::byteToHex((unsigned char)pW[i], pHex);
+			pHex += 2;
+		}
+	}
+	pNode->addField(pDoc, "weights", pDoc->newString(hex.c_str()));
+	return pNode;
+}
+
+void GQuantizedWeights::clear()
+{
+	m_channels = 0;
+	m_length = 0;
+	m_stride = 0;
+	std::vector<int8_t>().swap(m_weights);
+	m_scales.resize(0);
+	m_offsets.clear();
+}
+
+void GQuantizedWeights::quantize(size_t channels, size_t length, double inputMax, const std::function<double(size_t, size_t)>& weight)
+{
+	m_channels = channels;
+	m_length = length;
+	m_stride = (length + 31) / 32 * 32;
+	m_inputScale = (inputMax > 0.0 ? inputMax : 1.0) / 127.0;
+	m_weights.assign(channels * m_stride, 0);
+	m_scales.resize(channels);
+	m_offsets.resize(channels);
+	for(size_t c = 0; c < channels; c++)
+	{
+		double mag = 0.0;
+		for(size_t i = 0; i < length; i++)
+			mag = std::max(mag, std::abs(weight(c, i)));
+		double weightScale = (mag > 0.0 ? mag / 127.0 : 1.0);
+		int8_t* pW = m_weights.data() + c * m_stride;
+		int32_t sum = 0;
+		for(size_t i = 0; i < length; i++)
+		{
+			double q = std::floor(weight(c, i) / weightScale + 0.5);
+			pW[i] = (int8_t)std::max(-127.0, std::min(127.0, q));
+			sum += pW[i];
+		}
+		m_scales[c] = m_inputScale * weightScale;
+		m_offsets[c] = 128 * sum;
+	}
+}
+
+void GQuantizedWeights::quantizeInput(const double* pIn, uint8_t* pOut) const
+{
+	for(size_t i = 0; i < m_length; i++)
+		pOut[i] = quantizeInput(pIn[i]);
+	for(size_t i = m_length; i < m_stride; i++)
+		pOut[i] = 128;
+}
+
+double GQuantizedWeights::dot(size_t c, const uint8_t* pIn) const
+{
+	int32_t sum = g_quantizedDot(pIn, m_weights.data() + c * m_stride, m_stride);
+	return m_scales[c] * (double)(sum - m_offsets[c]);
+}
+
+// static
+const char* GQuantizedWeights::kernelName()
+{
+	return g_szQuantizedDot;
+}
+
+// static
+uint8_t* GQuantizedWeights::scratch(size_t bytes)
+{
+	static thread_local std::vector<uint8_t> buf;
+	if(buf.size() < bytes)
+		buf.resize(bytes);
+	return buf.data();
+}
+
+// Gives the propagation kernels of GBlockLinear uniform access to the rows of the master weights
+class GBlockLinear_DoubleRows
+{
+protected:
+	const GMatrix& m_weights;
+
+public:
+	GBlockLinear_DoubleRows(const GMatrix& weights) : m_weights(weights) {}
+	const double* operator[](size_t i) const { return m_weights[i].data(); }
+};
+
+// Gives the propagation kernels of GBlockLinear uniform access to the rows of the single-precision weights
+class GBlockLinear_FloatRows
+{
+protected:
+	const float* m_pWeights;
+	size_t m_cols;
+
+public:
+	GBlockLinear_FloatRows(const std::vector<float>& weights, size_t cols) : m_pWeights(weights.data()), m_cols(cols) {}
+	const float* operator[](size_t i) const { return m_pWeights + i * m_cols; }
+};
+
+// Sets pOut to the bias row, then adds each input value (pIn1 followed by pIn2) times the corresponding row of weights.
+template<class Rows>
+void GBlockLinear_forwardProp(const Rows& w, size_t biasRow, size_t n, const double* pIn1, size_t count1, const double* pIn2, size_t count2, double* pOut)
+{
+	const auto* pBias = w[biasRow];
+	for(size_t j = 0; j < n; j++)
+		pOut[j] = pBias[j];
+	for(size_t i = 0; i < count1; i++)
+	{
+		const auto* pW = w[i];
+		double a = pIn1[i];
+		for(size_t j = 0; j < n; j++)
+			pOut[j] += a * pW[j];
+	}
+	for(size_t i = 0; i < count2; i++)
+	{
+		const auto* pW = w[count1 + i];
+		double a = pIn2[i];
+		for(size_t j = 0; j < n; j++)
+			pOut[j] += a * pW[j];
+	}
+}
+
+// Adds the dot product of pBlame with each row of weights (starting at firstRow) to pInBlame.
+template<class Rows>
+void GBlockLinear_backProp(const Rows& w, size_t firstRow, size_t n, const double* pBlame, size_t count, double* pInBlame)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		const auto* pW = w[firstRow + i];
+		double sum = 0.0;
+		for(size_t j = 0; j < n; j++)
+			sum += pBlame[j] * pW[j];
+		pInBlame[i] += sum;
+	}
+}
+
+// Propagates four rows of a batch at a time, so each row of weights is read once per tile
+template<class Rows>
+size_t GBlockLinear_forwardPropTiles(const Rows& w, size_t inputs, size_t n, const GMatrix& input, GMatrix& output)
+{
+	const auto* pBias = w[inputs];
+	size_t r = 0;
+	for(; r + 4 <= input.rows(); r += 4)
+	{
+		const double* pIn0 = input[r].data();
+		const double* pIn1 = input[r + 1].data();
+		const double* pIn2 = input[r + 2].data();
+		const double* pIn3 = input[r + 3].data();
+		double* pOut0 = output[r].data();
+		double* pOut1 = output[r + 1].data();
+		double* pOut2 = output[r + 2].data();
+		double* pOut3 = output[r + 3].data();
+		for(size_t j = 0; j < n; j++)
+			pOut0[j] = pOut1[j] = pOut2[j] = pOut3[j] = pBias[j];
+		for(size_t i = 0; i < inputs; i++)
+		{
+			const auto* pW = w[i];
+			double a0 = pIn0[i];
+			double a1 = pIn1[i];
+			double a2 = pIn2[i];
+			double a3 = pIn3[i];
+			for(size_t j = 0; j < n; j++)
+			{
+				double wj = pW[j];
+				pOut0[j] += a0 * wj;
+				pOut1[j] += a1 * wj;
+				pOut2[j] += a2 * wj;
+				pOut3[j] += a3 * wj;
+			}
+		}
+	}
+	return r;
+}
+
+// Back-propagates four rows of a batch at a time, so each row of weights is read once per tile
+template<class Rows>
+size_t GBlockLinear_backPropTiles(const Rows& w, size_t inputs, size_t n, const GMatrix& outBlame, GMatrix& inBlame)
+{
+	size_t r = 0;
+	for(; r + 4 <= outBlame.rows(); r += 4)
+	{
+		const double* pB0 = outBlame[r].data();
+		const double* pB1 = outBlame[r + 1].data();
+		const double* pB2 = outBlame[r + 2].data();
+		const double* pB3 = outBlame[r + 3].data();
+		double* pIn0 = inBlame[r].data();
+		double* pIn1 = inBlame[r + 1].data();
+		double* pIn2 = inBlame[r + 2].data();
+		double* pIn3 = inBlame[r + 3].data();
+		for(size_t i = 0; i < inputs; i++)
+		{
+			const auto* pW = w[i];
+			double s0 = 0.0;
+			double s1 = 0.0;
+			double s2 = 0.0;
+			double s3 = 0.0;
+			for(size_t j = 0; j < n; j++)
+			{
+				double wj = pW[j];
+				s0 += pB0[j] * wj;
+				s1 += pB1[j] * wj;
+				s2 += pB2[j] * wj;
+				s3 += pB3[j] * wj;
+			}
+			pIn0[i] += s0;
+			pIn1[i] += s1;
+			pIn2[i] += s2;
+			pIn3[i] += s3;
+		}
+	}
+	return r;
+}
+
 GBlockLinear::GBlockLinear(size_t outputs, size_t inputs)
+: m_single(false)
 {
 	resize(inputs, outputs);
 }
 
 GBlockLinear::GBlockLinear(GDomNode* pNode)
-: GBlock(pNode), m_weights(pNode->field("weights"))
-{}
+: GBlock(pNode), m_weights(pNode->field("weights")), m_single(false)
+{
+	GDomNode* pSingle = pNode->fieldIfExists("single");
+	if(pSingle && pSingle->asBool())
+		setSinglePrecision(true);
+	GDomNode* pQuantized = pNode->fieldIfExists("int8");
+	if(pQuantized)
+	{
+		m_quantized.deserialize(pQuantized);
+		if(m_quantized.channels() != outputs() || m_quantized.length() != inputs())
+			throw Ex("The int8 weights do not fit this GBlockLinear");
+	}
+}
 
 GDomNode* GBlockLinear::serialize(GDom* pDoc) const
 {
 	GDomNode* pNode = baseDomNode(pDoc);
 	pNode->addField(pDoc, "weights", m_weights.serialize(pDoc));
+	if(m_single)
+		pNode->addField(pDoc, "single", pDoc->newBool(true));
+	if(!m_quantized.empty())
+		pNode->addField(pDoc, "int8", m_quantized.serialize(pDoc));
 	return pNode;
 }
 
@@ -715,46 +1119,103 @@ void GBlockLinear::resize(size_t in, size_t out)
 	if(in == inputs() && out == outputs())
 		return;
 	m_weights.resize(in + 1, out);
+	syncWeightCopies();
+}
+
+void GBlockLinear::setSinglePrecision(bool single)
+{
+	m_single = single;
+	syncWeightCopies();
+}
+
+void GBlockLinear::quantizeWeights(double inputMax)
+{
+	m_quantized.quantize(outputs(), inputs(), inputMax, [this](size_t c, size_t i) { return m_weights[i][c]; });
+}
+
+void GBlockLinear::syncWeightCopies()
+{
+	if(!m_quantized.empty())
+		quantizeWeights(m_quantized.inputMax());
+	if(!m_single)
+	{
+		std::vector<float>().swap(m_weightsSingle);
+		return;
+	}
+	size_t n = m_weights.cols();
+	m_weightsSingle.resize(m_weights.rows() * n);
+	float* pDest = m_weightsSingle.data();
+	for(size_t i = 0; i < m_weights.rows(); i++)
+	{
+		const double* pSrc = m_weights[i].data();
+		for(size_t j = 0; j < n; j++)
+			*pDest++ = (float)pSrc[j];
+	}
+}
+
+void GBlockLinear::refreshWeightCopies() const
+{
+	m_stale.refresh([this]() { const_cast<GBlockLinear*>(this)->syncWeightCopies(); });
 }
 
 void GBlockLinear::forwardProp(GContext& ctx, const GVec& input, GVec& output) const
 {
+	refreshWeightCopies();
 	GAssert(input.size() == m_weights.rows() - 1);
 	GAssert(output.size() == m_weights.cols());
-	output.copy(bias());
-	GAssert(output[outputs() - 1] > -1e100 && output[outputs() - 1] < 1e100);
-	for(size_t i = 0; i < input.size(); i++)
-		output.addScaled(input[i], m_weights.row(i));
+	if(!m_quantized.empty())
+	{
+		uint8_t* pBuf = GQuantizedWeights::scratch(m_quantized.stride());
+		m_quantized.quantizeInput(input.data(), pBuf);
+		const GVec& b = bias();
+		for(size_t j = 0; j < output.size(); j++)
+			output[j] = b[j] + m_quantized.dot(j, pBuf);
+	}
+	else if(m_single)
+		GBlockLinear_forwardProp(GBlockLinear_FloatRows(m_weightsSingle, outputs()), inputs(), outputs(), input.data(), input.size(), nullptr, 0, output.data());
+	else
+		GBlockLinear_forwardProp(GBlockLinear_DoubleRows(m_weights), inputs(), outputs(), input.data(), input.size(), nullptr, 0, output.data());
 	GAssert(output[outputs() - 1] > -1e100 && output[outputs() - 1] < 1e100);
 }
 
 void GBlockLinear::forwardProp2(const GVec& in1, const GVec& in2, GVec& output) const
 {
+	refreshWeightCopies();
 	GAssert(in1.size() + in2.size() == m_weights.rows() - 1);
 	GAssert(output.size() == m_weights.cols());
-	output.copy(bias());
-	GAssert(output[outputs() - 1] > -1e100 && output[outputs() - 1] < 1e100);
-	for(size_t i = 0; i < in1.size(); i++)
-		output.addScaled(in1[i], m_weights.row(i));
-	for(size_t i = 0; i < in2.size(); i++)
-		output.addScaled(in2[i], m_weights.row(in1.size() + i));
+	if(m_single)
+		GBlockLinear_forwardProp(GBlockLinear_FloatRows(m_weightsSingle, outputs()), inputs(), outputs(), in1.data(), in1.size(), in2.data(), in2.size(), output.data());
+	else
+		GBlockLinear_forwardProp(GBlockLinear_DoubleRows(m_weights), inputs(), outputs(), in1.data(), in1.size(), in2.data(), in2.size(), output.data());
 	GAssert(output[outputs() - 1] > -1e100 && output[outputs() - 1] < 1e100);
 }
 
 void GBlockLinear::backProp(GContext& ctx, const GVec& input, const GVec& output, const GVec& outBlame, GVec& inBlame) const
 {
+	refreshWeightCopies();
 	GAssert(outBlame.size() == m_weights.cols() && inBlame.size() == m_weights.rows() - 1);
-	for(size_t i = 0; i < inBlame.size(); i++)
-		inBlame[i] += outBlame.dotProduct(m_weights[i]);
+	if(m_single)
+		GBlockLinear_backProp(GBlockLinear_FloatRows(m_weightsSingle, outputs()), 0, outputs(), outBlame.data(), inBlame.size(), inBlame.data());
+	else
+		GBlockLinear_backProp(GBlockLinear_DoubleRows(m_weights), 0, outputs(), outBlame.data(), inBlame.size(), inBlame.data());
 }
 
 void GBlockLinear::backProp2(const GVec& outBlame, GVec& inBlame1, GVec& inBlame2) const
 {
+	refreshWeightCopies();
 	GAssert(outBlame.size() == m_weights.cols() && inBlame1.size() + inBlame2.size() == m_weights.rows() - 1);
-	for(size_t i = 0; i < inBlame1.size(); i++)
-		inBlame1[i] += outBlame.dotProduct(m_weights[i]);
-	for(size_t i = 0; i < inBlame2.size(); i++)
-		inBlame2[i] += outBlame.dotProduct(m_weights[inBlame1.size() + i]);
+	if(m_single)
+	{
+		GBlockLinear_FloatRows w(m_weightsSingle, outputs());
+		GBlockLinear_backProp(w, 0, outputs(), outBlame.data(), inBlame1.size(), inBlame1.data());
+		GBlockLinear_backProp(w, inBlame1.size(), outputs(), outBlame.data(), inBlame2.size(), inBlame2.data());
+	}
+	else
+	{
+		GBlockLinear_DoubleRows w(m_weights);
+		GBlockLinear_backProp(w, 0, outputs(), outBlame.data(), inBlame1.size(), inBlame1.data());
+		GBlockLinear_backProp(w, inBlame1.size(), outputs(), outBlame.data(), inBlame2.size(), inBlame2.data());
+	}
 }
 
 void GBlockLinear::updateGradient(GContext& ctx, const GVec& input, const GVec& outBlame, GVec& gradient) const
@@ -792,6 +1253,78 @@ void GBlockLinear::updateGradient2(const GVec& in1, const GVec& in2, const GVec&
 		*delta++ += outBlame[j];
 }
 
+void GBlockLinear::forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const
+{
+	refreshWeightCopies();
+	GAssert(input.rows() == output.rows() && input.cols() == inputs() && output.cols() == outputs());
+	if(!m_quantized.empty())
+	{
+		uint8_t* pBuf = GQuantizedWeights::scratch(m_quantized.stride());
+		const GVec& b = bias();
+		for(size_t r = 0; r < input.rows(); r++)
+		{
+			m_quantized.quantizeInput(input[r].data(), pBuf);
+			double* pOut = output[r].data();
+			for(size_t j = 0; j < outputs(); j++)
+				pOut[j] = b[j] + m_quantized.dot(j, pBuf);
+		}
+		return;
+	}
+	size_t r;
+	if(m_single)
+		r = GBlockLinear_forwardPropTiles(GBlockLinear_FloatRows(m_weightsSingle, outputs()), inputs(), outputs(), input, output);
+	else
+		r = GBlockLinear_forwardPropTiles(GBlockLinear_DoubleRows(m_weights), inputs(), outputs(), input, output);
+	for(; r < input.rows(); r++)
+		forwardProp(ctx, input[r], output[r]);
+}
+
+void GBlockLinear::backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
+{
+	refreshWeightCopies();
+	GAssert(outBlame.rows() == inBlame.rows() && outBlame.cols() == outputs() && inBlame.cols() == inputs());
+	size_t r;
+	if(m_single)
+		r = GBlockLinear_backPropTiles(GBlockLinear_FloatRows(m_weightsSingle, outputs()), inputs(), outputs(), outBlame, inBlame);
+	else
+		r = GBlockLinear_backPropTiles(GBlockLinear_DoubleRows(m_weights), inputs(), outputs(), outBlame, inBlame);
+	for(; r < outBlame.rows(); r++)
+		backProp(ctx, input[r], output[r], outBlame[r], inBlame[r]);
+}
+
+void GBlockLinear::updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const
+{
+	GAssert(gradient.size() == weightCount(), "gradient must match the dimensions of weights!");
+	GAssert(input.rows() == outBlame.rows());
+	size_t n = outputs();
+	size_t r = 0;
+	for(; r + 4 <= input.rows(); r += 4)
+	{
+		const double* pIn0 = input[r].data();
+		const double* pIn1 = input[r + 1].data();
+		const double* pIn2 = input[r + 2].data();
+		const double* pIn3 = input[r + 3].data();
+		const double* pB0 = outBlame[r].data();
+		const double* pB1 = outBlame[r + 1].data();
+		const double* pB2 = outBlame[r + 2].data();
+		const double* pB3 = outBlame[r + 3].data();
+		double* delta = gradient.data();
+		for(size_t i = 0; i < inputs(); i++)
+		{
+			double a0 = pIn0[i];
+			double a1 = pIn1[i];
+			double a2 = pIn2[i];
+			double a3 = pIn3[i];
+			for(size_t j = 0; j < n; j++)
+				*delta++ += a0 * pB0[j] + a1 * pB1[j] + a2 * pB2[j] + a3 * pB3[j];
+		}
+		for(size_t j = 0; j < n; j++)
+			*delta++ += pB0[j] + pB1[j] + pB2[j] + pB3[j];
+	}
+	for(; r < input.rows(); r++)
+		updateGradient(ctx, input[r], outBlame[r], gradient);
+}
+
 void GBlockLinear::step(double learningRate, const GVec& gradient)
 {
 	GAssert(gradient.size() == weightCount(), "gradient must match the dimensions of weights!");
@@ -802,9 +1335,10 @@ void GBlockLinear::step(double learningRate, const GVec& gradient)
 		for(size_t j = 0; j < outputs(); ++j)
 			row[j] += learningRate * *delta++;
 	}
-	GVec& b = bias();
+	GVec& b = m_weights.back();
 	for(size_t j = 0; j < outputs(); ++j)
 		b[j] += learningRate * *delta++;
+	syncWeightCopies();
 }
 
 size_t GBlockLinear::weightCount() const
@@ -821,6 +1355,7 @@ size_t GBlockLinear::weightsToVector(double* pOutVector) const
 size_t GBlockLinear::vectorToWeights(const double* pVector)
 {
 	m_weights.fromVector(pVector, m_weights.rows());
+	syncWeightCopies();
 	return weightCount();
 }
 
@@ -828,6 +1363,7 @@ void GBlockLinear::copyWeights(const GBlock* pSource)
 {
 	GBlockLinear *src = (GBlockLinear*) pSource;
 	m_weights.copyBlock(src->m_weights, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+	syncWeightCopies();
 }
 
 void GBlockLinear::resetWeights(GRand& rand)
@@ -841,12 +1377,14 @@ void GBlockLinear::resetWeights(GRand& rand)
 		for(size_t j = 0; j < outputCount; j++)
 			w[j] = rand.normal() * mag;
 	}
+	syncWeightCopies();
 }
 
 void GBlockLinear::perturbWeights(GRand &rand, double deviation)
 {
 	for(size_t j = 0; j < m_weights.rows(); j++)
 		GVec::perturb(m_weights[j].data(), deviation, m_weights.cols(), rand);
+	syncWeightCopies();
 }
 
 void GBlockLinear::maxNorm(double min, double max)
@@ -880,6 +1418,7 @@ void GBlockLinear::maxNorm(double min, double max)
 				m_weights[j][i] *= scal;
 		}
 	}
+	syncWeightCopies();
 }
 
 void GBlockLinear::scaleWeights(double factor, bool scaleBiases)
@@ -887,7 +1426,8 @@ void GBlockLinear::scaleWeights(double factor, bool scaleBiases)
 	for(size_t i = 0; i < inputs(); i++)
 		m_weights[i] *= factor;
 	if(scaleBiases)
-		bias() *= factor;
+		m_weights.back() *= factor;
+	syncWeightCopies();
 }
 
 void GBlockLinear::diminishWeights(double amount, bool regularizeBiases)
@@ -895,12 +1435,13 @@ void GBlockLinear::diminishWeights(double amount, bool regularizeBiases)
 	for(size_t i = 0; i < inputs(); i++)
 		m_weights[i].regularizeL1(amount);
 	if(regularizeBiases)
-		bias().regularizeL1(amount);
+		m_weights.back().regularizeL1(amount);
+	syncWeightCopies();
 }
 
 void GBlockLinear::contractWeights(double factor, bool contractBiases, const GVec& output)
 {
-	GVec& b = bias();
+	GVec& b = m_weights.back();
 	size_t outputCount = outputs();
 	for(size_t i = 0; i < outputCount; i++)
 	{
@@ -916,13 +1457,14 @@ void GBlockLinear::contractWeights(double factor, bool contractBiases, const GVe
 		if(contractBiases)
 			b[i] *= f;
 	}
+	syncWeightCopies();
 }
 
 void GBlockLinear::renormalizeInput(size_t input, double oldMin, double oldMax, double newMin, double newMax)
 {
 	size_t outputCount = outputs();
 	GVec& w = m_weights[input];
-	GVec& b = bias();
+	GVec& b = m_weights.back();
 	double f = (oldMax - oldMin) / (newMax - newMin);
 	double g = (oldMin - newMin * f);
 	for(size_t i = 0; i < outputCount; i++)
@@ -930,6 +1472,7 @@ void GBlockLinear::renormalizeInput(size_t input, double oldMin, double oldMax,
 		b[i] += (w[i] * g);
 		w[i] *= f;
 	}
+	syncWeightCopies();
 }
 
 void GBlockLinear::adjustOutput(const GVec& input, size_t outputIndex, double delta)
@@ -937,7 +1480,8 @@ void GBlockLinear::adjustOutput(const GVec& input, size_t outputIndex, double de
 	double step = delta / (input.squaredMagnitude() + 1.0);
 	for(size_t i = 0; i < inputs(); i++)
 		m_weights[i][outputIndex] += step * input[i];
-	bias()[outputIndex] += step;
+	m_weights.back()[outputIndex] += step;
+	syncWeightCopies();
 }
 
 void GBlockLinear::clipOutput(const GVec& input, const GVec& output, double min, double max)
@@ -970,17 +1514,20 @@ void GBlockLinear::transformWeights(GMatrix& transform, const GVec& offset)
 	n.fill(0.0);
 	for(size_t i = 0; i < inputs(); i++)
 		n.addScaled(offset[i], m_weights.row(i));
-	bias() += n;
+	m_weights.back() += n;
+	syncWeightCopies();
 }
 
 void GBlockLinear::dropInput(size_t input)
 {
 	m_weights.deleteRowPreserveOrder(input);
+	syncWeightCopies();
 }
 
 void GBlockLinear::dropOutput(size_t output)
 {
 	m_weights.deleteColumns(output, 1);
+	syncWeightCopies();
 }
 
 
@@ -1015,7 +1562,7 @@ GBlockSparse::GBlockSparse(size_t outputs, size_t inputs, GRand& rand, size_t co
 		}
 		for(size_t i = 0; i < inputs; i++)
 			delete(ppVecs[i]);
-		delete(ppVecs);
+		delete[] ppVecs;
 	}
 	else
 	{
@@ -1035,7 +1582,7 @@ GBlockSparse::GBlockSparse(size_t outputs, size_t inputs, GRand& rand, size_t co
 		}
 		for(size_t i = 0; i < outputs; i++)
 			delete(ppVecs[i]);
-		delete(ppVecs);
+		delete[] ppVecs;
 	}
 }
 
@@ -2382,8 +2929,10 @@ GBlockConvolutional2D::GBlockConvolutional2D(size_t width, size_t height, size_t
   m_inputImage(width, height, channels),
   m_upStreamErrorImage(width, height, channels),
   m_actImage(m_outputWidth, m_outputHeight, kCount),
-  m_errImage(m_outputWidth, m_outputHeight, kCount)
+  m_errImage(m_outputWidth, m_outputHeight, kCount),
+  m_algorithm(conv_auto)
 {
+	m_stale.set();
 }
 
 
@@ -2399,8 +2948,11 @@ GBlockConvolutional2D::GBlockConvolutional2D(size_t kWidth, size_t kHeight, size
   m_inputImage(0, 0, 0),
   m_upStreamErrorImage(0, 0, 0),
   m_actImage(0, 0, 0),
-  m_errImage(0, 0, 0)
-{}
+  m_errImage(0, 0, 0),
+  m_algorithm(conv_auto)
+{
+	m_stale.set();
+}
 
 GBlockConvolutional2D::GBlockConvolutional2D(GDomNode* pNode)
 : GBlock(pNode),
@@ -2414,7 +2966,8 @@ GBlockConvolutional2D::GBlockConvolutional2D(GDomNode* pNode)
   m_inputImage(m_width, m_height, m_channels),
   m_upStreamErrorImage(m_width, m_height, m_channels),
   m_actImage(m_outputWidth, m_outputHeight, m_kernels.rows()),
-  m_errImage(m_outputWidth, m_outputHeight, m_kernels.rows())
+  m_errImage(m_outputWidth, m_outputHeight, m_kernels.rows()),
+  m_algorithm(conv_auto)
 {
 	m_inputImage.sx	= pNode->field("strideX")->asInt();
 	m_inputImage.sy	= pNode->field("strideY")->asInt();
@@ -2424,6 +2977,14 @@ GBlockConvolutional2D::GBlockConvolutional2D(GDomNode* pNode)
 	setInputInterlaced(pNode->field("inputInterlaced")->asBool());
 	setKernelsInterlaced(pNode->field("kernelsInterlaced")->asBool());
 	setOutputInterlaced(pNode->field("outputInterlaced")->asBool());
+	GDomNode* pQuantized = pNode->fieldIfExists("int8");
+	if(pQuantized)
+	{
+		m_quantized.deserialize(pQuantized);
+		if(m_quantized.channels() != m_kernels.rows() || m_quantized.length() != m_kernels.cols())
+			throw Ex("The int8 weights do not fit this GBlockConvolutional2D");
+	}
+	m_stale.set();
 }
 
 GDomNode *GBlockConvolutional2D::serialize(GDom *pDoc) const
@@ -2445,6 +3006,8 @@ GDomNode *GBlockConvolutional2D::serialize(GDom *pDoc) const
 	pNode->addField(pDoc, "outputInterlaced", pDoc->newBool(m_actImage.interlaced));
 	pNode->addField(pDoc, "bias", m_bias.serialize(pDoc));
 	pNode->addField(pDoc, "kernels", m_kernels.serialize(pDoc));
+	if(!m_quantized.empty())
+		pNode->addField(pDoc, "int8", m_quantized.serialize(pDoc));
 	return pNode;
 
 }
@@ -2487,6 +3050,26 @@ void GBlockConvolutional2D::resize(size_t inputSize, size_t outputSize)
 
 void GBlockConvolutional2D::forwardProp(GContext& ctx, const GVec& input, GVec& output) const
 {
+	refreshWeightCopies();
+	if(!m_quantized.empty())
+	{
+		uint8_t* pInBuf = GQuantizedWeights::scratch(inputs() + m_quantized.stride());
+		forwardPropQuantized(input.data(), output.data(), m_patchTable, pInBuf, pInBuf + inputs());
+		return;
+	}
+	const double* pIn = input.data();
+	double* pOut = output.data();
+	Algorithm alg = chooseAlgorithm(false);
+	if(alg == conv_winograd)
+	{
+		winograd(&pIn, m_inputImage, m_winogradForward, &pOut, m_actImage, 1, m_bias.data());
+		return;
+	}
+	else if(alg == conv_im2col)
+	{
+		forwardPropIm2col(&pIn, &pOut, 1, m_patchTable);
+		return;
+	}
 	Image inputImage(const_cast<GVec*>(&input), m_inputImage);
 	Image n(&output, m_actImage);
 	Image k(nullptr, m_kernelImage);
@@ -2503,10 +3086,26 @@ void GBlockConvolutional2D::forwardProp(GContext& ctx, const GVec& input, GVec&
 
 void GBlockConvolutional2D::backProp(GContext& ctx, const GVec& input, const GVec& output, const GVec& outBlame, GVec& inBlame) const
 {
+	refreshWeightCopies();
+	const double* pOutBlame = outBlame.data();
+	double* pInBlame = inBlame.data();
+	Algorithm alg = chooseAlgorithm(true);
+	if(alg == conv_winograd)
+	{
+		Image err(nullptr, m_errImage);
+		err.px = 2 - m_inputImage.px;
+		err.py = 2 - m_inputImage.py;
+		winograd(&pOutBlame, err, m_winogradBackward, &pInBlame, m_upStreamErrorImage, 1, nullptr);
+		return;
+	}
+	else if(alg == conv_im2col)
+	{
+		backPropIm2col(&pOutBlame, &pInBlame, 1, m_patchTable);
+		return;
+	}
 	Image err(const_cast<GVec*>(&outBlame), m_errImage);
 	Image upErr(&inBlame, m_upStreamErrorImage);
 	Image k(nullptr, m_kernelImage);
-	inBlame.fill(0.0);
 	upErr.px = m_inputImage.px;
 	upErr.py = m_inputImage.py;
 
@@ -2525,6 +3124,17 @@ void GBlockConvolutional2D::backProp(GContext& ctx, const GVec& input, const GVe
 
 void GBlockConvolutional2D::updateGradient(GContext& ctx, const GVec& input, const GVec& outBlame, GVec& gradient) const
 {
+	GAssert(gradient.size() == weightCount(), "gradient must match the dimensions of weights!");
+	if(chooseAlgorithm(false) != conv_direct)
+	{
+		// Winograd does not pay for itself on the weight gradient, which is a correlation with
+		// a kernel the size of the output, so every other algorithm uses im2col here
+		refreshWeightCopies();
+		const double* pIn = input.data();
+		const double* pOutBlame = outBlame.data();
+		updateGradientIm2col(&pIn, &pOutBlame, 1, m_patchTable, gradient.data());
+		return;
+	}
 	Image err(const_cast<GVec*>(&outBlame), m_errImage);
 	Image in(const_cast<GVec*>(&input), m_inputImage);
 	size_t count = m_kernels.cols();
@@ -2533,44 +3143,141 @@ void GBlockConvolutional2D::updateGradient(GContext& ctx, const GVec& input, con
 	for(err.dz = 0; err.dz < err.channels; ++err.dz)
 	{
 		double* biasDelta = delt.data->data() + count;
-		delta.vec().fill(0.0);
 		for(in.dz = delt.dz = 0; in.dz < in.channels; ++in.dz, ++delt.dz)
 			for(in.dy = 0; in.dy < err.height; ++in.dy)
 				for(in.dx = 0; in.dx < err.width; ++in.dx)
-				{
 					addScaled(in, err.read(in.dx, in.dy), delt);
-					*biasDelta += err.read(in.dx, in.dy);
-				}
 		delt.dz = 0;
+		for(size_t y = 0; y < err.height; ++y)
+			for(size_t x = 0; x < err.width; ++x)
+				*biasDelta += err.read(x, y);
 		delta.setData(delta.vec().data() + count + 1);
 	}
 }
 
-void GBlockConvolutional2D::step(double learningRate, const GVec& gradient)
+void GBlockConvolutional2D::forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const
 {
-	size_t count = m_kernels.cols();
-	GConstVecWrapper delta(gradient.data(), count);
-	for(size_t i = 0; i < m_kernels.rows(); i++)
+	GAssert(input.rows() == output.rows() && input.cols() == inputs() && output.cols() == outputs());
+	refreshWeightCopies();
+	if(!m_quantized.empty())
 	{
-		m_kernels[i].addScaled(learningRate, delta.vec());
-		m_bias[i] += learningRate * *(delta.vec().data() + count);
-		delta.setData(delta.vec().data() + count + 1);
+		uint8_t* pInBuf = GQuantizedWeights::scratch(inputs() + m_quantized.stride());
+		for(size_t r = 0; r < input.rows(); r++)
+			forwardPropQuantized(input[r].data(), output[r].data(), m_patchTable, pInBuf, pInBuf + inputs());
+		return;
+	}
+	Algorithm alg = chooseAlgorithm(false);
+	if(alg == conv_direct)
+	{
+		for(size_t r = 0; r < input.rows(); r++)
+			forwardProp(ctx, input[r], output[r]);
+		return;
+	}
+	size_t chunk = chunkSize();
+	std::vector<const double*> ins(chunk);
+	std::vector<double*> outs(chunk);
+	for(size_t r = 0; r < input.rows(); r += chunk)
+	{
+		size_t count = std::min(chunk, input.rows() - r);
+		for(size_t i = 0; i < count; i++)
+		{
+			ins[i] = input[r + i].data();
+			outs[i] = output[r + i].data();
+		}
+		if(alg == conv_winograd)
+			winograd(ins.data(), m_inputImage, m_winogradForward, outs.data(), m_actImage, count, m_bias.data());
+		else
+			forwardPropIm2col(ins.data(), outs.data(), count, m_patchTable);
 	}
 }
 
-void GBlockConvolutional2D::scaleWeights(double factor, bool scaleBiases)
-{
-	throw Ex("scaleWeights not implemented");
-}
-
-void GBlockConvolutional2D::diminishWeights(double amount, bool regularizeBiases)
+void GBlockConvolutional2D::backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
 {
-	throw Ex("diminishWeights not implemented");
+	GAssert(outBlame.rows() == inBlame.rows() && outBlame.cols() == outputs() && inBlame.cols() == inputs());
+	Algorithm alg = chooseAlgorithm(true);
+	if(alg == conv_direct)
+	{
+		for(size_t r = 0; r < outBlame.rows(); r++)
+			backProp(ctx, input[r], output[r], outBlame[r], inBlame[r]);
+		return;
+	}
+	refreshWeightCopies();
+	Image err(nullptr, m_errImage);
+	if(alg == conv_winograd)
+	{
+		err.px = 2 - m_inputImage.px;
+		err.py = 2 - m_inputImage.py;
+	}
+	size_t chunk = chunkSize();
+	std::vector<const double*> outBlames(chunk);
+	std::vector<double*> inBlames(chunk);
+	for(size_t r = 0; r < outBlame.rows(); r += chunk)
+	{
+		size_t count = std::min(chunk, outBlame.rows() - r);
+		for(size_t i = 0; i < count; i++)
+		{
+			outBlames[i] = outBlame[r + i].data();
+			inBlames[i] = inBlame[r + i].data();
+		}
+		if(alg == conv_winograd)
+			winograd(outBlames.data(), err, m_winogradBackward, inBlames.data(), m_upStreamErrorImage, count, nullptr);
+		else
+			backPropIm2col(outBlames.data(), inBlames.data(), count, m_patchTable);
+	}
 }
 
-size_t GBlockConvolutional2D::weightCount() const
+void GBlockConvolutional2D::updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const
 {
-	return m_kWidth * m_kHeight * m_channels * m_kernels.rows() + m_kernels.rows();
+	GAssert(gradient.size() == weightCount(), "gradient must match the dimensions of weights!");
+	GAssert(input.rows() == outBlame.rows());
+	if(chooseAlgorithm(false) == conv_direct)
+	{
+		for(size_t r = 0; r < input.rows(); r++)
+			updateGradient(ctx, input[r], outBlame[r], gradient);
+		return;
+	}
+	refreshWeightCopies();
+	size_t chunk = chunkSize();
+	std::vector<const double*> ins(chunk);
+	std::vector<const double*> outBlames(chunk);
+	for(size_t r = 0; r < input.rows(); r += chunk)
+	{
+		size_t count = std::min(chunk, input.rows() - r);
+		for(size_t i = 0; i < count; i++)
+		{
+			ins[i] = input[r + i].data();
+			outBlames[i] = outBlame[r + i].data();
+		}
+		updateGradientIm2col(ins.data(), outBlames.data(), count, m_patchTable, gradient.data());
+	}
+}
+
+void GBlockConvolutional2D::step(double learningRate, const GVec& gradient)
+{
+	size_t count = m_kernels.cols();
+	GConstVecWrapper delta(gradient.data(), count);
+	for(size_t i = 0; i < m_kernels.rows(); i++)
+	{
+		m_kernels[i].addScaled(learningRate, delta.vec());
+		m_bias[i] += learningRate * *(delta.vec().data() + count);
+		delta.setData(delta.vec().data() + count + 1);
+	}
+	syncWeightCopies();
+}
+
+void GBlockConvolutional2D::scaleWeights(double factor, bool scaleBiases)
+{
+	throw Ex("scaleWeights not implemented");
+}
+
+void GBlockConvolutional2D::diminishWeights(double amount, bool regularizeBiases)
+{
+	throw Ex("diminishWeights not implemented");
+}
+
+size_t GBlockConvolutional2D::weightCount() const
+{
+	return m_kWidth * m_kHeight * m_channels * m_kernels.rows() + m_kernels.rows();
 }
 
 size_t GBlockConvolutional2D::weightsToVector(double *pOutVector) const
@@ -2584,6 +3291,7 @@ size_t GBlockConvolutional2D::vectorToWeights(const double *pVector)
 {
 	m_kernels.fromVector(pVector, m_kernels.rows());
 	m_bias.put(0, GConstVecWrapper(pVector + m_kernels.rows() * m_kernels.cols(), m_kernels.rows()).vec());
+	syncWeightCopies();
 	return weightCount();
 }
 
@@ -2598,6 +3306,7 @@ void GBlockConvolutional2D::resetWeights(GRand &rand)
 	for(size_t i = 0; i < m_kernels.rows(); i++)
 		m_kernels[i].fillNormal(rand, mag);
 	m_bias.fillNormal(rand, mag);
+	syncWeightCopies();
 }
 
 void GBlockConvolutional2D::perturbWeights(GRand &rand, double deviation)
@@ -2605,6 +3314,7 @@ void GBlockConvolutional2D::perturbWeights(GRand &rand, double deviation)
 	for(size_t j = 0; j < m_kernels.rows(); j++)
 		GVec::perturb(m_kernels[j].data(), deviation, m_kernels.cols(), rand);
 	GVec::perturb(m_bias.data(), deviation, m_kernels.rows(), rand);
+	syncWeightCopies();
 }
 
 void GBlockConvolutional2D::maxNorm(double min, double max)
@@ -2612,6 +3322,356 @@ void GBlockConvolutional2D::maxNorm(double min, double max)
 	throw Ex("maxNorm not implemented");
 }
 
+void GBlockConvolutional2D::quantizeWeights(double inputMax)
+{
+	m_quantized.quantize(m_kernels.rows(), m_kernels.cols(), inputMax, [this](size_t c, size_t i) { return m_kernels[c][i]; });
+	m_stale.set(); // The int8 path needs the patch table
+}
+
+void GBlockConvolutional2D::syncWeightCopies()
+{
+	if(!m_quantized.empty())
+		m_quantized.quantize(m_kernels.rows(), m_kernels.cols(), m_quantized.inputMax(), [this](size_t c, size_t i) { return m_kernels[c][i]; });
+	if(!m_quantized.empty() || chooseAlgorithm(false) != conv_direct)
+		patchIndexes(m_patchTable);
+	else
+		std::vector<size_t>().swap(m_patchTable);
+	if(chooseAlgorithm(false) == conv_winograd)
+		winogradKernels(false, m_winogradForward);
+	else
+	{
+		for(size_t i = 0; i < 16; i++)
+			m_winogradForward[i].resize(0, 0);
+	}
+	if(chooseAlgorithm(true) == conv_winograd)
+		winogradKernels(true, m_winogradBackward);
+	else
+	{
+		for(size_t i = 0; i < 16; i++)
+			m_winogradBackward[i].resize(0, 0);
+	}
+}
+
+void GBlockConvolutional2D::refreshWeightCopies() const
+{
+	m_stale.refresh([this]() { const_cast<GBlockConvolutional2D*>(this)->syncWeightCopies(); });
+}
+
+void GBlockConvolutional2D::setAlgorithm(Algorithm algorithm)
+{
+	m_algorithm = algorithm;
+	m_stale.set();
+}
+
+GBlockConvolutional2D::Algorithm GBlockConvolutional2D::chooseAlgorithm(bool backward) const
+{
+	bool winogradFits = m_kWidth == 3 && m_kHeight == 3 && m_inputImage.sx == 1 && m_inputImage.sy == 1;
+	if(backward && (m_inputImage.px > 2 || m_inputImage.py > 2))
+		winogradFits = false;
+	if(m_algorithm == conv_auto)
+	{
+		// The tile transforms cost O(channels + kernels) per tile, so Winograd only beats
+		// im2col when there are enough channels and kernels for the products to dominate
+		bool winogradPays = m_channels >= 16 && m_kernels.rows() >= 16;
+		return (winogradFits && winogradPays) ? conv_winograd : conv_im2col;
+	}
+	else if(m_algorithm == conv_winograd && !winogradFits)
+		return conv_im2col;
+	return m_algorithm;
+}
+
+size_t GBlockConvolutional2D::chunkSize() const
+{
+	// Enough samples to give the matrix products some height, while keeping the
+	// gathered receptive fields of a chunk within a couple of megabytes
+	size_t patchValues = m_outputWidth * m_outputHeight * std::max((size_t)1, m_kernels.cols());
+	return std::max((size_t)1, ((size_t)1 << 18) / std::max((size_t)1, patchValues));
+}
+
+void GBlockConvolutional2D::im2col(const double* const* ppIn, size_t count, const std::vector<size_t>& table, GMatrix& cols) const
+{
+	size_t kSize = m_kernels.cols();
+	size_t positions = m_outputWidth * m_outputHeight;
+	cols.setContiguous(true);
+	cols.resize(count * positions, kSize);
+	for(size_t s = 0; s < count; s++)
+	{
+		const double* pIn = ppIn[s];
+		const size_t* pIndex = table.data();
+		for(size_t p = 0; p < positions; p++)
+		{
+			double* pRow = cols[s * positions + p].data();
+			for(size_t e = 0; e < kSize; e++)
+				pRow[e] = (pIndex[e] == Image::npos ? 0.0 : pIn[pIndex[e]]);
+			pIndex += kSize;
+		}
+	}
+}
+
+void GBlockConvolutional2D::gatherBlame(const double* const* ppOutBlame, size_t count, GMatrix& blame) const
+{
+	size_t kCount = m_kernels.rows();
+	size_t positions = m_outputWidth * m_outputHeight;
+	blame.setContiguous(true);
+	blame.resize(count * positions, kCount);
+	for(size_t s = 0; s < count; s++)
+	{
+		const double* pOutBlame = ppOutBlame[s];
+		for(size_t p = 0; p < positions; p++)
+		{
+			double* pRow = blame[s * positions + p].data();
+			for(size_t c = 0; c < kCount; c++)
+				pRow[c] = pOutBlame[outputIndex(p, c)];
+		}
+	}
+}
+
+void GBlockConvolutional2D::forwardPropIm2col(const double* const* ppIn, double* const* ppOut, size_t count, const std::vector<size_t>& table) const
+{
+	GMatrix cols;
+	im2col(ppIn, count, table, cols);
+	std::unique_ptr<GMatrix> hProduct(GMatrix::multiply(cols, m_kernels, false, true));
+	size_t positions = m_outputWidth * m_outputHeight;
+	for(size_t s = 0; s < count; s++)
+	{
+		double* pOut = ppOut[s];
+		for(size_t p = 0; p < positions; p++)
+		{
+			const double* pRow = (*hProduct)[s * positions + p].data();
+			for(size_t c = 0; c < m_kernels.rows(); c++)
+				pOut[outputIndex(p, c)] = m_bias[c] + pRow[c];
+		}
+	}
+}
+
+void GBlockConvolutional2D::backPropIm2col(const double* const* ppOutBlame, double* const* ppInBlame, size_t count, const std::vector<size_t>& table) const
+{
+	// Compute the blame on every receptive field, then scatter it back onto the inputs (col2im)
+	GMatrix blame;
+	gatherBlame(ppOutBlame, count, blame);
+	std::unique_ptr<GMatrix> hProduct(GMatrix::multiply(blame, m_kernels, false, false));
+	size_t kSize = m_kernels.cols();
+	size_t positions = m_outputWidth * m_outputHeight;
+	for(size_t s = 0; s < count; s++)
+	{
+		double* pInBlame = ppInBlame[s];
+		const size_t* pIndex = table.data();
+		for(size_t p = 0; p < positions; p++)
+		{
+			const double* pRow = (*hProduct)[s * positions + p].data();
+			for(size_t e = 0; e < kSize; e++)
+			{
+				if(pIndex[e] != Image::npos)
+					pInBlame[pIndex[e]] += pRow[e];
+			}
+			pIndex += kSize;
+		}
+	}
+}
+
+void GBlockConvolutional2D::updateGradientIm2col(const double* const* ppIn, const double* const* ppOutBlame, size_t count, const std::vector<size_t>& table, double* pGradient) const
+{
+	GMatrix cols;
+	im2col(ppIn, count, table, cols);
+	GMatrix blame;
+	gatherBlame(ppOutBlame, count, blame);
+	std::unique_ptr<GMatrix> hProduct(GMatrix::multiply(blame, cols, true, false));
+	size_t kSize = m_kernels.cols();
+	double* delta = pGradient;
+	for(size_t c = 0; c < m_kernels.rows(); c++)
+	{
+		const double* pRow = (*hProduct)[c].data();
+		for(size_t e = 0; e < kSize; e++)
+			delta[e] += pRow[e];
+		for(size_t i = 0; i < blame.rows(); i++)
+			delta[kSize] += blame[i][c];
+		delta += kSize + 1;
+	}
+}
+
+void GBlockConvolutional2D::winogradKernels(bool backward, GMatrix* pU) const
+{
+	size_t kCount = m_kernels.rows();
+	for(size_t i = 0; i < 16; i++)
+	{
+		pU[i].setContiguous(true);
+		pU[i].resize(backward ? m_channels : kCount, backward ? kCount : m_channels);
+	}
+	const Image& k = m_kernelImage;
+	for(size_t c = 0; c < kCount; c++)
+	{
+		const double* pKernel = m_kernels[c].data();
+		for(size_t z = 0; z < m_channels; z++)
+		{
+			double g[3][3];
+			for(size_t y = 0; y < 3; y++)
+			{
+				for(size_t x = 0; x < 3; x++)
+					g[y][x] = pKernel[backward ? k.index(2 - x, 2 - y, z) : k.index(x, y, z)];
+			}
+
+			// G g
+			double t[4][3];
+			for(size_t x = 0; x < 3; x++)
+			{
+				t[0][x] = g[0][x];
+				t[1][x] = 0.5 * (g[0][x] + g[1][x] + g[2][x]);
+				t[2][x] = 0.5 * (g[0][x] - g[1][x] + g[2][x]);
+				t[3][x] = g[2][x];
+			}
+
+			// (G g) G^T
+			size_t row = backward ? z : c;
+			size_t col = backward ? c : z;
+			for(size_t y = 0; y < 4; y++)
+			{
+				pU[4 * y][row][col] = t[y][0];
+				pU[4 * y + 1][row][col] = 0.5 * (t[y][0] + t[y][1] + t[y][2]);
+				pU[4 * y + 2][row][col] = 0.5 * (t[y][0] - t[y][1] + t[y][2]);
+				pU[4 * y + 3][row][col] = t[y][2];
+			}
+		}
+	}
+}
+
+void GBlockConvolutional2D::winograd(const double* const* ppIn, const Image& in, const GMatrix* pU, double* const* ppOut, const Image& out, size_t count, const double* pBias) const
+{
+	size_t inChannels = pU[0].cols();
+	size_t outChannels = pU[0].rows();
+	size_t tilesX = (out.width + 1) / 2;
+	size_t tilesY = (out.height + 1) / 2;
+	size_t tiles = tilesX * tilesY;
+	size_t paddedWidth = 2 * tilesX + 2;
+	size_t paddedHeight = 2 * tilesY + 2;
+
+	// Transform each 4x4 input tile (tiles overlap their neighbors by 2) into the Winograd domain, B^T d B
+	GMatrix v[16];
+	for(size_t i = 0; i < 16; i++)
+	{
+		v[i].setContiguous(true);
+		v[i].resize(count * tiles, inChannels);
+	}
+	GVec padded(inChannels * paddedHeight * paddedWidth);
+	for(size_t s = 0; s < count; s++)
+	{
+		// Make a planar copy of the image with its padding, so the tiles can be read without bounds checks
+		const double* pIn = ppIn[s];
+		double* pPad = padded.data();
+		for(size_t z = 0; z < inChannels; z++)
+		{
+			for(size_t y = 0; y < paddedHeight; y++)
+			{
+				for(size_t x = 0; x < paddedWidth; x++)
+				{
+					size_t i = in.index(x, y, z);
+					*(pPad++) = (i == Image::npos ? 0.0 : pIn[i]);
+				}
+			}
+		}
+		for(size_t ty = 0; ty < tilesY; ty++)
+		{
+			for(size_t tx = 0; tx < tilesX; tx++)
+			{
+				size_t row = (s * tilesY + ty) * tilesX + tx;
+				double* pV[16];
+				for(size_t i = 0; i < 16; i++)
+					pV[i] = v[i][row].data();
+				for(size_t z = 0; z < inChannels; z++)
+				{
+					const double* pTile = padded.data() + (z * paddedHeight + 2 * ty) * paddedWidth + 2 * tx;
+					double t[4][4];
+					for(size_t x = 0; x < 4; x++)
+					{
+						double d0 = pTile[x];
+						double d1 = pTile[paddedWidth + x];
+						double d2 = pTile[2 * paddedWidth + x];
+						double d3 = pTile[3 * paddedWidth + x];
+						t[0][x] = d0 - d2;
+						t[1][x] = d1 + d2;
+						t[2][x] = d2 - d1;
+						t[3][x] = d1 - d3;
+					}
+					for(size_t y = 0; y < 4; y++)
+					{
+						pV[4 * y][z] = t[y][0] - t[y][2];
+						pV[4 * y + 1][z] = t[y][1] + t[y][2];
+						pV[4 * y + 2][z] = t[y][2] - t[y][1];
+						pV[4 * y + 3][z] = t[y][1] - t[y][3];
+					}
+				}
+			}
+		}
+	}
+
+	// Sum over the input channels with one matrix product per Winograd coordinate
+	std::unique_ptr<GMatrix> m[16];
+	for(size_t i = 0; i < 16; i++)
+		m[i].reset(GMatrix::multiply(v[i], pU[i], false, true));
+
+	// Transform back, A^T M A, and keep the part of each 2x2 output tile that lies inside the image
+	for(size_t s = 0; s < count; s++)
+	{
+		double* pOut = ppOut[s];
+		for(size_t ty = 0; ty < tilesY; ty++)
+		{
+			for(size_t tx = 0; tx < tilesX; tx++)
+			{
+				size_t row = (s * tilesY + ty) * tilesX + tx;
+				const double* pM[16];
+				for(size_t i = 0; i < 16; i++)
+					pM[i] = (*m[i])[row].data();
+				for(size_t c = 0; c < outChannels; c++)
+				{
+					double t[2][4];
+					for(size_t x = 0; x < 4; x++)
+					{
+						double m0 = pM[x][c];
+						double m1 = pM[4 + x][c];
+						double m2 = pM[8 + x][c];
+						double m3 = pM[12 + x][c];
+						t[0][x] = m0 + m1 + m2;
+						t[1][x] = m1 - m2 - m3;
+					}
+					for(size_t y = 0; y < 2 && 2 * ty + y < out.height; y++)
+					{
+						double val[2];
+						val[0] = t[y][0] + t[y][1] + t[y][2];
+						val[1] = t[y][1] - t[y][2] - t[y][3];
+						for(size_t x = 0; x < 2 && 2 * tx + x < out.width; x++)
+						{
+							size_t i = out.index(2 * tx + x, 2 * ty + y, c);
+							if(pBias)
+								pOut[i] = pBias[c] + val[x];
+							else
+								pOut[i] += val[x];
+						}
+					}
+				}
+			}
+		}
+	}
+}
+
+void GBlockConvolutional2D::forwardPropQuantized(const double* pIn, double* pOut, const std::vector<size_t>& table, uint8_t* pInBuf, uint8_t* pPatch) const
+{
+	// Quantize each input once, then gather the receptive fields from the bytes
+	for(size_t i = 0; i < inputs(); i++)
+		pInBuf[i] = m_quantized.quantizeInput(pIn[i]);
+	size_t kSize = m_kernels.cols();
+	size_t positions = m_outputWidth * m_outputHeight;
+	for(size_t e = kSize; e < m_quantized.stride(); e++)
+		pPatch[e] = 128;
+	const size_t* pIndex = table.data();
+	for(size_t p = 0; p < positions; p++)
+	{
+		for(size_t e = 0; e < kSize; e++)
+			pPatch[e] = (pIndex[e] == Image::npos ? 128 : pInBuf[pIndex[e]]);
+		pIndex += kSize;
+		for(size_t c = 0; c < m_kernels.rows(); c++)
+			pOut[outputIndex(p, c)] = m_bias[c] + m_quantized.dot(c, pPatch);
+	}
+}
+
 void GBlockConvolutional2D::setPadding(size_t px, size_t py)
 {
 	m_inputImage.px = px;
@@ -2637,18 +3697,21 @@ void GBlockConvolutional2D::setInputInterlaced(bool interlaced)
 {
 	m_inputImage.interlaced = interlaced;
 	m_upStreamErrorImage.interlaced = interlaced;
+	m_stale.set();
 }
 
 void GBlockConvolutional2D::setKernelsInterlaced(bool interlaced)
 {
 	m_kernelImage.interlaced = interlaced;
 	m_deltaImage.interlaced = interlaced;
+	m_stale.set();
 }
 
 void GBlockConvolutional2D::setOutputInterlaced(bool interlaced)
 {
 	m_actImage.interlaced = interlaced;
 	m_errImage.interlaced = interlaced;
+	m_stale.set();
 }
 
 void GBlockConvolutional2D::addKernel()
@@ -2662,6 +3725,7 @@ void GBlockConvolutional2D::addKernel()
 	m_actImage.channels = m_kernels.rows();
 	m_errImage.channels = m_kernels.rows();
 	updateOutputSize();
+	syncWeightCopies();
 }
 
 void GBlockConvolutional2D::addKernels(size_t n)
@@ -2706,6 +3770,34 @@ void GBlockConvolutional2D::convolveFull(const Image &in, const Image &filter, I
 	in.px = px, in.py = py;
 }
 
+void GBlockConvolutional2D::patchIndexes(std::vector<size_t>& table) const
+{
+	size_t kSize = m_kernels.cols();
+	table.resize(m_outputWidth * m_outputHeight * kSize);
+	Image in(nullptr, m_inputImage);
+	Image k(nullptr, m_kernelImage);
+	size_t* pIndex = table.data();
+	for(in.dy = 0; in.dy < m_outputHeight; ++in.dy)
+	{
+		for(in.dx = 0; in.dx < m_outputWidth; ++in.dx)
+		{
+			for(size_t z = 0; z < k.channels; ++z)
+				for(size_t y = 0; y < k.height; ++y)
+					for(size_t x = 0; x < k.width; ++x)
+						pIndex[k.index(x, y, z)] = in.index(x, y, z);
+			pIndex += kSize;
+		}
+	}
+}
+
+size_t GBlockConvolutional2D::outputIndex(size_t pos, size_t kernel) const
+{
+	if(m_actImage.interlaced)
+		return pos * m_kernels.rows() + kernel;
+	else
+		return kernel * m_outputWidth * m_outputHeight + pos;
+}
+
 void GBlockConvolutional2D::updateOutputSize()
 {
 	m_outputWidth = (m_width - m_kWidth + 2 * m_inputImage.px) / m_inputImage.sx + 1;
@@ -2716,6 +3808,7 @@ void GBlockConvolutional2D::updateOutputSize()
 
 	m_errImage.width = m_outputWidth;
 	m_errImage.height = m_outputHeight;
+	m_stale.set();
 }
 
 
@@ -2937,6 +4030,82 @@ void GContextRecurrent::updateGradient(const GVec& input, const GVec& outBlame,
 
 
 
+GContextRecurrentBatch::GContextRecurrentBatch(GRand& rand, GBlockRecurrent& block, size_t sequences)
+: GContext(rand),
+m_block(block),
+m_sequences(sequences),
+m_steps(0),
+m_step(0)
+{
+	m_instances.push_back(m_block.newBatchContext(m_rand, m_sequences));
+	m_instances[0]->resetState();
+}
+
+GContextRecurrentBatch::~GContextRecurrentBatch()
+{
+	for(size_t i = 0; i < m_instances.size(); i++)
+		delete(m_instances[i]);
+}
+
+void GContextRecurrentBatch::resetState()
+{
+	m_instances[0]->resetState();
+	m_steps = 0;
+}
+
+void GContextRecurrentBatch::beginWindow()
+{
+	if(m_steps > 0)
+		m_instances[0]->copyState(m_instances[m_steps]);
+	m_steps = 0;
+}
+
+void GContextRecurrentBatch::beginStep(const std::vector<bool>& active)
+{
+	GAssert(active.size() == m_sequences);
+	m_steps++;
+	if(m_instances.size() <= m_steps)
+		m_instances.push_back(m_block.newBatchContext(m_rand, m_sequences));
+	if(m_active.size() < m_steps)
+		m_active.push_back(active);
+	else
+		m_active[m_steps - 1] = active;
+}
+
+void GContextRecurrentBatch::setStep(size_t step)
+{
+	GAssert(step < m_steps);
+	if(step + 1 == m_steps)
+	{
+		for(size_t i = 0; i <= m_steps; i++)
+			m_instances[i]->clearBlame();
+	}
+	m_step = step;
+}
+
+void GContextRecurrentBatch::forwardProp(const GMatrix& input, GMatrix& output)
+{
+	if(m_steps < 1)
+		throw Ex("beginStep must be called before each step is propagated");
+	m_instances[m_steps]->forwardProp(m_instances[m_steps - 1], input, output, m_active[m_steps - 1]);
+}
+
+void GContextRecurrentBatch::backProp(const GMatrix& outBlame, GMatrix& inBlame)
+{
+	m_instances[m_step + 1]->backProp(m_instances[m_step], outBlame, inBlame, m_active[m_step]);
+}
+
+void GContextRecurrentBatch::updateGradient(GVec& gradient)
+{
+	GAssert(gradient.size() == m_block.weightCount(), "gradient size must match the number of weights!");
+	m_instances[m_step + 1]->updateGradient(gradient);
+}
+
+
+
+
+
+
 
 
 GBlockLSTM::GBlockLSTM(size_t outputs, size_t inputs)
@@ -2974,6 +4143,11 @@ GContextRecurrentInstance* GBlockLSTM::newContext(GRand& rand)
 	return new GContextLSTM(rand, *this);
 }
 
+GContextRecurrentBatchInstance* GBlockLSTM::newBatchContext(GRand& rand, size_t sequences)
+{
+	return new GContextLSTMBatch(rand, *this, sequences);
+}
+
 // virtual
 void GBlockLSTM::resize(size_t inputs, size_t outputs)
 {
@@ -2988,6 +4162,13 @@ void GBlockLSTM::resize(size_t inputs, size_t outputs)
 	m_read.resize(outputs + inputs, outputs);
 }
 
+void GBlockLSTM::setSinglePrecision(bool single)
+{
+	m_write.setSinglePrecision(single);
+	m_val.setSinglePrecision(single);
+	m_read.setSinglePrecision(single);
+}
+
 // virtual
 GDomNode* GBlockLSTM::serialize(GDom* pDoc) const
 {
@@ -3224,6 +4405,163 @@ void GContextLSTM::updateGradient(GContextRecurrentInstance* prev, const GVec& i
 
 
 
+GContextLSTMBatch::GContextLSTMBatch(GRand& rand, GBlockLSTM& block, size_t sequences)
+: GContextRecurrentBatchInstance(rand),
+m_block(block),
+m_hx(sequences, block.outputs() + block.inputs()),
+m_c(sequences, block.outputs()),
+m_h(sequences, block.outputs()),
+m_f(sequences, block.outputs()),
+m_t(sequences, block.outputs()),
+m_o(sequences, block.outputs()),
+m_s(sequences, block.outputs()),
+m_blamec(sequences, block.outputs()),
+m_blameh(sequences, block.outputs()),
+m_blamef(sequences, block.outputs()),
+m_blamet(sequences, block.outputs()),
+m_blameo(sequences, block.outputs()),
+m_blamehx(sequences, block.outputs() + block.inputs())
+{
+}
+
+void GContextLSTMBatch::resetState()
+{
+	m_c.fill(0.0);
+	m_h.fill(0.0);
+}
+
+void GContextLSTMBatch::copyState(const GContextRecurrentBatchInstance* pOther)
+{
+	const GContextLSTMBatch* pThat = (const GContextLSTMBatch*)pOther;
+	m_c.copyBlock(pThat->m_c, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+	m_h.copyBlock(pThat->m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+}
+
+void GContextLSTMBatch::clearBlame()
+{
+	m_blamec.fill(0.0);
+	m_blameh.fill(0.0);
+}
+
+void GContextLSTMBatch::forwardProp(GContextRecurrentBatchInstance* prev, const GMatrix& input, GMatrix& output, const std::vector<bool>& active)
+{
+	GContextLSTMBatch* pPrev = (GContextLSTMBatch*)prev;
+	size_t units = m_block.outputs();
+	m_hx.copyBlock(pPrev->m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+	m_hx.copyBlock(input, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, units, false);
+
+	// Compute the gates of every sequence with one batch product each
+	m_block.m_write.forwardPropBatch(*this, m_hx, m_f);
+	m_block.m_logistic.forwardPropBatch(*this, m_f, m_f);
+	m_block.m_val.forwardPropBatch(*this, m_hx, m_t);
+	m_block.m_tanh.forwardPropBatch(*this, m_t, m_t);
+	m_block.m_read.forwardPropBatch(*this, m_hx, m_o);
+	m_block.m_logistic.forwardPropBatch(*this, m_o, m_o);
+
+	// Update the memory and read from it
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pPrevC = pPrev->m_c[r].data();
+		double* pC = m_c[r].data();
+		double* pH = m_h[r].data();
+		if(!active[r])
+		{
+			memcpy(pC, pPrevC, sizeof(double) * units);
+			memcpy(pH, pPrev->m_h[r].data(), sizeof(double) * units);
+			continue;
+		}
+		const double* pF = m_f[r].data();
+		const double* pT = m_t[r].data();
+		const double* pO = m_o[r].data();
+		double* pS = m_s[r].data();
+		for(size_t i = 0; i < units; i++)
+		{
+			pC[i] = pF[i] * pPrevC[i] + (1.0 - pF[i]) * pT[i];
+			pS[i] = m_block.m_tanh.eval(pC[i]);
+			pH[i] = pO[i] * pS[i];
+		}
+	}
+	if(&output != &m_h)
+		output.copyBlock(m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+}
+
+void GContextLSTMBatch::backProp(GContextRecurrentBatchInstance* prev, const GMatrix& outBlame, GMatrix& inBlame, const std::vector<bool>& active)
+{
+	GContextLSTMBatch* pPrev = (GContextLSTMBatch*)prev;
+	size_t units = m_block.outputs();
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		double* pBlameH = m_blameh[r].data();
+		double* pBlameC = m_blamec[r].data();
+		double* pPrevBlameH = pPrev->m_blameh[r].data();
+		double* pPrevBlameC = pPrev->m_blamec[r].data();
+		double* pBlameF = m_blamef[r].data();
+		double* pBlameT = m_blamet[r].data();
+		double* pBlameO = m_blameo[r].data();
+		const double* pOutBlame = outBlame[r].data();
+		if(!active[r])
+		{
+			// This sequence did not advance, so pass its blame straight through
+			for(size_t i = 0; i < units; i++)
+			{
+				pPrevBlameH[i] += pBlameH[i] + pOutBlame[i];
+				pPrevBlameC[i] += pBlameC[i];
+				pBlameF[i] = 0.0;
+				pBlameT[i] = 0.0;
+				pBlameO[i] = 0.0;
+			}
+			continue;
+		}
+		const double* pPrevC = pPrev->m_c[r].data();
+		const double* pF = m_f[r].data();
+		const double* pT = m_t[r].data();
+		const double* pO = m_o[r].data();
+		const double* pS = m_s[r].data();
+		for(size_t i = 0; i < units; i++)
+		{
+			double bh = pBlameH[i] + pOutBlame[i];
+			double bc = pBlameC[i] + bh * pO[i] * (1.0 - pS[i] * pS[i]);
+			pBlameO[i] = bh * pS[i] * pO[i] * (1.0 - pO[i]);
+			pBlameF[i] = bc * (pPrevC[i] - pT[i]) * pF[i] * (1.0 - pF[i]);
+			pBlameT[i] = bc * (1.0 - pF[i]) * (1.0 - pT[i] * pT[i]);
+			pPrevBlameC[i] += bc * pF[i];
+		}
+	}
+
+	// Blame the previous h and the input with one batch product for each gate
+	m_blamehx.fill(0.0);
+	m_block.m_write.backPropBatch(*this, m_hx, m_f, m_blamef, m_blamehx);
+	m_block.m_val.backPropBatch(*this, m_hx, m_t, m_blamet, m_blamehx);
+	m_block.m_read.backPropBatch(*this, m_hx, m_o, m_blameo, m_blamehx);
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pBlameHX = m_blamehx[r].data();
+		double* pPrevBlameH = pPrev->m_blameh[r].data();
+		for(size_t i = 0; i < units; i++)
+			pPrevBlameH[i] += pBlameHX[i];
+		double* pInBlame = inBlame[r].data();
+		for(size_t i = 0; i < inBlame.cols(); i++)
+			pInBlame[i] += pBlameHX[units + i];
+	}
+}
+
+void GContextLSTMBatch::updateGradient(GVec& gradient)
+{
+	size_t wcWrite = m_block.m_write.weightCount();
+	size_t wcVal = m_block.m_val.weightCount();
+	size_t wcRead = m_block.m_read.weightCount();
+	GVecWrapper g(gradient.data(), wcWrite);
+	m_block.m_write.updateGradientBatch(*this, m_hx, m_blamef, g.vec());
+	g.setData(gradient.data() + wcWrite, wcVal);
+	m_block.m_val.updateGradientBatch(*this, m_hx, m_blamet, g.vec());
+	g.setData(gradient.data() + wcWrite + wcVal, wcRead);
+	m_block.m_read.updateGradientBatch(*this, m_hx, m_blameo, g.vec());
+}
+
+
+
+
+
 
 
 
@@ -3261,6 +4599,11 @@ GContextRecurrentInstance* GBlockGRU::newContext(GRand& rand)
 	return new GContextGRU(rand, *this);
 }
 
+GContextRecurrentBatchInstance* GBlockGRU::newBatchContext(GRand& rand, size_t sequences)
+{
+	return new GContextGRUBatch(rand, *this, sequences);
+}
+
 // virtual
 void GBlockGRU::resize(size_t inputs, size_t outputs)
 {
@@ -3275,6 +4618,13 @@ void GBlockGRU::resize(size_t inputs, size_t outputs)
 	m_val.resize(outputs + inputs, outputs);
 }
 
+void GBlockGRU::setSinglePrecision(bool single)
+{
+	m_update.setSinglePrecision(single);
+	m_remember.setSinglePrecision(single);
+	m_val.setSinglePrecision(single);
+}
+
 // virtual
 GDomNode* GBlockGRU::serialize(GDom* pDoc) const
 {
@@ -3500,4 +4850,166 @@ void GContextGRU::updateGradient(GContextRecurrentInstance* prev, const GVec& in
 
 
 
+
+
+GContextGRUBatch::GContextGRUBatch(GRand& rand, GBlockGRU& block, size_t sequences)
+: GContextRecurrentBatchInstance(rand),
+m_block(block),
+m_hx(sequences, block.outputs() + block.inputs()),
+m_rhx(sequences, block.outputs() + block.inputs()),
+m_h(sequences, block.outputs()),
+m_z(sequences, block.outputs()),
+m_r(sequences, block.outputs()),
+m_t(sequences, block.outputs()),
+m_blameh(sequences, block.outputs()),
+m_blamez(sequences, block.outputs()),
+m_blamer(sequences, block.outputs()),
+m_blamet(sequences, block.outputs()),
+m_blamehx(sequences, block.outputs() + block.inputs())
+{
+}
+
+void GContextGRUBatch::resetState()
+{
+	m_h.fill(0.0);
+}
+
+void GContextGRUBatch::copyState(const GContextRecurrentBatchInstance* pOther)
+{
+	const GContextGRUBatch* pThat = (const GContextGRUBatch*)pOther;
+	m_h.copyBlock(pThat->m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+}
+
+void GContextGRUBatch::clearBlame()
+{
+	m_blameh.fill(0.0);
+}
+
+void GContextGRUBatch::forwardProp(GContextRecurrentBatchInstance* prev, const GMatrix& input, GMatrix& output, const std::vector<bool>& active)
+{
+	GContextGRUBatch* pPrev = (GContextGRUBatch*)prev;
+	size_t units = m_block.outputs();
+	m_hx.copyBlock(pPrev->m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+	m_hx.copyBlock(input, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, units, false);
+
+	// Compute the update and remember gates of every sequence with one batch product each
+	m_block.m_update.forwardPropBatch(*this, m_hx, m_z);
+	m_block.m_logistic.forwardPropBatch(*this, m_z, m_z);
+	m_block.m_remember.forwardPropBatch(*this, m_hx, m_r);
+	m_block.m_logistic.forwardPropBatch(*this, m_r, m_r);
+
+	// Compute the value to write to memory
+	m_rhx.copyBlock(input, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, units, false);
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pPrevH = pPrev->m_h[r].data();
+		const double* pR = m_r[r].data();
+		double* pRH = m_rhx[r].data();
+		for(size_t i = 0; i < units; i++)
+			pRH[i] = pR[i] * pPrevH[i];
+	}
+	m_block.m_val.forwardPropBatch(*this, m_rhx, m_t);
+	m_block.m_tanh.forwardPropBatch(*this, m_t, m_t);
+
+	// Compute the output
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pPrevH = pPrev->m_h[r].data();
+		double* pH = m_h[r].data();
+		if(!active[r])
+		{
+			memcpy(pH, pPrevH, sizeof(double) * units);
+			continue;
+		}
+		const double* pZ = m_z[r].data();
+		const double* pT = m_t[r].data();
+		for(size_t i = 0; i < units; i++)
+			pH[i] = pZ[i] * pT[i] + (1.0 - pZ[i]) * pPrevH[i];
+	}
+	if(&output != &m_h)
+		output.copyBlock(m_h, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+}
+
+void GContextGRUBatch::backProp(GContextRecurrentBatchInstance* prev, const GMatrix& outBlame, GMatrix& inBlame, const std::vector<bool>& active)
+{
+	GContextGRUBatch* pPrev = (GContextGRUBatch*)prev;
+	size_t units = m_block.outputs();
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pBlameH = m_blameh[r].data();
+		const double* pOutBlame = outBlame[r].data();
+		double* pPrevBlameH = pPrev->m_blameh[r].data();
+		double* pBlameZ = m_blamez[r].data();
+		double* pBlameT = m_blamet[r].data();
+		if(!active[r])
+		{
+			// This sequence did not advance, so pass its blame straight through
+			for(size_t i = 0; i < units; i++)
+			{
+				pPrevBlameH[i] += pBlameH[i] + pOutBlame[i];
+				pBlameZ[i] = 0.0;
+				pBlameT[i] = 0.0;
+			}
+			continue;
+		}
+		const double* pPrevH = pPrev->m_h[r].data();
+		const double* pZ = m_z[r].data();
+		const double* pT = m_t[r].data();
+		for(size_t i = 0; i < units; i++)
+		{
+			double bh = pBlameH[i] + pOutBlame[i];
+			pBlameZ[i] = bh * (pT[i] - pPrevH[i]) * pZ[i] * (1.0 - pZ[i]);
+			pBlameT[i] = bh * pZ[i] * (1.0 - pT[i] * pT[i]);
+			pPrevBlameH[i] += bh * (1.0 - pZ[i]);
+		}
+	}
+
+	// Blame the remember gate through the value written to memory
+	m_blamehx.fill(0.0);
+	m_block.m_val.backPropBatch(*this, m_rhx, m_t, m_blamet, m_blamehx);
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pPrevH = pPrev->m_h[r].data();
+		const double* pR = m_r[r].data();
+		double* pBlameR = m_blamer[r].data();
+		double* pBlameRH = m_blamehx[r].data();
+		double* pPrevBlameH = pPrev->m_blameh[r].data();
+		for(size_t i = 0; i < units; i++)
+		{
+			pBlameR[i] = pBlameRH[i] * pPrevH[i] * pR[i] * (1.0 - pR[i]);
+			pPrevBlameH[i] += pBlameRH[i] * pR[i];
+			pBlameRH[i] = 0.0;
+		}
+	}
+
+	// Blame the previous h and the input through the gates
+	m_block.m_update.backPropBatch(*this, m_hx, m_z, m_blamez, m_blamehx);
+	m_block.m_remember.backPropBatch(*this, m_hx, m_r, m_blamer, m_blamehx);
+	for(size_t r = 0; r < m_h.rows(); r++)
+	{
+		const double* pBlameHX = m_blamehx[r].data();
+		double* pPrevBlameH = pPrev->m_blameh[r].data();
+		for(size_t i = 0; i < units; i++)
+			pPrevBlameH[i] += pBlameHX[i];
+		double* pInBlame = inBlame[r].data();
+		for(size_t i = 0; i < inBlame.cols(); i++)
+			pInBlame[i] += pBlameHX[units + i];
+	}
+}
+
+void GContextGRUBatch::updateGradient(GVec& gradient)
+{
+	size_t wcUpdate = m_block.m_update.weightCount();
+	size_t wcRemember = m_block.m_remember.weightCount();
+	size_t wcVal = m_block.m_val.weightCount();
+	GVecWrapper g(gradient.data(), wcUpdate);
+	m_block.m_update.updateGradientBatch(*this, m_hx, m_blamez, g.vec());
+	g.setData(gradient.data() + wcUpdate, wcRemember);
+	m_block.m_remember.updateGradientBatch(*this, m_hx, m_blamer, g.vec());
+	g.setData(gradient.data() + wcUpdate + wcRemember, wcVal);
+	m_block.m_val.updateGradientBatch(*this, m_rhx, m_blamet, g.vec());
+}
+
+
+
 } // namespace GClasses
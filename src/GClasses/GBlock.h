@@ -25,12 +25,17 @@
 #include <vector>
 #include <ostream>
 #include <cmath>
+#include <cstdint>
+#include <functional>
+#include <atomic>
+#include <mutex>
 
 namespace GClasses {
 
 class GContext;
 class GContextRecurrent;
 class GContextRecurrentInstance;
+class GContextRecurrentBatchInstance;
 class GNeuralNet;
 
 
@@ -110,6 +115,27 @@ public:
 	/// Returns true iff this block does its computations in parallel on a GPU.
 	virtual bool usesGPU() { return false; }
 
+	/// Specifies whether this block should propagate with a single-precision (float) copy of its
+	/// weights. The double-precision weights remain the master copy, so gradients and steps are
+	/// computed as before, and activations and sums are still accumulated in double precision.
+	/// Blocks without a single-precision implementation ignore this.
+	virtual void setSinglePrecision(bool single) {}
+
+	/// Returns true iff this block propagates with single-precision weights.
+	virtual bool singlePrecision() const { return false; }
+
+	/// Makes an int8 copy of the weights, which forwardProp and forwardPropBatch will use from now on.
+	/// inputMax is the largest input magnitude to represent, usually measured on sample data.
+	/// (See GNeuralNet::quantize.) Training still uses the master weights, and every change to them
+	/// re-quantizes the copy. Blocks without an int8 implementation ignore this.
+	virtual void quantizeWeights(double inputMax) {}
+
+	/// Discards the int8 copy of the weights.
+	virtual void dequantize() {}
+
+	/// Returns true iff this block forward-propagates with int8 weights.
+	virtual bool quantized() const { return false; }
+
 	/// Marshall this block into a DOM.
 	virtual GDomNode* serialize(GDom* pDoc) const = 0;
 
@@ -172,6 +198,18 @@ public:
 	/// Add the weight and bias gradient to the weights.
 	virtual void step(double learningRate, const GVec &gradient) = 0;
 
+	/// Evaluates a batch of inputs (one sample per row), and sets the corresponding rows of output.
+	/// The default implementation calls forwardProp once for each row.
+	virtual void forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const;
+
+	/// Evaluates a batch of outBlame rows, and adds to the corresponding rows of inBlame.
+	/// The default implementation calls backProp once for each row.
+	virtual void backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const;
+
+	/// Adds the gradient, summed over every row in the batch, to gradient.
+	/// The default implementation calls updateGradient once for each row.
+	virtual void updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const;
+
 protected:
 	GDomNode* baseDomNode(GDom* pDoc) const;
 
@@ -200,6 +238,7 @@ public:
 	virtual void scaleWeights(double factor, bool scaleBiases) override {}
 	virtual void diminishWeights(double amount, bool regularizeBiases) override {}
 	virtual void updateGradient(GContext& ctx, const GVec& input, const GVec& outBlame, GVec &gradient) const override {}
+	virtual void updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const override {}
 	virtual void step(double learningRate, const GVec &gradient) override {}
 };
 
@@ -452,6 +491,12 @@ public:
 	/// (Note that it "adds to" the inBlame because multiple blocks may fork from a common source.)
 	virtual void backProp(GContext& ctx, const GVec& input, const GVec& output, const GVec& outBlame, GVec& inBlame) const override;
 
+	/// Applies the activation function to every element in a batch.
+	virtual void forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const override;
+
+	/// Evaluates outBlame for every element in a batch, and adds to inBlame.
+	virtual void backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const override;
+
 	/// Evaluates the activation function
 	virtual double eval(double x) const = 0;
 
@@ -813,11 +858,121 @@ public:
 
 
 
+/// Remembers that the copies a block keeps of its weights (in another precision or layout) may no
+/// longer match the master weights, because the master weights were exposed through a mutable
+/// accessor. The next propagation rebuilds the copies, in only one thread if several propagate at once.
+class GStaleWeightCopies
+{
+protected:
+	std::atomic<bool> m_stale;
+	std::mutex m_mutex;
+
+public:
+	GStaleWeightCopies() : m_stale(false) {}
+
+	/// Marks the copies as stale.
+	void set() { m_stale.store(true, std::memory_order_release); }
+
+	/// If the copies are stale, calls rebuild and marks them current. Threads that call this while
+	/// another one is rebuilding wait for it to finish.
+	template<typename F>
+	void refresh(F rebuild)
+	{
+		if(!m_stale.load(std::memory_order_acquire))
+			return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_stale.load(std::memory_order_relaxed))
+		{
+			rebuild();
+			m_stale.store(false, std::memory_order_release);
+		}
+	}
+};
+
+
+
+
+/// An int8 copy of the weights of a block, used for fast inference after training.
+/// Each output channel has its own weight scale. Inputs are mapped to unsigned bytes with a
+/// single scale (measured on sample data) and a zero point of 128, so that the inner loop is
+/// a dot product of unsigned bytes with signed bytes, accumulated in 32-bit integers.
+class GQuantizedWeights
+{
+protected:
+	size_t m_channels, m_length, m_stride;
+	double m_inputScale;
+	std::vector<int8_t> m_weights; // A channels-by-stride matrix of quantized weights. The padding is zero.
+	GVec m_scales; // For each channel, the input scale times the weight scale
+	std::vector<int32_t> m_offsets; // For each channel, 128 times the sum of the quantized weights
+
+public:
+	GQuantizedWeights();
+
+	/// Unmarshals the quantized weights from a DOM node made by serialize.
+	void deserialize(GDomNode* pNode);
+
+	/// Marshals this object into a DOM. The weights are stored as a hexadecimal string.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Returns true iff no weights have been quantized.
+	bool empty() const { return m_channels == 0; }
+
+	/// Returns the number of output channels.
+	size_t channels() const { return m_channels; }
+
+	/// Returns the number of inputs to each channel.
+	size_t length() const { return m_length; }
+
+	/// Discards the quantized weights.
+	void clear();
+
+	/// Quantizes the weights of a block with the specified number of output channels, each
+	/// of which takes the dot product of length inputs. weight(c, i) returns weight i of channel c.
+	void quantize(size_t channels, size_t length, double inputMax, const std::function<double(size_t, size_t)>& weight);
+
+	/// Returns the largest input magnitude that can be represented.
+	double inputMax() const { return m_inputScale * 127.0; }
+
+	/// Returns the number of bytes in a quantized input vector. (This is length rounded up for SIMD.)
+	size_t stride() const { return m_stride; }
+
+	/// Quantizes a single input value.
+	uint8_t quantizeInput(double x) const
+	{
+		double q = std::floor(x / m_inputScale + 0.5);
+		return (uint8_t)(128 + (q > 127.0 ? 127 : (q < -127.0 ? -127 : (int)q)));
+	}
+
+	/// Quantizes an input vector of length values into pOut, and pads it to stride bytes.
+	void quantizeInput(const double* pIn, uint8_t* pOut) const;
+
+	/// Returns the dot product of channel c with a quantized input vector, in real units.
+	double dot(size_t c, const uint8_t* pIn) const;
+
+	/// Returns the name of the instruction set that dot uses. (It is picked at runtime, from the
+	/// ones this CPU supports, so builds without -march still use SIMD instructions.)
+	static const char* kernelName();
+
+	/// Returns a buffer of at least the specified number of bytes that belongs to the calling thread.
+	/// (Quantized inference uses this for its quantized inputs, so it does not allocate memory for each sample.)
+	static uint8_t* scratch(size_t bytes);
+};
+
+
+
+
 /// Standard fully-connected block of weights. Often followed by a GBlockActivation.
 class GBlockLinear : public GBlock
 {
 protected:
 	GMatrix m_weights; // An (inputs+1)-by-outputs matrix of weights. The last row contains the bias values.
+	bool m_single;
+	std::vector<float> m_weightsSingle; // A row-major float copy of m_weights. (Only used when m_single is true.)
+	GQuantizedWeights m_quantized;
+	mutable GStaleWeightCopies m_stale; // Set when weights() or bias() exposes the master weights
+
+	/// Rebuilds the float and int8 copies if weights() or bias() has exposed the master weights since they were made.
+	void refreshWeightCopies() const;
 
 public:
 	GBlockLinear(size_t outputs, size_t inputs = 0);
@@ -841,6 +996,29 @@ public:
 	/// Returns the number of outputs this block produces
 	virtual size_t outputs() const override { return m_weights.cols(); }
 
+	/// Specifies whether to propagate with a float copy of the weights. This halves the number of
+	/// bytes read per weight, so it only helps when the weights do not fit in the cache, and the
+	/// conversions make it somewhat slower when they do. ("bench inference" measures this. On one
+	/// machine, it made a 4096x4096 block propagate 1.65 times as fast, and a 256x256 block 0.75 times as fast.)
+	virtual void setSinglePrecision(bool single) override;
+
+	/// Returns true iff this block propagates with a float copy of the weights.
+	virtual bool singlePrecision() const override { return m_single; }
+
+	/// Makes an int8 copy of the weights with one scale per output.
+	virtual void quantizeWeights(double inputMax) override;
+
+	/// Discards the int8 copy of the weights.
+	virtual void dequantize() override { m_quantized.clear(); }
+
+	/// Returns true iff this block forward-propagates with int8 weights.
+	virtual bool quantized() const override { return !m_quantized.empty(); }
+
+	/// Refreshes the float and int8 copies of the weights. The methods of this class do this
+	/// automatically, and calling weights() or bias() makes the next propagation do it. But if you
+	/// keep the reference they return and modify the weights through it after propagating, call this afterward.
+	void syncWeightCopies();
+
 	/// Evaluate the input, set the output.
 	virtual void forwardProp(GContext& ctx, const GVec& input, GVec& output) const override;
 
@@ -861,6 +1039,16 @@ public:
 	/// A convenience method that goes with forwardProp2 and backProp2.
 	void updateGradient2(const GVec& in1, const GVec& in2, const GVec& outBlame, GVec &gradient) const;
 
+	/// Evaluates a batch of inputs. Rows are processed in small tiles so that each row of
+	/// weights is read once per tile instead of once per sample.
+	virtual void forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const override;
+
+	/// Evaluates a batch of outBlame rows, and adds to the corresponding rows of inBlame.
+	virtual void backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const override;
+
+	/// Adds the gradient, summed over every row in the batch, to gradient.
+	virtual void updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const override;
+
 	/// Add the weight and bias gradient to the weights.
 	virtual void step(double learningRate, const GVec &gradient) override;
 
@@ -895,14 +1083,14 @@ public:
 	/// Moves all weights in the direction of zero by the specified amount.
 	virtual void diminishWeights(double amount, bool regularizeBiases) override;
 
-	/// Returns the bias vector of this block.
-	GVec& bias() { return m_weights.back(); }
+	/// Returns the bias vector of this block. (The float and int8 copies are rebuilt before the next propagation.)
+	GVec& bias() { m_stale.set(); return m_weights.back(); }
 
 	/// Returns the bias vector of this block.
 	const GVec& bias() const { return m_weights.back(); }
 
-	/// Get the entire weights matrix
-	GMatrix& weights() { return m_weights; }
+	/// Get the entire weights matrix. (The float and int8 copies are rebuilt before the next propagation.)
+	GMatrix& weights() { m_stale.set(); return m_weights; }
 
 	/// Get the entire weights matrix
 	const GMatrix& weights() const { return m_weights; }
@@ -1578,6 +1766,16 @@ public:
 
 class GBlockConvolutional2D : public GBlock
 {
+public:
+	/// The ways this block can compute its convolutions.
+	enum Algorithm
+	{
+		conv_auto, ///< Winograd where it applies and there are at least 16 channels and 16 kernels, and im2col otherwise
+		conv_direct, ///< Nested loops over the images, one kernel and one sample at a time
+		conv_im2col, ///< Gathers the receptive fields into the rows of a matrix and multiplies it by the kernels
+		conv_winograd, ///< Winograd F(2x2,3x3) minimal filtering (falls back to im2col unless the kernels are 3x3 with a stride of 1)
+	};
+
 protected:
 	/// Image abstraction to facilitate convolution
 	struct Image
@@ -1621,6 +1819,22 @@ protected:
 	Image m_inputImage, m_upStreamErrorImage;
 	Image m_actImage, m_errImage;
 
+	/// An int8 copy of the kernels (empty unless quantizeWeights has been called)
+	GQuantizedWeights m_quantized;
+
+	/// The patch table (see patchIndexes), unless every pass uses the direct loops
+	std::vector<size_t> m_patchTable;
+
+	/// The Winograd-domain kernels (see winogradKernels) for the passes that use Winograd
+	GMatrix m_winogradForward[16];
+	GMatrix m_winogradBackward[16];
+
+	/// Set when the geometry or the algorithm changes, or when kernels() or bias() exposes the weights
+	mutable GStaleWeightCopies m_stale;
+
+	/// The requested convolution algorithm
+	Algorithm m_algorithm;
+
 private:
 	/// Helper functions for convolution
 	double filterSum(const Image &in, const Image &filter, size_t channels) const;
@@ -1629,6 +1843,56 @@ private:
 	void convolveFull(const Image &in, const Image &filter, Image &out, size_t channels = none) const;
 	void updateOutputSize();
 
+	/// Computes, for each output position and each kernel weight, the index of the input
+	/// value that the weight touches (or Image::npos where it falls on padding). The table
+	/// depends only on the geometry of this block, so it is shared by every sample in a batch.
+	void patchIndexes(std::vector<size_t>& table) const;
+
+	/// Returns the index in the output vector of the specified output position and kernel.
+	size_t outputIndex(size_t pos, size_t kernel) const;
+
+	/// Re-quantizes the kernels (if this block is quantized), and rebuilds the patch table and the
+	/// Winograd kernels that the chosen algorithms use. This is called after the kernels change.
+	void syncWeightCopies();
+
+	/// Calls syncWeightCopies if the geometry or the algorithm has changed, or if kernels() or
+	/// bias() has exposed the weights, since it was last called.
+	void refreshWeightCopies() const;
+
+	/// Returns the algorithm that will actually be used. (Winograd needs 3x3 kernels with a stride
+	/// of 1, and when propagating blame backward it also needs the padding to be at most 2.)
+	Algorithm chooseAlgorithm(bool backward) const;
+
+	/// Returns the number of samples to process with each call to the im2col or Winograd helpers.
+	size_t chunkSize() const;
+
+	/// Gathers the receptive fields of count samples into the rows of cols (one row per sample per output position).
+	void im2col(const double* const* ppIn, size_t count, const std::vector<size_t>& table, GMatrix& cols) const;
+
+	/// Copies the outBlame of count samples into the rows of blame (one row per sample per output position).
+	void gatherBlame(const double* const* ppOutBlame, size_t count, GMatrix& blame) const;
+
+	/// Computes count samples with a single matrix product.
+	void forwardPropIm2col(const double* const* ppIn, double* const* ppOut, size_t count, const std::vector<size_t>& table) const;
+
+	/// Adds the blame of count samples onto their inputs with a single matrix product.
+	void backPropIm2col(const double* const* ppOutBlame, double* const* ppInBlame, size_t count, const std::vector<size_t>& table) const;
+
+	/// Adds the gradient, summed over count samples, to pGradient with a single matrix product.
+	void updateGradientIm2col(const double* const* ppIn, const double* const* ppOutBlame, size_t count, const std::vector<size_t>& table, double* pGradient) const;
+
+	/// Computes the 16 Winograd-domain kernel matrices, G g G^T. If backward is true, the kernels are
+	/// flipped and their channels swapped, so they map output blame to input blame.
+	void winogradKernels(bool backward, GMatrix* pU) const;
+
+	/// Correlates count images described by in with the 3x3 kernels transformed into pU, using
+	/// Winograd F(2x2,3x3). If pBias is non-null, the results are stored (after adding the bias) in
+	/// the images described by out. Otherwise, they are added to them.
+	void winograd(const double* const* ppIn, const Image& in, const GMatrix* pU, double* const* ppOut, const Image& out, size_t count, const double* pBias) const;
+
+	/// Evaluates one sample with the int8 kernels. pInBuf must hold inputs() bytes, and pPatch must hold m_quantized.stride() bytes.
+	void forwardPropQuantized(const double* pIn, double* pOut, const std::vector<size_t>& table, uint8_t* pInBuf, uint8_t* pPatch) const;
+
 public:
 	static size_t none;
 
@@ -1662,6 +1926,16 @@ public:
 	/// (Assumes the error has already been computed and deactivated.)
 	virtual void updateGradient(GContext& ctx, const GVec& input, const GVec& outBlame, GVec &gradient) const override;
 
+	/// Evaluates a batch of inputs. Several samples at a time are gathered into one matrix
+	/// (or one set of Winograd tiles), so each chunk of the batch costs a few large matrix products.
+	virtual void forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const override;
+
+	/// Evaluates a batch of outBlame rows, and adds to the corresponding rows of inBlame.
+	virtual void backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const override;
+
+	/// Adds the gradient, summed over every row in the batch, to gradient.
+	virtual void updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const override;
+
 	/// Add the weight and bias gradient to the weights.
 	virtual void step(double learningRate, const GVec &gradient) override;
 
@@ -1675,6 +1949,15 @@ public:
 	virtual void perturbWeights(GRand& rand, double deviation) override;
 	virtual void maxNorm(double min, double max) override;
 
+	/// Makes an int8 copy of the kernels with one scale per kernel.
+	virtual void quantizeWeights(double inputMax) override;
+
+	/// Discards the int8 copy of the kernels.
+	virtual void dequantize() override { m_quantized.clear(); }
+
+	/// Returns true iff this block forward-propagates with int8 kernels.
+	virtual bool quantized() const override { return !m_quantized.empty(); }
+
 	void setPadding(size_t px, size_t py = none);
 	void setStride(size_t sx, size_t sy = none);
 	void setInterlaced(bool interlaced);
@@ -1684,6 +1967,13 @@ public:
 	void addKernel();
 	void addKernels(size_t n);
 
+	/// Specifies how the convolutions should be computed. The default, conv_auto, picks the fastest
+	/// algorithm that supports the geometry of this block. (This is a runtime choice, so it is not serialized.)
+	void setAlgorithm(Algorithm algorithm);
+
+	/// Returns the requested convolution algorithm.
+	Algorithm algorithm() const { return m_algorithm; }
+
 	size_t inputWidth() const { return m_width; }
 	size_t inputHeight() const { return m_height; }
 	size_t inputChannels() const { return m_channels; }
@@ -1698,9 +1988,9 @@ public:
 
 	size_t kernelCount() const { return m_kernels.rows(); }
 	const GMatrix &kernels() const { return m_kernels; }
-	GMatrix &kernels() { return m_kernels; }
+	GMatrix &kernels() { m_stale.set(); return m_kernels; }
 	const GVec &bias() const { return m_bias; }
-	GVec &bias() { return m_bias; }
+	GVec &bias() { m_stale.set(); return m_bias; }
 };
 
 
@@ -1740,6 +2030,10 @@ public:
 	/// The recurrent state should be initialized to the starting state.
 	virtual GContextRecurrentInstance* newContext(GRand& rand) = 0;
 
+	/// Returns a new context object that propagates the specified number of sequences through this block in lockstep.
+	/// The recurrent state should be initialized to the starting state.
+	virtual GContextRecurrentBatchInstance* newBatchContext(GRand& rand, size_t sequences) = 0;
+
 protected:
 	/// Deliberately protected.
 	/// Throws an exception telling you to call GContextRecurrent::forwardProp instead.
@@ -1829,10 +2123,76 @@ public:
 
 
 
+/// A special context object for propagating a batch of sequences through a recurrent block
+/// in lockstep. Row i of every matrix belongs to sequence i. It remembers every step since
+/// the beginning of the current window, so blame can be propagated back through all of them.
+/// Windows implement truncated backpropagation through time: the state reached at the end of
+/// one window carries into the next one, but blame does not flow back across the boundary.
+class GContextRecurrentBatch : public GContext
+{
+public:
+	GBlockRecurrent& m_block;
+	size_t m_sequences;
+	std::vector<GContextRecurrentBatchInstance*> m_instances; // m_instances[0] holds the state carried into the window. m_instances[i] holds the state after step i - 1.
+	std::vector<std::vector<bool> > m_active; // m_active[i] tells which sequences advance at step i of the window
+	size_t m_steps; // The number of steps in the current window
+	size_t m_step; // The step that backProp and updateGradient apply to
+
+	GContextRecurrentBatch(GRand& rand, GBlockRecurrent& block, size_t sequences);
+	virtual ~GContextRecurrentBatch();
+
+	/// Sets every sequence to the starting state, and begins a new window.
+	virtual void resetState() override;
+
+	/// Begins a new window, keeping the state reached at the end of the previous one.
+	void beginWindow();
+
+	/// Appends a step to the current window. Only the sequences marked in active will advance.
+	void beginStep(const std::vector<bool>& active);
+
+	/// Selects the step that backProp and updateGradient apply to. Steps must be visited in
+	/// reverse order. Selecting the last step of the window clears all of the blame.
+	void setStep(size_t step);
+
+	/// Advances the sequences one step with the input for the step that was just appended.
+	void forwardProp(const GMatrix& input, GMatrix& output);
+
+	/// Backpropagates outBlame through the selected step, and adds to inBlame.
+	void backProp(const GMatrix& outBlame, GMatrix& inBlame);
+
+	/// Adds the gradient of the selected step to gradient.
+	void updateGradient(GVec& gradient);
+};
+
+/// A single step of a batch of sequences that has been unfolded through time
+class GContextRecurrentBatchInstance : public GContext
+{
+public:
+	GContextRecurrentBatchInstance(GRand& rand) : GContext(rand) {}
+	virtual ~GContextRecurrentBatchInstance() {}
+
+	/// Copies the recurrent state of pOther into this instance.
+	virtual void copyState(const GContextRecurrentBatchInstance* pOther) = 0;
+
+	virtual void clearBlame() = 0;
+
+	/// Advances every sequence from the state in pPrev. The rows where active is false keep the state in pPrev.
+	virtual void forwardProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& input, GMatrix& output, const std::vector<bool>& active) = 0;
+
+	/// Adds outBlame to the blame on the output of this step, backpropagates it into pPrev, and adds to inBlame.
+	virtual void backProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& outBlame, GMatrix& inBlame, const std::vector<bool>& active) = 0;
+
+	/// Adds the gradient of this step to gradient. (Assumes backProp was just called.)
+	virtual void updateGradient(GVec& gradient) = 0;
+};
+
+
+
 /// A classic Long Short Term Memory block (with coupled forget and input gates)
 class GBlockLSTM : public GBlockRecurrent
 {
 friend class GContextLSTM;
+friend class GContextLSTMBatch;
 protected:
 	GBlockScalarProduct m_product;
 	GBlockSwitch m_switch;
@@ -1862,9 +2222,18 @@ public:
 	/// Returns the number of outputs this block produces
 	virtual size_t outputs() const override { return m_write.outputs(); }
 
+	/// Specifies whether the internal linear blocks should propagate with float copies of their weights.
+	virtual void setSinglePrecision(bool single) override;
+
+	/// Returns true iff the internal linear blocks propagate with float copies of their weights.
+	virtual bool singlePrecision() const override { return m_write.singlePrecision(); }
+
 	/// Makes a new context object for this block
 	virtual GContextRecurrentInstance* newContext(GRand& rand) override;
 
+	/// Makes a new context object for propagating a batch of sequences through this block
+	virtual GContextRecurrentBatchInstance* newBatchContext(GRand& rand, size_t sequences) override;
+
 	/// Resizes this block.
 	virtual void resize(size_t inputs, size_t outputs) override;
 
@@ -1935,6 +2304,35 @@ public:
 	virtual void updateGradient(GContextRecurrentInstance* prev, const GVec& input, GVec& gradient) const override;
 };
 
+/// Context class for propagating a batch of sequences through an LSTM block
+class GContextLSTMBatch : public GContextRecurrentBatchInstance
+{
+public:
+	const GBlockLSTM& m_block;
+	GMatrix m_hx; // The previous h beside the input, for every sequence
+	GMatrix m_c;
+	GMatrix m_h;
+	GMatrix m_f;
+	GMatrix m_t;
+	GMatrix m_o;
+	GMatrix m_s; // tanh(m_c)
+	GMatrix m_blamec;
+	GMatrix m_blameh;
+	GMatrix m_blamef; // The blame on the net inputs of the gates
+	GMatrix m_blamet;
+	GMatrix m_blameo;
+	GMatrix m_blamehx;
+
+	GContextLSTMBatch(GRand& rand, GBlockLSTM& block, size_t sequences);
+
+	virtual void resetState() override;
+	virtual void copyState(const GContextRecurrentBatchInstance* pOther) override;
+	virtual void clearBlame() override;
+	virtual void forwardProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& input, GMatrix& output, const std::vector<bool>& active) override;
+	virtual void backProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& outBlame, GMatrix& inBlame, const std::vector<bool>& active) override;
+	virtual void updateGradient(GVec& gradient) override;
+};
+
 
 
 
@@ -1943,6 +2341,7 @@ public:
 class GBlockGRU : public GBlockRecurrent
 {
 friend class GContextGRU;
+friend class GContextGRUBatch;
 protected:
 	GBlockScalarProduct m_product;
 	GBlockSwitch m_switch;
@@ -1972,9 +2371,18 @@ public:
 	/// Returns the number of outputs this block produces
 	virtual size_t outputs() const override { return m_update.outputs(); }
 
+	/// Specifies whether the internal linear blocks should propagate with float copies of their weights.
+	virtual void setSinglePrecision(bool single) override;
+
+	/// Returns true iff the internal linear blocks propagate with float copies of their weights.
+	virtual bool singlePrecision() const override { return m_update.singlePrecision(); }
+
 	/// Makes a new context object for this block
 	virtual GContextRecurrentInstance* newContext(GRand& rand) override;
 
+	/// Makes a new context object for propagating a batch of sequences through this block
+	virtual GContextRecurrentBatchInstance* newBatchContext(GRand& rand, size_t sequences) override;
+
 	/// Resizes this block.
 	virtual void resize(size_t inputs, size_t outputs) override;
 
@@ -2043,6 +2451,33 @@ public:
 
 };
 
+/// Context class for propagating a batch of sequences through a GRU block
+class GContextGRUBatch : public GContextRecurrentBatchInstance
+{
+public:
+	const GBlockGRU& m_block;
+	GMatrix m_hx; // The previous h beside the input, for every sequence
+	GMatrix m_rhx; // The previous h times the remember gate beside the input
+	GMatrix m_h;
+	GMatrix m_z;
+	GMatrix m_r;
+	GMatrix m_t;
+	GMatrix m_blameh;
+	GMatrix m_blamez; // The blame on the net inputs of the gates
+	GMatrix m_blamer;
+	GMatrix m_blamet;
+	GMatrix m_blamehx;
+
+	GContextGRUBatch(GRand& rand, GBlockGRU& block, size_t sequences);
+
+	virtual void resetState() override;
+	virtual void copyState(const GContextRecurrentBatchInstance* pOther) override;
+	virtual void clearBlame() override;
+	virtual void forwardProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& input, GMatrix& output, const std::vector<bool>& active) override;
+	virtual void backProp(GContextRecurrentBatchInstance* pPrev, const GMatrix& outBlame, GMatrix& inBlame, const std::vector<bool>& active) override;
+	virtual void updateGradient(GVec& gradient) override;
+};
+
 
 
 } // namespace GClasses
@@ -37,12 +37,134 @@
 #include <iostream>
 #include <map>
 #include <memory>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include "GThread.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define GCLUSTER_X86_KERNELS
+#	include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#	include <arm_neon.h>
+#endif
 
 using namespace GClasses;
 using std::cout;
 using std::vector;
 using std::map;
 
+// Returns the squared Euclidean distance between two vectors of n elements
+static double GKMeans_squaredEuclideanPortable(const double* pA, const double* pB, size_t n)
+{
+	size_t i = 0;
+	double sum;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	float64x2_t acc0 = vdupq_n_f64(0.0);
+	float64x2_t acc1 = vdupq_n_f64(0.0);
+	for( ; i + 4 <= n; i += 4)
+	{
+		float64x2_t d0 = vsubq_f64(vld1q_f64(pA + i), vld1q_f64(pB + i));
+		float64x2_t d1 = vsubq_f64(vld1q_f64(pA + i + 2), vld1q_f64(pB + i + 2));
+		acc0 = vfmaq_f64(acc0, d0, d0);
+		acc1 = vfmaq_f64(acc1, d1, d1);
+	}
+	sum = vaddvq_f64(vaddq_f64(acc0, acc1));
+#else
+	// Independent accumulators let the compiler vectorize this and keep several additions in flight
+	double s0 = 0.0;
+	double s1 = 0.0;
+	double s2 = 0.0;
+	double s3 = 0.0;
+	for( ; i + 4 <= n; i += 4)
+	{
+		double d0 = pA[i] - pB[i];
+		double d1 = pA[i + 1] - pB[i + 1];
+		double d2 = pA[i + 2] - pB[i + 2];
+		double d3 = pA[i + 3] - pB[i + 3];
+		s0 += d0 * d0;
+		s1 += d1 * d1;
+		s2 += d2 * d2;
+		s3 += d3 * d3;
+	}
+	sum = (s0 + s1) + (s2 + s3);
+#endif
+	for( ; i < n; i++)
+	{
+		double d = pA[i] - pB[i];
+		sum += d * d;
+	}
+	return sum;
+}
+
+#ifdef GCLUSTER_X86_KERNELS
+// The x86 kernels are compiled for their instruction sets with target attributes, and
+// GKMeans_pickSquaredEuclidean chooses one at runtime, so builds without -march can use them.
+
+__attribute__((target("avx512f")))
+static double GKMeans_squaredEuclideanAvx512(const double* pA, const double* pB, size_t n)
+{
+	size_t i = 0;
+	double sum;
+	__m512d acc = _mm512_setzero_pd();
+	for( ; i + 8 <= n; i += 8)
+	{
+		__m512d d = _mm512_sub_pd(_mm512_loadu_pd(pA + i), _mm512_loadu_pd(pB + i));
+		acc = _mm512_fmadd_pd(d, d, acc);
+	}
+	double lanes[8];
+	_mm512_storeu_pd(lanes, acc);
+	sum = ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) + ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+	for( ; i < n; i++)
+	{
+		double d = pA[i] - pB[i];
+		sum += d * d;
+	}
+	return sum;
+}
+
+__attribute__((target("avx2,fma")))
+static double GKMeans_squaredEuclideanAvx2(const double* pA, const double* pB, size_t n)
+{
+	size_t i = 0;
+	double sum;
+	__m256d acc0 = _mm256_setzero_pd();
+	__m256d acc1 = _mm256_setzero_pd();
+	for( ; i + 8 <= n; i += 8)
+	{
+		__m256d d0 = _mm256_sub_pd(_mm256_loadu_pd(pA + i), _mm256_loadu_pd(pB + i));
+		__m256d d1 = _mm256_sub_pd(_mm256_loadu_pd(pA + i + 4), _mm256_loadu_pd(pB + i + 4));
+		acc0 = _mm256_fmadd_pd(d0, d0, acc0);
+		acc1 = _mm256_fmadd_pd(d1, d1, acc1);
+	}
+	double lanes[4];
+	_mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+	sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+	for( ; i < n; i++)
+	{
+		double d = pA[i] - pB[i];
+		sum += d * d;
+	}
+	return sum;
+}
+#endif // GCLUSTER_X86_KERNELS
+
+typedef double (*GKMeans_squaredEuclideanFunc)(const double* pA, const double* pB, size_t n);
+
+// Returns the fastest distance kernel that this CPU supports
+static GKMeans_squaredEuclideanFunc GKMeans_pickSquaredEuclidean()
+{
+#ifdef GCLUSTER_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return GKMeans_squaredEuclideanAvx512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return GKMeans_squaredEuclideanAvx2;
+#endif
+	return GKMeans_squaredEuclideanPortable;
+}
+
+static const GKMeans_squaredEuclideanFunc GKMeans_squaredEuclidean = GKMeans_pickSquaredEuclidean();
+
 GClusterer::GClusterer(size_t nClusterCount)
 : GTransform(), m_clusterCount(nClusterCount), m_pMetric(NULL), m_ownMetric(false)
 {
@@ -94,14 +216,90 @@ void GSparseClusterer::setMetric(GSparseSimilarity* pMetric, bool own)
 
 
 
+GDendrogram::GDendrogram(size_t rows)
+: m_rows(rows)
+{
+}
+
+void GDendrogram::reset(size_t rows)
+{
+	m_rows = rows;
+	m_merges.clear();
+}
+
+void GDendrogram::addMerge(size_t a, size_t b, double height)
+{
+	GAssert(a < m_rows && b < m_rows && a != b);
+	Merge m;
+	m.a = a;
+	m.b = b;
+	m.height = height;
+	m_merges.push_back(m);
+}
+
+void GDendrogram::sortMerges()
+{
+	std::stable_sort(m_merges.begin(), m_merges.end(), [](const Merge& x, const Merge& y) { return x.height < y.height; });
+}
+
+// Returns the representative of the set that contains i, and compresses the path to it
+static size_t GAgglomerativeClusterer_find(vector<size_t>& parent, size_t i)
+{
+	size_t root = i;
+	while(parent[root] != root)
+		root = parent[root];
+	while(parent[i] != root)
+	{
+		size_t next = parent[i];
+		parent[i] = root;
+		i = next;
+	}
+	return root;
+}
+
+void GDendrogram::cut(size_t clusters, size_t* pOut) const
+{
+	if(clusters < 1 || clusters > m_rows)
+		throw Ex("Expected from 1 to ", to_str(m_rows), " clusters. Got ", to_str(clusters));
+	size_t count = m_rows - clusters;
+	if(count > m_merges.size())
+		throw Ex("The dendrogram only has ", to_str(m_merges.size()), " merges, so it cannot be cut into ", to_str(clusters), " clusters");
+
+	// Apply the lowest merges
+	vector<size_t> parent(m_rows);
+	for(size_t i = 0; i < m_rows; i++)
+		parent[i] = i;
+	for(size_t i = 0; i < count; i++)
+	{
+		size_t ra = GAgglomerativeClusterer_find(parent, m_merges[i].a);
+		size_t rb = GAgglomerativeClusterer_find(parent, m_merges[i].b);
+		if(ra == rb)
+			throw Ex("The dendrogram merges two rows that are already in the same cluster");
+		parent[rb] = ra;
+	}
+
+	// Number the clusters in the order that their first rows appear
+	vector<size_t> ids(m_rows, INVALID_INDEX);
+	size_t next = 0;
+	for(size_t i = 0; i < m_rows; i++)
+	{
+		size_t r = GAgglomerativeClusterer_find(parent, i);
+		if(ids[r] == INVALID_INDEX)
+			ids[r] = next++;
+		pOut[i] = ids[r];
+	}
+}
+
+
+
+
 GAgglomerativeClusterer::GAgglomerativeClusterer(size_t clusters)
-: GClusterer(clusters), m_pClusters(NULL)
+: GClusterer(clusters), m_linkage(Single)
 {
 }
 
 GAgglomerativeClusterer::~GAgglomerativeClusterer()
 {
-	delete[] m_pClusters;
 }
 
 // virtual
@@ -112,101 +310,251 @@ void GAgglomerativeClusterer::cluster(const GMatrix* pData)
 		setMetric(new GRowDistance(), true);
 	m_pMetric->init(&pData->relation(), false);
 
-	// Find enough neighbors to form a connected graph
-	GNeighborGraph* pNF = NULL;
-	std::unique_ptr<GNeighborGraph> hNF;
-	size_t neighbors = 6;
-	while(true)
+	// Find all of the merges
+	size_t rows = pData->rows();
+	m_dendrogram.reset(rows);
+	if(rows > 1)
 	{
-		GKdTree* pKdTree = new GKdTree(pData, m_pMetric, false);
-		pNF = new GNeighborGraph(pKdTree, true, neighbors);
-		hNF.reset(pNF);
-		if(pNF->isConnected())
-			break;
-		if(neighbors + 1 >= pData->rows())
-			throw Ex("internal problem--a graph with so many neighbors must be connected");
-		neighbors = std::min((neighbors * 3) / 2, pData->rows() - 1);
+		switch(m_linkage)
+		{
+			case Single: singleLinkage(*pData); break;
+			case Ward: wardLinkage(*pData); break;
+			case Complete:
+			case Average: matrixLinkage(*pData); break;
+			default: throw Ex("Unrecognized linkage");
+		}
 	}
+	m_dendrogram.sortMerges();
 
-	// Sort all the neighbors by their distances
-	vector< std::pair<double,size_t> > distNeighs;
-	distNeighs.resize(pData->rows() * neighbors);
-	vector< std::pair<double,size_t> >::iterator it = distNeighs.begin();
-	for(size_t i = 0; i < pData->rows(); i++)
+	// Cut the tree. (If there are fewer rows than clusters, each row gets its own cluster.)
+	m_clusters.resize(rows);
+	if(rows > 0)
+		m_dendrogram.cut(std::max((size_t)1, std::min(m_clusterCount, rows)), m_clusters.data());
+}
+
+void GAgglomerativeClusterer::recut(size_t clusters)
+{
+	if(m_clusters.size() != m_dendrogram.rows() || m_clusters.size() == 0)
+		throw Ex("cluster must be called before recut");
+	m_dendrogram.cut(clusters, m_clusters.data());
+	m_clusterCount = clusters;
+}
+
+void GAgglomerativeClusterer::singleLinkage(const GMatrix& data)
+{
+	size_t n = data.rows();
+	GKdTree tree(&data, m_pMetric, false);
+	vector<size_t> parent(n);
+	for(size_t i = 0; i < n; i++)
+		parent[i] = i;
+	vector<size_t> labels(n);
+	vector<size_t> nearest(n);
+	vector<double> nearestDist(n);
+	vector<size_t> best(n);
+	size_t blockSize = 256;
+	size_t components = n;
+	while(components > 1)
 	{
-		size_t nc = pNF->findNearest(neighbors, i);
-		for(size_t j = 0; j < nc; j++)
+		// Label each point with its component, so the tree can skip whole subtrees of one component
+		for(size_t i = 0; i < n; i++)
+			labels[i] = GAgglomerativeClusterer_find(parent, i);
+		tree.labelNodes(labels.data());
+
+		// Find the nearest point in another component for every point
+		size_t blocks = (n + blockSize - 1) / blockSize;
+		GThreadPool::global().parallelFor(0, blocks, [&](size_t blk) {
+			size_t end = std::min(n, (blk + 1) * blockSize);
+			for(size_t i = blk * blockSize; i < end; i++)
+				nearest[i] = tree.findNearestWithDifferentLabel(data[i], labels.data(), labels[i], 1e308, &nearestDist[i]);
+		});
+
+		// Pick the shortest edge out of each component. Ties go to the smallest pair of
+		// indexes, so the picked edges cannot form a cycle.
+		std::fill(best.begin(), best.end(), INVALID_INDEX);
+		for(size_t i = 0; i < n; i++)
 		{
-			it->first = pNF->distance(j);
-			it->second = i * neighbors + j;
-			it++;
+			if(nearest[i] == INVALID_INDEX)
+				continue;
+			size_t& b = best[labels[i]];
+			if(b == INVALID_INDEX || nearestDist[i] < nearestDist[b])
+				b = i;
+			else if(nearestDist[i] == nearestDist[b])
+			{
+				std::pair<size_t,size_t> cand(std::min(i, nearest[i]), std::max(i, nearest[i]));
+				std::pair<size_t,size_t> cur(std::min(b, nearest[b]), std::max(b, nearest[b]));
+				if(cand < cur)
+					b = i;
+			}
 		}
-	}
-	std::sort(distNeighs.begin(), it);
 
-	// Assign each row to its own cluster
-	delete[] m_pClusters;
-	m_pClusters = new size_t[pData->rows()]; // specifies which cluster each row belongs to
-	GIndexVec::makeIndexVec(m_pClusters, pData->rows());
-	size_t* pSiblings = new size_t[pData->rows()]; // a cyclical linked list of each row in the cluster
-	std::unique_ptr<size_t[]> hSiblings(pSiblings);
-	GIndexVec::makeIndexVec(pSiblings, pData->rows()); // init such that each row is in a cluster of 1
-	size_t currentClusterCount = pData->rows();
-	if(currentClusterCount <= m_clusterCount)
-		return; // nothing to do
-
-	// Merge until we have the desired number of clusters
-	for(vector< std::pair<double,size_t> >::iterator dn = distNeighs.begin(); dn != it; dn++)
-	{
-		// Get the next two closest points
-		size_t a = dn->second / neighbors;
-		pNF->findNearest(neighbors, a);
-		size_t b = pNF->neighbor(dn->second % neighbors);
-		GAssert(a != b && a < pData->rows() && b < pData->rows());
-		size_t clustA = m_pClusters[a];
-		size_t clustB = m_pClusters[b];
-
-		// Merge the clusters
-		if(clustA == clustB)
-			continue; // The two points are already in the same cluster
-		if(clustB < clustA) // Make sure clustA has the smaller value
+		// Join the components along the picked edges
+		size_t before = components;
+		for(size_t c = 0; c < n; c++)
 		{
-			std::swap(a, b);
-			std::swap(clustA, clustB);
+			size_t i = best[c];
+			if(i == INVALID_INDEX)
+				continue;
+			size_t j = nearest[i];
+			size_t ri = GAgglomerativeClusterer_find(parent, i);
+			size_t rj = GAgglomerativeClusterer_find(parent, j);
+			if(ri == rj)
+				continue; // the other component picked the same edge
+			parent[rj] = ri;
+			m_dendrogram.addMerge(i, j, sqrt(nearestDist[i]));
+			components--;
 		}
-		for(size_t i = pSiblings[b]; true; i = pSiblings[i]) // Convert every row in clustB to clustA
+		if(components == before)
+			throw Ex("Failed to find a point in another cluster");
+	}
+}
+
+// Finds all of the merges with the nearest-neighbor chain algorithm. dist(a, b) returns the
+// distance between the clusters in slots a and b, and merge(a, b) merges the cluster in slot b
+// into slot a. The linkage must be reducible, so that merging two clusters never brings them
+// closer to a third cluster. (Ward, complete, and average linkage are all reducible.)
+template<typename D, typename M>
+static void GAgglomerativeClusterer_nnChain(size_t n, GDendrogram& dendrogram, const D& dist, const M& merge)
+{
+	vector<size_t> active(n); // the slots that still hold a cluster
+	vector<size_t> position(n); // the position of each slot in active
+	for(size_t i = 0; i < n; i++)
+	{
+		active[i] = i;
+		position[i] = i;
+	}
+	vector<size_t> chain;
+	chain.reserve(n);
+	GThreadPool& pool = GThreadPool::global();
+	size_t blockSize = 1024;
+	vector<std::pair<double,size_t> > blockBest;
+	while(active.size() > 1)
+	{
+		if(chain.empty())
+			chain.push_back(active[0]);
+		size_t a = chain.back();
+		size_t prev = chain.size() >= 2 ? chain[chain.size() - 2] : INVALID_INDEX;
+
+		// Find the nearest active cluster to a. Ties go to the previous link in the chain, and
+		// then to the smallest slot, so the chain cannot cycle.
+		size_t count = active.size();
+		size_t blocks = (count + blockSize - 1) / blockSize;
+		blockBest.assign(blocks, std::make_pair(1e308, INVALID_INDEX));
+		auto scan = [&](size_t blk) {
+			std::pair<double,size_t> b(1e308, INVALID_INDEX);
+			size_t end = std::min(count, (blk + 1) * blockSize);
+			for(size_t k = blk * blockSize; k < end; k++)
+			{
+				size_t j = active[k];
+				if(j == a)
+					continue;
+				std::pair<double,size_t> cand(dist(a, j), j);
+				if(cand < b)
+					b = cand;
+			}
+			blockBest[blk] = b;
+		};
+		if(blocks > 1)
+			pool.parallelFor(0, blocks, scan);
+		else
+			scan(0);
+		std::pair<double,size_t> b = blockBest[0];
+		for(size_t blk = 1; blk < blocks; blk++)
 		{
-			m_pClusters[i] = clustA;
-			if(i == b)
-				break;
+			if(blockBest[blk] < b)
+				b = blockBest[blk];
 		}
-		std::swap(pSiblings[a], pSiblings[b]); // This line joins the cyclical linked lists into one big cycle
-		if(clustB < m_clusterCount) // Ensure that the first m_clusterCount cluster numbers are always in use
+		if(prev != INVALID_INDEX && dist(a, prev) <= b.first)
+			b = std::make_pair(dist(a, prev), prev);
+
+		if(b.second == prev)
 		{
-			for(size_t i = 0; i < pData->rows(); i++) // rename another cluster to take the spot of clustB
-			{
-				if(m_pClusters[i] >= m_clusterCount)
-				{
-					for(size_t j = pSiblings[i]; true; j = pSiblings[j])
-					{
-						m_pClusters[j] = clustB;
-						if(j == i)
-							break;
-					}
-					break;
-				}
-			}
+			// a and prev are reciprocal nearest neighbors, so merge them
+			chain.pop_back();
+			chain.pop_back();
+			size_t keep = std::min(a, prev);
+			size_t gone = std::max(a, prev);
+			dendrogram.addMerge(keep, gone, b.first);
+			merge(keep, gone);
+			size_t pos = position[gone];
+			active[pos] = active.back();
+			position[active[pos]] = pos;
+			active.pop_back();
 		}
-		if(--currentClusterCount <= m_clusterCount)
-			return;
+		else
+			chain.push_back(b.second);
 	}
-	throw Ex("internal error--should have found the desired number of clusters before now");
+}
+
+void GAgglomerativeClusterer::wardLinkage(const GMatrix& data)
+{
+	if(!data.relation().areContinuous())
+		throw Ex("Ward linkage only supports continuous attributes");
+	if(data.doesHaveAnyMissingValues())
+		throw Ex("Ward linkage does not support missing values");
+	size_t n = data.rows();
+	size_t dims = data.cols();
+	GMatrix centroids(data);
+	vector<double> sizes(n, 1.0);
+	auto dist = [&](size_t a, size_t b) {
+		double na = sizes[a];
+		double nb = sizes[b];
+		return sqrt(2.0 * na * nb / (na + nb) * GKMeans_squaredEuclidean(centroids[a].data(), centroids[b].data(), dims));
+	};
+	auto merge = [&](size_t a, size_t b) {
+		double na = sizes[a];
+		double nb = sizes[b];
+		GVec& ca = centroids[a];
+		const GVec& cb = centroids[b];
+		for(size_t i = 0; i < dims; i++)
+			ca[i] = (na * ca[i] + nb * cb[i]) / (na + nb);
+		sizes[a] = na + nb;
+	};
+	GAgglomerativeClusterer_nnChain(n, m_dendrogram, dist, merge);
+}
+
+void GAgglomerativeClusterer::matrixLinkage(const GMatrix& data)
+{
+	// Compute all the pairwise distances. (Only the upper triangle is stored, one row after another.)
+	size_t n = data.rows();
+	vector<double> distances(n * (n - 1) / 2);
+	auto at = [n](size_t a, size_t b) {
+		if(b < a)
+			std::swap(a, b);
+		return a * n - a * (a + 1) / 2 + b - a - 1;
+	};
+	GThreadPool::global().parallelFor(0, n, [&](size_t i) {
+		for(size_t j = i + 1; j < n; j++)
+			distances[at(i, j)] = sqrt(m_pMetric->squaredDistance(data[i], data[j]));
+	});
+
+	// Update the distances with the Lance-Williams formula as clusters merge
+	vector<double> sizes(n, 1.0);
+	bool complete = (m_linkage == Complete);
+	auto dist = [&](size_t a, size_t b) { return distances[at(a, b)]; };
+	auto merge = [&](size_t a, size_t b) {
+		double na = sizes[a];
+		double nb = sizes[b];
+		for(size_t k = 0; k < n; k++)
+		{
+			if(k == a || k == b || sizes[k] == 0.0)
+				continue;
+			double& dak = distances[at(a, k)];
+			double dbk = distances[at(b, k)];
+			if(complete)
+				dak = std::max(dak, dbk);
+			else
+				dak = (na * dak + nb * dbk) / (na + nb);
+		}
+		sizes[a] = na + nb;
+		sizes[b] = 0.0;
+	};
+	GAgglomerativeClusterer_nnChain(n, m_dendrogram, dist, merge);
 }
 
 // virtual
 size_t GAgglomerativeClusterer::whichCluster(size_t nVector)
 {
-	return m_pClusters[nVector];
+	return m_clusters[nVector];
 }
 
 #ifndef NO_TEST_CODE
@@ -217,6 +565,71 @@ size_t GAgglomerativeClusterer::whichCluster(size_t nVector)
 #include "GImage.h"
 //#include "G3D.h"
 
+// Finds the merges of Euclidean agglomerative clustering the slow way, by measuring the distance
+// between every pair of clusters at every step
+static void GAgglomerativeClusterer_naive(const GMatrix& data, GAgglomerativeClusterer::Linkage linkage, GDendrogram& dendrogram)
+{
+	vector< vector<size_t> > clusters(data.rows());
+	for(size_t i = 0; i < data.rows(); i++)
+		clusters[i].push_back(i);
+	dendrogram.reset(data.rows());
+	while(clusters.size() > 1)
+	{
+		double bestDist = 1e308;
+		size_t bestP = 0;
+		size_t bestQ = 0;
+		for(size_t p = 0; p < clusters.size(); p++)
+		{
+			for(size_t q = p + 1; q < clusters.size(); q++)
+			{
+				double d;
+				if(linkage == GAgglomerativeClusterer::Ward)
+				{
+					GVec cp(data.cols());
+					GVec cq(data.cols());
+					cp.fill(0.0);
+					cq.fill(0.0);
+					for(size_t i : clusters[p])
+						cp += data[i];
+					for(size_t i : clusters[q])
+						cq += data[i];
+					double np = (double)clusters[p].size();
+					double nq = (double)clusters[q].size();
+					cp *= (1.0 / np);
+					cq *= (1.0 / nq);
+					d = sqrt(2.0 * np * nq / (np + nq) * cp.squaredDistance(cq));
+				}
+				else
+				{
+					d = (linkage == GAgglomerativeClusterer::Single ? 1e308 : 0.0);
+					for(size_t i : clusters[p])
+					{
+						for(size_t j : clusters[q])
+						{
+							double e = sqrt(data[i].squaredDistance(data[j]));
+							if(linkage == GAgglomerativeClusterer::Single)
+								d = std::min(d, e);
+							else if(linkage == GAgglomerativeClusterer::Complete)
+								d = std::max(d, e);
+							else
+								d += e / (clusters[p].size() * clusters[q].size());
+						}
+					}
+				}
+				if(d < bestDist)
+				{
+					bestDist = d;
+					bestP = p;
+					bestQ = q;
+				}
+			}
+		}
+		dendrogram.addMerge(clusters[bestP][0], clusters[bestQ][0], bestDist);
+		clusters[bestP].insert(clusters[bestP].end(), clusters[bestQ].begin(), clusters[bestQ].end());
+		clusters.erase(clusters.begin() + bestQ);
+	}
+}
+
 // static
 void GAgglomerativeClusterer::test()
 {
@@ -266,6 +679,55 @@ void GAgglomerativeClusterer::test()
 			throw Ex("Wrong cluster");
 	}
 
+	// Compare every linkage against the naive algorithm
+	GRand rand(0);
+	GMatrix small(60, 3);
+	for(size_t i = 0; i < small.rows(); i++)
+		small[i].fillUniform(rand);
+	Linkage linkages[] = { Single, Complete, Average, Ward };
+	vector<size_t> fast(small.rows());
+	vector<size_t> slow(small.rows());
+	for(size_t l = 0; l < 4; l++)
+	{
+		GAgglomerativeClusterer agg(1);
+		agg.setLinkage(linkages[l]);
+		agg.cluster(&small);
+		GDendrogram naive;
+		GAgglomerativeClusterer_naive(small, linkages[l], naive);
+		naive.sortMerges();
+		if(agg.dendrogram().mergeCount() != small.rows() - 1)
+			throw Ex("Wrong number of merges");
+		for(size_t i = 0; i < naive.mergeCount(); i++)
+		{
+			if(std::abs(agg.dendrogram().merge(i).height - naive.merge(i).height) > 1e-9)
+				throw Ex("Wrong merge height");
+		}
+		for(size_t k = 1; k <= small.rows(); k++)
+		{
+			agg.dendrogram().cut(k, fast.data());
+			naive.cut(k, slow.data());
+			if(fast != slow)
+				throw Ex("Wrong clusters");
+		}
+
+		// Check that recutting gives nested clusters
+		agg.recut(8);
+		vector<size_t> fine(small.rows());
+		for(size_t i = 0; i < small.rows(); i++)
+			fine[i] = agg.whichCluster(i);
+		agg.recut(3);
+		if(agg.clusterCount() != 3)
+			throw Ex("Wrong cluster count");
+		for(size_t i = 0; i < small.rows(); i++)
+		{
+			for(size_t j = i + 1; j < small.rows(); j++)
+			{
+				if(fine[i] == fine[j] && agg.whichCluster(i) != agg.whichCluster(j))
+					throw Ex("The clusters are not nested");
+			}
+		}
+	}
+
 /*  // Uncomment this to make a spiffy visualization of the entwined spirals
 
 	// Draw the classifications
@@ -454,8 +916,58 @@ std::unique_ptr<GMatrix> GAgglomerativeTransducer::transduceInner(const GMatrix&
 
 // -----------------------------------------------------------------------------------------
 
+// The number of rows in each block of GKMeans::assignClusters. Each block breaks ties with its
+// own random number generator, so the assignments do not depend on how many threads there are.
+#define GKMEANS_BLOCK 256
+
+// Computes the squared Euclidean distance from pRow to every row of centroids
+static void GKMeans_squaredEuclideanBatch(const double* pRow, const GMatrix& centroids, double* pOut)
+{
+	size_t n = centroids.cols();
+	for(size_t j = 0; j < centroids.rows(); j++)
+		pOut[j] = GKMeans_squaredEuclidean(pRow, centroids[j].data(), n);
+}
+
+// Returns true iff pMetric measures plain Euclidean distance over data
+static bool GKMeans_isPlainEuclidean(GDistanceMetric* pMetric, const GMatrix& data)
+{
+	if(!dynamic_cast<GRowDistance*>(pMetric))
+		return false;
+	for(size_t i = 0; i < data.cols(); i++)
+	{
+		if(data.relation().valueCount(i) != 0 || pMetric->scaleFactors()[i] != 1.0)
+			return false;
+	}
+
+	// GRowDistance treats unknown values specially
+	size_t blocks = (data.rows() + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	vector<char> unknown(blocks, 0);
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t b)
+	{
+		size_t end = std::min(data.rows(), (b + 1) * GKMEANS_BLOCK);
+		for(size_t i = b * GKMEANS_BLOCK; i < end && !unknown[b]; i++)
+		{
+			const GVec& row = data[i];
+			for(size_t j = 0; j < data.cols(); j++)
+			{
+				if(row[j] == UNKNOWN_REAL_VALUE)
+				{
+					unknown[b] = 1;
+					break;
+				}
+			}
+		}
+	});
+	for(size_t b = 0; b < blocks; b++)
+	{
+		if(unknown[b])
+			return false;
+	}
+	return true;
+}
+
 GKMeans::GKMeans(size_t clusters, GRand* pRand)
-: GClusterer(clusters), m_pCentroids(NULL), m_pClusters(NULL), m_reps(1), m_pRand(pRand)
+: GClusterer(clusters), m_pCentroids(NULL), m_pClusters(NULL), m_reps(1), m_pRand(pRand), m_accelerate(false), m_euclidean(false), m_boundsValid(false)
 {
 }
 
@@ -472,6 +984,7 @@ void GKMeans::init(const GMatrix* pData)
 	m_pMetric->init(&pData->relation(), false);
 	if(pData->rows() < (size_t)m_clusterCount)
 		throw Ex("Fewer data point than clusters");
+	m_euclidean = GKMeans_isPlainEuclidean(m_pMetric, *pData);
 
 	// Initialize the centroids with random rows. (Note that it is okay if two centroids happen to be initialized with the same row here, because the assignClusters method randomly picks among the best centroids in the event of a tie.)
 	delete(m_pCentroids);
@@ -486,116 +999,279 @@ void GKMeans::init(const GMatrix* pData)
 	// Initialize the clusters
 	delete[] m_pClusters;
 	m_pClusters = new size_t[pData->rows()];
+	m_boundsValid = false;
+	m_lower.clear();
 }
 
-double GKMeans::assignClusters(const GMatrix* pData)
+double GKMeans::squaredDistance(const GVec& row, const GVec& centroid) const
 {
-	// Assign each row to a cluster
-	double sse = 0.0;
-	for(size_t i = 0; i < pData->rows(); i++)
+	if(m_euclidean)
+		return GKMeans_squaredEuclidean(row.data(), centroid.data(), row.size());
+	else
+		return m_pMetric->squaredDistance(row, centroid);
+}
+
+size_t GKMeans::nearestCentroid(const GVec& row, GRand& rand, double* pScratch, double* pBest, double* pSecond) const
+{
+	if(m_euclidean)
+		GKMeans_squaredEuclideanBatch(row.data(), *m_pCentroids, pScratch);
+	else
 	{
-		double best = 1e308;
-		size_t clust = 0;
-		size_t ties = 1;
 		for(size_t j = 0; j < m_clusterCount; j++)
+			pScratch[j] = m_pMetric->squaredDistance(row, m_pCentroids->row(j));
+	}
+	double best = 1e308;
+	double second = 1e308;
+	size_t clust = 0;
+	size_t ties = 1;
+	for(size_t j = 0; j < m_clusterCount; j++)
+	{
+		double d = pScratch[j];
+		if(d < best)
+		{
+			clust = j;
+			second = best;
+			best = d;
+			ties = 1;
+		}
+		else if(d == best)
+		{
+			second = d;
+			ties++;
+		}
+		else if(d < second)
+			second = d;
+	}
+
+	// Pick randomly among the centroids that tie for the closest. (Drawing only for a tie at the
+	// nearest distance keeps the random draws the same when the bounds skip rows that have no tie.)
+	if(ties > 1)
+	{
+		size_t pick = (size_t)rand.next(ties);
+		for(clust = 0; pScratch[clust] != best || pick-- > 0; clust++)
+		{
+		}
+	}
+	*pBest = best;
+	*pSecond = second;
+	return clust;
+}
+
+double GKMeans::assignClusters(const GMatrix* pData)
+{
+	// The caller may have changed the data or the centroids, so the bounds cannot be trusted
+	m_boundsValid = false;
+	return assignClusters(pData, false);
+}
+
+double GKMeans::assignClusters(const GMatrix* pData, bool useBounds)
+{
+	size_t rows = pData->rows();
+	size_t blocks = (rows + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	vector<uint64_t> seeds(blocks);
+	for(size_t b = 0; b < blocks; b++)
+		seeds[b] = m_pRand->next();
+	GThreadPool& pool = GThreadPool::global();
+
+	// Find half the distance from each centroid to the nearest other centroid. A row that is
+	// closer than that to its centroid cannot be closer to any other centroid.
+	useBounds = useBounds && m_accelerate && m_boundsValid;
+	vector<double> halfGap;
+	if(useBounds)
+	{
+		halfGap.resize(m_clusterCount);
+		pool.parallelFor(0, m_clusterCount, [&](size_t j)
 		{
-			double d = m_pMetric->squaredDistance(pData->row(i), m_pCentroids->row(j));
-			if(d < best)
+			double nearest = 1e308;
+			for(size_t k = 0; k < m_clusterCount; k++)
 			{
-				clust = j;
-				best = d;
-				ties = 1;
+				if(k != j)
+					nearest = std::min(nearest, squaredDistance(m_pCentroids->row(j), m_pCentroids->row(k)));
 			}
-			else if(d == best)
+			halfGap[j] = 0.5 * sqrt(nearest);
+		});
+	}
+	if(m_accelerate)
+		m_lower.resize(rows);
+
+	// Assign each row to a cluster
+	vector<double> blockSse(blocks);
+	vector<double> scratch(pool.participants() * m_clusterCount);
+	pool.parallelForSlots(0, blocks, [&](size_t b, size_t slot)
+	{
+		GRand rand(seeds[b]);
+		double* pScratch = scratch.data() + slot * m_clusterCount;
+		size_t end = std::min(rows, (b + 1) * GKMEANS_BLOCK);
+		double sse = 0.0;
+		for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+		{
+			const GVec& row = pData->row(i);
+			if(useBounds)
 			{
-				// Pick randomly among the centroids that tie for the closest
-				ties++;
-				if(m_pRand->next(ties) == 0)
-					clust = j;
+				// The distance to the assigned centroid is always measured, so the returned error is exact
+				size_t clust = m_pClusters[i];
+				double d = squaredDistance(row, m_pCentroids->row(clust));
+				if(sqrt(d) < std::max(halfGap[clust], m_lower[i]))
+				{
+					sse += d;
+					continue;
+				}
 			}
+			double best, second;
+			m_pClusters[i] = nearestCentroid(row, rand, pScratch, &best, &second);
+			if(m_accelerate)
+				m_lower[i] = sqrt(second);
+			sse += best;
 		}
-		sse += best;
-		m_pClusters[i] = clust;
-	}
+		blockSse[b] = sse;
+	});
+	if(m_accelerate)
+		m_boundsValid = true;
+	double sse = 0.0;
+	for(size_t b = 0; b < blocks; b++)
+		sse += blockSse[b];
 	return sse;
 }
 
 void GKMeans::recomputeCentroids(const GMatrix* pData)
 {
+	// Bucket the rows by cluster (keeping them in order), so each centroid can be computed independently
+	size_t rows = pData->rows();
+	size_t cols = pData->cols();
+	vector<size_t> starts(m_clusterCount + 1, 0);
+	for(size_t i = 0; i < rows; i++)
+		starts[m_pClusters[i] + 1]++;
 	for(size_t i = 0; i < m_clusterCount; i++)
+		starts[i + 1] += starts[i];
+	vector<size_t> members(rows);
+	{
+		vector<size_t> pos(starts.begin(), starts.end() - 1);
+		for(size_t i = 0; i < rows; i++)
+			members[pos[m_pClusters[i]]++] = i;
+	}
+	vector<size_t> valueCounts(cols);
+	vector<size_t> freqStarts(cols + 1, 0);
+	for(size_t j = 0; j < cols; j++)
+	{
+		valueCounts[j] = pData->relation().valueCount(j);
+		freqStarts[j + 1] = freqStarts[j] + valueCounts[j];
+	}
+
+	// Remember the old centroids, so the bounds can follow them
+	std::unique_ptr<GMatrix> hOld;
+	if(m_accelerate && m_boundsValid)
+		hOld.reset(new GMatrix(*m_pCentroids));
+
+	vector<char> hasUnknowns(m_clusterCount, 0);
+	GThreadPool& pool = GThreadPool::global();
+	size_t slots = pool.participants();
+	vector<double> sumsBuf(slots * cols);
+	vector<size_t> countsBuf(slots * cols);
+	vector<size_t> freqBuf(slots * freqStarts[cols]);
+	pool.parallelForSlots(0, m_clusterCount, [&](size_t i, size_t slot)
 	{
 		GVec& centroid = m_pCentroids->row(i);
-		size_t unknownCount = 0;
-		for(size_t j = 0; j < pData->cols(); j++)
+		double* sums = sumsBuf.data() + slot * cols;
+		size_t* counts = countsBuf.data() + slot * cols;
+		size_t* freq = freqBuf.data() + slot * freqStarts[cols];
+		std::fill(sums, sums + cols, 0.0);
+		std::fill(counts, counts + cols, (size_t)0);
+		std::fill(freq, freq + freqStarts[cols], (size_t)0);
+		for(size_t m = starts[i]; m < starts[i + 1]; m++)
 		{
-			size_t vals = pData->relation().valueCount(j);
-			if(vals == 0)
+			const GVec& row = pData->row(members[m]);
+			for(size_t j = 0; j < cols; j++)
 			{
-				double sum = 0.0;
-				size_t count = 0;
-				for(size_t k = 0; k < pData->rows(); k++)
+				if(valueCounts[j] == 0)
 				{
-					if(m_pClusters[k] == i)
+					if(row[j] != UNKNOWN_REAL_VALUE)
 					{
-						double d = pData->row(k)[j];
-						if(d != UNKNOWN_REAL_VALUE)
-						{
-							sum += d;
-							count++;
-						}
+						sums[j] += row[j];
+						counts[j]++;
 					}
 				}
-				if(count > 0)
-					centroid[j] = sum / count;
 				else
 				{
-					centroid[j] = UNKNOWN_REAL_VALUE;
-					unknownCount++;
+					int v = (int)row[j];
+					if(v != UNKNOWN_DISCRETE_VALUE && (size_t)v < valueCounts[j])
+						freq[freqStarts[j] + v]++;
 				}
 			}
-			else
+		}
+		for(size_t j = 0; j < cols; j++)
+		{
+			if(valueCounts[j] == 0)
 			{
-				size_t* pFreq = new size_t[vals];
-				std::unique_ptr<size_t[]> hFreq(pFreq);
-				memset(pFreq, 0, sizeof(size_t) * vals);
-				for(size_t k = 0; k < pData->rows(); k++)
+				if(counts[j] > 0)
+					centroid[j] = sums[j] / counts[j];
+				else
 				{
-					if(m_pClusters[k] == i)
-					{
-						int v = (int)pData->row(k)[j];
-						if(v != UNKNOWN_DISCRETE_VALUE && (size_t)v < vals)
-							pFreq[v]++;
-					}
+					centroid[j] = UNKNOWN_REAL_VALUE;
+					hasUnknowns[i] = 1;
 				}
-				size_t index = GIndexVec::indexOfMax(pFreq, vals);
+			}
+			else
+			{
+				size_t* pFreq = freq + freqStarts[j];
+				size_t index = GIndexVec::indexOfMax(pFreq, valueCounts[j]);
 				if(pFreq[index] == 0)
 				{
 					centroid[j] = UNKNOWN_DISCRETE_VALUE;
-					unknownCount++;
+					hasUnknowns[i] = 1;
 				}
 				else
 					centroid[j] = (double)index;
 			}
 		}
-		if(unknownCount > 0)
+	});
+
+	// Fill in unknown elements from random rows. (This is done in cluster order, so the random draws do not depend on the threads.)
+	for(size_t i = 0; i < m_clusterCount; i++)
+	{
+		if(!hasUnknowns[i])
+			continue;
+		GVec& centroid = m_pCentroids->row(i);
+		const GVec& row = pData->row((size_t)m_pRand->next(pData->rows()));
+		for(size_t j = 0; j < cols; j++)
 		{
-			const GVec& row = pData->row((size_t)m_pRand->next(pData->rows()));
-			for(size_t j = 0; j < pData->cols(); j++)
+			if(valueCounts[j] == 0)
 			{
-				size_t vals = pData->relation().valueCount(j);
-				if(vals == 0)
-				{
-					if(centroid[j] == UNKNOWN_REAL_VALUE)
-						centroid[j] = row[j];
-				}
-				else
-				{
-					if(centroid[j] == UNKNOWN_DISCRETE_VALUE)
-						centroid[j] = row[j];
-				}
+				if(centroid[j] == UNKNOWN_REAL_VALUE)
+					centroid[j] = row[j];
+			}
+			else
+			{
+				if(centroid[j] == UNKNOWN_DISCRETE_VALUE)
+					centroid[j] = row[j];
 			}
 		}
 	}
+
+	// Move the bounds by as much as the centroids moved. The second-nearest centroid
+	// of a row may be any centroid except its own, so it uses the largest other shift.
+	if(hOld)
+	{
+		vector<double> shift(m_clusterCount);
+		pool.parallelFor(0, m_clusterCount, [&](size_t j)
+		{
+			shift[j] = sqrt(squaredDistance(hOld->row(j), m_pCentroids->row(j)));
+		});
+		size_t biggest = 0;
+		double secondShift = 0.0;
+		for(size_t j = 1; j < m_clusterCount; j++)
+		{
+			if(shift[j] > shift[biggest])
+			{
+				secondShift = shift[biggest];
+				biggest = j;
+			}
+			else
+				secondShift = std::max(secondShift, shift[j]);
+		}
+		double biggestShift = shift[biggest];
+		for(size_t i = 0; i < rows; i++)
+			m_lower[i] -= (m_pClusters[i] == biggest ? secondShift : biggestShift);
+	}
 }
 
 // virtual
@@ -610,7 +1286,7 @@ void GKMeans::cluster(const GMatrix* pData)
 		double sse = 1e308;
 		for(size_t iters = 0; true; iters++)
 		{
-			d = assignClusters(pData);
+			d = assignClusters(pData, true);
 			if(d >= sse && iters > 2)
 				break;
 			recomputeCentroids(pData);
@@ -637,6 +1313,548 @@ size_t GKMeans::whichCluster(size_t index)
 	return m_pClusters[index];
 }
 
+#ifndef NO_TEST_CODE
+// static
+void GKMeans::test()
+{
+	// Make some blobs
+	GRand rand(0);
+	size_t blobs = 6;
+	GMatrix centers(blobs, 5);
+	for(size_t i = 0; i < blobs; i++)
+	{
+		centers[i].fillUniform(rand);
+		centers[i] *= 20.0;
+	}
+	GMatrix data(1200, 5);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		data[i].fillNormal(rand);
+		data[i] += centers[i % blobs];
+	}
+
+	// The accelerated assignments must match the exhaustive ones
+	GRand r1(1);
+	GKMeans plain(blobs * 2, &r1);
+	plain.cluster(&data);
+	GRand r2(1);
+	GKMeans fast(blobs * 2, &r2);
+	fast.setAccelerate(true);
+	fast.cluster(&data);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		if(plain.whichCluster(i) != fast.whichCluster(i))
+			throw Ex("The accelerated clustering differs");
+	}
+
+	// Rows that tie between centroids must be broken with the same random draws with and without the bounds.
+	// On this grid, two centroids start out equal, and many rows are equidistant from several centroids.
+	GMatrix grid(256, 2);
+	for(size_t i = 0; i < grid.rows(); i++)
+	{
+		grid[i][0] = (double)(i % 4);
+		grid[i][1] = (double)((i / 4) % 4);
+	}
+	GRand r6(4);
+	GKMeans plainGrid(4, &r6);
+	GRand r7(4);
+	GKMeans fastGrid(4, &r7);
+	fastGrid.setAccelerate(true);
+	GKMeans* pGridModels[] = { &plainGrid, &fastGrid };
+	for(size_t m = 0; m < 2; m++)
+	{
+		pGridModels[m]->init(&grid);
+		GMatrix& c = *pGridModels[m]->centroids();
+		c[0][0] = 0.0; c[0][1] = 0.0;
+		c[1][0] = 0.0; c[1][1] = 0.0;
+		c[2][0] = 2.0; c[2][1] = 0.0;
+		c[3][0] = 2.0; c[3][1] = 2.0;
+	}
+	// (Each assignment is repeated before the centroids move, which leaves the bounds exactly at the tied distances.)
+	for(size_t iter = 0; iter < 12; iter++)
+	{
+		double plainErr = plainGrid.assignClusters(&grid, true);
+		double fastErr = fastGrid.assignClusters(&grid, true);
+		if(plainErr != fastErr)
+			throw Ex("The accelerated clustering differs with ties");
+		size_t origin[2] = { 0, 0 };
+		for(size_t i = 0; i < grid.rows(); i++)
+		{
+			if(plainGrid.m_pClusters[i] != fastGrid.m_pClusters[i])
+				throw Ex("The accelerated clustering differs with ties");
+			if(i % 16 == 0 && plainGrid.m_pClusters[i] < 2)
+				origin[plainGrid.m_pClusters[i]]++;
+		}
+		if(iter == 0 && (origin[0] == 0 || origin[1] == 0))
+			throw Ex("Expected the ties to be broken randomly");
+		if(iter % 2 == 1)
+		{
+			plainGrid.recomputeCentroids(&grid);
+			fastGrid.recomputeCentroids(&grid);
+		}
+	}
+
+	// With enough restarts, each blob should land in its own cluster. (The centroids start at random rows,
+	// so a few restarts are not always enough; 20 succeeded for each of the first 40 seeds.)
+	GRand r3(2);
+	GKMeans km(blobs, &r3);
+	km.setAccelerate(true);
+	km.setReps(20);
+	km.cluster(&data);
+	for(size_t i = blobs; i < data.rows(); i++)
+	{
+		if(km.whichCluster(i) != km.whichCluster(i % blobs))
+			throw Ex("A blob was split");
+	}
+	for(size_t i = 1; i < blobs; i++)
+	{
+		for(size_t j = 0; j < i; j++)
+		{
+			if(km.whichCluster(i) == km.whichCluster(j))
+				throw Ex("Two blobs were merged");
+		}
+	}
+
+	// A nominal attribute makes GRowDistance mix in Hamming distance, so the general path is used
+	vector<size_t> vals;
+	vals.push_back(0);
+	vals.push_back(0);
+	vals.push_back(3);
+	GMatrix mixed(vals);
+	mixed.newRows(600);
+	for(size_t i = 0; i < mixed.rows(); i++)
+	{
+		mixed[i][0] = centers[i % 3][0] + rand.normal();
+		mixed[i][1] = centers[i % 3][1] + rand.normal();
+		mixed[i][2] = (double)(i % 3);
+	}
+	GRand r4(3);
+	GKMeans plainMixed(5, &r4);
+	plainMixed.cluster(&mixed);
+	GRand r5(3);
+	GKMeans fastMixed(5, &r5);
+	fastMixed.setAccelerate(true);
+	fastMixed.cluster(&mixed);
+	for(size_t i = 0; i < mixed.rows(); i++)
+	{
+		if(plainMixed.whichCluster(i) != fastMixed.whichCluster(i))
+			throw Ex("The accelerated clustering differs with mixed attributes");
+	}
+}
+#endif // !NO_TEST_CODE
+
+
+// -----------------------------------------------------------------------------------------
+
+GMiniBatchKMeans::GMiniBatchKMeans(size_t clusters, GRand* pRand)
+: GClusterer(clusters), m_pCentroids(NULL), m_batchSize(1024), m_iters(100), m_sampleSize(100000), m_seeding(KMeansPlusPlus), m_pRand(pRand)
+{
+}
+
+// virtual
+GMiniBatchKMeans::~GMiniBatchKMeans()
+{
+	delete(m_pCentroids);
+}
+
+// static
+void GMiniBatchKMeans::checkRelation(const GRelation& relation)
+{
+	if(!relation.areContinuous())
+		throw Ex("GMiniBatchKMeans only supports continuous attributes");
+}
+
+// Returns the index of the row of centroids nearest to point, and its squared distance in *pDist
+static size_t GMiniBatchKMeans_nearest(const GMatrix& centroids, const GVec& point, double* pDist)
+{
+	size_t best = 0;
+	double bestDist = 1e308;
+	for(size_t j = 0; j < centroids.rows(); j++)
+	{
+		double d = GKMeans_squaredEuclidean(point.data(), centroids[j].data(), point.size());
+		if(d < bestDist)
+		{
+			best = j;
+			bestDist = d;
+		}
+	}
+	*pDist = bestDist;
+	return best;
+}
+
+// Lowers each element of dist to the squared distance from the corresponding row of data to center
+static void GMiniBatchKMeans_lowerDistances(const GMatrix& data, const GVec& center, vector<double>& dist)
+{
+	size_t blocks = (data.rows() + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t b)
+	{
+		size_t end = std::min(data.rows(), (b + 1) * GKMEANS_BLOCK);
+		for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+			dist[i] = std::min(dist[i], GKMeans_squaredEuclidean(data[i].data(), center.data(), data.cols()));
+	});
+}
+
+// Draws an index with probability proportional to pWeights[i] * dist[i]. (pWeights may be NULL.)
+// Returns INVALID_INDEX if every product is zero.
+static size_t GMiniBatchKMeans_draw(const vector<double>& dist, const double* pWeights, GRand& rand)
+{
+	double total = 0.0;
+	for(size_t i = 0; i < dist.size(); i++)
+		total += (pWeights ? pWeights[i] : 1.0) * dist[i];
+	if(total <= 0.0)
+		return INVALID_INDEX;
+	double x = rand.uniform() * total;
+	size_t last = INVALID_INDEX;
+	for(size_t i = 0; i < dist.size(); i++)
+	{
+		double p = (pWeights ? pWeights[i] : 1.0) * dist[i];
+		if(p > 0.0)
+		{
+			last = i;
+			x -= p;
+			if(x < 0.0)
+				break;
+		}
+	}
+	return last;
+}
+
+// static
+GMatrix* GMiniBatchKMeans::seedPlusPlus(const GMatrix& data, const double* pWeights, size_t k, GRand& rand)
+{
+	if(data.rows() < 1)
+		throw Ex("Expected at least one row");
+	GMatrix* pCenters = new GMatrix(data.relation().clone());
+	std::unique_ptr<GMatrix> hCenters(pCenters);
+	pCenters->newRows(k);
+
+	// The first center is drawn in proportion to the weights alone
+	vector<double> dist(data.rows(), 1.0);
+	size_t index = GMiniBatchKMeans_draw(dist, pWeights, rand);
+	if(index == INVALID_INDEX)
+		throw Ex("Expected a positive weight");
+	pCenters->row(0).copy(data[index]);
+	for(size_t i = 0; i < data.rows(); i++)
+		dist[i] = 1e308;
+	GMiniBatchKMeans_lowerDistances(data, pCenters->row(0), dist);
+
+	// Like scikit-learn, each step draws several candidates and keeps the one that leaves the
+	// smallest potential. This makes it much less likely to put two centers in one cluster.
+	size_t trials = 2 + (size_t)log((double)k);
+	vector<double> trialDist(data.rows());
+	vector<double> bestDist(data.rows());
+	for(size_t c = 1; c < k; c++)
+	{
+		double bestPotential = 1e308;
+		for(size_t t = 0; t < trials; t++)
+		{
+			size_t candidate = GMiniBatchKMeans_draw(dist, pWeights, rand);
+			if(candidate == INVALID_INDEX)
+				candidate = (size_t)rand.next(data.rows()); // Every row is already a center
+			trialDist = dist;
+			GMiniBatchKMeans_lowerDistances(data, data[candidate], trialDist);
+			double potential = 0.0;
+			for(size_t i = 0; i < data.rows(); i++)
+				potential += (pWeights ? pWeights[i] : 1.0) * trialDist[i];
+			if(t == 0 || potential < bestPotential)
+			{
+				bestPotential = potential;
+				index = candidate;
+				bestDist.swap(trialDist);
+			}
+		}
+		pCenters->row(c).copy(data[index]);
+		dist.swap(bestDist);
+	}
+	return hCenters.release();
+}
+
+// static
+GMatrix* GMiniBatchKMeans::seedParallel(const GMatrix& data, size_t k, size_t rounds, size_t oversample, GRand& rand)
+{
+	if(data.rows() < 1)
+		throw Ex("Expected at least one row");
+	GMatrix candidates(data.relation().clone());
+	candidates.newRow().copy(data[(size_t)rand.next(data.rows())]);
+	vector<double> dist(data.rows(), 1e308);
+	GMiniBatchKMeans_lowerDistances(data, candidates[0], dist);
+	size_t blocks = (data.rows() + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	vector<uint64_t> seeds(blocks);
+	vector<char> picked(data.rows());
+	for(size_t r = 0; r < rounds; r++)
+	{
+		double total = 0.0;
+		for(size_t i = 0; i < data.rows(); i++)
+			total += dist[i];
+		if(total <= 0.0)
+			break;
+
+		// Each row is picked independently, so the rows are visited in parallel. Each block has its own generator.
+		for(size_t b = 0; b < blocks; b++)
+			seeds[b] = rand.next();
+		GThreadPool::global().parallelFor(0, blocks, [&](size_t b)
+		{
+			GRand blockRand(seeds[b]);
+			size_t end = std::min(data.rows(), (b + 1) * GKMEANS_BLOCK);
+			for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+				picked[i] = (blockRand.uniform() * total < oversample * dist[i] ? 1 : 0);
+		});
+		size_t firstNew = candidates.rows();
+		for(size_t i = 0; i < data.rows(); i++)
+		{
+			if(picked[i])
+				candidates.newRow().copy(data[i]);
+		}
+		for(size_t j = firstNew; j < candidates.rows(); j++)
+			GMiniBatchKMeans_lowerDistances(data, candidates[j], dist);
+	}
+	if(candidates.rows() <= k)
+		return seedPlusPlus(data, NULL, k, rand);
+
+	// Weight each candidate by the number of rows nearest to it, and reduce them to k centers
+	vector<size_t> nearest(data.rows());
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t b)
+	{
+		size_t end = std::min(data.rows(), (b + 1) * GKMEANS_BLOCK);
+		double d;
+		for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+			nearest[i] = GMiniBatchKMeans_nearest(candidates, data[i], &d);
+	});
+	vector<double> weights(candidates.rows(), 0.0);
+	for(size_t i = 0; i < data.rows(); i++)
+		weights[nearest[i]] += 1.0;
+	return seedPlusPlus(candidates, weights.data(), k, rand);
+}
+
+void GMiniBatchKMeans::seed(const GMatrix& sample)
+{
+	checkRelation(sample.relation());
+	if(sample.rows() < m_clusterCount)
+		throw Ex("Fewer data point than clusters");
+	if(sample.doesHaveAnyMissingValues())
+		throw Ex("GMiniBatchKMeans does not support missing values");
+	delete(m_pCentroids);
+	m_pCentroids = NULL;
+	if(m_seeding == KMeansParallel)
+		m_pCentroids = seedParallel(sample, m_clusterCount, 5, 2 * m_clusterCount, *m_pRand);
+	else
+		m_pCentroids = seedPlusPlus(sample, NULL, m_clusterCount, *m_pRand);
+	m_counts.assign(m_clusterCount, 0);
+}
+
+void GMiniBatchKMeans::update(const GMatrix& batch)
+{
+	if(!m_pCentroids)
+		throw Ex("seed must be called before update");
+	if(batch.cols() != m_pCentroids->cols())
+		throw Ex("Mismatching number of columns");
+	if(batch.doesHaveAnyMissingValues())
+		throw Ex("GMiniBatchKMeans does not support missing values");
+
+	// Assign the batch to the current centroids
+	size_t rows = batch.rows();
+	vector<size_t> assignments(rows);
+	size_t blocks = (rows + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	GThreadPool& pool = GThreadPool::global();
+	pool.parallelFor(0, blocks, [&](size_t b)
+	{
+		size_t end = std::min(rows, (b + 1) * GKMEANS_BLOCK);
+		double d;
+		for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+			assignments[i] = GMiniBatchKMeans_nearest(*m_pCentroids, batch[i], &d);
+	});
+
+	// Bucket the rows by centroid (keeping them in order), so each centroid can absorb its rows independently
+	vector<size_t> starts(m_clusterCount + 1, 0);
+	for(size_t i = 0; i < rows; i++)
+		starts[assignments[i] + 1]++;
+	for(size_t j = 0; j < m_clusterCount; j++)
+		starts[j + 1] += starts[j];
+	vector<size_t> members(rows);
+	{
+		vector<size_t> pos(starts.begin(), starts.end() - 1);
+		for(size_t i = 0; i < rows; i++)
+			members[pos[assignments[i]]++] = i;
+	}
+	size_t cols = batch.cols();
+	pool.parallelFor(0, m_clusterCount, [&](size_t j)
+	{
+		GVec& centroid = m_pCentroids->row(j);
+		for(size_t m = starts[j]; m < starts[j + 1]; m++)
+		{
+			const GVec& row = batch[members[m]];
+			double eta = 1.0 / (double)(++m_counts[j]);
+			for(size_t c = 0; c < cols; c++)
+				centroid[c] += eta * (row[c] - centroid[c]);
+		}
+	});
+}
+
+// virtual
+void GMiniBatchKMeans::cluster(const GMatrix* pData)
+{
+	checkRelation(pData->relation());
+	size_t rows = pData->rows();
+
+	// Seed with a random sample
+	if(rows <= m_sampleSize)
+		seed(*pData);
+	else
+	{
+		vector<size_t> indexes(rows);
+		GIndexVec::makeIndexVec(indexes.data(), rows);
+		GMatrix sample(pData->relation().clone());
+		sample.newRows(m_sampleSize);
+		for(size_t i = 0; i < m_sampleSize; i++)
+		{
+			std::swap(indexes[i], indexes[i + (size_t)m_pRand->next(rows - i)]);
+			sample[i].copy(pData->row(indexes[i]));
+		}
+		seed(sample);
+	}
+
+	// Take steps with random batches
+	GMatrix batch(pData->relation().clone());
+	batch.newRows(std::min(m_batchSize, rows));
+	for(size_t iter = 0; iter < m_iters; iter++)
+	{
+		for(size_t i = 0; i < batch.rows(); i++)
+			batch[i].copy(pData->row((size_t)m_pRand->next(rows)));
+		update(batch);
+	}
+
+	// Assign every row
+	m_clusters.resize(rows);
+	size_t blocks = (rows + GKMEANS_BLOCK - 1) / GKMEANS_BLOCK;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t b)
+	{
+		size_t end = std::min(rows, (b + 1) * GKMEANS_BLOCK);
+		double d;
+		for(size_t i = b * GKMEANS_BLOCK; i < end; i++)
+			m_clusters[i] = GMiniBatchKMeans_nearest(*m_pCentroids, pData->row(i), &d);
+	});
+}
+
+void GMiniBatchKMeans::clusterStream(const char* szFilename, size_t passes)
+{
+	// Draw a reservoir sample to seed with
+	std::unique_ptr<GMatrix> hSample;
+	size_t seen = 0;
+	GMatrix::streamArff(szFilename, m_batchSize, [&](GMatrix& batch)
+	{
+		if(!hSample)
+		{
+			checkRelation(batch.relation());
+			hSample.reset(new GMatrix(batch.relation().clone()));
+		}
+		for(size_t i = 0; i < batch.rows(); i++)
+		{
+			seen++;
+			if(hSample->rows() < m_sampleSize)
+				hSample->newRow().copy(batch[i]);
+			else
+			{
+				size_t j = (size_t)m_pRand->next(seen);
+				if(j < m_sampleSize)
+					hSample->row(j).copy(batch[i]);
+			}
+		}
+	});
+	if(!hSample)
+		throw Ex("The file contains no rows");
+	seed(*hSample);
+	hSample.reset();
+
+	// Stream the batches through
+	m_clusters.clear();
+	for(size_t pass = 0; pass < passes; pass++)
+		GMatrix::streamArff(szFilename, m_batchSize, [&](GMatrix& batch) { update(batch); });
+}
+
+size_t GMiniBatchKMeans::nearest(const GVec& point, double* pDist) const
+{
+	if(!m_pCentroids)
+		throw Ex("Not clustered yet");
+	if(point.size() != m_pCentroids->cols())
+		throw Ex("Mismatching number of columns");
+	return GMiniBatchKMeans_nearest(*m_pCentroids, point, pDist);
+}
+
+size_t GMiniBatchKMeans::nearestCentroid(const GVec& point) const
+{
+	double d;
+	return nearest(point, &d);
+}
+
+// virtual
+size_t GMiniBatchKMeans::whichCluster(size_t nVector)
+{
+	if(nVector >= m_clusters.size())
+		throw Ex("Index out of range. (clusterStream does not assign the rows. Use nearestCentroid.)");
+	return m_clusters[nVector];
+}
+
+#ifndef NO_TEST_CODE
+// static
+void GMiniBatchKMeans::test()
+{
+	// Make some well-separated blobs at the corners of a cube
+	GRand rand(0);
+	size_t blobs = 8;
+	GMatrix centers(blobs, 4);
+	for(size_t i = 0; i < blobs; i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+			centers[i][j] = (i & ((size_t)1 << j)) ? 20.0 : 0.0;
+		centers[i][3] = 5.0;
+	}
+	GMatrix data(4000, 4);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		data[i].fillNormal(rand);
+		data[i] += centers[i % blobs];
+	}
+
+	for(size_t s = 0; s < 2; s++)
+	{
+		GRand r(1);
+		GMiniBatchKMeans km(blobs, &r);
+		km.setSeeding(s == 0 ? KMeansPlusPlus : KMeansParallel);
+		km.setBatchSize(200);
+		km.setIters(50);
+		km.setSampleSize(1000);
+		km.cluster(&data);
+
+		// Each blob should land in its own cluster
+		for(size_t i = blobs; i < data.rows(); i++)
+		{
+			if(km.whichCluster(i) != km.whichCluster(i % blobs))
+				throw Ex("A blob was split");
+		}
+		for(size_t i = 1; i < blobs; i++)
+		{
+			for(size_t j = 0; j < i; j++)
+			{
+				if(km.whichCluster(i) == km.whichCluster(j))
+					throw Ex("Two blobs were merged");
+			}
+		}
+
+		// New points should be quantized to the centroid of their blob
+		GVec point(4);
+		for(size_t i = 0; i < blobs; i++)
+		{
+			point.fillNormal(rand);
+			point += centers[i];
+			if(km.nearestCentroid(point) != km.whichCluster(i))
+				throw Ex("Wrong centroid");
+			if(km.centroids()->row(km.whichCluster(i)).squaredDistance(centers[i]) > 0.1)
+				throw Ex("Centroid too far from the center of its blob");
+		}
+	}
+}
+#endif // !NO_TEST_CODE
+
 
 // -----------------------------------------------------------------------------------------
 
@@ -828,8 +2046,369 @@ size_t GFuzzyKMeans::whichCluster(size_t index)
 
 // -----------------------------------------------------------------------------------------
 
+// A bounded cache of distance columns for k-medoids. Each column holds the distances from one row
+// to every row. When it is full, the least recently used column is evicted. Several threads may
+// use it at once.
+class GKMedoidsColumnCache
+{
+protected:
+	size_t m_capacity;
+	std::list<size_t> m_order; // the cached rows, most recently used first
+	std::map<size_t, std::pair<std::shared_ptr<const vector<double> >, std::list<size_t>::iterator> > m_columns;
+	std::mutex m_mutex;
+
+public:
+	GKMedoidsColumnCache(size_t capacity)
+	: m_capacity(capacity)
+	{
+	}
+
+	/// Returns true iff the column of the specified row is in the cache
+	bool contains(size_t row)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_columns.find(row) != m_columns.end();
+	}
+
+	/// Returns the column of the specified row, or an empty pointer if it is not in the cache
+	std::shared_ptr<const vector<double> > find(size_t row)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_columns.find(row);
+		if(it == m_columns.end())
+			return std::shared_ptr<const vector<double> >();
+		m_order.splice(m_order.begin(), m_order, it->second.second);
+		return it->second.first;
+	}
+
+	/// Adds the column of the specified row
+	void insert(size_t row, const std::shared_ptr<const vector<double> >& column)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if(m_columns.find(row) != m_columns.end())
+			return;
+		if(m_columns.size() >= m_capacity)
+		{
+			m_columns.erase(m_order.back());
+			m_order.pop_back();
+		}
+		m_order.push_front(row);
+		m_columns[row] = std::make_pair(column, m_order.begin());
+	}
+};
+
+// Returns the distances from row c to every row. They come from the cache if it has them.
+// Otherwise they are computed into a new column (which is added to the cache), or into buf if
+// there is no cache. hold keeps a cached column alive until the caller is done with it.
+template<typename D>
+static const double* GKMedoids_column(size_t n, const D& dist, size_t c, GKMedoidsColumnCache* pCache, vector<double>& buf, std::shared_ptr<const vector<double> >& hold)
+{
+	if(pCache)
+	{
+		hold = pCache->find(c);
+		if(hold)
+			return hold->data();
+		std::shared_ptr<vector<double> > column = std::make_shared<vector<double> >(n);
+		for(size_t o = 0; o < n; o++)
+			(*column)[o] = dist(o, c);
+		hold = column;
+		pCache->insert(c, hold);
+		return hold->data();
+	}
+	buf.resize(n);
+	for(size_t o = 0; o < n; o++)
+		buf[o] = dist(o, c);
+	return buf.data();
+}
+
+// Finds the nearest and second-nearest medoid of every row, and returns the total distance to
+// the nearest medoids. Ties go to the medoid that comes first.
+template<typename D>
+static double GKMedoids_findNearest(size_t n, const D& dist, const vector<size_t>& medoids, GKMedoidsColumnCache* pCache, vector<size_t>& nearest, vector<double>& dNearest, vector<double>& dSecond)
+{
+	size_t k = medoids.size();
+	vector< std::shared_ptr<const vector<double> > > holds(k);
+	if(pCache)
+	{
+		for(size_t j = 0; j < k; j++)
+			holds[j] = pCache->find(medoids[j]);
+	}
+	nearest.resize(n);
+	dNearest.resize(n);
+	dSecond.resize(n);
+	size_t blockSize = 256;
+	size_t blocks = (n + blockSize - 1) / blockSize;
+	vector<double> blockErr(blocks);
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t blk) {
+		double err = 0.0;
+		size_t end = std::min(n, (blk + 1) * blockSize);
+		for(size_t o = blk * blockSize; o < end; o++)
+		{
+			size_t best = 0;
+			double d1 = 1e308;
+			double d2 = 1e308;
+			for(size_t j = 0; j < k; j++)
+			{
+				double d = holds[j] ? (*holds[j])[o] : dist(o, medoids[j]);
+				if(d < d1)
+				{
+					d2 = d1;
+					d1 = d;
+					best = j;
+				}
+				else if(d < d2)
+					d2 = d;
+			}
+			nearest[o] = best;
+			dNearest[o] = d1;
+			dSecond[o] = d2;
+			err += d1;
+		}
+		blockErr[blk] = err;
+	});
+	double err = 0.0;
+	for(size_t blk = 0; blk < blocks; blk++)
+		err += blockErr[blk];
+	return err;
+}
+
+// A candidate swap (or medoid) and the change in the total distance that it would make
+struct GKMedoidsCandidate
+{
+	double delta;
+	size_t row;
+	size_t slot;
+
+	bool operator<(const GKMedoidsCandidate& that) const
+	{
+		if(delta != that.delta)
+			return delta < that.delta;
+		if(row != that.row)
+			return row < that.row;
+		return slot < that.slot;
+	}
+};
+
+// Evaluates each candidate row in parallel, and returns the best result. eval(c, column, slot)
+// returns the best candidate for row c, given the distances from c to every row. The winner
+// does not depend on the number of threads, or on the order of the candidates.
+template<typename E>
+static GKMedoidsCandidate GKMedoids_bestCandidate(size_t n, const vector<size_t>& candidates, GKMedoidsColumnCache* pCache, const E& eval)
+{
+	GThreadPool& pool = GThreadPool::global();
+	vector< vector<double> > bufs(pool.participants());
+	size_t blockSize = 16;
+	size_t blocks = (candidates.size() + blockSize - 1) / blockSize;
+	GKMedoidsCandidate none;
+	none.delta = 1e308;
+	none.row = INVALID_INDEX;
+	none.slot = INVALID_INDEX;
+	vector<GKMedoidsCandidate> blockBest(blocks, none);
+	pool.parallelForSlots(0, blocks, [&](size_t blk, size_t slot) {
+		std::shared_ptr<const vector<double> > hold;
+		size_t end = std::min(candidates.size(), (blk + 1) * blockSize);
+		for(size_t i = blk * blockSize; i < end; i++)
+		{
+			size_t c = candidates[i];
+			const double* pColumn = GKMedoids_column(n, eval.dist, c, pCache, bufs[slot], hold);
+			GKMedoidsCandidate cand = eval(c, pColumn);
+			if(cand < blockBest[blk])
+				blockBest[blk] = cand;
+		}
+	});
+	GKMedoidsCandidate best = none;
+	for(size_t blk = 0; blk < blocks; blk++)
+	{
+		if(blockBest[blk] < best)
+			best = blockBest[blk];
+	}
+	return best;
+}
+
+// Lists the rows that are not medoids. Rows whose columns are in the cache come first, so that
+// they are used before the columns of the other rows push them out.
+static void GKMedoids_candidates(size_t n, const vector<bool>& isMedoid, GKMedoidsColumnCache* pCache, vector<size_t>& candidates)
+{
+	candidates.clear();
+	for(size_t c = 0; c < n; c++)
+	{
+		if(!isMedoid[c] && (!pCache || pCache->contains(c)))
+			candidates.push_back(c);
+	}
+	if(pCache)
+	{
+		for(size_t c = 0; c < n; c++)
+		{
+			if(!isMedoid[c] && !pCache->contains(c))
+				candidates.push_back(c);
+		}
+	}
+}
+
+// Evaluates a candidate medoid for the BUILD step
+template<typename D>
+struct GKMedoidsBuildEval
+{
+	const D& dist;
+	size_t n;
+	const vector<double>& dNearest;
+	bool first;
+
+	GKMedoidsCandidate operator()(size_t c, const double* pColumn) const
+	{
+		double delta = 0.0;
+		for(size_t o = 0; o < n; o++)
+			delta += first ? pColumn[o] : std::min(pColumn[o] - dNearest[o], 0.0);
+		GKMedoidsCandidate cand;
+		cand.delta = delta;
+		cand.row = c;
+		cand.slot = 0;
+		return cand;
+	}
+};
+
+// Evaluates swapping a candidate with each medoid in one pass over the data (FastPAM1)
+template<typename D>
+struct GKMedoidsSwapEval
+{
+	const D& dist;
+	size_t n;
+	size_t k;
+	const vector<size_t>& nearest;
+	const vector<double>& dNearest;
+	const vector<double>& dSecond;
+
+	GKMedoidsCandidate operator()(size_t c, const double* pColumn) const
+	{
+		// delta[i] + shared is the change in the total distance if c replaces medoid i
+		GVec delta(k);
+		delta.fill(0.0);
+		double shared = 0.0;
+		for(size_t o = 0; o < n; o++)
+		{
+			double doc = pColumn[o];
+			double dn = dNearest[o];
+			double gain = std::min(doc - dn, 0.0); // o moves to c if it is closer, whichever medoid goes
+			shared += gain;
+			delta[nearest[o]] += std::min(doc, dSecond[o]) - dn - gain; // o loses its nearest medoid
+		}
+		GKMedoidsCandidate cand;
+		cand.delta = shared + delta[0];
+		cand.row = c;
+		cand.slot = 0;
+		for(size_t i = 1; i < k; i++)
+		{
+			if(shared + delta[i] < cand.delta)
+			{
+				cand.delta = shared + delta[i];
+				cand.slot = i;
+			}
+		}
+		return cand;
+	}
+};
+
+// Finds k medoids for n rows with the BUILD step, and then FastPAM1 swaps until no swap helps.
+// dist(a, b) returns the dissimilarity between rows a and b.
+template<typename D>
+static void GKMedoids_pam(size_t n, size_t k, const D& dist, size_t cacheColumns, vector<size_t>& medoids)
+{
+	std::unique_ptr<GKMedoidsColumnCache> hCache;
+	if(cacheColumns > 0)
+		hCache.reset(new GKMedoidsColumnCache(cacheColumns));
+	GKMedoidsColumnCache* pCache = hCache.get();
+	vector<bool> isMedoid(n, false);
+	vector<size_t> candidates;
+	vector<size_t> nearest;
+	vector<double> dNearest;
+	vector<double> dSecond;
+
+	// BUILD: greedily add the medoid that reduces the total distance the most
+	medoids.clear();
+	dNearest.assign(n, 1e308);
+	for(size_t j = 0; j < k; j++)
+	{
+		GKMedoids_candidates(n, isMedoid, pCache, candidates);
+		GKMedoidsBuildEval<D> eval = { dist, n, dNearest, j == 0 };
+		GKMedoidsCandidate best = GKMedoids_bestCandidate(n, candidates, pCache, eval);
+		medoids.push_back(best.row);
+		isMedoid[best.row] = true;
+		vector<double> buf;
+		std::shared_ptr<const vector<double> > hold;
+		const double* pColumn = GKMedoids_column(n, dist, best.row, pCache, buf, hold);
+		for(size_t o = 0; o < n; o++)
+			dNearest[o] = std::min(dNearest[o], pColumn[o]);
+	}
+
+	// SWAP: make the best swap until none of them reduce the total distance
+	double err = GKMedoids_findNearest(n, dist, medoids, pCache, nearest, dNearest, dSecond);
+	while(true)
+	{
+		GKMedoids_candidates(n, isMedoid, pCache, candidates);
+		GKMedoidsSwapEval<D> eval = { dist, n, k, nearest, dNearest, dSecond };
+		GKMedoidsCandidate best = GKMedoids_bestCandidate(n, candidates, pCache, eval);
+		if(best.row == INVALID_INDEX || best.delta >= -1e-12 * std::max(1.0, std::abs(err)))
+			break;
+		isMedoid[medoids[best.slot]] = false;
+		isMedoid[best.row] = true;
+		medoids[best.slot] = best.row;
+		err = GKMedoids_findNearest(n, dist, medoids, pCache, nearest, dNearest, dSecond);
+	}
+}
+
+// Finds k medoids with CLARA. Each sample holds the best medoids so far plus random rows, and
+// the medoids found by PAM on each sample are judged by their total distance over all n rows.
+template<typename D>
+static void GKMedoids_clara(size_t n, size_t k, const D& dist, size_t samples, size_t sampleSize, size_t cacheColumns, GRand& rand, vector<size_t>& medoids)
+{
+	sampleSize = std::max(sampleSize, k);
+	if(sampleSize >= n)
+	{
+		GKMedoids_pam(n, k, dist, cacheColumns, medoids);
+		return;
+	}
+	double bestErr = 1e308;
+	vector<size_t> best;
+	vector<size_t> sample;
+	vector<size_t> local;
+	vector<size_t> cand(k);
+	vector<size_t> nearest;
+	vector<double> dNearest;
+	vector<double> dSecond;
+	for(size_t s = 0; s < samples; s++)
+	{
+		// Draw the sample
+		sample = best;
+		vector<bool> chosen(n, false);
+		for(size_t i = 0; i < sample.size(); i++)
+			chosen[sample[i]] = true;
+		while(sample.size() < sampleSize)
+		{
+			size_t r = (size_t)rand.next(n);
+			if(!chosen[r])
+			{
+				chosen[r] = true;
+				sample.push_back(r);
+			}
+		}
+
+		// Cluster the sample, and measure the medoids on all of the rows
+		auto sampleDist = [&](size_t a, size_t b) { return dist(sample[a], sample[b]); };
+		GKMedoids_pam(sample.size(), k, sampleDist, cacheColumns, local);
+		for(size_t j = 0; j < k; j++)
+			cand[j] = sample[local[j]];
+		double err = GKMedoids_findNearest(n, dist, cand, NULL, nearest, dNearest, dSecond);
+		if(err < bestErr)
+		{
+			bestErr = err;
+			best = cand;
+		}
+	}
+	medoids = best;
+}
+
 GKMedoids::GKMedoids(size_t clusters)
-: GClusterer(clusters), m_pData(NULL)
+: GClusterer(clusters), m_err(0.0), m_cacheColumns(0), m_claraSamples(0), m_claraSampleSize(0), m_pRand(NULL)
 {
 	m_pMedoids = new size_t[clusters];
 }
@@ -840,91 +2419,145 @@ GKMedoids::~GKMedoids()
 	delete[] m_pMedoids;
 }
 
-double GKMedoids::curErr(const GMatrix* pData)
+void GKMedoids::setClara(size_t samples, size_t sampleSize, GRand* pRand)
 {
-	double err = 0;
-	for(size_t i = 0; i < pData->rows(); i++)
-	{
-		whichCluster(i);
-		err += m_d;
-	}
-	return err;
+	if(samples > 0 && !pRand)
+		throw Ex("CLARA needs a random number generator");
+	m_claraSamples = samples;
+	m_claraSampleSize = sampleSize;
+	m_pRand = pRand;
 }
 
 // virtual
 void GKMedoids::cluster(const GMatrix* pData)
 {
-	m_pData = pData;
 	if(!m_pMetric)
 		setMetric(new GRowDistance(), true);
 	m_pMetric->init(&pData->relation(), false);
 	if(pData->rows() < (size_t)m_clusterCount)
 		throw Ex("Fewer data point than clusters");
-	for(size_t i = 0; i < m_clusterCount; i++)
-		m_pMedoids[i] = i;
-	double err = curErr(pData);
-	while(true)
-	{
-		bool improved = false;
-		for(size_t i = 0; i < pData->rows(); i++)
-		{
-			// See if it's already a medoid
-			size_t j;
-			for(j = 0; j < m_clusterCount; j++)
-			{
-				if(m_pMedoids[j] == i)
-					break;
-			}
-			if(j < m_clusterCount)
-				continue;
-
-			// Try this point in place of each medoid
-			for(j = 0; j < m_clusterCount; j++)
-			{
-				size_t old = m_pMedoids[j];
-				m_pMedoids[j] = i;
-				double cand = curErr(pData);
-				if(cand < err)
-				{
-					err = cand;
-					improved = true;
-					break;
-				}
-				else
-					m_pMedoids[j] = old;
-			}
-		}
-		if(!improved)
-			break;
-	}
+	const GMatrix& data = *pData;
+	GDistanceMetric* pMetric = m_pMetric;
+	auto dist = [&data, pMetric](size_t a, size_t b) { return pMetric->squaredDistance(data[a], data[b]); };
+	vector<size_t> medoids;
+	if(m_claraSamples > 0)
+		GKMedoids_clara(data.rows(), m_clusterCount, dist, m_claraSamples, m_claraSampleSize, m_cacheColumns, *m_pRand, medoids);
+	else
+		GKMedoids_pam(data.rows(), m_clusterCount, dist, m_cacheColumns, medoids);
+	std::copy(medoids.begin(), medoids.end(), m_pMedoids);
+	vector<double> dNearest;
+	vector<double> dSecond;
+	m_err = GKMedoids_findNearest(data.rows(), dist, medoids, NULL, m_clusters, dNearest, dSecond);
 }
 
 // virtual
 size_t GKMedoids::whichCluster(size_t nVector)
 {
-	const GVec& vec = m_pData->row(nVector);
-	size_t clust = 0;
-	m_d = m_pMetric->squaredDistance(vec, m_pData->row(m_pMedoids[0]));
-	for(size_t i = 1; i < m_clusterCount; i++)
+	return m_clusters[nVector];
+}
+
+#ifndef NO_TEST_CODE
+// static
+void GKMedoids::test()
+{
+	// Make some blobs
+	GRand rand(0);
+	GMatrix data(300, 2);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		data[i].fillNormal(rand, 0.5);
+		data[i][0] += 10.0 * (i % 3);
+		data[i][1] += 10.0 * ((i % 3) == 1 ? 1 : 0);
+	}
+
+	// Check that PAM finds the blobs
+	GKMedoids pam(3);
+	pam.cluster(&data);
+	for(size_t i = 3; i < data.rows(); i++)
+	{
+		if(pam.whichCluster(i) != pam.whichCluster(i % 3))
+			throw Ex("Wrong cluster");
+	}
+	if(pam.whichCluster(0) == pam.whichCluster(1) || pam.whichCluster(1) == pam.whichCluster(2) || pam.whichCluster(0) == pam.whichCluster(2))
+		throw Ex("Blobs were merged");
+
+	// Check that no single swap would do better
+	GMatrix small(60, 2);
+	for(size_t i = 0; i < small.rows(); i++)
+		small[i].fillUniform(rand);
+	GKMedoids local(4);
+	local.cluster(&small);
+	size_t medoids[4];
+	for(size_t j = 0; j < 4; j++)
+		medoids[j] = local.medoid(j);
+	for(size_t c = 0; c < small.rows(); c++)
 	{
-		double d = m_pMetric->squaredDistance(vec, m_pData->row(m_pMedoids[i]));
-		if(d < m_d)
+		for(size_t j = 0; j < 4; j++)
 		{
-			m_d = d;
-			clust = i;
+			size_t old = medoids[j];
+			medoids[j] = c;
+			double err = 0.0;
+			for(size_t o = 0; o < small.rows(); o++)
+			{
+				double d = 1e308;
+				for(size_t m = 0; m < 4; m++)
+					d = std::min(d, small[o].squaredDistance(small[medoids[m]]));
+				err += d;
+			}
+			if(err < local.error() - 1e-9)
+				throw Ex("A swap would have reduced the error");
+			medoids[j] = old;
 		}
 	}
-	return clust;
+
+	// Check that a small cache does not change the result
+	GKMedoids cached(4);
+	cached.setCacheSize(10);
+	cached.cluster(&small);
+	for(size_t j = 0; j < 4; j++)
+	{
+		if(cached.medoid(j) != local.medoid(j))
+			throw Ex("The cache changed the medoids");
+	}
+
+	// Check that CLARA finds the blobs
+	GKMedoids clara(3);
+	clara.setClara(5, 46, &rand);
+	clara.cluster(&data);
+	for(size_t i = 3; i < data.rows(); i++)
+	{
+		if(clara.whichCluster(i) != clara.whichCluster(i % 3))
+			throw Ex("Wrong cluster");
+	}
+	if(clara.error() > 1.1 * pam.error())
+		throw Ex("CLARA did poorly");
+
+	// Check the sparse version with two groups of rows that use different attributes
+	GSparseMatrix sparse(40, 20);
+	for(size_t i = 0; i < sparse.rows(); i++)
+	{
+		for(size_t a = 0; a < 10; a++)
+			sparse.set(i, (i % 2) * 10 + a, rand.uniform() + 0.1);
+	}
+	GKMedoidsSparse sp(2);
+	sp.cluster(&sparse);
+	for(size_t i = 2; i < sparse.rows(); i++)
+	{
+		if(sp.whichCluster(i) != sp.whichCluster(i % 2))
+			throw Ex("Wrong sparse cluster");
+	}
+	if(sp.whichCluster(0) == sp.whichCluster(1))
+		throw Ex("Sparse groups were merged");
 }
+#endif // !NO_TEST_CODE
 
 
 // -----------------------------------------------------------------------------------------
 
 GKMedoidsSparse::GKMedoidsSparse(size_t clusters)
-: GSparseClusterer(clusters)
+: GSparseClusterer(clusters), m_goodness(0.0), m_cacheColumns(0), m_claraSamples(0), m_claraSampleSize(0), m_pRand(NULL)
 {
 	m_pMedoids = new size_t[clusters];
-	m_pData = NULL;
 }
 
 // virtual
@@ -933,80 +2566,41 @@ GKMedoidsSparse::~GKMedoidsSparse()
 	delete[] m_pMedoids;
 }
 
-double GKMedoidsSparse::curGoodness()
+void GKMedoidsSparse::setClara(size_t samples, size_t sampleSize, GRand* pRand)
 {
-	double goodness = 0;
-	for(size_t i = 0; i < m_pData->rows(); i++)
-	{
-		whichCluster(i);
-		goodness += m_d;
-	}
-	return goodness;
+	if(samples > 0 && !pRand)
+		throw Ex("CLARA needs a random number generator");
+	m_claraSamples = samples;
+	m_claraSampleSize = sampleSize;
+	m_pRand = pRand;
 }
 
 // virtual
 void GKMedoidsSparse::cluster(GSparseMatrix* pData)
 {
-	m_pData = pData;
 	if(!m_pMetric)
 		setMetric(new GCosineSimilarity(), true);
 	if(pData->rows() < (size_t)m_clusterCount)
 		throw Ex("Fewer data point than clusters");
-	for(size_t i = 0; i < m_clusterCount; i++)
-		m_pMedoids[i] = i;
-	double goodness = curGoodness();
-	while(true)
-	{
-		bool improved = false;
-		for(size_t i = 0; i < pData->rows(); i++)
-		{
-			// See if it's already a medoid
-			size_t j;
-			for(j = 0; j < m_clusterCount; j++)
-			{
-				if(m_pMedoids[j] == i)
-					break;
-			}
-			if(j < m_clusterCount)
-				continue;
 
-			// Try this point in place of each medoid
-			for(j = 0; j < m_clusterCount; j++)
-			{
-				size_t old = m_pMedoids[j];
-				m_pMedoids[j] = i;
-				double cand = curGoodness();
-				if(cand > goodness)
-				{
-					goodness = cand;
-					improved = true;
-					break;
-				}
-				else
-					m_pMedoids[j] = old;
-			}
-		}
-		if(!improved)
-			break;
-	}
+	// Maximizing the total similarity is the same as minimizing the total negative similarity
+	GSparseSimilarity* pMetric = m_pMetric;
+	auto dist = [pData, pMetric](size_t a, size_t b) { return -pMetric->similarity(pData->row(a), pData->row(b)); };
+	vector<size_t> medoids;
+	if(m_claraSamples > 0)
+		GKMedoids_clara(pData->rows(), m_clusterCount, dist, m_claraSamples, m_claraSampleSize, m_cacheColumns, *m_pRand, medoids);
+	else
+		GKMedoids_pam(pData->rows(), m_clusterCount, dist, m_cacheColumns, medoids);
+	std::copy(medoids.begin(), medoids.end(), m_pMedoids);
+	vector<double> dNearest;
+	vector<double> dSecond;
+	m_goodness = -GKMedoids_findNearest(pData->rows(), dist, medoids, NULL, m_clusters, dNearest, dSecond);
 }
 
 // virtual
 size_t GKMedoidsSparse::whichCluster(size_t nVector)
 {
-	std::map<size_t,double>& vec = m_pData->row(nVector);
-	size_t clust = 0;
-	m_d = m_pMetric->similarity(vec, m_pData->row(m_pMedoids[0]));
-	for(size_t i = 1; i < m_clusterCount; i++)
-	{
-		double d = m_pMetric->similarity(vec, m_pData->row(m_pMedoids[i]));
-		if(d > m_d)
-		{
-			m_d = d;
-			clust = i;
-		}
-	}
-	return clust;
+	return m_clusters[nVector];
 }
 
 
@@ -1031,6 +2625,9 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 	if(!m_pMetric)
 		setMetric(new GCosineSimilarity(), true);
 
+	// The compressed form is much faster to iterate over than the map form
+	GCSRMatrix data(*pData);
+
 	// Pick the seeds (by randomly picking a known value for each element independently)
 	size_t* pCounts = new size_t[pData->cols()];
 	std::unique_ptr<size_t[]> hCounts(pCounts);
@@ -1045,8 +2642,8 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 			GVec& mean = means.row(i);
 			for(size_t k = 0; k < pData->rows(); k++)
 			{
-				GSparseMatrix::Iter it;
-				for(it = pData->rowBegin(k); it != pData->rowEnd(k); it++)
+				GSparseRow row = data.row(k);
+				for(GSparseRow::Iter it = row.begin(); it != row.end(); it++)
 				{
 					if(m_pRand->next(pCounts[it->first] + 1) == 0)
 					{
@@ -1075,7 +2672,7 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 			size_t oldClust = *pClust;
 			*pClust = 0;
 			double maxSimilarity = -1e300;
-			map<size_t,double>& sparseRow = pData->row(i);
+			GSparseRow sparseRow = data.row(i);
 			for(size_t j = 0; j < m_nClusters; j++)
 			{
 				double sim = m_pMetric->similarity(sparseRow, means.row(j));
@@ -1115,8 +2712,8 @@ void GKMeansSparse::cluster(GSparseMatrix* pData)
 					continue;
 
 				// Update only the mean of the elements that this row specifies
-				GSparseMatrix::Iter it;
-				for(it = pData->rowBegin(i); it != pData->rowEnd(i); it++)
+				GSparseRow row = data.row(i);
+				for(GSparseRow::Iter it = row.begin(); it != row.end(); it++)
 				{
 					mean[it->first] *= (pCounts[it->first] / (pCounts[it->first] + 1));
 					mean[it->first] += (1.0 / (pCounts[it->first] + 1) * it->second);
@@ -100,14 +100,80 @@ public:
 
 
 
-/// This merges each cluster with its closest neighbor. (The distance between
-/// clusters is computed as the distance between the closest members of the
-/// clusters times (n^b), where n is the total number of points from both
-/// clusters, and b is a balancing factor.
+/// The result of hierarchical clustering: the sequence of merges that joins n rows into one
+/// cluster. Each merge names one row from each of the two clusters it joins, so the tree can be
+/// cut into any number of clusters without clustering again.
+class GDendrogram
+{
+public:
+	struct Merge
+	{
+		size_t a; // a row in one of the merged clusters
+		size_t b; // a row in the other merged cluster
+		double height; // the distance between the two clusters
+	};
+
+protected:
+	size_t m_rows;
+	std::vector<Merge> m_merges;
+
+public:
+	/// Makes a dendrogram of rows singleton clusters with no merges.
+	GDendrogram(size_t rows = 0);
+
+	/// Discards all merges, and sets the number of rows.
+	void reset(size_t rows);
+
+	/// Adds a merge. The merges may be added in any order. (Clusterers such as the
+	/// nearest-neighbor chain find them out of order.) Call sortMerges after adding them.
+	void addMerge(size_t a, size_t b, double height);
+
+	/// Sorts the merges by height. Merges of the same height keep the order they were added in.
+	void sortMerges();
+
+	/// Returns the number of rows
+	size_t rows() const { return m_rows; }
+
+	/// Returns the number of merges. (This is rows() - 1 when the tree is complete.)
+	size_t mergeCount() const { return m_merges.size(); }
+
+	/// Returns the ith merge, in order of height (after sortMerges)
+	const Merge& merge(size_t i) const { return m_merges[i]; }
+
+	/// Cuts the tree into the specified number of clusters by undoing the highest merges.
+	/// Stores the cluster of each row (from 0 to clusters - 1) in pOut. Clusters are numbered in
+	/// the order that their first rows appear.
+	void cut(size_t clusters, size_t* pOut) const;
+};
+
+
+/// Hierarchical agglomerative clustering. Each step merges the two closest clusters, until only
+/// the requested number are left. All of the merges are kept in a dendrogram, so the same
+/// clustering can be cut into any other number of clusters with recut.
+///
+/// Single linkage (the distance between the closest members of two clusters) builds a minimum
+/// spanning tree with Boruvka's algorithm, which uses GKdTree::findNearestWithDifferentLabel to
+/// find the closest point in another cluster. It takes about O(n log n) queries and O(n) memory.
+/// Ward, complete and average linkage use the nearest-neighbor chain algorithm, which finds the
+/// same merges as the naive algorithm in O(n^2) time. Ward linkage keeps only the centroids,
+/// so it needs O(n) memory, but complete and average linkage keep all of the pairwise distances
+/// (O(n^2) memory). Ward linkage always uses Euclidean distance, and only supports continuous
+/// attributes without missing values.
 class GAgglomerativeClusterer : public GClusterer
 {
+public:
+	enum Linkage
+	{
+		Single,
+		Complete,
+		Average,
+		Ward
+	};
+
 protected:
-	size_t* m_pClusters;
+	Linkage m_linkage;
+	GDendrogram m_dendrogram;
+	std::vector<size_t> m_clusters;
 
 public:
 	GAgglomerativeClusterer(size_t nClusterCount);
@@ -118,11 +184,31 @@ public:
 	static void test();
 #endif // !NO_TEST_CODE
 
+	/// Specifies how to measure the distance between clusters. The default is Single.
+	void setLinkage(Linkage l) { m_linkage = l; }
+
 	/// Performs clustering
 	virtual void cluster(const GMatrix* pData);
 
 	/// Identifies the cluster of the specified row
 	virtual size_t whichCluster(size_t nVector);
+
+	/// Returns all of the merges found by the last call to cluster
+	const GDendrogram& dendrogram() const { return m_dendrogram; }
+
+	/// Cuts the dendrogram of the last call to cluster into a different number of clusters.
+	/// Subsequent calls to whichCluster and clusterCount reflect the new number.
+	void recut(size_t clusters);
+
+protected:
+	/// Builds a minimum spanning tree with Boruvka's algorithm, and adds its edges as merges
+	void singleLinkage(const GMatrix& data);
+
+	/// Finds the Ward merges with the nearest-neighbor chain algorithm
+	void wardLinkage(const GMatrix& data);
+
+	/// Finds the complete or average linkage merges with the nearest-neighbor chain algorithm
+	void matrixLinkage(const GMatrix& data);
 };
 
 
@@ -164,11 +250,20 @@ protected:
 	size_t* m_pClusters;
 	size_t m_reps;
 	GRand* m_pRand;
+	bool m_accelerate;
+	bool m_euclidean; // true iff the metric is plain Euclidean distance, so the vector kernel can stand in for it
+	bool m_boundsValid;
+	std::vector<double> m_lower; // a lower bound on the distance from each row to its second-nearest centroid
 
 public:
 	GKMeans(size_t nClusters, GRand* pRand);
 	~GKMeans();
 
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif // !NO_TEST_CODE
+
 	/// Performs clustering
 	virtual void cluster(const GMatrix* pData);
 
@@ -180,9 +275,11 @@ public:
 
 	/// Assigns each row to the cluster of the nearest centroid as measured
 	/// with the dissimilarity metric. Returns the sum-squared-distance of each row with its centroid.
+	/// The rows are processed in parallel. Every row is compared with every centroid, since the
+	/// caller may have changed the data or the centroids; only cluster uses the accelerated bounds.
 	double assignClusters(const GMatrix* pData);
 
-	/// Computes new centroids for each cluster.
+	/// Computes new centroids for each cluster. The clusters are processed in parallel.
 	void recomputeCentroids(const GMatrix* pData);
 
 	/// Returns a k x d matrix, where each row is one of the k centroids.
@@ -192,9 +289,129 @@ public:
 	/// by the sum-squared-difference between each point and its cluster-centroid) will be kept.
 	void setReps(size_t r) { m_reps = r; }
 
+	/// Specifies whether cluster uses Hamerly's bounds to skip most of the distance computations.
+	/// Each row keeps a lower bound on the distance to its second-nearest centroid, and a row is
+	/// only compared with all of the centroids when that bound (or half the distance from its
+	/// centroid to the nearest other centroid) strictly proves that its assignment is unchanged.
+	/// A row whose nearest centroids tie is never skipped, so ties are broken with the same random
+	/// draws as without this. The metric must satisfy the triangle inequality. The assignments match
+	/// the exhaustive ones, except that a row whose two nearest distances differ by less than the
+	/// rounding error in the bounds may be kept with a centroid that is not quite the nearest.
+	/// The default is false.
+	void setAccelerate(bool b) { m_accelerate = b; }
+
 protected:
 	bool clusterAttempt(size_t nMaxIterations);
 	bool selectSeeds(const GMatrix* pSeeds);
+
+	/// Assigns each row to its nearest centroid. If useBounds is true and the bounds left by the
+	/// previous call are still valid, rows whose assignment the bounds prove unchanged are skipped.
+	double assignClusters(const GMatrix* pData, bool useBounds);
+
+	/// Returns the squared distance between a row and a centroid
+	double squaredDistance(const GVec& row, const GVec& centroid) const;
+
+	/// Returns the index of the centroid nearest to row, breaking ties with rand. Stores the squared
+	/// distances to the nearest and second-nearest centroids in *pBest and *pSecond. pScratch must
+	/// have room for one value per cluster.
+	size_t nearestCentroid(const GVec& row, GRand& rand, double* pScratch, double* pBest, double* pSecond) const;
+};
+
+
+/// Mini-batch k-means (Sculley, Web-scale k-means clustering, WWW 2010). Each step assigns a
+/// small batch of rows to their nearest centroids, then moves each centroid toward its rows with a
+/// step size of one over the number of rows it has absorbed so far. Since only one batch is needed at
+/// a time, it can cluster data that does not fit in memory (see clusterStream), and since the
+/// centroids are kept, it can serve as an online quantizer for new points (see nearestCentroid).
+/// The centroids are seeded with k-means++ or k-means|| on a sample of the data.
+/// It always uses Euclidean distance (any metric set with setMetric is ignored), and only
+/// supports continuous attributes without missing values.
+class GMiniBatchKMeans : public GClusterer
+{
+public:
+	enum Seeding
+	{
+		KMeansPlusPlus, // Arthur and Vassilvitskii, k-means++: The advantages of careful seeding, SODA 2007
+		KMeansParallel // Bahmani et al., Scalable k-means++, VLDB 2012
+	};
+
+protected:
+	GMatrix* m_pCentroids;
+	std::vector<size_t> m_counts; // the number of rows that each centroid has absorbed
+	std::vector<size_t> m_clusters; // the cluster of each row passed to cluster
+	size_t m_batchSize;
+	size_t m_iters;
+	size_t m_sampleSize;
+	Seeding m_seeding;
+	GRand* m_pRand;
+
+public:
+	GMiniBatchKMeans(size_t nClusters, GRand* pRand);
+	virtual ~GMiniBatchKMeans();
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif // !NO_TEST_CODE
+
+	/// Sets the number of rows in each mini-batch. The default is 1024.
+	void setBatchSize(size_t n) { m_batchSize = n; }
+
+	/// Sets the number of mini-batch steps that cluster performs. The default is 100.
+	void setIters(size_t n) { m_iters = n; }
+
+	/// Sets the maximum number of rows that are used to seed the centroids. The default is 100000.
+	void setSampleSize(size_t n) { m_sampleSize = n; }
+
+	/// Specifies how to seed the centroids. The default is KMeansPlusPlus.
+	void setSeeding(Seeding s) { m_seeding = s; }
+
+	/// Seeds the centroids from a sample of the rows. Any previous centroids are discarded.
+	void seed(const GMatrix& sample);
+
+	/// Performs one mini-batch step with the rows in batch. seed must be called first.
+	/// The batch is assigned in parallel, and the centroids are updated in parallel.
+	void update(const GMatrix& batch);
+
+	/// Seeds with a random sample of pData, performs the mini-batch steps with random
+	/// batches of pData, and then assigns each row to its nearest centroid.
+	virtual void cluster(const GMatrix* pData);
+
+	/// Clusters the rows of an ARFF file without loading all of it. The first pass draws
+	/// a reservoir sample of the rows to seed with, and each of the following passes streams
+	/// the file through update, one batch at a time. (Since consecutive rows form each batch,
+	/// the rows of the file should be in random order.) Only one batch, the sample, and the
+	/// centroids are held in memory.
+	void clusterStream(const char* szFilename, size_t passes = 1);
+
+	/// Identifies the cluster of the specified row of the matrix that was passed to cluster.
+	virtual size_t whichCluster(size_t nVector);
+
+	/// Returns the index of the centroid nearest to the specified point.
+	size_t nearestCentroid(const GVec& point) const;
+
+	/// Returns a k x d matrix, where each row is one of the k centroids.
+	GMatrix* centroids() { return m_pCentroids; }
+
+	/// Picks k rows of data with greedy k-means++. Each row after the first is drawn with
+	/// probability proportional to its weight times its squared distance to the nearest row
+	/// already picked. Each step draws 2 + ln(k) rows this way, and keeps the one that leaves the
+	/// smallest weighted sum of squared distances. pWeights may be NULL to weight every row equally.
+	/// The distances are updated in parallel. Returns a k x d matrix of the picked rows.
+	static GMatrix* seedPlusPlus(const GMatrix& data, const double* pWeights, size_t k, GRand& rand);
+
+	/// Picks k rows of data with k-means||. Each of the specified number of rounds picks about
+	/// oversample rows independently (in parallel), with probability proportional to their squared
+	/// distances to the nearest row already picked. The candidates are then weighted by how many rows
+	/// are nearest to them and reduced to k rows with k-means++. Returns a k x d matrix of the picked rows.
+	static GMatrix* seedParallel(const GMatrix& data, size_t k, size_t rounds, size_t oversample, GRand& rand);
+
+protected:
+	/// Throws if the relation has any nominal attributes
+	static void checkRelation(const GRelation& relation);
+
+	/// Returns the index of the centroid nearest to point, and its squared distance in *pDist
+	size_t nearest(const GVec& point, double* pDist) const;
 };
 
 
@@ -248,50 +465,98 @@ protected:
 };
 
 
-/// An implementation of the K-medoids clustering algorithm
+/// An implementation of the K-medoids clustering algorithm. Each row is assigned to the nearest
+/// of the medoids, and the medoids are chosen to minimize the sum of the squared distances
+/// (as measured by the metric) between the rows and their medoids.
+///
+/// The medoids are seeded with the greedy BUILD step, and then refined with FastPAM1 swaps
+/// (Schubert and Rousseeuw, Faster k-Medoids Clustering, SISAP 2019). Each swap step measures
+/// every non-medoid against all of the medoids in one pass over the data, so it takes O(n^2)
+/// distance computations instead of O(k n^2). The candidates are evaluated in parallel. For
+/// large data sets, CLARA mode (see setClara) runs PAM on several random samples, and keeps the
+/// medoids that do best on all of the rows.
 class GKMedoids : public GClusterer
 {
 protected:
 	size_t* m_pMedoids;
-	double m_d;
-	const GMatrix* m_pData;
+	std::vector<size_t> m_clusters; // the cluster of each row
+	double m_err;
+	size_t m_cacheColumns;
+	size_t m_claraSamples;
+	size_t m_claraSampleSize;
+	GRand* m_pRand;
 
 public:
 	GKMedoids(size_t clusters);
 	virtual ~GKMedoids();
 
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif // !NO_TEST_CODE
+
+	/// Keeps up to columns rows of distances (each with one distance to every row) in a cache
+	/// that evicts the least recently used row. The swap steps measure the same rows in every
+	/// iteration, so a cache of c rows saves about c * n distance computations per iteration, at
+	/// a cost of c * n * sizeof(double) bytes. The default is 0 (no cache).
+	void setCacheSize(size_t columns) { m_cacheColumns = columns; }
+
+	/// Switches to CLARA mode, which runs PAM on samples random samples of sampleSize rows each
+	/// (plus the best medoids so far), and keeps the medoids with the lowest error over all of
+	/// the rows. This is much faster than PAM when there are many rows. Kaufman and Rousseeuw
+	/// recommend 5 samples of 40 + 2k rows. Pass 0 samples to go back to PAM on all of the rows.
+	void setClara(size_t samples, size_t sampleSize, GRand* pRand);
+
 	/// Performs clustering
 	virtual void cluster(const GMatrix* pData);
 
 	/// Identifies the cluster of the specified row
 	virtual size_t whichCluster(size_t nVector);
 
-protected:
-	double curErr(const GMatrix* pData);
+	/// Returns the index of the row that is the medoid of the specified cluster
+	size_t medoid(size_t cluster) const { return m_pMedoids[cluster]; }
+
+	/// Returns the sum of the squared distances between each row and its medoid
+	double error() const { return m_err; }
 };
 
 
 
-/// An implementation of the K-medoids clustering algorithm for sparse data
+/// An implementation of the K-medoids clustering algorithm for sparse data. It finds the
+/// medoids the same way as GKMedoids, except that it maximizes the total similarity between
+/// the rows and their medoids.
 class GKMedoidsSparse : public GSparseClusterer
 {
 protected:
 	size_t* m_pMedoids;
-	double m_d;
-	GSparseMatrix* m_pData;
+	std::vector<size_t> m_clusters; // the cluster of each row
+	double m_goodness;
+	size_t m_cacheColumns;
+	size_t m_claraSamples;
+	size_t m_claraSampleSize;
+	GRand* m_pRand;
 
 public:
 	GKMedoidsSparse(size_t clusters);
 	virtual ~GKMedoidsSparse();
 
+	/// See the comment for GKMedoids::setCacheSize
+	void setCacheSize(size_t columns) { m_cacheColumns = columns; }
+
+	/// See the comment for GKMedoids::setClara
+	void setClara(size_t samples, size_t sampleSize, GRand* pRand);
+
 	/// Performs clustering
 	virtual void cluster(GSparseMatrix* pData);
 
 	/// Identifies the cluster of the specified row
 	virtual size_t whichCluster(size_t nVector);
 
-protected:
-	double curGoodness();
+	/// Returns the index of the row that is the medoid of the specified cluster
+	size_t medoid(size_t cluster) const { return m_pMedoids[cluster]; }
+
+	/// Returns the sum of the similarities between each row and its medoid
+	double goodness() const { return m_goodness; }
 };
 
 
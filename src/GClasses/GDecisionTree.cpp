@@ -29,9 +29,12 @@
 #include "GTransform.h"
 #include "GEnsemble.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <string>
 #include <iostream>
 #include <memory>
+#include <algorithm>
+#include <unordered_map>
 
 using namespace GClasses;
 using std::string;
@@ -65,6 +68,7 @@ public:
 class GDecisionTreeInteriorNode : public GDecisionTreeNode
 {
 friend class GDecisionTree;
+friend class GCompiledForest;
 protected:
 	size_t m_nAttribute;
 	double m_dPivot;
@@ -352,19 +356,345 @@ GDecisionTreeNode* GDecisionTreeNode::deserialize(const GDomNode* pNode)
 
 // -----------------------------------------------------------------
 
+namespace GClasses {
+
+#define GDecisionTree_binSampleSize 200000
+
+/// Holds the training data for the histogram-based tree builder. Every feature is
+/// quantized once into a byte column, and the rows of each branch are a contiguous
+/// range of m_indexes, so dividing the data only permutes indexes.
+class GDecisionTreeHistogram
+{
+public:
+	const GMatrix& m_labels;
+	size_t m_rows;
+	size_t m_cols;
+	size_t m_bins; // the number of bins per feature. The last one holds the missing values.
+	size_t m_stride; // the number of values per bin: a row count, then the statistics for each label
+	vector<unsigned char> m_binned; // column-major. Each feature has m_rows bytes.
+	vector<size_t> m_binCounts; // the number of bins that each feature uses for known values
+	vector< vector<double> > m_thresholds; // for continuous features, bin b holds values in [m_thresholds[b - 1], m_thresholds[b])
+	vector<bool> m_nominal;
+	vector<size_t> m_labelOffsets;
+	vector<size_t> m_labelValues;
+	vector<size_t> m_indexes;
+	vector<char> m_active; // If not empty, only the attributes with a non-zero value here are considered for divisions
+
+	GDecisionTreeHistogram(const GMatrix& features, const GMatrix& labels, size_t bins)
+	: m_labels(labels), m_rows(features.rows()), m_cols(features.cols()), m_bins(bins)
+	{
+		// Lay out the label statistics. Continuous labels need a count, sum, and sum-of-squares.
+		// Nominal labels need a count for each value.
+		const GRelation& labelRel = labels.relation();
+		m_stride = 1;
+		for(size_t i = 0; i < labelRel.size(); i++)
+		{
+			m_labelOffsets.push_back(m_stride);
+			m_labelValues.push_back(labelRel.valueCount(i));
+			m_stride += (m_labelValues[i] == 0 ? 3 : m_labelValues[i]);
+		}
+
+		// Quantize the features
+		const GRelation& featureRel = features.relation();
+		size_t missingBin = m_bins - 1;
+		m_binned.resize(m_rows * m_cols);
+		m_binCounts.resize(m_cols);
+		m_thresholds.resize(m_cols);
+		m_nominal.resize(m_cols);
+		for(size_t i = 0; i < m_cols; i++)
+		{
+			m_nominal[i] = (featureRel.valueCount(i) != 0);
+			if(featureRel.valueCount(i) > missingBin)
+				throw Ex("Attribute ", to_str(i), " has ", to_str(featureRel.valueCount(i)), " values, but histogram splits only support ", to_str(missingBin));
+		}
+		GThreadPool::global().parallelFor(0, m_cols, [&](size_t attr)
+		{
+			unsigned char* pCol = m_binned.data() + attr * m_rows;
+			if(m_nominal[attr])
+			{
+				m_binCounts[attr] = featureRel.valueCount(attr);
+				for(size_t i = 0; i < m_rows; i++)
+				{
+					int v = (int)features[i][attr];
+					pCol[i] = (unsigned char)(v < 0 ? missingBin : (size_t)v);
+				}
+				return;
+			}
+
+			// Pick thresholds at the quantiles of the known values. (With big datasets,
+			// a systematic sample of the rows is enough to place them.)
+			vector<double> vals;
+			size_t step = (m_rows + GDecisionTree_binSampleSize - 1) / GDecisionTree_binSampleSize;
+			vals.reserve(m_rows / step + 1);
+			for(size_t i = 0; i < m_rows; i += step)
+			{
+				double d = features[i][attr];
+				if(d != UNKNOWN_REAL_VALUE)
+					vals.push_back(d);
+			}
+			std::sort(vals.begin(), vals.end());
+			vector<double>& thresh = m_thresholds[attr];
+			size_t distinct = vals.size() > 0 ? 1 : 0;
+			for(size_t i = 1; i < vals.size() && distinct <= missingBin; i++)
+			{
+				if(vals[i] != vals[i - 1])
+					distinct++;
+			}
+			if(distinct <= missingBin)
+			{
+				// Every distinct value gets its own bin, so the pivots can fall halfway between them
+				for(size_t i = 1; i < vals.size(); i++)
+				{
+					if(vals[i] != vals[i - 1])
+						thresh.push_back(0.5 * (vals[i - 1] + vals[i]));
+				}
+			}
+			else
+			{
+				for(size_t q = 1; q < missingBin; q++)
+				{
+					double d = vals[q * vals.size() / missingBin];
+					if(d > vals[0] && (thresh.size() == 0 || d > thresh.back()))
+						thresh.push_back(d);
+				}
+			}
+			m_binCounts[attr] = thresh.size() + (vals.size() > 0 ? 1 : 0);
+			for(size_t i = 0; i < m_rows; i++)
+			{
+				double d = features[i][attr];
+				if(d == UNKNOWN_REAL_VALUE)
+					pCol[i] = (unsigned char)missingBin;
+				else
+					pCol[i] = (unsigned char)(std::upper_bound(thresh.begin(), thresh.end(), d) - thresh.begin());
+			}
+		});
+
+		m_indexes.resize(m_rows);
+		for(size_t i = 0; i < m_rows; i++)
+			m_indexes[i] = i;
+	}
+
+	/// Returns the number of values in a histogram of all the features
+	size_t histogramSize()
+	{
+		return m_cols * m_bins * m_stride;
+	}
+
+	/// Adds the label statistics of the specified row to pStats
+	void addRow(double* pStats, size_t row)
+	{
+		const GVec& lab = m_labels[row];
+		pStats[0] += 1.0;
+		for(size_t i = 0; i < m_labelOffsets.size(); i++)
+		{
+			double* pS = pStats + m_labelOffsets[i];
+			if(m_labelValues[i] == 0)
+			{
+				double d = lab[i];
+				if(d != UNKNOWN_REAL_VALUE)
+				{
+					pS[0] += 1.0;
+					pS[1] += d;
+					pS[2] += d * d;
+				}
+			}
+			else
+			{
+				int v = (int)lab[i];
+				if(v >= 0)
+					pS[v] += 1.0;
+			}
+		}
+	}
+
+	/// Computes the histogram of every feature for the rows m_indexes[start] to m_indexes[end - 1]
+	void buildHistogram(size_t start, size_t end, vector<double>& histogram)
+	{
+		histogram.resize(histogramSize());
+		GThreadPool::global().parallelFor(0, m_cols, [&](size_t attr)
+		{
+			double* pHist = histogram.data() + attr * m_bins * m_stride;
+			std::fill(pHist, pHist + m_bins * m_stride, 0.0);
+			const unsigned char* pCol = m_binned.data() + attr * m_rows;
+			for(size_t i = start; i < end; i++)
+			{
+				size_t row = m_indexes[i];
+				addRow(pHist + pCol[row] * m_stride, row);
+			}
+		});
+	}
+
+	/// Sums the bins of one feature to obtain the statistics of all the rows in a branch
+	void totals(const vector<double>& histogram, double* pTotals)
+	{
+		std::fill(pTotals, pTotals + m_stride, 0.0);
+		for(size_t b = 0; b < m_bins; b++)
+		{
+			const double* pBin = histogram.data() + b * m_stride;
+			for(size_t i = 0; i < m_stride; i++)
+				pTotals[i] += pBin[i];
+		}
+	}
+
+	/// Returns the same measure as GMatrix::measureInfo for the rows summarized by pStats
+	double info(const double* pStats)
+	{
+		double dInfo = 0.0;
+		for(size_t i = 0; i < m_labelOffsets.size(); i++)
+		{
+			const double* pS = pStats + m_labelOffsets[i];
+			size_t vals = m_labelValues[i];
+			if(vals == 0)
+			{
+				if(pS[0] > 1.5)
+					dInfo += std::max(0.0, (pS[2] - pS[1] * pS[1] / pS[0]) / (pS[0] - 1.0));
+			}
+			else
+			{
+				double total = 0.0;
+				for(size_t j = 0; j < vals; j++)
+					total += pS[j];
+				double dEntropy = 0.0;
+				for(size_t j = 0; j < vals; j++)
+				{
+					if(pS[j] > 0.5)
+					{
+						double dRatio = pS[j] / total;
+						dEntropy -= dRatio * log(dRatio);
+					}
+				}
+				dInfo += M_LOG2E * dEntropy;
+			}
+		}
+		return dInfo;
+	}
+
+	/// Returns a newly allocated label vector for a leaf that summarizes pStats
+	double* labelVec(const double* pStats)
+	{
+		size_t n = m_labelOffsets.size();
+		double* pVec = new double[n];
+		for(size_t i = 0; i < n; i++)
+		{
+			const double* pS = pStats + m_labelOffsets[i];
+			size_t vals = m_labelValues[i];
+			if(vals == 0)
+				pVec[i] = (pS[0] > 0.5 ? pS[1] / pS[0] : 0.0);
+			else
+			{
+				size_t best = 0;
+				for(size_t j = 1; j < vals; j++)
+				{
+					if(pS[j] > pS[best])
+						best = j;
+				}
+				pVec[i] = (double)best;
+			}
+		}
+		return pVec;
+	}
+
+	/// Finds the best binary division of attr. Continuous attributes send bins [0, *pBin] to
+	/// child 0. Nominal attributes send bin *pBin to child 0. Returns 1e308 if attr cannot divide
+	/// the data. pLeft and pRight are buffers of m_stride values.
+	double bestSplit(const vector<double>& histogram, const double* pTotals, size_t attr, size_t* pBin, bool* pMissingLeft, double* pLeft, double* pRight)
+	{
+		const double* pHist = histogram.data() + attr * m_bins * m_stride;
+		const double* pMissing = pHist + (m_bins - 1) * m_stride;
+		double rowCount = pTotals[0];
+		double bestInfo = 1e308;
+		std::fill(pLeft, pLeft + m_stride, 0.0);
+		for(size_t b = 0; b + 1 < m_binCounts[attr] || (m_nominal[attr] && b < m_binCounts[attr]); b++)
+		{
+			const double* pStats = pHist + b * m_stride;
+			if(m_nominal[attr])
+			{
+				for(size_t i = 0; i < m_stride; i++)
+					pLeft[i] = pStats[i];
+			}
+			else
+			{
+				for(size_t i = 0; i < m_stride; i++)
+					pLeft[i] += pStats[i];
+			}
+			if(pLeft[0] < 0.5 || pStats[0] < 0.5)
+				continue; // Either child 0 is empty, or this division is the same as the previous one
+
+			// The missing values go with the larger side for continuous attributes. For nominal
+			// attributes, they follow the unequal side, just like GDecisionTree::findLeaf does.
+			for(size_t i = 0; i < m_stride; i++)
+				pRight[i] = pTotals[i] - pLeft[i] - pMissing[i];
+			if(pRight[0] < 0.5)
+				continue;
+			bool missingLeft = !m_nominal[attr] && pLeft[0] >= pRight[0];
+			double* pBigger = missingLeft ? pLeft : pRight;
+			for(size_t i = 0; i < m_stride; i++)
+				pBigger[i] += pMissing[i];
+			double dInfo = (info(pLeft) * pLeft[0] + info(pRight) * pRight[0]) / rowCount;
+			if(dInfo + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+			{
+				bestInfo = dInfo;
+				*pBin = b;
+				*pMissingLeft = missingLeft;
+			}
+			if(missingLeft)
+			{
+				for(size_t i = 0; i < m_stride; i++)
+					pLeft[i] -= pMissing[i];
+			}
+		}
+		return bestInfo;
+	}
+
+	/// Returns true iff the specified row goes to child 0 of a division at bin "bin" of attr
+	bool goesLeft(size_t attr, size_t bin, bool missingLeft, size_t row)
+	{
+		size_t b = m_binned[attr * m_rows + row];
+		if(b == m_bins - 1)
+			return missingLeft;
+		if(m_nominal[attr])
+			return b == bin;
+		else
+			return b <= bin;
+	}
+};
+
+} // namespace GClasses
+
+// -----------------------------------------------------------------
+
 GDecisionTree::GDecisionTree()
-: GSupervisedLearner(), m_leafThresh(1), m_maxLevels(0), m_binaryDivisions(false)
+: GSupervisedLearner(), m_leafThresh(1), m_maxLevels(0), m_binaryDivisions(false), m_histogramBins(0), m_parallelNodeRows(0), m_parallelAttrs(0), m_pCompiled(NULL)
 {
 	m_pRoot = NULL;
 	m_eAlg = GDecisionTree::MINIMIZE_ENTROPY;
 }
 
 GDecisionTree::GDecisionTree(const GDomNode* pNode)
-: GSupervisedLearner(pNode), m_leafThresh(1), m_maxLevels(0)
+: GSupervisedLearner(pNode), m_leafThresh(1), m_maxLevels(0), m_histogramBins(0), m_parallelNodeRows(0), m_parallelAttrs(0), m_pCompiled(NULL)
 {
 	m_eAlg = (DivisionAlgorithm)pNode->field("alg")->asInt();
 	m_pRoot = GDecisionTreeNode::deserialize(pNode->field("root"));
 	m_binaryDivisions = pNode->field("bin")->asBool();
+
+	// Training settings (older files do not have these)
+	GDomNode* pSetting = pNode->fieldIfExists("leaf");
+	if(pSetting)
+		m_leafThresh = (size_t)pSetting->asInt();
+	pSetting = pNode->fieldIfExists("maxlev");
+	if(pSetting)
+		m_maxLevels = (size_t)pSetting->asInt();
+	pSetting = pNode->fieldIfExists("draws");
+	m_randomDraws = pSetting ? (size_t)pSetting->asInt() : 1;
+	pSetting = pNode->fieldIfExists("hbins");
+	if(pSetting)
+		m_histogramBins = (size_t)pSetting->asInt();
+	pSetting = pNode->fieldIfExists("pnrows");
+	if(pSetting)
+		m_parallelNodeRows = (size_t)pSetting->asInt();
+	pSetting = pNode->fieldIfExists("pattrs");
+	if(pSetting)
+		m_parallelAttrs = (size_t)pSetting->asInt();
 }
 
 // virtual
@@ -382,6 +712,16 @@ GDomNode* GDecisionTree::serialize(GDom* pDoc) const
 	pNode->addField(pDoc, "alg", pDoc->newInt(m_eAlg));
 	pNode->addField(pDoc, "root", m_pRoot->serialize(pDoc, m_pRelLabels->size()));
 	pNode->addField(pDoc, "bin", pDoc->newBool(m_binaryDivisions));
+	pNode->addField(pDoc, "leaf", pDoc->newInt(m_leafThresh));
+	pNode->addField(pDoc, "maxlev", pDoc->newInt(m_maxLevels));
+	if(m_eAlg == RANDOM)
+		pNode->addField(pDoc, "draws", pDoc->newInt(m_randomDraws));
+	if(m_histogramBins > 0)
+		pNode->addField(pDoc, "hbins", pDoc->newInt(m_histogramBins));
+	if(m_parallelNodeRows > 0)
+		pNode->addField(pDoc, "pnrows", pDoc->newInt(m_parallelNodeRows));
+	if(m_parallelAttrs > 0)
+		pNode->addField(pDoc, "pattrs", pDoc->newInt(m_parallelAttrs));
 	return pNode;
 }
 
@@ -393,8 +733,16 @@ size_t GDecisionTree::treeSize()
 void GDecisionTree::useBinaryDivisions()
 {
 	m_binaryDivisions = true;
-	delete(m_pRoot);
-	m_pRoot = NULL;
+	clear();
+}
+
+void GDecisionTree::useHistogramSplits(size_t bins)
+{
+	if(bins != 0 && (bins < 3 || bins > 256))
+		throw Ex("The number of histogram bins must be from 3 to 256");
+	m_histogramBins = bins;
+	if(bins > 0)
+		useBinaryDivisions();
 }
 
 void GDecisionTree::print(ostream& stream, GArffRelation* pFeatureRel, GArffRelation* pLabelRel)
@@ -424,6 +772,15 @@ void GDecisionTree::trainInner(const GMatrix& features, const GMatrix& labels)
 {
 	clear();
 
+	if(m_histogramBins > 0)
+	{
+		GDecisionTreeHistogram hist(features, labels, m_histogramBins);
+		vector<double> histogram;
+		hist.buildHistogram(0, hist.m_rows, histogram);
+		m_pRoot = buildHistogramBranch(hist, 0, hist.m_rows, histogram, 0/*depth*/, m_rand);
+		return;
+	}
+
 	// Make a list of available features
 	vector<size_t> attrPool;
 	attrPool.reserve(m_pRelFeatures->size());
@@ -436,20 +793,26 @@ void GDecisionTree::trainInner(const GMatrix& features, const GMatrix& labels)
 	GMatrix tmpLabels(m_pRelLabels->clone());
 	tmpLabels.copy(labels);
 
-	m_pRoot = buildBranch(tmpFeatures, tmpLabels, attrPool, 0/*depth*/, 4/*tolerance*/);
+	m_pRoot = buildBranch(tmpFeatures, tmpLabels, attrPool, 0/*depth*/, 4/*tolerance*/, m_rand);
 }
 
 void GDecisionTree::autoTune(GMatrix& features, GMatrix& labels)
 {
-	// Try binary splits
-	m_binaryDivisions = false;
-	double bestErr = crossValidate(features, labels, 2);
-	m_binaryDivisions = true;
-	double d = crossValidate(features, labels, 2);
-	if(d < bestErr)
-		bestErr = d;
+	// Try binary splits (Histogram splits are always binary.)
+	double bestErr;
+	if(m_histogramBins > 0)
+		bestErr = crossValidate(features, labels, 2);
 	else
+	{
 		m_binaryDivisions = false;
+		bestErr = crossValidate(features, labels, 2);
+		m_binaryDivisions = true;
+		double d = crossValidate(features, labels, 2);
+		if(d < bestErr)
+			bestErr = d;
+		else
+			m_binaryDivisions = false;
+	}
 
 	// Find the best leaf threshold
 	size_t cap = size_t(floor(sqrt(double(features.rows()))));
@@ -558,8 +921,10 @@ double GDecisionTree_measureNominalSplitInfo(GMatrix& features, GMatrix& labels,
 	return dInfo;
 }
 
-size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* pPivot, vector<size_t>& attrPool, size_t nDepth)
+size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* pPivot, vector<size_t>& attrPool, size_t nDepth, GRand& rand)
 {
+	if(m_eAlg == MINIMIZE_ENTROPY && m_parallelAttrs > 0 && attrPool.size() >= m_parallelAttrs)
+		return pickDivisionInParallel(features, labels, pPivot, attrPool, rand);
 	GMatrix tmpFeatures(features.relation().clone());
 	tmpFeatures.reserve(features.rows());
 	GMatrix tmpLabels(labels.relation().clone());
@@ -577,7 +942,7 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 		{
 			double info;
 			if(m_binaryDivisions || features.relation().valueCount(*it) == 0)
-				info = GDecisionTree_pickPivotToReduceInfo(features, labels, tmpFeatures, tmpLabels, &pivot, *it, &m_rand);
+				info = GDecisionTree_pickPivotToReduceInfo(features, labels, tmpFeatures, tmpLabels, &pivot, *it, &rand);
 			else
 				info = GDecisionTree_measureNominalSplitInfo(features, labels, tmpFeatures, tmpLabels, *it);
 			if(info + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
@@ -601,14 +966,14 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 		size_t patience = std::max((size_t)6, m_randomDraws * 2);
 		for(size_t i = 0; i < m_randomDraws && patience > 0; i++)
 		{
-			size_t index = (size_t)m_rand.next(attrPool.size());
+			size_t index = (size_t)rand.next(attrPool.size());
 			size_t attr = attrPool[index];
 			double pivot = 0.0;
 			double info;
 			if(features.relation().valueCount(attr) == 0)
 			{
-				double a = features[(size_t)m_rand.next(features.rows())][attr];
-				double b = features[(size_t)m_rand.next(features.rows())][attr];
+				double a = features[(size_t)rand.next(features.rows())][attr];
+				double b = features[(size_t)rand.next(features.rows())][attr];
 				if(a == UNKNOWN_REAL_VALUE)
 				{
 					if(b == UNKNOWN_REAL_VALUE)
@@ -630,7 +995,7 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 			}
 			else if(m_binaryDivisions)
 			{
-				pivot = features[(size_t)m_rand.next(features.rows())][attr];
+				pivot = features[(size_t)rand.next(features.rows())][attr];
 				if(pivot == UNKNOWN_DISCRETE_VALUE)
 					pivot = features.baselineValue(attr);
 				if(m_randomDraws > 1)
@@ -662,7 +1027,7 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 		// ratio of homogeneous attributes.) Now, we need to be a little more systematic about finding a good
 		// attribute. (This is not specified in the random forest algorithm, but it can make a big difference
 		// with some problems.)
-		size_t k = (size_t)m_rand.next(attrPool.size());
+		size_t k = (size_t)rand.next(attrPool.size());
 		for(size_t i = 0; i < attrPool.size(); i++)
 		{
 			size_t index = (i + k) % attrPool.size();
@@ -685,7 +1050,7 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 					double d = features[j][attr];
 					if(d != UNKNOWN_REAL_VALUE && d > m)
 					{
-						if(m_rand.next(++candidates) == 0)
+						if(rand.next(++candidates) == 0)
 							*pPivot = d;
 					}
 				}
@@ -705,6 +1070,94 @@ size_t GDecisionTree::pickDivision(GMatrix& features, GMatrix& labels, double* p
 	return attrPool.size();
 }
 
+// Measuring a split temporarily moves rows between matrices, so each thread that evaluates attributes
+// in parallel needs its own views of the rows. (The views use a GMixedRelation so that mergeVert only
+// moves row pointers, and never writes nominal values back into the shared rows.)
+class GDecisionTreeSplitViews
+{
+public:
+	GMatrix m_features;
+	GMatrix m_labels;
+	GMatrix m_tmpFeatures;
+	GMatrix m_tmpLabels;
+
+	GDecisionTreeSplitViews(const GMatrix& features, const GMatrix& labels)
+	: m_features(new GMixedRelation(&features.relation())),
+	m_labels(new GMixedRelation(&labels.relation())),
+	m_tmpFeatures(new GMixedRelation(&features.relation())),
+	m_tmpLabels(new GMixedRelation(&labels.relation()))
+	{
+		m_features.reserve(features.rows());
+		m_labels.reserve(features.rows());
+		m_tmpFeatures.reserve(features.rows());
+		m_tmpLabels.reserve(features.rows());
+	}
+
+	~GDecisionTreeSplitViews()
+	{
+		release();
+	}
+
+	/// Refers to all the rows of features and labels in their current order. (This only copies
+	/// the row pointers, so it is cheap to restore the order after an attribute permuted them.)
+	void reset(const GMatrix& features, const GMatrix& labels)
+	{
+		m_features.borrowRows(features);
+		m_labels.borrowRows(labels);
+	}
+
+	void release()
+	{
+		m_features.releaseAllRows();
+		m_labels.releaseAllRows();
+		m_tmpFeatures.releaseAllRows();
+		m_tmpLabels.releaseAllRows();
+	}
+};
+
+size_t GDecisionTree::pickDivisionInParallel(GMatrix& features, GMatrix& labels, double* pPivot, vector<size_t>& attrPool, GRand& rand)
+{
+	// Give each attribute its own random stream, so the choice does not depend on scheduling
+	GAssert(labels.rows() > 0); // Can't work without data
+	vector<size_t> seeds(attrPool.size());
+	for(size_t i = 0; i < attrPool.size(); i++)
+		seeds[i] = (size_t)rand.next();
+
+	// Evaluate the attributes. Each thread builds its views the first time it needs them, and
+	// every attribute starts with the rows in the same order.
+	GThreadPool& pool = GThreadPool::global();
+	vector< std::unique_ptr<GDecisionTreeSplitViews> > views(pool.participants());
+	vector<double> infos(attrPool.size());
+	vector<double> pivots(attrPool.size(), 0.0);
+	pool.parallelForSlots(0, attrPool.size(), [&](size_t i, size_t slot)
+	{
+		if(!views[slot])
+			views[slot].reset(new GDecisionTreeSplitViews(features, labels));
+		GDecisionTreeSplitViews& v = *views[slot];
+		v.reset(features, labels);
+		GRand r(seeds[i]);
+		size_t attr = attrPool[i];
+		if(m_binaryDivisions || features.relation().valueCount(attr) == 0)
+			infos[i] = GDecisionTree_pickPivotToReduceInfo(v.m_features, v.m_labels, v.m_tmpFeatures, v.m_tmpLabels, &pivots[i], attr, &r);
+		else
+			infos[i] = GDecisionTree_measureNominalSplitInfo(v.m_features, v.m_labels, v.m_tmpFeatures, v.m_tmpLabels, attr);
+	});
+
+	// Pick the best one in a deterministic order
+	double bestInfo = 1e100;
+	size_t bestIndex = attrPool.size();
+	for(size_t i = 0; i < attrPool.size(); i++)
+	{
+		if(infos[i] + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+		{
+			bestInfo = infos[i];
+			bestIndex = i;
+		}
+	}
+	*pPivot = (bestIndex < attrPool.size() ? pivots[bestIndex] : 0.0);
+	return bestIndex;
+}
+
 double* GDecisionTreeNode_labelVec(GMatrix& labels)
 {
 	size_t n = labels.cols();
@@ -759,9 +1212,10 @@ public:
 };
 
 // This constructs the decision tree in a recursive depth-first manner
-GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels, vector<size_t>& attrPool, size_t nDepth, size_t tolerance)
+GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels, vector<size_t>& attrPool, size_t nDepth, size_t tolerance, GRand& rand)
 {
 	GAssert(features.rows() == labels.rows());
+	size_t rowCount = features.rows();
 
 	// Make a leaf if we're out of tolerance or the output is
 	// homogenous or there are no attributes left or we have
@@ -774,7 +1228,7 @@ GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels
 
 	// Pick the division
 	double pivot = 0.0;
-	size_t bestIndex = pickDivision(features, labels, &pivot, attrPool, nDepth);
+	size_t bestIndex = pickDivision(features, labels, &pivot, attrPool, nDepth, rand);
 
 	// Make a leaf if there are no good divisions
 	if(bestIndex >= attrPool.size()){
@@ -845,7 +1299,7 @@ GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels
 		else
 		{
 			// Try another division
-			GDecisionTreeNode* pNode = buildBranch(features, labels, attrPool, nDepth, tolerance - 1);
+			GDecisionTreeNode* pNode = buildBranch(features, labels, attrPool, nDepth, tolerance - 1, rand);
 			return pNode;
 		}
 	}
@@ -876,9 +1330,47 @@ GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels
 	std::unique_ptr<double[]> hBaselineVec(pBaselineVec);
 	GDecisionTreeInteriorNode* pNode = new GDecisionTreeInteriorNode(attr, pivot, featureParts.size() + 1, 0);
 	std::unique_ptr<GDecisionTreeInteriorNode> hNode(pNode);
+
+	// The default child is the one with the most rows (the first one, in case of a tie)
 	size_t biggest = features.rows();
+	for(size_t i = 0; i < featureParts.size(); i++)
+	{
+		if(featureParts[i]->rows() > biggest)
+		{
+			biggest = featureParts[i]->rows();
+			pNode->m_defaultChild = i + 1;
+		}
+	}
+	if(m_parallelNodeRows > 0 && rowCount >= m_parallelNodeRows)
+	{
+		// Build the branches concurrently. Each one gets its own random stream and its own copy of the attribute pool.
+		vector<GMatrix*> branchFeatures(1, &features);
+		branchFeatures.insert(branchFeatures.end(), featureParts.begin(), featureParts.end());
+		vector<GMatrix*> branchLabels(1, &labels);
+		branchLabels.insert(branchLabels.end(), labelParts.begin(), labelParts.end());
+		vector<size_t> seeds(branchFeatures.size());
+		for(size_t i = 0; i < branchFeatures.size(); i++)
+			seeds[i] = (size_t)rand.next();
+		GTaskGroup group(GThreadPool::global());
+		for(size_t i = 0; i < branchFeatures.size(); i++)
+		{
+			if(branchFeatures[i]->rows() > 0)
+			{
+				group.run([&, i]()
+				{
+					GRand childRand(seeds[i]);
+					vector<size_t> childPool(attrPool);
+					pNode->m_ppChildren[i] = buildBranch(*branchFeatures[i], *branchLabels[i], childPool, nDepth + 1, tolerance, childRand);
+				});
+			}
+			else
+				pNode->m_ppChildren[i] = new GDecisionTreeLeafNode(GDecisionTreeNode_copyIfNotTheLast(emptySets--, hBaselineVec, labels.cols()), 0);
+		}
+		group.wait();
+		return hNode.release();
+	}
 	if(features.rows() > 0){
-		pNode->m_ppChildren[0] = buildBranch(features, labels, attrPool, nDepth + 1, tolerance);
+		pNode->m_ppChildren[0] = buildBranch(features, labels, attrPool, nDepth + 1, tolerance, rand);
 	}else{
 		pNode->m_ppChildren[0] = new GDecisionTreeLeafNode(GDecisionTreeNode_copyIfNotTheLast(emptySets--, hBaselineVec, labels.cols()), 0);
 	}
@@ -886,30 +1378,219 @@ GDecisionTreeNode* GDecisionTree::buildBranch(GMatrix& features, GMatrix& labels
 	{
 		if(featureParts[i]->rows() > 0)
 		{
-			pNode->m_ppChildren[i + 1] = buildBranch(*featureParts[i], *labelParts[i], attrPool, nDepth + 1, tolerance);
-			if(featureParts[i]->rows() > biggest)
+			pNode->m_ppChildren[i + 1] = buildBranch(*featureParts[i], *labelParts[i], attrPool, nDepth + 1, tolerance, rand);
+		}
+		else
+			pNode->m_ppChildren[i + 1] = new GDecisionTreeLeafNode(GDecisionTreeNode_copyIfNotTheLast(emptySets--, hBaselineVec, labels.cols()), 0);
+	}
+	return hNode.release();
+}
+
+GDecisionTreeNode* GDecisionTree::buildHistogramBranch(GDecisionTreeHistogram& hist, size_t start, size_t end, vector<double>& histogram, size_t nDepth, GRand& rand)
+{
+	// Make a leaf if there are too few rows, the labels are homogenous,
+	// or we have reached the maximum number of levels in the tree
+	size_t stride = hist.m_stride;
+	vector<double> buf(stride * 3);
+	double* pTotals = buf.data();
+	double* pLeft = pTotals + stride;
+	double* pRight = pLeft + stride;
+	size_t rowCount = end - start;
+	if(histogram.size() == 0) // This happens when the parent already knew that this would be a leaf
+	{
+		for(size_t i = start; i < end; i++)
+			hist.addRow(pTotals, hist.m_indexes[i]);
+		return new GDecisionTreeLeafNode(hist.labelVec(pTotals), rowCount);
+	}
+	hist.totals(histogram, pTotals);
+	if(rowCount <= m_leafThresh || (nDepth + 1 == m_maxLevels) || hist.info(pTotals) <= 1e-12)
+		return new GDecisionTreeLeafNode(hist.labelVec(pTotals), rowCount);
+
+	// Pick the division
+	size_t attr = INVALID_INDEX;
+	size_t bin = 0;
+	bool missingLeft = false;
+	double bestInfo = 1e308;
+	if(m_eAlg == MINIMIZE_ENTROPY)
+	{
+		// Evaluate every attribute in parallel, then pick the best in a deterministic order
+		GThreadPool& pool = GThreadPool::global();
+		vector<double> slotBufs(pool.participants() * stride * 2);
+		vector<double> infos(hist.m_cols);
+		vector<size_t> bins(hist.m_cols);
+		vector<char> missingLefts(hist.m_cols);
+		pool.parallelForSlots(0, hist.m_cols, [&](size_t a, size_t slot)
+		{
+			if(hist.m_active.size() > 0 && !hist.m_active[a])
 			{
-				biggest = featureParts[i]->rows();
-				pNode->m_defaultChild = i + 1;
+				infos[a] = 1e308;
+				return;
 			}
+			double* pL = slotBufs.data() + slot * stride * 2;
+			bool ml = false;
+			infos[a] = hist.bestSplit(histogram, pTotals, a, &bins[a], &ml, pL, pL + stride);
+			missingLefts[a] = ml ? 1 : 0;
+		});
+		for(size_t a = 0; a < hist.m_cols; a++)
+		{
+			if(infos[a] + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+			{
+				bestInfo = infos[a];
+				attr = a;
+				bin = bins[a];
+				missingLeft = (missingLefts[a] != 0);
+			}
+		}
+	}
+	else if(m_eAlg == RANDOM)
+	{
+		// Pick the best division among m_randomDraws random attributes
+		for(size_t i = 0; i < m_randomDraws; i++)
+		{
+			size_t a = (size_t)rand.next(hist.m_cols);
+			size_t b = 0;
+			bool ml = false;
+			double dInfo = hist.bestSplit(histogram, pTotals, a, &b, &ml, pLeft, pRight);
+			if(dInfo + 1e-14 < bestInfo) // the small value makes it deterministic across hardware
+			{
+				bestInfo = dInfo;
+				attr = a;
+				bin = b;
+				missingLeft = ml;
+			}
+		}
+
+		// If the random draws were all homogenous, take the first attribute that can divide the data
+		size_t k = (size_t)rand.next(hist.m_cols);
+		for(size_t i = 0; i < hist.m_cols && attr == INVALID_INDEX; i++)
+		{
+			size_t a = (i + k) % hist.m_cols;
+			if(hist.bestSplit(histogram, pTotals, a, &bin, &missingLeft, pLeft, pRight) < 1e308)
+				attr = a;
 		}
+	}
+	else
+		GAssert(false); // unknown division algorithm
+
+	// Make a leaf if there are no good divisions
+	if(attr == INVALID_INDEX)
+		return new GDecisionTreeLeafNode(hist.labelVec(pTotals), rowCount);
+
+	// Divide the rows by permuting their indexes
+	size_t* pIndexes = hist.m_indexes.data();
+	size_t mid = std::partition(pIndexes + start, pIndexes + end, [&](size_t row)
+	{
+		return hist.goesLeft(attr, bin, missingLeft, row);
+	}) - pIndexes;
+	GAssert(mid > start && mid < end);
+
+	// Build the histogram of the smaller child, and obtain the other one by subtraction.
+	// (If both children will be leaves, they do not need histograms.)
+	bool leftSmaller = (mid - start <= end - mid);
+	vector<double> smallHistogram;
+	if(std::max(mid - start, end - mid) <= m_leafThresh || nDepth + 2 == m_maxLevels)
+		histogram.clear();
+	else
+	{
+		if(leftSmaller)
+			hist.buildHistogram(start, mid, smallHistogram);
 		else
-			pNode->m_ppChildren[i + 1] = new GDecisionTreeLeafNode(GDecisionTreeNode_copyIfNotTheLast(emptySets--, hBaselineVec, labels.cols()), 0);
+			hist.buildHistogram(mid, end, smallHistogram);
+		for(size_t i = 0; i < histogram.size(); i++)
+			histogram[i] -= smallHistogram[i];
+	}
+
+	// Make an interior node. (GDecisionTree::findLeaf treats an unknown nominal value as though
+	// it were the value m_defaultChild, so for nominal attributes the default child is just a
+	// value that differs from the pivot, unless the attribute has only one value.)
+	GDecisionTreeInteriorNode* pNode;
+	if(hist.m_nominal[attr])
+		pNode = new GDecisionTreeInteriorNode(attr, (double)bin, 2, std::min((size_t)(bin == 1 ? 0 : 1), hist.m_binCounts[attr] - 1));
+	else
+		pNode = new GDecisionTreeInteriorNode(attr, hist.m_thresholds[attr][bin], 2, missingLeft ? 0 : 1);
+	std::unique_ptr<GDecisionTreeInteriorNode> hNode(pNode);
+	vector<double>& leftHistogram = leftSmaller ? smallHistogram : histogram;
+	vector<double>& rightHistogram = leftSmaller ? histogram : smallHistogram;
+	if(m_parallelNodeRows > 0 && rowCount >= m_parallelNodeRows)
+	{
+		// Build the left branch in another thread while this one builds the right branch.
+		// (They permute disjoint ranges of hist.m_indexes, and each one gets its own random stream.)
+		GRand leftRand((size_t)rand.next());
+		GRand rightRand((size_t)rand.next());
+		GTaskGroup group(GThreadPool::global());
+		group.run([&]()
+		{
+			pNode->m_ppChildren[0] = buildHistogramBranch(hist, start, mid, leftHistogram, nDepth + 1, leftRand);
+		});
+		pNode->m_ppChildren[1] = buildHistogramBranch(hist, mid, end, rightHistogram, nDepth + 1, rightRand);
+		group.wait();
+	}
+	else
+	{
+		pNode->m_ppChildren[0] = buildHistogramBranch(hist, start, mid, leftHistogram, nDepth + 1, rand);
+		pNode->m_ppChildren[1] = buildHistogramBranch(hist, mid, end, rightHistogram, nDepth + 1, rand);
 	}
 	return hNode.release();
 }
 
-GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
+GDecisionTreeNode* GDecisionTree::buildHistogramTree(GDecisionTreeHistogram& hist, vector<size_t>& indexes, const vector<char>& active, GRand& rand)
 {
-	if(!m_pRoot)
-		throw Ex("Not trained yet");
-	GDecisionTreeNode* pNode = m_pRoot;
+	hist.m_indexes.swap(indexes);
+	hist.m_active = active;
+	vector<double> histogram;
+	size_t n = hist.m_indexes.size();
+	hist.buildHistogram(0, n, histogram);
+	GDecisionTreeNode* pRoot = buildHistogramBranch(hist, 0, n, histogram, 0/*depth*/, rand);
+	hist.m_indexes.swap(indexes);
+	return pRoot;
+}
+
+// static
+GDecisionTreeHistogram* GDecisionTree::newHistogram(const GMatrix& features, const GMatrix& labels, size_t bins)
+{
+	return new GDecisionTreeHistogram(features, labels, bins);
+}
+
+// static
+void GDecisionTree::deleteHistogram(GDecisionTreeHistogram* pHist)
+{
+	delete(pHist);
+}
+
+// static
+double* GDecisionTree::leafValues(GDecisionTreeLeafNode* pLeaf)
+{
+	return pLeaf->m_pOutputValues;
+}
+
+// static
+GDomNode* GDecisionTree::serializeTree(GDecisionTreeNode* pRoot, GDom* pDoc, size_t outputCount)
+{
+	return pRoot->serialize(pDoc, outputCount);
+}
+
+// static
+GDecisionTreeNode* GDecisionTree::deserializeTree(const GDomNode* pNode)
+{
+	return GDecisionTreeNode::deserialize(pNode);
+}
+
+// static
+void GDecisionTree::deleteTree(GDecisionTreeNode* pRoot)
+{
+	delete(pRoot);
+}
+
+// static
+GDecisionTreeLeafNode* GDecisionTree::findLeaf(GDecisionTreeNode* pRoot, const GRelation& featureRel, bool binaryDivisions, const GVec& in, size_t* pDepth)
+{
+	GDecisionTreeNode* pNode = pRoot;
 	int nVal;
 	size_t nDepth = 1;
 	while(!pNode->IsLeaf())
 	{
 		GDecisionTreeInteriorNode* pInterior = (GDecisionTreeInteriorNode*)pNode;
-		if(m_pRelFeatures->valueCount(pInterior->m_nAttribute) == 0)
+		if(featureRel.valueCount(pInterior->m_nAttribute) == 0)
 		{
 			if(in[pInterior->m_nAttribute] == UNKNOWN_REAL_VALUE)
 				pNode = pInterior->m_ppChildren[pInterior->m_defaultChild];
@@ -918,7 +1599,7 @@ GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
 			else
 				pNode = pInterior->m_ppChildren[1];
 		}
-		else if(m_binaryDivisions)
+		else if(binaryDivisions)
 		{
 			nVal = (int)in[pInterior->m_nAttribute];
 			if(nVal < 0)
@@ -926,7 +1607,7 @@ GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
 				GAssert(nVal == UNKNOWN_DISCRETE_VALUE); // out of range
 				nVal = (int)pInterior->m_defaultChild;
 			}
-			GAssert((size_t)nVal < m_pRelFeatures->valueCount(pInterior->m_nAttribute)); // value out of range
+			GAssert((size_t)nVal < featureRel.valueCount(pInterior->m_nAttribute)); // value out of range
 			if(nVal == (int)pInterior->m_dPivot)
 				pNode = pInterior->m_ppChildren[0];
 			else
@@ -940,7 +1621,7 @@ GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
 				GAssert(nVal == UNKNOWN_DISCRETE_VALUE); // out of range
 				nVal = (int)pInterior->m_defaultChild;
 			}
-			GAssert((size_t)nVal < m_pRelFeatures->valueCount(pInterior->m_nAttribute)); // value out of range
+			GAssert((size_t)nVal < featureRel.valueCount(pInterior->m_nAttribute)); // value out of range
 			pNode = pInterior->m_ppChildren[nVal];
 		}
 		nDepth++;
@@ -949,9 +1630,21 @@ GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
 	return (GDecisionTreeLeafNode*)pNode;
 }
 
+GDecisionTreeLeafNode* GDecisionTree::findLeaf(const GVec& in, size_t* pDepth)
+{
+	if(!m_pRoot)
+		throw Ex("Not trained yet");
+	return findLeaf(m_pRoot, *m_pRelFeatures, m_binaryDivisions, in, pDepth);
+}
+
 // virtual
 void GDecisionTree::predict(const GVec& in, GVec& out)
 {
+	if(m_pCompiled)
+	{
+		m_pCompiled->predict(in, out);
+		return;
+	}
 	size_t depth;
 	GDecisionTreeLeafNode* pLeaf = findLeaf(in, &depth);
 	out.set(pLeaf->m_pOutputValues, m_pRelLabels->size());
@@ -980,12 +1673,90 @@ void GDecisionTree::clear()
 {
 	delete(m_pRoot);
 	m_pRoot = NULL;
+	delete(m_pCompiled);
+	m_pCompiled = NULL;
+}
+
+void GDecisionTree::compile()
+{
+	GCompiledForest* pCompiled = new GCompiledForest(*m_pRelLabels);
+	std::unique_ptr<GCompiledForest> hCompiled(pCompiled);
+	pCompiled->addTree(*this);
+	delete(m_pCompiled);
+	m_pCompiled = hCompiled.release();
+}
+
+// virtual
+void GDecisionTree::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	prepareBatch(features, labels);
+	if(m_pCompiled)
+		m_pCompiled->predict(features, labels);
+	else
+		GSupervisedLearner::predictBatch(features, labels);
 }
 
 #ifndef NO_TEST_CODE
 // static
+// Trains the learner with a wide problem that has continuous and nominal features, and returns the serialized model
+string GDecisionTree_trainWide(GSupervisedLearner& learner)
+{
+	GRand rand(0);
+	GArffRelation* pFRel = new GArffRelation();
+	for(size_t i = 0; i < 40; i++)
+		pFRel->addAttribute(to_str(i).c_str(), i % 4 == 0 ? 3 : 0, NULL);
+	GArffRelation* pLRel = new GArffRelation();
+	pLRel->addAttribute("y", 3, NULL);
+	GMatrix features(pFRel);
+	GMatrix labels(pLRel);
+	for(size_t i = 0; i < 500; i++)
+	{
+		GVec& f = features.newRow();
+		for(size_t j = 0; j < features.cols(); j++)
+			f[j] = (j % 4 == 0 ? (double)rand.next(3) : rand.normal());
+		labels.newRow()[0] = (double)(((size_t)std::abs(f[1] + f[2]) + (size_t)f[4]) % 3);
+	}
+	learner.train(features, labels);
+	GDom doc;
+	doc.setRoot(learner.serialize(&doc));
+	ostringstream os;
+	doc.writeJson(os);
+	return os.str();
+}
+
 void GDecisionTree::test()
 {
+	{
+		// Trees that build branches and evaluate attributes concurrently must not depend on scheduling
+		for(size_t kind = 0; kind < 3; kind++)
+		{
+			string first;
+			for(size_t i = 0; i < 3; i++)
+			{
+				GDecisionTree tree;
+				tree.setParallelNodeRows(16);
+				tree.setParallelAttrs(8);
+				if(kind == 1)
+					tree.useRandomDivisions(3);
+				else if(kind == 2)
+				{
+					tree.useHistogramSplits(32);
+					tree.useRandomDivisions(3);
+				}
+				string s = GDecisionTree_trainWide(tree);
+				if(i == 0)
+					first = s;
+				else if(s != first)
+					throw Ex("a parallel tree depends on scheduling");
+			}
+		}
+	}
+	{
+		GDecisionTree parallelTree;
+		parallelTree.setParallelNodeRows(20);
+		parallelTree.setParallelAttrs(1);
+		parallelTree.basicTest(0.70, 0.84);
+	}
 	{
 		GDecisionTree tree;
 		tree.basicTest(0.704, 0.77);
@@ -1000,6 +1771,246 @@ void GDecisionTree::test()
 		ml1Tree.setMaxLevels(1);
 		ml1Tree.basicTest(0.33, 0.33);
 	}
+	{
+		GDecisionTree histTree;
+		histTree.useHistogramSplits();
+		histTree.basicTest(0.70, 0.83);
+	}
+	{
+		GDecisionTree histForestTree;
+		histForestTree.useHistogramSplits(16);
+		histForestTree.useRandomDivisions(2);
+		histForestTree.basicTest(0.73, 0.79);
+	}
+}
+#endif
+
+// ----------------------------------------------------------------------
+
+#define COMPILED_FOREST_BLOCK_ROWS 256
+
+GCompiledForest::GCompiledForest(const GRelation& labelRel)
+: m_labelDims(labelRel.size()), m_voteDims(0)
+{
+	for(size_t i = 0; i < m_labelDims; i++)
+	{
+		m_labelValues.push_back(labelRel.valueCount(i));
+		m_voteDims += std::max((size_t)1, labelRel.valueCount(i));
+	}
+}
+
+void GCompiledForest::addTree(const GDecisionTree& tree, double weight)
+{
+	if(!tree.m_pRoot)
+		throw Ex("The tree has not been trained");
+	if(tree.m_pRelLabels->size() != m_labelDims)
+		throw Ex("Expected ", to_str(m_labelDims), " label dims. Got ", to_str(tree.m_pRelLabels->size()));
+	const GRelation& featureRel = *tree.m_pRelFeatures;
+
+	// Lay out the nodes in breadth-first order, so the children of each node are contiguous
+	size_t root = m_kinds.size();
+	m_roots.push_back(root);
+	m_weights.push_back(weight);
+	vector<GDecisionTreeNode*> queue;
+	queue.push_back(tree.m_pRoot);
+	m_kinds.resize(root + 1);
+	m_attrs.resize(root + 1);
+	m_pivots.resize(root + 1);
+	m_children.resize(root + 1);
+	m_defaults.resize(root + 1);
+	for(size_t i = 0; i < queue.size(); i++)
+	{
+		size_t n = root + i;
+		if(queue[i]->IsLeaf())
+		{
+			GDecisionTreeLeafNode* pLeaf = (GDecisionTreeLeafNode*)queue[i];
+			m_kinds[n] = LEAF;
+			m_attrs[n] = 0;
+			m_pivots[n] = 0.0;
+			m_defaults[n] = 0;
+			m_children[n] = m_leafValues.size();
+			for(size_t j = 0; j < m_labelDims; j++)
+				m_leafValues.push_back(pLeaf->m_pOutputValues[j]);
+		}
+		else
+		{
+			GDecisionTreeInteriorNode* pInterior = (GDecisionTreeInteriorNode*)queue[i];
+			if(featureRel.valueCount(pInterior->m_nAttribute) == 0)
+				m_kinds[n] = CONTINUOUS;
+			else if(tree.m_binaryDivisions)
+				m_kinds[n] = BINARY;
+			else
+				m_kinds[n] = NOMINAL;
+			m_attrs[n] = (unsigned int)pInterior->m_nAttribute;
+			m_pivots[n] = pInterior->m_dPivot;
+			m_defaults[n] = (unsigned int)pInterior->m_defaultChild;
+			m_children[n] = root + queue.size();
+			for(size_t j = 0; j < pInterior->m_nChildren; j++)
+				queue.push_back(pInterior->m_ppChildren[j]);
+			m_kinds.resize(root + queue.size());
+			m_attrs.resize(root + queue.size());
+			m_pivots.resize(root + queue.size());
+			m_children.resize(root + queue.size());
+			m_defaults.resize(root + queue.size());
+		}
+	}
+}
+
+void GCompiledForest::castVote(size_t leaf, double weight, double* pVotes) const
+{
+	const double* pValues = m_leafValues.data() + m_children[leaf];
+	for(size_t i = 0; i < m_labelDims; i++)
+	{
+		size_t nValues = m_labelValues[i];
+		if(nValues > 0)
+		{
+			int nVal = (int)pValues[i];
+			if(nVal >= 0 && nVal < (int)nValues)
+				pVotes[nVal] += weight;
+			pVotes += nValues;
+		}
+		else
+			*(pVotes++) += weight * pValues[i];
+	}
+}
+
+void GCompiledForest::tally(const double* pVotes, GVec& out) const
+{
+	for(size_t i = 0; i < m_labelDims; i++)
+	{
+		size_t nValues = m_labelValues[i];
+		if(nValues > 0)
+		{
+			size_t best = 0;
+			for(size_t j = 1; j < nValues; j++)
+			{
+				if(pVotes[j] > pVotes[best])
+					best = j;
+			}
+			out[i] = (double)best;
+			pVotes += nValues;
+		}
+		else
+			out[i] = *(pVotes++);
+	}
+}
+
+void GCompiledForest::predict(const GVec& in, GVec& out) const
+{
+	GTEMPBUF(double, pVotes, m_voteDims);
+	std::fill(pVotes, pVotes + m_voteDims, 0.0);
+	for(size_t i = 0; i < m_roots.size(); i++)
+		castVote(findLeaf(m_roots[i], in), m_weights[i], pVotes);
+	out.resize(m_labelDims);
+	tally(pVotes, out);
+}
+
+void GCompiledForest::predict(const GMatrix& features, GMatrix& labels) const
+{
+	size_t rows = features.rows();
+	if(labels.rows() != rows || labels.cols() != m_labelDims)
+		labels.resize(rows, m_labelDims);
+	size_t blocks = (rows + COMPILED_FOREST_BLOCK_ROWS - 1) / COMPILED_FOREST_BLOCK_ROWS;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t block)
+	{
+		size_t start = block * COMPILED_FOREST_BLOCK_ROWS;
+		size_t end = std::min(rows, start + COMPILED_FOREST_BLOCK_ROWS);
+		vector<double> votes((end - start) * m_voteDims, 0.0);
+		for(size_t t = 0; t < m_roots.size(); t++)
+		{
+			size_t root = m_roots[t];
+			double weight = m_weights[t];
+			double* pVotes = votes.data();
+			for(size_t i = start; i < end; i++)
+			{
+				castVote(findLeaf(root, features[i]), weight, pVotes);
+				pVotes += m_voteDims;
+			}
+		}
+		for(size_t i = start; i < end; i++)
+			tally(votes.data() + (i - start) * m_voteDims, labels[i]);
+	});
+}
+
+#ifndef NO_TEST_CODE
+// static
+void GCompiledForest::test()
+{
+	// Make a dataset with a continuous feature, a nominal feature, some missing values,
+	// a continuous label, and a nominal label
+	GRand rand(0);
+	GArffRelation* pFRel = new GArffRelation();
+	pFRel->addAttribute("x", 0, NULL);
+	pFRel->addAttribute("c", 4, NULL);
+	GArffRelation* pLRel = new GArffRelation();
+	pLRel->addAttribute("y", 0, NULL);
+	pLRel->addAttribute("k", 3, NULL);
+	GMatrix features(pFRel);
+	GMatrix labels(pLRel);
+	for(size_t i = 0; i < 600; i++)
+	{
+		GVec& f = features.newRow();
+		GVec& l = labels.newRow();
+		f[0] = rand.uniform() * 10.0;
+		f[1] = (double)rand.next(4);
+		l[0] = f[0] * f[1] + rand.normal();
+		l[1] = (double)(((size_t)f[0] + (size_t)f[1]) % 3);
+		if(rand.next(20) == 0)
+			f[0] = UNKNOWN_REAL_VALUE;
+		if(rand.next(20) == 0)
+			f[1] = UNKNOWN_DISCRETE_VALUE;
+	}
+	GMatrix test(features);
+	for(size_t i = 0; i < test.rows(); i++)
+	{
+		test[i][0] += rand.normal();
+		if(rand.next(10) == 0)
+			test[i][0] = UNKNOWN_REAL_VALUE;
+	}
+
+	// Compiled trees must make exactly the same predictions as the node objects
+	GVec expected(2);
+	GVec actual(2);
+	GMatrix batch;
+	for(size_t kind = 0; kind < 3; kind++)
+	{
+		GDecisionTree tree;
+		if(kind == 1)
+			tree.useBinaryDivisions();
+		else if(kind == 2)
+			tree.useHistogramSplits(32);
+		tree.train(features, labels);
+		GMatrix ref(test.rows(), 2);
+		for(size_t i = 0; i < test.rows(); i++)
+			tree.predict(test[i], ref[i]);
+		tree.compile();
+		if(tree.compiled()->nodes() != tree.treeSize())
+			throw Ex("wrong node count");
+		tree.predictBatch(test, batch);
+		for(size_t i = 0; i < test.rows(); i++)
+		{
+			tree.predict(test[i], actual);
+			if(actual.squaredDistance(ref[i]) != 0.0 || batch[i].squaredDistance(ref[i]) != 0.0)
+				throw Ex("compiled tree disagrees");
+		}
+	}
+	GRandomForest rf(12);
+	rf.train(features, labels);
+	GMatrix ref(test.rows(), 2);
+	for(size_t i = 0; i < test.rows(); i++)
+		rf.predict(test[i], ref[i]);
+	rf.compile();
+	if(rf.compiled()->trees() != 12)
+		throw Ex("wrong tree count");
+	rf.predictBatch(test, batch);
+	for(size_t i = 0; i < test.rows(); i++)
+	{
+		rf.predict(test[i], actual);
+		if(std::abs(actual[0] - ref[i][0]) > 1e-9 || actual[1] != ref[i][1])
+			throw Ex("compiled forest disagrees");
+		if(std::abs(batch[i][0] - ref[i][0]) > 1e-9 || batch[i][1] != ref[i][1])
+			throw Ex("batched forest disagrees");
+	}
 }
 #endif
 
@@ -1359,7 +2370,7 @@ void GMeanMarginsTree::test()
 
 
 GRandomForest::GRandomForest(size_t trees, size_t samples)
-: GSupervisedLearner()
+: GSupervisedLearner(), m_pCompiled(NULL), m_trainThreads(INVALID_INDEX)
 {
 	m_pEnsemble = new GBag();
 	for(size_t i = 0; i < trees; i++)
@@ -1372,7 +2383,7 @@ GRandomForest::GRandomForest(size_t trees, size_t samples)
 }
 
 GRandomForest::GRandomForest(const GDomNode* pNode, GLearnerLoader& ll)
-: GSupervisedLearner(pNode)
+: GSupervisedLearner(pNode), m_pCompiled(NULL), m_trainThreads(INVALID_INDEX)
 {
 	m_pEnsemble = new GBag(pNode->field("bag"), ll);
 }
@@ -1381,6 +2392,7 @@ GRandomForest::GRandomForest(const GDomNode* pNode, GLearnerLoader& ll)
 GRandomForest::~GRandomForest()
 {
 	delete(m_pEnsemble);
+	delete(m_pCompiled);
 }
 
 // virtual
@@ -1395,6 +2407,40 @@ GDomNode* GRandomForest::serialize(GDom* pDoc) const
 void GRandomForest::clear()
 {
 	m_pEnsemble->clear();
+	delete(m_pCompiled);
+	m_pCompiled = NULL;
+}
+
+GCompiledForest* GRandomForest::newCompiledForest()
+{
+	GCompiledForest* pCompiled = new GCompiledForest(*m_pRelLabels);
+	std::unique_ptr<GCompiledForest> hCompiled(pCompiled);
+	std::vector<GWeightedModel*>& models = m_pEnsemble->models();
+	for(size_t i = 0; i < models.size(); i++)
+		pCompiled->addTree(*(GDecisionTree*)models[i]->m_pModel, models[i]->m_weight);
+	return hCompiled.release();
+}
+
+void GRandomForest::compile()
+{
+	GCompiledForest* pCompiled = newCompiledForest();
+	delete(m_pCompiled);
+	m_pCompiled = pCompiled;
+}
+
+// virtual
+void GRandomForest::predictBatch(const GMatrix& features, GMatrix& labels)
+{
+	prepareBatch(features, labels);
+	if(m_pCompiled)
+		m_pCompiled->predict(features, labels);
+	else
+	{
+		// The ensemble tallies its votes in shared buffers, so it cannot predict concurrently.
+		// Compiling the trees takes much less time than predicting a large batch, though.
+		std::unique_ptr<GCompiledForest> hCompiled(newCompiledForest());
+		hCompiled->predict(features, labels);
+	}
 }
 
 void GRandomForest::print(std::ostream& stream, GArffRelation* pFeatureRel, GArffRelation* pLabelRel)
@@ -1411,13 +2457,30 @@ void GRandomForest::print(std::ostream& stream, GArffRelation* pFeatureRel, GArf
 // virtual
 void GRandomForest::trainInner(const GMatrix& features, const GMatrix& labels)
 {
-	m_pEnsemble->train(features, labels);
+	delete(m_pCompiled);
+	m_pCompiled = NULL;
+
+	// Grow the trees concurrently, then go back to predicting with one thread
+	m_pEnsemble->setWorkerThreads(m_trainThreads);
+	try
+	{
+		m_pEnsemble->train(features, labels);
+	}
+	catch(...)
+	{
+		m_pEnsemble->setWorkerThreads(1);
+		throw;
+	}
+	m_pEnsemble->setWorkerThreads(1);
 }
 
 // virtual
 void GRandomForest::predict(const GVec& in, GVec& out)
 {
-	m_pEnsemble->predict(in, out);
+	if(m_pCompiled)
+		m_pCompiled->predict(in, out);
+	else
+		m_pEnsemble->predict(in, out);
 }
 
 // virtual
@@ -1430,7 +2493,17 @@ void GRandomForest::predictDistribution(const GVec& in, GPrediction* out)
 // static
 void GRandomForest::test()
 {
-	GRandomForest rf(30);
-	rf.basicTest(0.762, 0.925, 0.01);
+	{
+		GRandomForest rf(30);
+		rf.basicTest(0.762, 0.925, 0.01);
+	}
+	{
+		// The trees are grown concurrently, but the forest must not depend on the number of threads
+		GRandomForest twoThreads(16, 2);
+		twoThreads.setTrainThreads(2);
+		GRandomForest allThreads(16, 2);
+		if(GDecisionTree_trainWide(twoThreads) != GDecisionTree_trainWide(allThreads))
+			throw Ex("the forest depends on the number of threads");
+	}
 }
 #endif
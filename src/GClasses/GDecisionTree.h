@@ -30,6 +30,8 @@ class GRegressionTreeNode;
 class GRand;
 class GMeanMarginsTreeNode;
 class GDecisionTreeLeafNode;
+class GDecisionTreeHistogram;
+class GCompiledForest;
 class GBag;
 
 
@@ -52,6 +54,10 @@ protected:
 	size_t m_randomDraws;
 	size_t m_maxLevels;
 	bool m_binaryDivisions;
+	size_t m_histogramBins;
+	size_t m_parallelNodeRows;
+	size_t m_parallelAttrs;
+	GCompiledForest* m_pCompiled;
 
 public:
 	/// General-purpose constructor. See also the comment for GSupervisedLearner::GSupervisedLearner.
@@ -90,11 +96,39 @@ public:
 	/// Returns true iff useBinaryDivisions was called.
 	bool isBinary() { return m_binaryDivisions; }
 
+	/// Specifies to train with histogram-based split finding. Each feature is quantized
+	/// once into at most bins - 1 quantile bins (one more bin is reserved for missing values),
+	/// and the splits are found from per-node label histograms instead of by repeatedly
+	/// dividing the data. This is much faster with large datasets, and the pivots are limited
+	/// to the bin boundaries. Nominal features may have at most bins - 1 values.
+	/// This implies useBinaryDivisions. bins must be from 3 to 256. Pass 0 to turn it off.
+	void useHistogramSplits(size_t bins = 256);
+
+	/// Returns the number of bins used for histogram-based split finding, or 0 if it is not used.
+	size_t histogramBins() { return m_histogramBins; }
+
 	/// Sets the leaf threshold. When the number of samples is <= this value,
 	/// it will no longer try to divide the data, but will create a leaf node.
 	/// The default value is 1. For noisy data, a larger value may be advantageous.
 	void setLeafThresh(size_t n) { m_leafThresh = n; }
 
+	/// Specifies to build the branches below any node with at least rows training
+	/// rows concurrently on the global thread pool. Each of those branches draws its
+	/// random numbers from its own stream, seeded from its parent's, so the trained tree
+	/// depends only on the seed and this setting, not on the number of threads.
+	/// Pass 0 (the default) to build every branch in the calling thread.
+	void setParallelNodeRows(size_t rows) { m_parallelNodeRows = rows; }
+
+	/// Returns the row count at which branches are built concurrently, or 0 if they are not.
+	size_t parallelNodeRows() { return m_parallelNodeRows; }
+
+	/// Specifies to evaluate the candidate attributes of a node in parallel when there are
+	/// at least attrs of them. This only applies to MINIMIZE_ENTROPY divisions without
+	/// histograms. (Histogram split finding always evaluates attributes in parallel.)
+	/// As with setParallelNodeRows, each attribute gets its own random stream, so the result
+	/// does not depend on the number of threads. Pass 0 (the default) to turn it off.
+	void setParallelAttrs(size_t attrs) { m_parallelAttrs = attrs; }
+
 	/// Sets the max levels.  When a path from the root to the
 	/// current node contains n nodes (including the root), it
 	/// will no longer try to divide the data, but will create a
@@ -105,6 +139,18 @@ public:
 	/// Frees the model
 	virtual void clear();
 
+	/// Packs the trained tree into contiguous node tables. After this is called,
+	/// predict and predictBatch walk the tables instead of the node objects.
+	/// Training or clearing the model discards them.
+	void compile();
+
+	/// Returns the compiled node tables, or NULL if compile has not been called.
+	const GCompiledForest* compiled() const { return m_pCompiled; }
+
+	/// See the comment for GSupervisedLearner::predictBatch.
+	/// This uses the compiled tables if they exist.
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// Returns the number of nodes in this tree
 	size_t treeSize();
 
@@ -120,6 +166,15 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+#ifndef MIN_PREDICT
+	/// Returns true, since the serialized tree includes all of its training settings.
+	/// See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return true; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
@@ -130,8 +185,12 @@ protected:
 	/// Finds the leaf node that corresponds with the specified feature vector
 	GDecisionTreeLeafNode* findLeaf(const GVec& pIn, size_t* pDepth);
 
+	/// Finds the leaf of the tree at pRoot that corresponds with the specified feature vector.
+	/// featureRel describes the features, and binaryDivisions tells how the nominal attributes were divided.
+	static GDecisionTreeLeafNode* findLeaf(GDecisionTreeNode* pRoot, const GRelation& featureRel, bool binaryDivisions, const GVec& in, size_t* pDepth);
+
 	/// A recursive helper method used to construct the decision tree
-	GDecisionTreeNode* buildBranch(GMatrix& features, GMatrix& labels, std::vector<size_t>& attrPool, size_t nDepth, size_t tolerance);
+	GDecisionTreeNode* buildBranch(GMatrix& features, GMatrix& labels, std::vector<size_t>& attrPool, size_t nDepth, size_t tolerance, GRand& rand);
 
 	/// InfoGain is defined as the difference in entropy in the data
 	/// before and after dividing it based on the specified attribute. For
@@ -140,7 +199,148 @@ protected:
 	/// dividing at the point the maximizes this value.
 	double measureInfoGain(GMatrix* pData, size_t nAttribute, double* pPivot);
 
-	size_t pickDivision(GMatrix& features, GMatrix& labels, double* pPivot, std::vector<size_t>& attrPool, size_t nDepth);
+	size_t pickDivision(GMatrix& features, GMatrix& labels, double* pPivot, std::vector<size_t>& attrPool, size_t nDepth, GRand& rand);
+
+	/// Like the MINIMIZE_ENTROPY case of pickDivision, except the attributes are evaluated in parallel
+	size_t pickDivisionInParallel(GMatrix& features, GMatrix& labels, double* pPivot, std::vector<size_t>& attrPool, GRand& rand);
+
+	friend class GCompiledForest;
+	friend class GGradientBoostedTrees;
+
+	/// A recursive helper method that builds the tree from the pre-binned data in hist.
+	/// The rows of this branch are the indexes in [start, end), and histogram holds
+	/// their label statistics. (It is consumed to compute the histogram of the larger child.)
+	GDecisionTreeNode* buildHistogramBranch(GDecisionTreeHistogram& hist, size_t start, size_t end, std::vector<double>& histogram, size_t nDepth, GRand& rand);
+
+	/// Grows a tree (with the settings of this object) from the rows of hist listed in indexes,
+	/// which is permuted so that the rows of each leaf are adjacent. If active is not empty, only
+	/// the attributes with a non-zero value in it are divided on. (The caller must delete the
+	/// tree with deleteTree.) GGradientBoostedTrees uses this to grow a tree each round without
+	/// quantizing the features again.
+	GDecisionTreeNode* buildHistogramTree(GDecisionTreeHistogram& hist, std::vector<size_t>& indexes, const std::vector<char>& active, GRand& rand);
+
+	/// Quantizes the features for buildHistogramTree. labels is referenced, not copied, so its
+	/// values may be changed between trees. (The caller must delete it with deleteHistogram.)
+	static GDecisionTreeHistogram* newHistogram(const GMatrix& features, const GMatrix& labels, size_t bins);
+
+	/// Deletes a histogram made by newHistogram
+	static void deleteHistogram(GDecisionTreeHistogram* pHist);
+
+	/// Returns the output values of a leaf
+	static double* leafValues(GDecisionTreeLeafNode* pLeaf);
+
+	/// Marshals a tree with outputCount values in each leaf
+	static GDomNode* serializeTree(GDecisionTreeNode* pRoot, GDom* pDoc, size_t outputCount);
+
+	/// Loads a tree that was marshaled with serializeTree
+	static GDecisionTreeNode* deserializeTree(const GDomNode* pNode);
+
+	/// Deletes a tree made by buildHistogramTree or deserializeTree
+	static void deleteTree(GDecisionTreeNode* pRoot);
+};
+
+
+
+/// Holds one or more trained decision trees packed into contiguous
+/// struct-of-arrays node tables, so that prediction does not chase pointers
+/// across the heap. The children of each interior node are stored next to
+/// each other, so a node only needs the index of its first child. Predictions
+/// are combined with the same weighted voting that GEnsemble uses.
+class GCompiledForest
+{
+protected:
+	enum NodeKind
+	{
+		LEAF,
+		CONTINUOUS, // child 0 if the value < pivot, else child 1
+		BINARY, // child 0 if the value == pivot, else child 1
+		NOMINAL, // the value is the index of the child
+	};
+
+	size_t m_labelDims;
+	size_t m_voteDims;
+	std::vector<size_t> m_labelValues;
+	std::vector<size_t> m_roots;
+	std::vector<double> m_weights;
+	std::vector<unsigned char> m_kinds;
+	std::vector<unsigned int> m_attrs;
+	std::vector<double> m_pivots;
+	std::vector<size_t> m_children; // For interior nodes, the index of the first child. For leaves, the index of the first value in m_leafValues.
+	std::vector<unsigned int> m_defaults;
+	std::vector<double> m_leafValues;
+
+public:
+	/// labelRel specifies the meta-data of the labels that the trees predict.
+	GCompiledForest(const GRelation& labelRel);
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif
+
+	/// Appends the node tables of a trained tree. weight is its vote in the ensemble.
+	void addTree(const GDecisionTree& tree, double weight = 1.0);
+
+	/// Returns the number of trees that have been added.
+	size_t trees() const { return m_roots.size(); }
+
+	/// Returns the total number of nodes in all of the trees.
+	size_t nodes() const { return m_kinds.size(); }
+
+	/// Predicts the labels for a single feature vector.
+	void predict(const GVec& in, GVec& out) const;
+
+	/// Predicts a label vector for each row in features. labels is resized if it does not
+	/// already have the right shape. The rows are processed in blocks, and every tree is applied to a whole block
+	/// before moving on to the next tree, so the nodes stay in cache. The blocks are
+	/// distributed over the global thread pool.
+	void predict(const GMatrix& features, GMatrix& labels) const;
+
+protected:
+	/// Returns the index of the leaf that the specified tree reaches with the feature vector in.
+	size_t findLeaf(size_t root, const GVec& in) const
+	{
+		size_t n = root;
+		while(true)
+		{
+			switch(m_kinds[n])
+			{
+				case LEAF:
+					return n;
+				case CONTINUOUS:
+				{
+					double d = in[m_attrs[n]];
+					if(d == UNKNOWN_REAL_VALUE)
+						n = m_children[n] + m_defaults[n];
+					else
+						n = m_children[n] + (d < m_pivots[n] ? 0 : 1);
+					break;
+				}
+				case BINARY:
+				{
+					int v = (int)in[m_attrs[n]];
+					if(v < 0)
+						v = (int)m_defaults[n];
+					n = m_children[n] + ((double)v == m_pivots[n] ? 0 : 1);
+					break;
+				}
+				default:
+				{
+					int v = (int)in[m_attrs[n]];
+					if(v < 0)
+						v = (int)m_defaults[n];
+					n = m_children[n] + v;
+					break;
+				}
+			}
+		}
+	}
+
+	/// Adds the vote of the specified leaf to pVotes
+	void castVote(size_t leaf, double weight, double* pVotes) const;
+
+	/// Converts votes into a label vector
+	void tally(const double* pVotes, GVec& out) const;
 };
 
 
@@ -185,6 +385,14 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+#ifndef MIN_PREDICT
+	/// Returns true. See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return true; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
@@ -213,6 +421,8 @@ class GRandomForest : public GSupervisedLearner
 {
 protected:
 	GBag* m_pEnsemble;
+	GCompiledForest* m_pCompiled;
+	size_t m_trainThreads;
 
 public:
 	GRandomForest(size_t trees, size_t samples = 1);
@@ -229,11 +439,32 @@ public:
 	/// See the comment for GSupervisedLearner::clear
 	virtual void clear();
 
+	/// Specifies the maximum number of threads (including the calling thread) that grow
+	/// trees concurrently during training. The default is to use all of the threads in
+	/// GThreadPool::global(). Every tree draws its bootstrap sample and its divisions from
+	/// its own random stream, so the trained forest does not depend on this value, as long
+	/// as it is greater than 1. (A value of 1 trains the trees in order from one shared
+	/// random stream, which is how GBag trains serially.)
+	/// (Predictions are still made in the calling thread. See predictBatch for a parallel alternative.)
+	void setTrainThreads(size_t count) { m_trainThreads = count; }
+
 	/// Prints an ascii representation of the random forest to the specified stream.
 	/// pRelation is an optional relation that can be supplied in order to provide
 	/// better meta-data to make the print-out richer.
 	void print(std::ostream& stream, GArffRelation* pFeatureRel = NULL, GArffRelation* pLabelRel = NULL);
 
+	/// Packs all of the trained trees into one set of contiguous node tables.
+	/// After this is called, predict and predictBatch use the tables instead of
+	/// the ensemble. Training or clearing the model discards them.
+	void compile();
+
+	/// Returns the compiled node tables, or NULL if compile has not been called.
+	const GCompiledForest* compiled() const { return m_pCompiled; }
+
+	/// See the comment for GSupervisedLearner::predictBatch.
+	/// This uses the compiled tables, and compiles temporary ones if compile has not been called.
+	virtual void predictBatch(const GMatrix& features, GMatrix& labels);
+
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
@@ -243,6 +474,9 @@ public:
 protected:
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
+
+	/// Packs all of the trees into a new set of node tables. (The caller must delete it.)
+	GCompiledForest* newCompiledForest();
 };
 
 } // namespace GClasses
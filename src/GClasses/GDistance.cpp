@@ -21,6 +21,7 @@
 #include "GDistance.h"
 #include "GDom.h"
 #include "GVec.h"
+#include "GSparseMatrix.h"
 #include <math.h>
 #include <cassert>
 #include <memory>
@@ -356,11 +357,11 @@ GDomNode* GCosineSimilarity::serialize(GDom* pDoc) const
 	return pNode;
 }
 
-// virtual
-double GCosineSimilarity::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
+template<typename A, typename B>
+double GCosineSimilarity_similarity(const A& a, const B& b, double regularizer)
 {
-	map<size_t,double>::const_iterator itA = a.begin();
-	map<size_t,double>::const_iterator itB = b.begin();
+	typename A::const_iterator itA = a.begin();
+	typename B::const_iterator itB = b.begin();
 	if(itA == a.end())
 		return 0.0;
 	if(itB == b.end())
@@ -391,7 +392,7 @@ double GCosineSimilarity::similarity(const map<size_t,double>& a, const map<size
 				break;
 		}
 	}
-	double denom = sqrt(sum_sq_a * sum_sq_b) + m_regularizer;
+	double denom = sqrt(sum_sq_a * sum_sq_b) + regularizer;
 	if(denom > 0.0)
 		return sum_co_prod / denom;
 	else
@@ -399,9 +400,21 @@ double GCosineSimilarity::similarity(const map<size_t,double>& a, const map<size
 }
 
 // virtual
-double GCosineSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
+double GCosineSimilarity::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
+{
+	return GCosineSimilarity_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GCosineSimilarity::similarity(const GSparseRow& a, const GSparseRow& b)
+{
+	return GCosineSimilarity_similarity(a, b, m_regularizer);
+}
+
+template<typename A>
+double GCosineSimilarity_similarity(const A& a, const GVec& b, double regularizer)
 {
-	map<size_t,double>::const_iterator itA = a.begin();
+	typename A::const_iterator itA = a.begin();
 	if(itA == a.end())
 		return 0.0;
 	double sum_sq_a = 0.0;
@@ -414,13 +427,25 @@ double GCosineSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
 		sum_co_prod += (itA->second * b[itA->first]);
 		itA++;
 	}
-	double denom = sqrt(sum_sq_a * sum_sq_b) + m_regularizer;
+	double denom = sqrt(sum_sq_a * sum_sq_b) + regularizer;
 	if(denom > 0.0)
 		return sum_co_prod / denom;
 	else
 		return 0.0;
 }
 
+// virtual
+double GCosineSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
+{
+	return GCosineSimilarity_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GCosineSimilarity::similarity(const GSparseRow& a, const GVec& b)
+{
+	return GCosineSimilarity_similarity(a, b, m_regularizer);
+}
+
 // virtual
 double GCosineSimilarity::similarity(const GVec& a, const GVec& b)
 {
@@ -451,12 +476,12 @@ GDomNode* GPearsonCorrelation::serialize(GDom* pDoc) const
 	return pNode;
 }
 
-// virtual
-double GPearsonCorrelation::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
+template<typename A, typename B>
+double GPearsonCorrelation_similarity(const A& a, const B& b, double regularizer)
 {
 	// Compute the mean of the overlapping portions
-	map<size_t,double>::const_iterator itA = a.begin();
-	map<size_t,double>::const_iterator itB = b.begin();
+	typename A::const_iterator itA = a.begin();
+	typename B::const_iterator itB = b.begin();
 	if(itA == a.end())
 		return 0.0;
 	if(itB == b.end())
@@ -519,7 +544,7 @@ double GPearsonCorrelation::similarity(const map<size_t,double>& a, const map<si
 				break;
 		}
 	}
-	double denom = sqrt(sum_of_sq) + m_regularizer;
+	double denom = sqrt(sum_of_sq) + regularizer;
 	if(denom > 0.0)
 		return std::max(-1.0, std::min(1.0, sum / denom));
 	else
@@ -527,10 +552,22 @@ double GPearsonCorrelation::similarity(const map<size_t,double>& a, const map<si
 }
 
 // virtual
-double GPearsonCorrelation::similarity(const map<size_t,double>& a, const GVec& b)
+double GPearsonCorrelation::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
+{
+	return GPearsonCorrelation_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GPearsonCorrelation::similarity(const GSparseRow& a, const GSparseRow& b)
+{
+	return GPearsonCorrelation_similarity(a, b, m_regularizer);
+}
+
+template<typename A>
+double GPearsonCorrelation_similarity(const A& a, const GVec& b, double regularizer)
 {
 	// Compute the mean of the overlapping portions
-	map<size_t,double>::const_iterator itA = a.begin();
+	typename A::const_iterator itA = a.begin();
 	double mean_a = 0.0;
 	double mean_b = 0.0;
 	size_t count = 0;
@@ -556,13 +593,25 @@ double GPearsonCorrelation::similarity(const map<size_t,double>& a, const GVec&
 		sum_of_sq += (d * d);
 		itA++;
 	}
-	double denom = sqrt(sum_of_sq) + m_regularizer;
+	double denom = sqrt(sum_of_sq) + regularizer;
 	if(denom > 0.0)
 		return sum / denom;
 	else
 		return 0.0;
 }
 
+// virtual
+double GPearsonCorrelation::similarity(const map<size_t,double>& a, const GVec& b)
+{
+	return GPearsonCorrelation_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GPearsonCorrelation::similarity(const GSparseRow& a, const GVec& b)
+{
+	return GPearsonCorrelation_similarity(a, b, m_regularizer);
+}
+
 // virtual
 double GPearsonCorrelation::similarity(const GVec& a, const GVec& b)
 {
@@ -606,11 +655,11 @@ GDomNode* GEuclidSimilarity::serialize(GDom* pDoc) const
 	return pNode;
 }
 
-// virtual
-double GEuclidSimilarity::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
+template<typename A, typename B>
+double GEuclidSimilarity_similarity(const A& a, const B& b, double regularizer)
 {
-	map<size_t,double>::const_iterator itA = a.begin();
-	map<size_t,double>::const_iterator itB = b.begin();
+	typename A::const_iterator itA = a.begin();
+	typename B::const_iterator itB = b.begin();
 	if(itA == a.end())
 		return 0.0;
 	if(itB == b.end())
@@ -645,9 +694,21 @@ double GEuclidSimilarity::similarity(const map<size_t,double>& a, const map<size
 }
 
 // virtual
-double GEuclidSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
+double GEuclidSimilarity::similarity(const map<size_t,double>& a, const map<size_t,double>& b)
 {
-	map<size_t,double>::const_iterator itA = a.begin();
+	return GEuclidSimilarity_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GEuclidSimilarity::similarity(const GSparseRow& a, const GSparseRow& b)
+{
+	return GEuclidSimilarity_similarity(a, b, m_regularizer);
+}
+
+template<typename A>
+double GEuclidSimilarity_similarity(const A& a, const GVec& b, double regularizer)
+{
+	typename A::const_iterator itA = a.begin();
 	if(itA == a.end())
 		return 0.0;
 	double sum_sq = 0.0;
@@ -663,6 +724,18 @@ double GEuclidSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
 		return 1e12;
 }
 
+// virtual
+double GEuclidSimilarity::similarity(const map<size_t,double>& a, const GVec& b)
+{
+	return GEuclidSimilarity_similarity(a, b, m_regularizer);
+}
+
+// virtual
+double GEuclidSimilarity::similarity(const GSparseRow& a, const GVec& b)
+{
+	return GEuclidSimilarity_similarity(a, b, m_regularizer);
+}
+
 // virtual
 double GEuclidSimilarity::similarity(const GVec& a, const GVec& b)
 {
@@ -29,6 +29,7 @@
 namespace GClasses {
 
 class GKernel;
+class GSparseRow;
 
 
 /// This class enables you to define a distance (or dissimilarity) metric between two vectors.
@@ -239,6 +240,12 @@ public:
 	/// Computes the similarity between a sparse and a dense vector
 	virtual double similarity(const std::map<size_t,double>& a, const GVec& b) = 0;
 
+	/// Computes the similarity between two rows of compressed sparse matrices
+	virtual double similarity(const GSparseRow& a, const GSparseRow& b) = 0;
+
+	/// Computes the similarity between a row of a compressed sparse matrix and a dense vector
+	virtual double similarity(const GSparseRow& a, const GVec& b) = 0;
+
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b) = 0;
 
@@ -268,6 +275,12 @@ public:
 	/// Computes the similarity between a sparse and a dense vector
 	virtual double similarity(const std::map<size_t,double>& a, const GVec& b);
 
+	/// Computes the similarity between two rows of compressed sparse matrices
+	virtual double similarity(const GSparseRow& a, const GSparseRow& b);
+
+	/// Computes the similarity between a row of a compressed sparse matrix and a dense vector
+	virtual double similarity(const GSparseRow& a, const GVec& b);
+
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
 };
@@ -290,6 +303,12 @@ public:
 	/// Computes the similarity between a sparse and a dense vector
 	virtual double similarity(const std::map<size_t,double>& a, const GVec& b);
 
+	/// Computes the similarity between two rows of compressed sparse matrices
+	virtual double similarity(const GSparseRow& a, const GSparseRow& b);
+
+	/// Computes the similarity between a row of a compressed sparse matrix and a dense vector
+	virtual double similarity(const GSparseRow& a, const GVec& b);
+
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
 };
@@ -315,6 +334,12 @@ public:
 	/// Computes the similarity between a sparse and a dense vector
 	virtual double similarity(const std::map<size_t,double>& a, const GVec& b);
 
+	/// Computes the similarity between two rows of compressed sparse matrices
+	virtual double similarity(const GSparseRow& a, const GSparseRow& b);
+
+	/// Computes the similarity between a row of a compressed sparse matrix and a dense vector
+	virtual double similarity(const GSparseRow& a, const GVec& b);
+
 	/// Computes the similarity between two dense vectors
 	virtual double similarity(const GVec& a, const GVec& b);
 };
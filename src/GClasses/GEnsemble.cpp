@@ -25,7 +25,10 @@
 #include "GRand.h"
 #include "GHolders.h"
 #include "GThread.h"
+#include "GDecisionTree.h"
 #include <memory>
+#include <algorithm>
+#include <unordered_map>
 
 using namespace GClasses;
 using std::vector;
@@ -55,12 +58,12 @@ GDomNode* GWeightedModel::serialize(GDom* pDoc) const
 
 
 GEnsemble::GEnsemble()
-: GSupervisedLearner(), m_pLabelRel(NULL), m_workerThreads(1), m_pPredictMaster(NULL)
+: GSupervisedLearner(), m_pLabelRel(NULL), m_workerThreads(1)
 {
 }
 
 GEnsemble::GEnsemble(const GDomNode* pNode, GLearnerLoader& ll)
-: GSupervisedLearner(pNode), m_pPredictMaster(NULL)
+: GSupervisedLearner(pNode)
 {
 	m_pLabelRel = GRelation::deserialize(pNode->field("labelrel"));
 	size_t accumulatorDims = (size_t)pNode->field("accum")->asInt();
@@ -82,7 +85,6 @@ GEnsemble::~GEnsemble()
 	for(vector<GWeightedModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
 		delete(*it);
 	delete(m_pLabelRel);
-	delete(m_pPredictMaster);
 }
 
 // virtual
@@ -103,8 +105,7 @@ void GEnsemble::clearBase()
 	delete(m_pLabelRel);
 	m_pLabelRel = NULL;
 	m_accumulator.resize(0);
-	delete(m_pPredictMaster);
-	m_pPredictMaster = NULL;
+	m_predictions.flush();
 }
 
 // virtual
@@ -208,45 +209,32 @@ void GEnsemble::tally(GVec& out)
 	GAssert(nDims == m_accumulator.size()); // invalid dim count
 }
 
-class GEnsemblePredictWorker : public GWorkerThread
-{
-protected:
-	GEnsemble* m_pEnsemble;
-	GVec m_prediction;
-
-public:
-	GEnsemblePredictWorker(GMasterThread& master, GEnsemble* pEnsemble, size_t outDims)
-	: GWorkerThread(master), m_pEnsemble(pEnsemble)
-	{
-		m_prediction.resize(outDims);
-	}
-
-	virtual ~GEnsemblePredictWorker()
-	{
-	}
-
-	virtual void doJob(size_t jobId)
-	{
-		const GVec& in = *(const GVec*)m_pEnsemble->m_pPredictInput;
-		GWeightedModel* pWM = m_pEnsemble->models()[jobId];
-		pWM->m_pModel->predict(in, m_prediction);
-		GSpinLockHolder lockHolder(m_master.getLock(), "GEnsemblePredictWorker::doJob");
-		m_pEnsemble->castVote(pWM->m_weight, m_prediction);
-	}
-};
-
 // virtual
 void GEnsemble::predict(const GVec& in, GVec& out)
 {
 	m_accumulator.fill(0.0);
-	m_pPredictInput = &in;
-	if(!m_pPredictMaster)
+	if(m_workerThreads > 1)
 	{
-		m_pPredictMaster = new GMasterThread();
-		for(size_t i = 0; i < m_workerThreads; i++)
-			m_pPredictMaster->addWorker(new GEnsemblePredictWorker(*m_pPredictMaster, this, m_models[0]->m_pModel->relLabels().size()));
+		// Predict in parallel, then tally the votes in model order so the result does not depend on scheduling
+		size_t labelDims = m_models[0]->m_pModel->relLabels().size();
+		if(m_predictions.rows() != m_models.size() || m_predictions.cols() != labelDims)
+			m_predictions.resize(m_models.size(), labelDims);
+		GThreadPool::global().parallelFor(0, m_models.size(), [&](size_t i) {
+			m_models[i]->m_pModel->predict(in, m_predictions[i]);
+		}, m_workerThreads);
+		for(size_t i = 0; i < m_models.size(); i++)
+			castVote(m_models[i]->m_weight, m_predictions[i]);
+	}
+	else
+	{
+		GVec prediction(m_models[0]->m_pModel->relLabels().size());
+		for(vector<GWeightedModel*>::iterator it = m_models.begin(); it != m_models.end(); it++)
+		{
+			GWeightedModel* pWM = *it;
+			pWM->m_pModel->predict(in, prediction);
+			castVote(pWM->m_weight, prediction);
+		}
 	}
-	m_pPredictMaster->doJobs(m_models.size());
 	tally(out);
 }
 
@@ -314,7 +302,8 @@ void GBag::addLearner(GSupervisedLearner* pLearner)
 	m_models.push_back(pWM);
 }
 
-class GBagTrainWorker : public GWorkerThread
+// Draws bootstrap samples and trains models. Each thread that participates in training gets its own instance.
+class GBagTrainWorker
 {
 protected:
 	GBag* m_pBag;
@@ -326,9 +315,8 @@ protected:
 	GRand m_rand;
 
 public:
-	GBagTrainWorker(GMasterThread& master, GBag* pBag, const GMatrix& features, const GMatrix& labels, double trainSize, size_t seed)
-	: GWorkerThread(master),
-	m_pBag(pBag),
+	GBagTrainWorker(GBag* pBag, const GMatrix& features, const GMatrix& labels, double trainSize, size_t seed)
+	: m_pBag(pBag),
 	m_features(features),
 	m_labels(labels),
 	m_drawnFeatures(features.relation().clone()),
@@ -341,11 +329,17 @@ public:
 		m_drawnLabels.reserve(m_drawSize);
 	}
 
-	virtual ~GBagTrainWorker()
+	~GBagTrainWorker()
 	{
 	}
 
-	virtual void doJob(size_t jobId)
+	void doJob(size_t jobId, size_t seed)
+	{
+		m_rand.setSeed(seed);
+		doJob(jobId);
+	}
+
+	void doJob(size_t jobId)
 	{
 		// Randomly draw some data (with replacement)
 		GReleaseDataHolder hDrawnFeatures(&m_drawnFeatures);
@@ -401,10 +395,28 @@ void GBag::trainInnerInner(const GMatrix& features, const GMatrix& labels)
 	normalizeWeights();
 */
 
-	GMasterThread trainMaster;
-	for(size_t i = 0; i < m_workerThreads; i++)
-		trainMaster.addWorker(new GBagTrainWorker(trainMaster, this, features, labels, m_trainSize, (size_t)m_rand.next()));
-	trainMaster.doJobs(m_models.size());
+	if(m_workerThreads <= 1)
+	{
+		// Train the models in order, all drawing from one random sequence
+		GBagTrainWorker worker(this, features, labels, m_trainSize, (size_t)m_rand.next());
+		for(size_t i = 0; i < m_models.size(); i++)
+			worker.doJob(i);
+		determineWeights(features, labels);
+		normalizeWeights();
+		return;
+	}
+
+	// Each model draws its sample from its own seed, so the result does not depend on which worker trains it
+	std::vector<size_t> seeds(m_models.size());
+	for(size_t i = 0; i < m_models.size(); i++)
+		seeds[i] = (size_t)m_rand.next();
+	GThreadPool& pool = GThreadPool::global();
+	std::vector<std::unique_ptr<GBagTrainWorker> > workers(pool.participants(m_workerThreads));
+	for(size_t i = 0; i < workers.size(); i++)
+		workers[i].reset(new GBagTrainWorker(this, features, labels, m_trainSize, 0));
+	pool.parallelForSlots(0, m_models.size(), [&](size_t i, size_t slot) {
+		workers[slot]->doJob(i, seeds[i]);
+	}, m_workerThreads);
 	determineWeights(features, labels);
 	normalizeWeights();
 }
@@ -417,7 +429,6 @@ void GBag::determineWeights(const GMatrix& features, const GMatrix& labels)
 }
 
 #ifndef NO_TEST_CODE
-#include "GDecisionTree.h"
 // static
 void GBag::test()
 {
@@ -986,7 +997,6 @@ void GBucket::predictDistribution(const GVec& in, GPrediction* out)
 }
 
 #ifndef NO_TEST_CODE
-#include "GDecisionTree.h"
 // static
 void GBucket::test()
 {
@@ -997,3 +1007,461 @@ void GBucket::test()
 	bucket.basicTest(0.695, 0.918);
 }
 #endif
+
+// ----------------------------------------------------------------------
+
+GGradientBoostedTrees::GGradientBoostedTrees()
+: GSupervisedLearner(), m_maxTrees(100), m_learningRate(0.1), m_rowSample(1.0), m_colSample(1.0), m_validationPortion(0.0), m_patience(10), m_leafThresh(20), m_maxLevels(7), m_bins(256), m_scoreDims(0)
+{
+}
+
+GGradientBoostedTrees::GGradientBoostedTrees(const GDomNode* pNode)
+: GSupervisedLearner(pNode)
+{
+	m_maxTrees = (size_t)pNode->field("maxtrees")->asInt();
+	m_learningRate = pNode->field("lr")->asDouble();
+	m_rowSample = pNode->field("rowsamp")->asDouble();
+	m_colSample = pNode->field("colsamp")->asDouble();
+	m_validationPortion = pNode->field("val")->asDouble();
+	m_patience = (size_t)pNode->field("patience")->asInt();
+	m_leafThresh = (size_t)pNode->field("leaf")->asInt();
+	m_maxLevels = (size_t)pNode->field("maxlev")->asInt();
+	m_bins = (size_t)pNode->field("bins")->asInt();
+	m_initScores.deserialize(pNode->field("init"));
+	m_variances.deserialize(pNode->field("var"));
+	m_scoreDims = m_initScores.size();
+	GDomListIterator it(pNode->field("trees"));
+	m_trees.reserve(it.remaining());
+	while(it.current())
+	{
+		m_trees.push_back(GDecisionTree::deserializeTree(it.current()));
+		it.advance();
+	}
+}
+
+// virtual
+GGradientBoostedTrees::~GGradientBoostedTrees()
+{
+	clear();
+}
+
+// virtual
+GDomNode* GGradientBoostedTrees::serialize(GDom* pDoc) const
+{
+	if(m_trees.size() == 0)
+		throw Ex("Attempted to serialize a model that has not been trained");
+	GDomNode* pNode = baseDomNode(pDoc, "GGradientBoostedTrees");
+	pNode->addField(pDoc, "maxtrees", pDoc->newInt(m_maxTrees));
+	pNode->addField(pDoc, "lr", pDoc->newDouble(m_learningRate));
+	pNode->addField(pDoc, "rowsamp", pDoc->newDouble(m_rowSample));
+	pNode->addField(pDoc, "colsamp", pDoc->newDouble(m_colSample));
+	pNode->addField(pDoc, "val", pDoc->newDouble(m_validationPortion));
+	pNode->addField(pDoc, "patience", pDoc->newInt(m_patience));
+	pNode->addField(pDoc, "leaf", pDoc->newInt(m_leafThresh));
+	pNode->addField(pDoc, "maxlev", pDoc->newInt(m_maxLevels));
+	pNode->addField(pDoc, "bins", pDoc->newInt(m_bins));
+	pNode->addField(pDoc, "init", m_initScores.serialize(pDoc));
+	pNode->addField(pDoc, "var", m_variances.serialize(pDoc));
+	GDomNode* pTrees = pNode->addField(pDoc, "trees", pDoc->newList());
+	for(size_t i = 0; i < m_trees.size(); i++)
+		pTrees->addItem(pDoc, GDecisionTree::serializeTree(m_trees[i], pDoc, m_scoreDims));
+	return pNode;
+}
+
+// virtual
+void GGradientBoostedTrees::clear()
+{
+	for(size_t i = 0; i < m_trees.size(); i++)
+		GDecisionTree::deleteTree(m_trees[i]);
+	m_trees.clear();
+}
+
+double GGradientBoostedTrees::gradient(const GVec& label, const double* pScores, double* pGrad, double* pHess)
+{
+	double loss = 0.0;
+	size_t pos = 0;
+	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+	{
+		size_t vals = m_pRelLabels->valueCount(i);
+		if(vals == 0)
+		{
+			// Squared error. (Unknown labels contribute nothing.)
+			double g = (label[i] == UNKNOWN_REAL_VALUE ? 0.0 : label[i] - pScores[pos]);
+			if(pGrad)
+				pGrad[pos] = g;
+			if(pHess)
+				pHess[pos] = (label[i] == UNKNOWN_REAL_VALUE ? 0.0 : 1.0);
+			loss += g * g;
+			pos++;
+		}
+		else
+		{
+			// Softmax cross-entropy
+			int y = (int)label[i];
+			double m = pScores[pos];
+			for(size_t j = 1; j < vals; j++)
+				m = std::max(m, pScores[pos + j]);
+			double sum = 0.0;
+			for(size_t j = 0; j < vals; j++)
+				sum += exp(pScores[pos + j] - m);
+			for(size_t j = 0; j < vals; j++)
+			{
+				double p = exp(pScores[pos + j] - m) / sum;
+				if(pGrad)
+					pGrad[pos + j] = (y < 0 ? 0.0 : ((int)j == y ? 1.0 : 0.0) - p);
+				if(pHess)
+					pHess[pos + j] = (y < 0 ? 0.0 : std::max(p * (1.0 - p), 1e-12));
+				if((int)j == y)
+					loss -= log(std::max(p, 1e-300));
+			}
+			pos += vals;
+		}
+	}
+	return loss;
+}
+
+// virtual
+void GGradientBoostedTrees::trainInner(const GMatrix& features, const GMatrix& labels)
+{
+	clear();
+	GThreadPool& pool = GThreadPool::global();
+
+	// Lay out the scores. Continuous labels get one, and nominal labels get one per value.
+	m_scoreDims = 0;
+	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+		m_scoreDims += std::max((size_t)1, m_pRelLabels->valueCount(i));
+
+	// Hold out some rows for early stopping
+	size_t rows = features.rows();
+	vector<size_t> order(rows);
+	GIndexVec::makeIndexVec(order.data(), rows);
+	size_t valCount = 0;
+	if(m_validationPortion > 0.0)
+	{
+		GIndexVec::shuffle(order.data(), rows, &m_rand);
+		valCount = std::min(rows - 1, (size_t)(m_validationPortion * rows));
+	}
+	size_t trainCount = rows - valCount;
+	if(trainCount == 0)
+		throw Ex("Expected at least one training row");
+
+	// Start with the mean of each continuous label and the log of the (smoothed) frequency of each nominal value
+	m_initScores.resize(m_scoreDims);
+	m_initScores.fill(0.0);
+	size_t pos = 0;
+	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+	{
+		size_t vals = m_pRelLabels->valueCount(i);
+		if(vals == 0)
+		{
+			double sum = 0.0;
+			size_t count = 0;
+			for(size_t j = 0; j < trainCount; j++)
+			{
+				double d = labels[order[j]][i];
+				if(d != UNKNOWN_REAL_VALUE)
+				{
+					sum += d;
+					count++;
+				}
+			}
+			m_initScores[pos++] = (count > 0 ? sum / count : 0.0);
+		}
+		else
+		{
+			vector<double> counts(vals, 1.0);
+			for(size_t j = 0; j < trainCount; j++)
+			{
+				int v = (int)labels[order[j]][i];
+				if(v >= 0)
+					counts[v] += 1.0;
+			}
+			for(size_t j = 0; j < vals; j++)
+				m_initScores[pos++] = log(counts[j] / (trainCount + vals));
+		}
+	}
+
+	// Quantize the features once. Each round, the histograms are built from the gradients in grad.
+	GMatrix grad(rows, m_scoreDims);
+	grad.fill(0.0);
+	vector<double> hess(rows * m_scoreDims, 0.0);
+	std::unique_ptr<GDecisionTreeHistogram, void (*)(GDecisionTreeHistogram*)> hHist(GDecisionTree::newHistogram(features, grad, m_bins), GDecisionTree::deleteHistogram);
+	GMatrix current(rows, m_scoreDims);
+	for(size_t i = 0; i < rows; i++)
+		current[i].copy(m_initScores);
+	GDecisionTree builder;
+	builder.useHistogramSplits(m_bins);
+	builder.setLeafThresh(m_leafThresh);
+	builder.setMaxLevels(m_maxLevels);
+
+	size_t sampleCount = std::max((size_t)1, std::min(trainCount, (size_t)(m_rowSample * trainCount)));
+	size_t cols = features.cols();
+	size_t colCount = std::max((size_t)1, std::min(cols, (size_t)(m_colSample * cols + 0.5)));
+	vector<size_t> attrs(cols);
+	GIndexVec::makeIndexVec(attrs.data(), cols);
+	vector<size_t> sample;
+	vector<char> active;
+	vector<GDecisionTreeLeafNode*> rowLeaf(rows);
+	vector<double> rowLoss(valCount);
+	double bestLoss = 1e308;
+	size_t bestTrees = 0;
+	for(size_t round = 0; round < m_maxTrees; round++)
+	{
+		// Compute the gradients of the training rows
+		pool.parallelFor(0, trainCount, [&](size_t i)
+		{
+			size_t r = order[i];
+			gradient(labels[r], current[r].data(), grad[r].data(), hess.data() + r * m_scoreDims);
+		});
+
+		// Draw the rows and features that this tree may use
+		if(sampleCount < trainCount)
+		{
+			for(size_t i = 0; i < sampleCount; i++)
+				std::swap(order[i], order[i + (size_t)m_rand.next(trainCount - i)]);
+		}
+		sample.assign(order.begin(), order.begin() + sampleCount);
+		if(colCount < cols)
+		{
+			active.assign(cols, 0);
+			for(size_t i = 0; i < colCount; i++)
+			{
+				std::swap(attrs[i], attrs[i + (size_t)m_rand.next(cols - i)]);
+				active[attrs[i]] = 1;
+			}
+		}
+
+		// Grow a tree that fits the gradients
+		GDecisionTreeNode* pRoot = builder.buildHistogramTree(*hHist, sample, active, m_rand);
+		m_trees.push_back(pRoot);
+
+		// Replace each leaf value with a Newton step (which is just the mean gradient for squared error),
+		// scaled by the learning rate. Softmax steps get the (k-1)/k factor of Friedman's multi-class algorithm.
+		pool.parallelFor(0, sampleCount, [&](size_t i)
+		{
+			size_t r = sample[i];
+			size_t depth;
+			rowLeaf[r] = GDecisionTree::findLeaf(pRoot, *m_pRelFeatures, true, features[r], &depth);
+		});
+		std::unordered_map<GDecisionTreeLeafNode*, size_t> leafIndexes;
+		vector<GDecisionTreeLeafNode*> leaves;
+		vector<double> sums;
+		for(size_t i = 0; i < sampleCount; i++)
+		{
+			size_t r = sample[i];
+			std::pair<std::unordered_map<GDecisionTreeLeafNode*, size_t>::iterator, bool> ins = leafIndexes.insert(std::make_pair(rowLeaf[r], leaves.size()));
+			if(ins.second)
+			{
+				leaves.push_back(rowLeaf[r]);
+				sums.resize(sums.size() + 2 * m_scoreDims, 0.0);
+			}
+			double* pG = sums.data() + ins.first->second * 2 * m_scoreDims;
+			double* pH = pG + m_scoreDims;
+			const double* pGrad = grad[r].data();
+			const double* pHess = hess.data() + r * m_scoreDims;
+			for(size_t j = 0; j < m_scoreDims; j++)
+			{
+				pG[j] += pGrad[j];
+				pH[j] += pHess[j];
+			}
+		}
+		for(size_t i = 0; i < leaves.size(); i++)
+		{
+			const double* pG = sums.data() + i * 2 * m_scoreDims;
+			const double* pH = pG + m_scoreDims;
+			double* pOut = GDecisionTree::leafValues(leaves[i]);
+			pos = 0;
+			for(size_t j = 0; j < m_pRelLabels->size(); j++)
+			{
+				size_t vals = m_pRelLabels->valueCount(j);
+				double scale = m_learningRate * (vals == 0 ? 1.0 : (double)(vals - 1) / vals);
+				for(size_t k = 0; k < std::max((size_t)1, vals); k++)
+				{
+					pOut[pos] = (pH[pos] > 0.0 ? scale * pG[pos] / pH[pos] : 0.0);
+					pos++;
+				}
+			}
+		}
+
+		// Update the scores of all the rows
+		pool.parallelFor(0, rows, [&](size_t r)
+		{
+			size_t depth;
+			const double* pValues = GDecisionTree::leafValues(GDecisionTree::findLeaf(pRoot, *m_pRelFeatures, true, features[r], &depth));
+			double* pScores = current[r].data();
+			for(size_t j = 0; j < m_scoreDims; j++)
+				pScores[j] += pValues[j];
+		});
+
+		// Stop early if the validation loss has not improved for a while
+		if(valCount > 0)
+		{
+			pool.parallelFor(0, valCount, [&](size_t i)
+			{
+				size_t r = order[trainCount + i];
+				rowLoss[i] = gradient(labels[r], current[r].data(), NULL, NULL);
+			});
+			double loss = 0.0;
+			for(size_t i = 0; i < valCount; i++)
+				loss += rowLoss[i];
+			if(loss < bestLoss)
+			{
+				bestLoss = loss;
+				bestTrees = m_trees.size();
+			}
+			else if(m_trees.size() - bestTrees >= m_patience)
+				break;
+		}
+	}
+	if(valCount > 0)
+	{
+		while(m_trees.size() > bestTrees)
+		{
+			GDecisionTree::deleteTree(m_trees.back());
+			m_trees.pop_back();
+		}
+	}
+
+	// Measure the variance of the training residuals, so predictDistribution can report it
+	m_variances.resize(m_pRelLabels->size());
+	m_variances.fill(0.0);
+	vector<size_t> counts(m_pRelLabels->size(), 0);
+	for(size_t i = 0; i < trainCount; i++)
+	{
+		size_t r = order[i];
+		GVec s(m_scoreDims);
+		scores(features[r], s);
+		pos = 0;
+		for(size_t j = 0; j < m_pRelLabels->size(); j++)
+		{
+			size_t vals = m_pRelLabels->valueCount(j);
+			if(vals == 0 && labels[r][j] != UNKNOWN_REAL_VALUE)
+			{
+				m_variances[j] += (labels[r][j] - s[pos]) * (labels[r][j] - s[pos]);
+				counts[j]++;
+			}
+			pos += std::max((size_t)1, vals);
+		}
+	}
+	for(size_t j = 0; j < m_pRelLabels->size(); j++)
+	{
+		if(counts[j] > 0)
+			m_variances[j] /= counts[j];
+	}
+}
+
+void GGradientBoostedTrees::scores(const GVec& in, GVec& out)
+{
+	if(m_scoreDims == 0)
+		throw Ex("Not trained yet");
+	out.copy(m_initScores);
+	for(size_t i = 0; i < m_trees.size(); i++)
+	{
+		size_t depth;
+		const double* pValues = GDecisionTree::leafValues(GDecisionTree::findLeaf(m_trees[i], *m_pRelFeatures, true, in, &depth));
+		for(size_t j = 0; j < m_scoreDims; j++)
+			out[j] += pValues[j];
+	}
+}
+
+// virtual
+void GGradientBoostedTrees::predict(const GVec& in, GVec& out)
+{
+	GVec s(m_scoreDims);
+	scores(in, s);
+	size_t pos = 0;
+	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+	{
+		size_t vals = m_pRelLabels->valueCount(i);
+		if(vals == 0)
+			out[i] = s[pos++];
+		else
+		{
+			size_t best = 0;
+			for(size_t j = 1; j < vals; j++)
+			{
+				if(s[pos + j] > s[pos + best])
+					best = j;
+			}
+			out[i] = (double)best;
+			pos += vals;
+		}
+	}
+}
+
+// virtual
+void GGradientBoostedTrees::predictDistribution(const GVec& in, GPrediction* out)
+{
+	GVec s(m_scoreDims);
+	scores(in, s);
+	size_t pos = 0;
+	for(size_t i = 0; i < m_pRelLabels->size(); i++)
+	{
+		size_t vals = m_pRelLabels->valueCount(i);
+		if(vals == 0)
+			out[i].makeNormal()->setMeanAndVariance(s[pos++], m_variances[i]);
+		else
+		{
+			GCategoricalDistribution* pCat = out[i].makeCategorical();
+			GVec& probs = pCat->values(vals);
+			for(size_t j = 0; j < vals; j++)
+				probs[j] = s[pos + j];
+			pCat->normalizeFromLogSpace();
+			pos += vals;
+		}
+	}
+}
+
+#ifndef NO_TEST_CODE
+// static
+void GGradientBoostedTrees::test()
+{
+	{
+		GGradientBoostedTrees gbt;
+		gbt.basicTest(0.765, 0.916);
+	}
+	{
+		GGradientBoostedTrees gbt;
+		gbt.setRowSample(0.7);
+		gbt.setColSample(0.5);
+		gbt.basicTest(0.748, 0.918);
+	}
+	{
+		// With pure noise, early stopping should keep only a few trees
+		GRand rand(0);
+		GMatrix features(400, 3);
+		GMatrix labels(400, 1);
+		for(size_t i = 0; i < 400; i++)
+		{
+			features[i].fillUniform(rand);
+			labels[i][0] = rand.normal();
+		}
+		GGradientBoostedTrees gbt;
+		gbt.setMaxTrees(200);
+		gbt.setValidation(0.25, 5);
+		gbt.train(features, labels);
+		if(gbt.treeCount() >= 50)
+			throw Ex("early stopping did not stop");
+
+		// A loaded model must predict the same, and train with the same settings
+		gbt.setMaxTrees(7);
+		gbt.setValidation(0.0);
+		gbt.train(features, labels);
+		GDom doc;
+		doc.setRoot(gbt.serialize(&doc));
+		GGradientBoostedTrees loaded(doc.root());
+		GVec a(1);
+		GVec b(1);
+		for(size_t i = 0; i < 400; i += 17)
+		{
+			gbt.predict(features[i], a);
+			loaded.predict(features[i], b);
+			if(a[0] != b[0])
+				throw Ex("the loaded model predicts differently");
+		}
+		loaded.train(features, labels);
+		if(loaded.treeCount() != 7)
+			throw Ex("the training settings were not restored");
+	}
+}
+#endif
@@ -27,8 +27,8 @@ namespace GClasses {
 
 class GRelation;
 class GRand;
-class GMasterThread;
 class GNeuralNetLearner;
+class GDecisionTreeNode;
 
 
 typedef void (*EnsembleProgressCallback)(void* pThis, size_t i, size_t n);
@@ -68,9 +68,8 @@ protected:
 	GVec m_accumulator; // a buffer for tallying votes (ballot box?)
 
 	size_t m_workerThreads;
-	GMasterThread* m_pPredictMaster;
+	GMatrix m_predictions; // a buffer for the prediction of each model when predicting with worker threads
 public:
-	volatile const GVec* m_pPredictInput;
 
 	/// General-purpose constructor. See also the comment for GSupervisedLearner::GSupervisedLearner.
 	GEnsemble();
@@ -88,15 +87,12 @@ public:
 	void castVote(double weight, const GVec& label);
 
 	/// Specify the number of worker threads to use. If count is 1,
-	/// then no additional threads will be spawned, but the work will
-	/// all be done by the same thread. If count is 2 or more, that
-	/// number of worker threads will be spawned. (Note that with fast models,
-	/// the overhead associated with worker threads is often too high to be
-	/// worthwhile.) The worker threads are spawned when the first prediction
-	/// is made. They are kept alive until clear() is called or this object is
-	/// deleted. If you only want to use worker threads during training, but
-	/// not when making predictions, you can call this method again to set it back
-	/// to 1 after training is complete. Since the inheriting class is
+	/// then all of the work will be done by the calling thread. If count is 2 or more,
+	/// the work will be spread across up to that many threads from GThreadPool::global().
+	/// (Note that with fast models, the overhead associated with worker threads
+	/// may still be too high to be worthwhile.) If you only want to use worker threads
+	/// during training, but not when making predictions, you can call this method again
+	/// to set it back to 1 after training is complete. Since the inheriting class is
 	/// responsible to implement the train method, some child classes may not
 	/// implement multi-threaded training. GBag, GBomb, GBayesianModelAveraging,
 	/// and GBayesianModelCombination all implement multi-threaded training.
@@ -471,6 +467,104 @@ protected:
 };
 
 
+
+/// Gradient-boosted regression trees. Each round fits one histogram-based GDecisionTree
+/// to the negative gradient of the loss with respect to the current scores, and adds its
+/// shrunken predictions to the scores. Continuous labels use squared error. Each nominal
+/// label with k values gets k scores and uses the softmax cross-entropy, with the leaf values
+/// refit by a Newton step. All of the scores share one multi-output tree per round.
+/// The features are quantized only once, so each round only builds label histograms.
+class GGradientBoostedTrees : public GSupervisedLearner
+{
+protected:
+	size_t m_maxTrees;
+	double m_learningRate;
+	double m_rowSample;
+	double m_colSample;
+	double m_validationPortion;
+	size_t m_patience;
+	size_t m_leafThresh;
+	size_t m_maxLevels;
+	size_t m_bins;
+	size_t m_scoreDims;
+	GVec m_initScores;
+	GVec m_variances; // the variance of the training residuals of each continuous label
+	std::vector<GDecisionTreeNode*> m_trees;
+
+public:
+	/// General-purpose constructor. See also the comment for GSupervisedLearner::GSupervisedLearner.
+	GGradientBoostedTrees();
+
+	/// Loads from a DOM. (The training settings are restored too.)
+	GGradientBoostedTrees(const GDomNode* pNode);
+
+	virtual ~GGradientBoostedTrees();
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif
+
+	/// Marshal this object into a DOM, which can then be converted to a variety of serial formats.
+	/// The training settings, the initial scores, and the nodes of the trees are stored.
+	virtual GDomNode* serialize(GDom* pDoc) const;
+
+	/// Sets the maximum number of boosting rounds (trees). The default is 100.
+	void setMaxTrees(size_t n) { m_maxTrees = n; }
+
+	/// Sets the shrinkage that scales the contribution of each tree. The default is 0.1.
+	void setLearningRate(double d) { m_learningRate = d; }
+
+	/// Specifies the portion of the training rows (drawn without replacement) that each tree
+	/// is fit with. The default is 1.0.
+	void setRowSample(double d) { m_rowSample = d; }
+
+	/// Specifies the portion of the features that each tree may divide on. The default is 1.0.
+	void setColSample(double d) { m_colSample = d; }
+
+	/// Specifies to hold out this portion of the training data for early stopping. When the
+	/// loss on the held-out rows has not improved for the specified number of rounds, training
+	/// stops, and the trees that were added after the best round are discarded. The default
+	/// portion is 0, which means to always train m_maxTrees trees.
+	void setValidation(double portion, size_t patience = 10) { m_validationPortion = portion; m_patience = patience; }
+
+	/// Sets the leaf threshold of each tree. (See GDecisionTree::setLeafThresh.) The default is 20.
+	void setLeafThresh(size_t n) { m_leafThresh = n; }
+
+	/// Sets the max levels of each tree. (See GDecisionTree::setMaxLevels.) The default is 7.
+	void setMaxLevels(size_t n) { m_maxLevels = n; }
+
+	/// Sets the number of histogram bins per feature. (See GDecisionTree::useHistogramSplits.) The default is 256.
+	void setBins(size_t n) { m_bins = n; }
+
+	/// Returns the number of trees in the trained model.
+	size_t treeCount() const { return m_trees.size(); }
+
+	/// Frees the model
+	virtual void clear();
+
+	/// See the comment for GSupervisedLearner::predict
+	virtual void predict(const GVec& pIn, GVec& pOut);
+
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+	/// See the comment for GSupervisedLearner::predictDistribution
+	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
+
+protected:
+	/// See the comment for GSupervisedLearner::trainInner
+	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
+
+	/// Computes the scores for the specified feature vector
+	void scores(const GVec& in, GVec& out);
+
+	/// Computes the negative gradient of the loss with respect to the scores of one row,
+	/// and the diagonal of the Hessian. (Either pointer may be NULL.) Returns the loss of the row.
+	double gradient(const GVec& label, const double* pScores, double* pGrad, double* pHess);
+};
+
+
 } // namespace GClasses
 
 #endif // __GENSEMBLE_H__
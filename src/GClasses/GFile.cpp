@@ -34,6 +34,7 @@
 #	include <unistd.h>
 #	include <utime.h> // utime, which sets file times
 #	include <dirent.h>
+#	include <sys/mman.h>
 #endif
 #include <stdio.h>
 #include <sys/types.h>
@@ -944,6 +945,73 @@ unsigned char* GCompressor::uncompress(unsigned char* pIn, unsigned int len, uns
 		return hCur.release();
 }
 
+GFileMapping::GFileMapping(const char* szFilename)
+: m_pData(NULL), m_size(0)
+{
+#ifdef WINDOWS
+	m_hMapping = NULL;
+	m_hFile = CreateFile(szFilename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if(m_hFile == INVALID_HANDLE_VALUE)
+		throw Ex("Error while trying to open the file, ", szFilename);
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(m_hFile, &size))
+	{
+		CloseHandle(m_hFile);
+		throw Ex("Error while trying to get the size of the file, ", szFilename);
+	}
+	m_size = (size_t)size.QuadPart;
+	if(m_size > 0)
+	{
+		m_hMapping = CreateFileMapping(m_hFile, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+		if(m_hMapping)
+			m_pData = (char*)MapViewOfFile(m_hMapping, FILE_MAP_COPY, 0, 0, 0);
+		if(!m_pData)
+		{
+			if(m_hMapping)
+				CloseHandle(m_hMapping);
+			CloseHandle(m_hFile);
+			throw Ex("Error while trying to map the file, ", szFilename);
+		}
+	}
+#else
+	int fd = open(szFilename, O_RDONLY);
+	if(fd < 0)
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+	struct stat st;
+	if(fstat(fd, &st) != 0)
+	{
+		close(fd);
+		throw Ex("Error while trying to get the size of the file, ", szFilename, ". ", strerror(errno));
+	}
+	m_size = (size_t)st.st_size;
+	if(m_size > 0)
+	{
+		void* pData = mmap(NULL, m_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		if(pData == MAP_FAILED)
+		{
+			close(fd);
+			throw Ex("Error while trying to map the file, ", szFilename, ". ", strerror(errno));
+		}
+		m_pData = (char*)pData;
+	}
+	close(fd); // (The mapping keeps the file open)
+#endif
+}
+
+GFileMapping::~GFileMapping()
+{
+#ifdef WINDOWS
+	if(m_pData)
+		UnmapViewOfFile(m_pData);
+	if(m_hMapping)
+		CloseHandle(m_hMapping);
+	CloseHandle(m_hFile);
+#else
+	if(m_pData)
+		munmap(m_pData, m_size);
+#endif
+}
+
 #ifndef NO_TEST_CODE
 // static
 void GCompressor::test()
@@ -155,6 +155,33 @@ public:
 };
 
 
+/// Maps a whole file into memory, so its contents can be used without reading or copying them.
+/// (The operating system loads each page when it is first touched.) The mapping is copy-on-write:
+/// the contents may be changed in memory, but the changes are private to this object and never
+/// reach the file.
+class GFileMapping
+{
+protected:
+	char* m_pData;
+	size_t m_size;
+#ifdef WINDOWS
+	void* m_hFile;
+	void* m_hMapping;
+#endif
+
+public:
+	/// Maps the specified file. Throws an exception if it cannot be opened or mapped.
+	GFileMapping(const char* szFilename);
+	~GFileMapping();
+
+	/// Returns the start of the mapped contents. (NULL if the file is empty.)
+	char* data() { return m_pData; }
+
+	/// Returns the number of bytes in the file.
+	size_t size() const { return m_size; }
+};
+
+
 
 } // namespace GClasses
 
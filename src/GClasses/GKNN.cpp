@@ -31,6 +31,7 @@
 #include "GDistance.h"
 #include "GSparseMatrix.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include "GBitTable.h"
 #include <map>
 #include <queue>
@@ -42,6 +43,9 @@ using std::pair;
 using std::priority_queue;
 using std::vector;
 
+// The number of rows that each thread interpolates at a time in GKNN::predictBatch
+#define KNN_BATCH_BLOCK_ROWS 256
+
 
 namespace GClasses {
 
@@ -102,6 +106,7 @@ GKNN::GKNN()
 	m_pSparseFeatures = NULL;
 	m_pLabels = NULL;
 	m_pNeighborFinder = NULL;
+	m_approxEf = 0;
 	m_normalizeScaleFactors = true;
 	m_optimizeScaleFactors = false;
 	m_pDistanceMetric = NULL;
@@ -125,6 +130,8 @@ GKNN::GKNN(const GDomNode* pNode)
 	m_trainParam = pNode->field("trainParam")->asDouble();
 	m_normalizeScaleFactors = pNode->field("normalize")->asBool();
 	m_optimizeScaleFactors = pNode->field("optimize")->asBool();
+	GDomNode* pApproxNode = pNode->fieldIfExists("approx");
+	m_approxEf = pApproxNode ? (size_t)pApproxNode->asInt() : 0;
 	GMatrix* pFeatures = NULL;
 	GSparseMatrix* pSparseFeatures = NULL;
 	GDomNode* pFeaturesNode = pNode->fieldIfExists("features");
@@ -177,6 +184,8 @@ GKNN::~GKNN()
 // virtual
 GDomNode* GKNN::serialize(GDom* pDoc) const
 {
+	if(!m_pFeatures && !m_pSparseFeatures)
+		throw Ex("Attempted to serialize a model that has not been trained");
 	GDomNode* pNode = baseDomNode(pDoc, "GKNN");
 	pNode->addField(pDoc, "neighbors", pDoc->newInt(m_nNeighbors));
 	if(m_eInterpolationMethod == Learner)
@@ -186,6 +195,8 @@ GDomNode* GKNN::serialize(GDom* pDoc) const
 	pNode->addField(pDoc, "trainParam", pDoc->newDouble(m_trainParam));
 	pNode->addField(pDoc, "normalize", pDoc->newBool(m_normalizeScaleFactors));
 	pNode->addField(pDoc, "optimize", pDoc->newBool(m_optimizeScaleFactors));
+	if(m_approxEf > 0)
+		pNode->addField(pDoc, "approx", pDoc->newInt(m_approxEf));
 	if(m_pFeatures)
 		pNode->addField(pDoc, "features", m_pFeatures->serialize(pDoc));
 	else
@@ -275,6 +286,13 @@ void GKNN::setOptimizeScaleFactors(bool b)
 	m_optimizeScaleFactors = b;
 }
 
+void GKNN::useApproximateNeighbors(size_t efSearch)
+{
+	m_approxEf = efSearch;
+	delete(m_pNeighborFinder);
+	m_pNeighborFinder = NULL;
+}
+
 void GKNN::setMetric(GDistanceMetric* pMetric, bool own)
 {
 	if(m_ownMetric)
@@ -405,9 +423,7 @@ void GKNN::trainInner(const GMatrix& feats, const GMatrix& labs)
 	if(m_pScaleFactorOptimizer)
 	{
 		if(!m_pNeighborFinder)
-		{
-			m_pNeighborFinder = new GKdTree(m_pFeatures, m_pDistanceMetric, false);
-		}
+			m_pNeighborFinder = newDenseNeighborFinder();
 		for(size_t j = 0; j < 50; j++)
 		{
 			m_pScaleFactorOptimizer->iterate();
@@ -435,15 +451,23 @@ void GKNN::trainSparse(GSparseMatrix& feats, GMatrix& labs)
 	m_pLabels->copy(labs);
 }
 
+GNeighborFinderGeneralizing* GKNN::newDenseNeighborFinder()
+{
+	if(m_approxEf > 0)
+	{
+		GHnswNeighborFinder* pHnsw = new GHnswNeighborFinder(m_pFeatures, m_pDistanceMetric, false);
+		pHnsw->setEfSearch(m_approxEf);
+		return pHnsw;
+	}
+	return new GKdTree(m_pFeatures, m_pDistanceMetric, false);
+}
+
 size_t GKNN::findNeighbors(const GVec& vec)
 {
 	if(!m_pNeighborFinder)
 	{
 		if(m_pDistanceMetric)
-		{
-			//m_pNeighborFinder = new GBruteForceNeighborFinder(m_pFeatures, m_pDistanceMetric, false);
-			m_pNeighborFinder = new GKdTree(m_pFeatures, m_pDistanceMetric, false);
-		}
+			m_pNeighborFinder = newDenseNeighborFinder();
 		else
 		{
 			GAssert(m_pSparseMetric);
@@ -455,7 +479,18 @@ size_t GKNN::findNeighbors(const GVec& vec)
 	return m_pNeighborFinder->findNearest(m_nNeighbors, vec);
 }
 
-void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pOut2)
+void GKNN::gatherNeighbors(size_t nc)
+{
+	m_neighborBuf.resize(nc);
+	m_distanceBuf.resize(nc);
+	for(size_t j = 0; j < nc; j++)
+	{
+		m_neighborBuf[j] = m_pNeighborFinder->neighbor(j);
+		m_distanceBuf[j] = m_pNeighborFinder->distance(j);
+	}
+}
+
+void GKNN::interpolateMean(size_t nc, const size_t* pNeighbors, const double* pDists, GVec& valueCounts, GPrediction* out, GVec* pOut2)
 {
 	for(size_t i = 0; i < m_pLabels->cols(); i++)
 	{
@@ -467,7 +502,7 @@ void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pO
 			size_t count = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = pNeighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				dSum += neighbor[i];
 				dSumOfSquares += (neighbor[i] * neighbor[i]);
@@ -495,25 +530,25 @@ void GKNN::interpolateMean(size_t nc, const GVec& in, GPrediction* out, GVec* pO
 		{
 			// Nominal label
 			size_t nValueCount = m_pLabels->relation().valueCount(i);
-			m_valueCounts.fill(0.0, 0, nValueCount);
+			valueCounts.fill(0.0, 0, nValueCount);
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = pNeighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				int val = (int)neighbor[i];
 				if(val < 0 || val >= (int)nValueCount)
 					throw Ex("GKNN doesn't support unknown label values");
-				m_valueCounts[val]++;
+				valueCounts[val]++;
 			}
 			if(out)
-				out[i].makeCategorical()->setValues(nValueCount, m_valueCounts.data());
+				out[i].makeCategorical()->setValues(nValueCount, valueCounts.data());
 			if(pOut2)
-				(*pOut2)[i] = m_valueCounts.indexOfMax((size_t)0, nValueCount);
+				(*pOut2)[i] = valueCounts.indexOfMax((size_t)0, nValueCount);
 		}
 	}
 }
 
-void GKNN::interpolateLinear(size_t nc, const GVec& in, GPrediction* out, GVec* pOut2)
+void GKNN::interpolateLinear(size_t nc, const size_t* pNeighbors, const double* pDists, GVec& valueCounts, GPrediction* out, GVec* pOut2)
 {
 	for(size_t i = 0; i < m_pLabels->cols(); i++)
 	{
@@ -525,11 +560,11 @@ void GKNN::interpolateLinear(size_t nc, const GVec& in, GPrediction* out, GVec*
 			double dTot = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = pNeighbors[j];
 				GVec& neighbor = m_pLabels->row(k);
 				if(neighbor[i] == UNKNOWN_REAL_VALUE)
 					throw Ex("GKNN doesn't support unknown label values");
-				double d = 1.0 / std::max(sqrt(m_pNeighborFinder->distance(j)), 1e-9); // the weight
+				double d = 1.0 / std::max(sqrt(pDists[j]), 1e-9); // the weight
 				dTot += d;
 				d *= neighbor[i]; // weighted sum
 				dSum += d;
@@ -558,26 +593,26 @@ void GKNN::interpolateLinear(size_t nc, const GVec& in, GPrediction* out, GVec*
 		{
 			// Nominal label
 			int nValueCount = (int)m_pLabels->relation().valueCount(i);
-			m_valueCounts.fill(0.0, 0, nValueCount);
+			valueCounts.fill(0.0, 0, nValueCount);
 			double dSumWeight = 0;
 			for(size_t j = 0; j < nc; j++)
 			{
-				size_t k = m_pNeighborFinder->neighbor(j);
+				size_t k = pNeighbors[j];
 				if(k < m_pLabels->rows())
 				{
 					GVec& neighbor = m_pLabels->row(k);
-					double d = 1.0 / std::max(m_pNeighborFinder->distance(j), 1e-9); // to be truly "linear", we should use sqrt(d) instead of d, but this is faster to compute and arguably better for nominal values anyway
+					double d = 1.0 / std::max(pDists[j], 1e-9); // to be truly "linear", we should use sqrt(d) instead of d, but this is faster to compute and arguably better for nominal values anyway
 					int val = (int)neighbor[i];
 					if(val < 0 || val >= nValueCount)
 						throw Ex("GKNN doesn't support unknown label values");
-					m_valueCounts[val] += d;
+					valueCounts[val] += d;
 					dSumWeight += d;
 				}
 			}
 			if(out)
-				out[i].makeCategorical()->setValues(nValueCount, m_valueCounts.data());
+				out[i].makeCategorical()->setValues(nValueCount, valueCounts.data());
 			if(pOut2)
-				(*pOut2)[i] = (double)m_valueCounts.indexOfMax((size_t)0, nValueCount);
+				(*pOut2)[i] = (double)valueCounts.indexOfMax((size_t)0, nValueCount);
 		}
 	}
 }
@@ -610,8 +645,8 @@ void GKNN::predictDistribution(const GVec& in, GPrediction* out)
 	size_t nc = findNeighbors(in);
 	switch(m_eInterpolationMethod)
 	{
-		case Linear: interpolateLinear(nc, in, out, NULL); break;
-		case Mean: interpolateMean(nc, in, out, NULL); break;
+		case Linear: gatherNeighbors(nc); interpolateLinear(nc, m_neighborBuf.data(), m_distanceBuf.data(), m_valueCounts, out, NULL); break;
+		case Mean: gatherNeighbors(nc); interpolateMean(nc, m_neighborBuf.data(), m_distanceBuf.data(), m_valueCounts, out, NULL); break;
 		case Learner: interpolateLearner(nc, in, out, NULL); break;
 		default:
 			GAssert(false); // unexpected enumeration
@@ -625,8 +660,8 @@ void GKNN::predict(const GVec& in, GVec& out)
 	size_t nc = findNeighbors(in);
 	switch(m_eInterpolationMethod)
 	{
-		case Linear: interpolateLinear(nc, in, NULL, &out); break;
-		case Mean: interpolateMean(nc, in, NULL, &out); break;
+		case Linear: gatherNeighbors(nc); interpolateLinear(nc, m_neighborBuf.data(), m_distanceBuf.data(), m_valueCounts, NULL, &out); break;
+		case Mean: gatherNeighbors(nc); interpolateMean(nc, m_neighborBuf.data(), m_distanceBuf.data(), m_valueCounts, NULL, &out); break;
 		case Learner: interpolateLearner(nc, in, NULL, &out); break;
 		default:
 			GAssert(false); // unexpected enumeration
@@ -634,6 +669,46 @@ void GKNN::predict(const GVec& in, GVec& out)
 	}
 }
 
+// virtual
+void GKNN::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	if(m_eInterpolationMethod == Learner || !m_pDistanceMetric)
+	{
+		// The learner is retrained for every row, and sparse neighbors are found one row at a time
+		GSupervisedLearner::predictBatch(in, out);
+		return;
+	}
+
+	// Find the neighbors of every row at once. (Thread-safe finders spread this across the thread pool.)
+	if(!m_pNeighborFinder)
+		m_pNeighborFinder = newDenseNeighborFinder();
+	size_t k = m_nNeighbors;
+	vector<size_t> neighbors;
+	vector<double> dists;
+	m_pNeighborFinder->findNearestAll(k, in, neighbors, dists);
+
+	// Interpolate the labels
+	size_t rows = in.rows();
+	size_t blocks = (rows + KNN_BATCH_BLOCK_ROWS - 1) / KNN_BATCH_BLOCK_ROWS;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t block)
+	{
+		GVec valueCounts(m_valueCounts.size());
+		size_t end = std::min(rows, (block + 1) * KNN_BATCH_BLOCK_ROWS);
+		for(size_t i = block * KNN_BATCH_BLOCK_ROWS; i < end; i++)
+		{
+			const size_t* pNeighbors = neighbors.data() + i * k;
+			size_t nc = 0;
+			while(nc < k && pNeighbors[nc] != INVALID_INDEX)
+				nc++;
+			if(m_eInterpolationMethod == Linear)
+				interpolateLinear(nc, pNeighbors, dists.data() + i * k, valueCounts, NULL, &out[i]);
+			else
+				interpolateMean(nc, pNeighbors, dists.data() + i * k, valueCounts, NULL, &out[i]);
+		}
+	});
+}
+
 // virtual
 void GKNN::clear()
 {
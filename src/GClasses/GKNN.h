@@ -73,9 +73,12 @@ protected:
 
 	// Working Buffers
 	GVec m_valueCounts;
+	std::vector<size_t> m_neighborBuf;
+	std::vector<double> m_distanceBuf;
 
 	// Neighbor Finding
 	GNeighborFinderGeneralizing* m_pNeighborFinder;
+	size_t m_approxEf;
 
 public:
 	/// General-purpose constructor
@@ -103,6 +106,17 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// Finds the neighbors of all the rows at once, and interpolates their labels in parallel.
+	/// (With the Learner interpolation method, or sparse features, this predicts one row at a time.)
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
+#ifndef MIN_PREDICT
+	/// Returns true unless this uses the Learner interpolation method or optimizes its scale
+	/// factors, since the inner learner and the optimizer are not serialized.
+	/// See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return m_eInterpolationMethod != Learner && !m_optimizeScaleFactors; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -141,6 +155,14 @@ public:
 	/// attribute scaling factors. If you set it to false (the default), it won't.
 	void setOptimizeScaleFactors(bool b);
 
+	/// Specify to find neighbors with an approximate HNSW graph (GHnswNeighborFinder) instead of
+	/// an exact kd-tree. efSearch is the size of the candidate list used by each query. Bigger values
+	/// find the true neighbors more often, but take longer. Pass 0 to go back to the exact kd-tree (the default).
+	void useApproximateNeighbors(size_t efSearch);
+
+	/// Returns the candidate-list size for approximate neighbor finding, or 0 if the neighbors are found exactly.
+	size_t approximateNeighbors() { return m_approxEf; }
+
 	/// Returns the internal feature set
 	GMatrix* features() { return m_pFeatures; }
 
@@ -182,13 +204,21 @@ protected:
 	/// Finds the nearest neighbors of pVector. Returns the number of neighbors found.
 	size_t findNeighbors(const GVec& vector);
 
-	/// Interpolate with each neighbor having equal vote
-	void interpolateMean(size_t nc, const GVec& in, GPrediction* pOut, GVec* pOut2);
+	/// Makes the neighbor finder for dense features
+	GNeighborFinderGeneralizing* newDenseNeighborFinder();
+
+	/// Copies the neighbors found by findNeighbors into m_neighborBuf and m_distanceBuf
+	void gatherNeighbors(size_t nc);
+
+	/// Interpolate with each neighbor having equal vote. pNeighbors and pDists hold the
+	/// nc neighbors and their distances. valueCounts is a working buffer with room for
+	/// the largest number of values in a nominal label.
+	void interpolateMean(size_t nc, const size_t* pNeighbors, const double* pDists, GVec& valueCounts, GPrediction* pOut, GVec* pOut2);
 
 	/// Interpolate with each neighbor having a linear vote. (Actually it's linear with
 	/// respect to the squared distance instead of the distance, because this is faster
-	/// to compute.)
-	void interpolateLinear(size_t nc, const GVec& in, GPrediction* pOut, GVec* pOut2);
+	/// to compute.) The parameters are the same as for interpolateMean.
+	void interpolateLinear(size_t nc, const size_t* pNeighbors, const double* pDists, GVec& valueCounts, GPrediction* pOut, GVec* pOut2);
 
 	/// Interpolates with the provided supervised learning algorithm
 	void interpolateLearner(size_t nc, const GVec& in, GPrediction* pOut, GVec* pOut2);
@@ -42,6 +42,7 @@
 #include "GTransform.h"
 #include "GRand.h"
 #include "GHolders.h"
+#include "GThread.h"
 #ifndef MIN_PREDICT
 #include "GPlot.h"
 #include "GDistribution.h"
@@ -49,6 +50,7 @@
 #endif // MIN_PREDICT
 #include <cmath>
 #include <iostream>
+#include <sstream>
 
 using std::vector;
 
@@ -129,7 +131,7 @@ GNormalDistribution* GPrediction::asNormal()
 // ---------------------------------------------------------------
 
 GTransducer::GTransducer()
-: m_rand(0)
+: m_rand(0), m_validationMemory(0)
 {
 }
 
@@ -338,76 +340,185 @@ void GTransducer::transductiveConfusionMatrix(const GMatrix& trainFeatures, cons
 	}
 }
 
-double GTransducer::crossValidate(const GMatrix& features, const GMatrix& labels, size_t folds, double* pOutSAE, RepValidateCallback pCB, size_t nRep, void* pThis)
+// Divides the rows, taken in the specified order (or in their natural order if pOrder is NULL), into a training
+// set and a test set for the specified fold. The matrices only borrow the rows, so the caller must release them.
+static void GTransducer_splitFold(const GMatrix& features, const GMatrix& labels, const size_t* pOrder, size_t folds, size_t fold, GMatrix& trainFeatures, GMatrix& trainLabels, GMatrix& testFeatures, GMatrix& testLabels)
 {
-	if(features.rows() != labels.rows())
-		throw Ex("Expected the features and labels to have the same number of rows");
-
-	// Do cross-validation
-	GMatrix trainFeatures(features.relation().cloneMinimal());
-	trainFeatures.reserve(features.rows());
-	GMatrix testFeatures(features.relation().cloneMinimal());
-	testFeatures.reserve(features.rows() / folds + 1);
-	GMatrix trainLabels(labels.relation().cloneMinimal());
-	trainLabels.reserve(labels.rows());
-	GMatrix testLabels(labels.relation().cloneMinimal());
-	testLabels.reserve(labels.rows() / folds + 1);
-	double sse = 0.0;
-	for(size_t i = 0; i < folds; i++)
+	size_t rows = features.rows();
+	size_t foldStart = fold * rows / folds;
+	size_t foldEnd = (fold + 1) * rows / folds;
+	for(size_t j = 0; j < rows; j++)
 	{
-		// Divide into a training set and a test set
-		GReleaseDataHolder hTrainFeatures(&trainFeatures);
-		GReleaseDataHolder hTestFeatures(&testFeatures);
-		GReleaseDataHolder hTrainLabels(&trainLabels);
-		GReleaseDataHolder hTestLabels(&testLabels);
-		size_t foldStart = i * features.rows() / folds;
-		size_t foldEnd = (i + 1) * features.rows() / folds;
-		for(size_t j = 0; j < foldStart; j++)
+		size_t r = pOrder ? pOrder[j] : j;
+		if(j >= foldStart && j < foldEnd)
 		{
-			trainFeatures.takeRow((GVec*)&features[j]);
-			trainLabels.takeRow((GVec*)&labels[j]);
+			testFeatures.takeRow((GVec*)&features[r]);
+			testLabels.takeRow((GVec*)&labels[r]);
 		}
-		for(size_t j = foldStart; j < foldEnd; j++)
-		{
-			testFeatures.takeRow((GVec*)&features[j]);
-			testLabels.takeRow((GVec*)&labels[j]);
-		}
-		for(size_t j = foldEnd; j < features.rows(); j++)
+		else
 		{
-			trainFeatures.takeRow((GVec*)&features[j]);
-			trainLabels.takeRow((GVec*)&labels[j]);
+			trainFeatures.takeRow((GVec*)&features[r]);
+			trainLabels.takeRow((GVec*)&labels[r]);
 		}
+	}
+}
 
-		// Evaluate
-		double foldsse = trainAndTest(trainFeatures, trainLabels, testFeatures, testLabels, pOutSAE);
-		sse += foldsse;
+double GTransducer::crossValidate(const GMatrix& features, const GMatrix& labels, size_t folds, double* pOutSAE, RepValidateCallback pCB, size_t nRep, void* pThis)
+{
+	if(features.rows() != labels.rows())
+		throw Ex("Expected the features and labels to have the same number of rows");
+	std::vector<std::vector<size_t> > orders(1);
+	orders[0].resize(features.rows());
+	for(size_t i = 0; i < features.rows(); i++)
+		orders[0][i] = i;
+	std::vector<double> sse;
+	std::vector<double> sae(1, pOutSAE ? *pOutSAE : 0.0);
+	std::vector<size_t> testRows;
+	validateFolds(features, labels, orders, folds, sse, sae, testRows);
+	double sum = 0.0;
+	for(size_t i = 0; i < folds; i++)
+	{
+		sum += sse[i];
 		if(pCB)
-			pCB(pThis, nRep, i, foldsse, testLabels.rows());
+			pCB(pThis, nRep, i, sse[i], testRows[i]);
 	}
-	return sse;
+	if(pOutSAE)
+		*pOutSAE = sae.back();
+	return sum;
 }
 
 double GTransducer::repValidate(const GMatrix& features, const GMatrix& labels, size_t reps, size_t folds, double* pOutSAE, RepValidateCallback pCB, void* pThis)
 {
 	if(features.rows() != labels.rows())
 		throw Ex("Expected the features and labels to have the same number of rows");
-	GMatrix f(features.relation().cloneMinimal());
-	GReleaseDataHolder hF(&f);
-	GMatrix l(labels.relation().cloneMinimal());
-	GReleaseDataHolder hL(&l);
-	for(size_t i = 0; i < features.rows(); i++)
+
+	// Draw all of the shuffles up front, the same way GMatrix::shuffle would
+	std::vector<std::vector<size_t> > orders(reps);
+	std::vector<size_t> order(features.rows());
+	for(size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	for(size_t i = 0; i < reps; i++)
 	{
-		f.takeRow((GVec*)&features[i]);
-		l.takeRow((GVec*)&labels[i]);
+		for(size_t n = order.size(); n > 0; n--)
+			std::swap(order[(size_t)m_rand.next(n)], order[n - 1]);
+		orders[i] = order;
 	}
+	std::vector<double> sse;
+	std::vector<double> sae(1, pOutSAE ? *pOutSAE : 0.0);
+	std::vector<size_t> testRows;
+	validateFolds(features, labels, orders, folds, sse, sae, testRows);
 	double ssse = 0.0;
 	for(size_t i = 0; i < reps; i++)
 	{
-		f.shuffle(m_rand, &l);
-		ssse += crossValidate(f, l, folds, pOutSAE, pCB, i, pThis);
+		double repsse = 0.0;
+		for(size_t j = 0; j < folds; j++)
+		{
+			repsse += sse[i * folds + j];
+			if(pCB)
+				pCB(pThis, i, j, sse[i * folds + j], testRows[i * folds + j]);
+		}
+		ssse += repsse;
 	}
+	if(pOutSAE)
+		*pOutSAE = sae.back();
 	return ssse / reps;
 }
+
+bool GTransducer::useConcurrentValidation()
+{
+	return GThreadPool::global().participants() > 1 && canValidateConcurrently();
+}
+
+// Returns the size of the serialized form of a trained learner, which stands in for the memory its
+// model needs, or 0 if it cannot be serialized
+static size_t GTransducer_modelBytes(GTransducer* pLearner)
+{
+	GSupervisedLearner* pSup = dynamic_cast<GSupervisedLearner*>(pLearner);
+	if(!pSup)
+		return 0;
+	try
+	{
+		GDom doc;
+		doc.setRoot(pSup->serialize(&doc));
+		std::ostringstream os;
+		doc.writeJson(os);
+		return (size_t)os.tellp();
+	}
+	catch(const std::exception&)
+	{
+		return 0;
+	}
+}
+
+void GTransducer::validateFolds(const GMatrix& features, const GMatrix& labels, const std::vector<std::vector<size_t> >& orders, size_t folds, std::vector<double>& sse, std::vector<double>& sae, std::vector<size_t>& testRows)
+{
+	// Every fold gets its own seed, so it trains the same way no matter which learner or thread it lands on
+	size_t jobs = orders.size() * folds;
+	std::vector<uint64_t> seeds(jobs);
+	for(size_t i = 0; i < jobs; i++)
+		seeds[i] = m_rand.next();
+	uint64_t finalSeed = m_rand.next();
+	sse.assign(jobs, 0.0);
+	double initialSAE = (sae.size() > 0 ? sae[0] : 0.0); // trainAndTest may leave it alone
+	sae.assign(jobs, initialSAE);
+	testRows.assign(jobs, 0);
+	auto evaluate = [&](GTransducer& learner, size_t job)
+	{
+		GMatrix trainFeatures(features.relation().cloneMinimal());
+		GReleaseDataHolder hTrainFeatures(&trainFeatures);
+		GMatrix testFeatures(features.relation().cloneMinimal());
+		GReleaseDataHolder hTestFeatures(&testFeatures);
+		GMatrix trainLabels(labels.relation().cloneMinimal());
+		GReleaseDataHolder hTrainLabels(&trainLabels);
+		GMatrix testLabels(labels.relation().cloneMinimal());
+		GReleaseDataHolder hTestLabels(&testLabels);
+		GTransducer_splitFold(features, labels, orders[job / folds].data(), folds, job % folds, trainFeatures, trainLabels, testFeatures, testLabels);
+		testRows[job] = testLabels.rows();
+		learner.reseed(seeds[job]);
+		sse[job] = learner.trainAndTest(trainFeatures, trainLabels, testFeatures, testLabels, &sae[job]);
+	};
+
+	// Make a clone for each thread, so this learner ends up in the same state no matter how the
+	// folds are divided. Clones can only be made from a trained learner, so if this one has not
+	// been trained yet, it does the first fold before any are made. (With a single thread, the
+	// folds are trained one after another on a single clone.)
+	GThreadPool& pool = GThreadPool::global();
+	size_t threads = (useConcurrentValidation() ? std::min(pool.participants(), jobs) : 1);
+	std::vector<std::unique_ptr<GTransducer> > clones;
+	size_t firstJob = 0;
+	GTransducer* pClone = newValidationClone();
+	if(!pClone)
+	{
+		evaluate(*this, firstJob++);
+		pClone = newValidationClone();
+	}
+	if(pClone)
+	{
+		clones.emplace_back(pClone);
+
+		// Limit the number of concurrent folds to fit within the memory cap. Each one needs a clone,
+		// and its training and test sets, which hold pointers to the rows of features and labels.
+		if(m_validationMemory > 0)
+		{
+			size_t bytesPerFold = GTransducer_modelBytes(this) + 2 * features.rows() * sizeof(GVec*);
+			threads = std::min(threads, std::max((size_t)1, m_validationMemory / std::max((size_t)1, bytesPerFold)));
+		}
+		while(clones.size() < threads && (pClone = newValidationClone()) != NULL)
+			clones.emplace_back(pClone);
+		pool.parallelForSlots(firstJob, jobs, [&](size_t job, size_t slot)
+		{
+			evaluate(*clones[slot], job);
+		}, clones.size());
+	}
+	else
+	{
+		for(size_t job = firstJob; job < jobs; job++)
+			evaluate(*this, job);
+	}
+
+	// Leave the random state the same no matter how the folds were divided among the learners
+	reseed(finalSeed);
+}
 #endif // MIN_PREDICT
 
 // ---------------------------------------------------------------
@@ -430,6 +541,26 @@ GSupervisedLearner::~GSupervisedLearner()
 	delete(m_pRelLabels);
 }
 
+#ifndef MIN_PREDICT
+// virtual
+GSupervisedLearner* GSupervisedLearner::newValidationClone()
+{
+	if(!m_pRelLabels || !canValidateConcurrently())
+		return NULL;
+	GDom doc;
+	try
+	{
+		doc.setRoot(serialize(&doc));
+	}
+	catch(const std::exception&)
+	{
+		return NULL; // The model was cleared after it was trained, so there is nothing to serialize yet
+	}
+	GLearnerLoader ll;
+	return ll.loadLearner(doc.root());
+}
+#endif // MIN_PREDICT
+
 const GRelation& GSupervisedLearner::relFeatures()
 {
 	if(!m_pRelFeatures)
@@ -444,6 +575,41 @@ const GRelation& GSupervisedLearner::relLabels()
 	return *m_pRelLabels;
 }
 
+// The number of rows that each thread predicts at a time in GSupervisedLearner::predictBatch
+#define PREDICT_BATCH_BLOCK_ROWS 256
+
+void GSupervisedLearner::prepareBatch(const GMatrix& in, GMatrix& out)
+{
+	if(!m_pRelLabels)
+		throw Ex("The model must be trained before it makes predictions");
+	if(in.cols() != m_pRelFeatures->size())
+		throw Ex("Expected ", to_str(m_pRelFeatures->size()), " feature columns. Got ", to_str(in.cols()));
+	if(out.rows() != in.rows() || out.cols() != m_pRelLabels->size())
+		out.resize(in.rows(), m_pRelLabels->size());
+}
+
+// virtual
+void GSupervisedLearner::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	if(canPredictConcurrently())
+	{
+		size_t rows = in.rows();
+		size_t blocks = (rows + PREDICT_BATCH_BLOCK_ROWS - 1) / PREDICT_BATCH_BLOCK_ROWS;
+		GThreadPool::global().parallelFor(0, blocks, [&](size_t block)
+		{
+			size_t end = std::min(rows, (block + 1) * PREDICT_BATCH_BLOCK_ROWS);
+			for(size_t i = block * PREDICT_BATCH_BLOCK_ROWS; i < end; i++)
+				predict(in[i], out[i]);
+		});
+	}
+	else
+	{
+		for(size_t i = 0; i < in.rows(); i++)
+			predict(in[i], out[i]);
+	}
+}
+
 #ifndef MIN_PREDICT
 GDomNode* GSupervisedLearner::baseDomNode(GDom* pDoc, const char* szClassName) const
 {
@@ -496,10 +662,11 @@ void GSupervisedLearner::confusion(GMatrix& features, GMatrix& labels, std::vect
 		else
 			stats[j] = NULL;
 	}
-	GVec prediction(labelDims);
+	GMatrix predictions;
+	predictBatch(features, predictions);
 	for(size_t i = 0; i < features.rows(); i++)
 	{
-		predict(features[i], prediction);
+		const GVec& prediction = predictions[i];
 		GVec& target = labels[i];
 		for(size_t j = 0; j < labelDims; j++)
 		{
@@ -521,12 +688,13 @@ double GSupervisedLearner::sumSquaredError(const GMatrix& features, const GMatri
 	if(!m_pRelLabels->isCompatible(labels.relation()))
 		throw Ex("Labels incompatible with this learner");
 	size_t labelDims = labels.cols();
-	GVec prediction(labelDims);
+	GMatrix predictions;
+	predictBatch(features, predictions);
 	double sae = 0.0;
 	double sse = 0.0;
 	for(size_t i = 0; i < features.rows(); i++)
 	{
-		predict(features[i], prediction);
+		const GVec& prediction = predictions[i];
 		const GVec& targ = labels[i];
 		for(size_t j = 0; j < labelDims; j++)
 		{
@@ -563,8 +731,7 @@ std::unique_ptr<GMatrix> GSupervisedLearner::transduceInner(const GMatrix& featu
 	// Predict
 	auto pOut = std::unique_ptr<GMatrix>(new GMatrix(labels1.relation().clone()));
 	pOut->newRows(features2.rows());
-	for(size_t i = 0; i < features2.rows(); i++)
-		predict(features2.row(i), pOut->row(i));
+	predictBatch(features2, *pOut);
 	return pOut;
 }
 
@@ -730,6 +897,16 @@ void GSupervisedLearner::precisionRecall(double* pOutPrecision, size_t nPrecisio
 
 
 #define TEST_SIZE 5000
+
+// An auto-filter that never makes clones, so its folds are always trained one after another on itself
+class GSupervisedLearnerTestSerial : public GAutoFilter
+{
+public:
+	GSupervisedLearnerTestSerial(GSupervisedLearner* pLearner) : GAutoFilter(pLearner) {}
+	virtual bool canValidateConcurrently() override { return false; }
+	virtual GSupervisedLearner* newValidationClone() override { return NULL; }
+};
+
 // static
 void GSupervisedLearner::test()
 {
@@ -807,6 +984,94 @@ void GSupervisedLearner::test()
 	prob = out.asCategorical()->values(2)[0];
 	if(std::abs(prob - 0.85) > .11)
 		throw Ex("failed");*/
+
+	// Make a dataset with a nominal label
+	GRand rand(0);
+	GMatrix f(0, 3);
+	vector<size_t> labelVals(1, 3);
+	GMatrix l(labelVals);
+	for(size_t i = 0; i < 240; i++)
+	{
+		GVec& x = f.newRow();
+		x.fillUniform(rand);
+		l.newRow()[0] = (x[0] + x[1] > 1.0 ? (x[2] > 0.5 ? 2.0 : 1.0) : 0.0);
+	}
+
+	// Folds trained on clones must give the same results as folds trained one after another on one learner
+	for(size_t n = 0; n < 6; n++)
+	{
+		std::unique_ptr<GSupervisedLearner> hLearners[3];
+		for(size_t i = 0; i < 3; i++)
+		{
+			GSupervisedLearner* pInner;
+			if(n == 0)
+				pInner = new GBaselineLearner();
+			else if(n == 1)
+				pInner = new GDecisionTree();
+			else if(n == 2)
+			{
+				GDecisionTree* pTree = new GDecisionTree();
+				pTree->useRandomDivisions(2);
+				pTree->setLeafThresh(3);
+				pInner = pTree;
+			}
+			else if(n == 3)
+				pInner = new GKNN();
+			else if(n == 4)
+				pInner = new GNaiveBayes();
+			else
+				pInner = new GLinearRegressor();
+			hLearners[i].reset(i < 2 ? new GAutoFilter(pInner) : new GSupervisedLearnerTestSerial(pInner));
+			hLearners[i]->rand().setSeed(1234);
+		}
+		hLearners[1]->setValidationMemory(1); // forces the folds to be trained one at a time
+		for(size_t j = 0; j < 2; j++) // The second time through, the learners have already been trained
+		{
+			double saeA = 0.0, saeB = 0.0, saeC = 0.0; // (left alone for nominal labels)
+			double a = hLearners[0]->repValidate(f, l, 3, 3, &saeA);
+			double b = hLearners[1]->repValidate(f, l, 3, 3, &saeB);
+			double c = hLearners[2]->repValidate(f, l, 3, 3, &saeC);
+			if(a != b || saeA != saeB)
+				throw Ex("Concurrent validation changed the results");
+			if(a != c || saeA != saeC)
+				throw Ex("Validating on clones and validating serially gave different results");
+			a = hLearners[0]->crossValidate(f, l, 4, &saeA);
+			c = hLearners[2]->crossValidate(f, l, 4, &saeC);
+			if(a != c || saeA != saeC)
+				throw Ex("Cross-validating on clones and cross-validating serially gave different results");
+			hLearners[1]->crossValidate(f, l, 4);
+			uint64_t r = hLearners[0]->rand().next();
+			if(hLearners[1]->rand().next() != r || hLearners[2]->rand().next() != r)
+				throw Ex("Validation left the random state depending on how the folds were trained");
+		}
+
+		// How the folds were divided must not change the state the learners are left in
+		GMatrix sa, sb;
+		hLearners[0]->predictBatch(f, sa);
+		hLearners[1]->predictBatch(f, sb);
+		for(size_t i = 0; i < f.rows(); i++)
+		{
+			if(sa[i][0] != sb[i][0])
+				throw Ex("Concurrent validation left the learner in a different state");
+		}
+
+		// A clone must train exactly like the original
+		std::unique_ptr<GSupervisedLearner> hClone(hLearners[0]->newValidationClone());
+		if(!hClone.get())
+			throw Ex("Expected a clone");
+		hLearners[0]->reseed(77);
+		hClone->reseed(77);
+		hLearners[0]->train(f, l);
+		hClone->train(f, l);
+		GMatrix pa, pb;
+		hLearners[0]->predictBatch(f, pa);
+		hClone->predictBatch(f, pb);
+		for(size_t i = 0; i < f.rows(); i++)
+		{
+			if(pa[i][0] != pb[i][0])
+				throw Ex("The clone trained differently");
+		}
+	}
 }
 
 void GSupervisedLearner_basicTestEngine(GSupervisedLearner* pLearner, GMatrix& features, GMatrix& labels, GMatrix& testFeatures, GMatrix& testLabels, double minAccuracy, GRand* pRand, double warnRange, double deviation, bool printAccuracy)
@@ -828,6 +1093,20 @@ void GSupervisedLearner_basicTestEngine(GSupervisedLearner* pLearner, GMatrix& f
 	if(resultsBefore >= minAccuracy + warnRange)
 		std::cout << "\nThe measured accuracy (" << resultsBefore << ") is much better than expected (" << minAccuracy << "). Please increase the expected accuracy value so that any future regressions will be caught.\n";
 
+	// Make sure batch prediction agrees with row-by-row prediction
+	GMatrix batchOut;
+	pLearner->predictBatch(testFeatures, batchOut);
+	GVec rowOut(testLabels.cols());
+	for(size_t i = 0; i < testFeatures.rows(); i++)
+	{
+		pLearner->predict(testFeatures[i], rowOut);
+		for(size_t j = 0; j < rowOut.size(); j++)
+		{
+			if(std::abs(batchOut[i][j] - rowOut[j]) > 1e-6 * (1.0 + std::abs(rowOut[j])))
+				throw Ex("predictBatch disagrees with predict");
+		}
+	}
+
 	// Roundtrip the model through serialization
 	const GRelation& relLabelsBefore = pLearner->relLabels();
 	GDom doc;
@@ -1024,6 +1303,8 @@ GSupervisedLearner* GLearnerLoader::loadLearner(const GDomNode* pNode)
 					return new GFeatureFilter(pNode, *this);
 				else if(strcmp(szClass, "GGaussianProcess") == 0)
 					return new GGaussianProcess(pNode);
+				else if(strcmp(szClass, "GGradientBoostedTrees") == 0)
+					return new GGradientBoostedTrees(pNode);
 				else if(strcmp(szClass, "GIdentityFunction") == 0)
 					return new GIdentityFunction(pNode);
 			}
@@ -1207,6 +1488,13 @@ void GFilter::trainSparse(GSparseMatrix& features, GMatrix& labels)
 {
 	throw Ex("Sorry, this method has not been implemented");
 }
+
+// virtual
+void GFilter::reseed(uint64_t seed)
+{
+	GTransducer::reseed(seed);
+	m_pLearner->reseed(seed);
+}
 #endif // MIN_PREDICT
 
 // ---------------------------------------------------------------
@@ -1257,6 +1545,16 @@ void GFeatureFilter::predict(const GVec& in, GVec& out)
 	m_pLearner->predict(m_pTransform->innerBuf(), out);
 }
 
+// virtual
+void GFeatureFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	GMatrix inner(in.rows(), m_pTransform->after().size());
+	for(size_t i = 0; i < in.rows(); i++)
+		m_pTransform->transform(in[i], inner[i]);
+	m_pLearner->predictBatch(inner, out);
+}
+
 // virtual
 void GFeatureFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
@@ -1352,6 +1650,16 @@ void GLabelFilter::predict(const GVec& in, GVec& out)
 	m_pTransform->untransform(m_pTransform->innerBuf(), out);
 }
 
+// virtual
+void GLabelFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	GMatrix inner;
+	m_pLearner->predictBatch(in, inner);
+	for(size_t i = 0; i < in.rows(); i++)
+		m_pTransform->untransform(inner[i], out[i]);
+}
+
 // virtual
 void GLabelFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
@@ -1427,6 +1735,17 @@ GDomNode* GAutoFilter::serialize(GDom* pDoc) const
 	return pNode;
 }
 
+#ifndef MIN_PREDICT
+// virtual
+GSupervisedLearner* GAutoFilter::newValidationClone()
+{
+	GSupervisedLearner* pInner = m_pOriginal->newValidationClone();
+	if(!pInner)
+		return NULL;
+	return new GAutoFilter(pInner);
+}
+#endif // MIN_PREDICT
+
 void GAutoFilter::whatTypesAreNeeded(const GRelation& featureRel, const GRelation& labelRel, bool& hasNominalFeatures, bool& hasContinuousFeatures, bool& hasNominalLabels, bool& hasContinuousLabels)
 {
 	// Determine what types are present in the feature data
@@ -1657,6 +1976,13 @@ void GAutoFilter::predict(const GVec& in, GVec& out)
 	m_pLearner->predict(in, out);
 }
 
+// virtual
+void GAutoFilter::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	m_pLearner->predictBatch(in, out);
+}
+
 // virtual
 void GAutoFilter::predictDistribution(const GVec& in, GPrediction* out)
 {
@@ -1800,6 +2126,13 @@ void GCalibrator::predict(const GVec& in, GVec& out)
 	m_pLearner->predict(in, out);
 }
 
+// virtual
+void GCalibrator::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	m_pLearner->predictBatch(in, out);
+}
+
 // virtual
 void GCalibrator::predictDistribution(const GVec& in, GPrediction* out)
 {
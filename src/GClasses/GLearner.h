@@ -106,13 +106,14 @@ class GTransducer
 {
 protected:
 	GRand m_rand;
+	size_t m_validationMemory;
 
 public:
 	/// General-purpose constructor.
 	GTransducer();
 
 	/// Copy-constructor. Throws an exception to prevent models from being copied by value.
-	GTransducer(const GTransducer& that) : m_rand(0)
+	GTransducer(const GTransducer& that) : m_rand(0), m_validationMemory(0)
 	{
 		throw Ex("This object is not intended to be copied by value");
 	}
@@ -161,6 +162,30 @@ public:
 	/// to use however you want. It doesn't affect this method.
 	/// if pOutSAE is not NULL, the sum absolute error will be placed there.
 	double repValidate(const GMatrix& features, const GMatrix& labels, size_t reps, size_t nFolds, double* pOutSAE = NULL, RepValidateCallback pCB = NULL, void* pThis = NULL);
+
+	/// Returns true iff crossValidate and repValidate may train the folds concurrently on
+	/// copies of this learner made by newValidationClone. Either way, every fold is trained after
+	/// calling reseed with a seed of its own, so the results do not depend on the number of threads,
+	/// and the intermediate stats are reported to the callback only after all of the folds are done.
+	/// When this returns true, the folds are trained on copies (concurrently if the global thread
+	/// pool has more than one thread), and this learner is left as it was, or, if it had not been
+	/// trained yet, trained on the first fold of the first rep. Otherwise (and by default), every
+	/// fold is trained on this object, one after another, which leaves it trained on the last fold
+	/// of the last rep.
+	virtual bool canValidateConcurrently() { return false; }
+
+	/// Returns a new learner that trains exactly like this one, or NULL if that is not possible
+	/// in this learner's current state. The caller is responsible to delete it.
+	virtual GTransducer* newValidationClone() { return NULL; }
+
+	/// Seeds the random number generator of this learner, and of any learners it wraps.
+	virtual void reseed(uint64_t seed) { m_rand.setSeed(seed); }
+
+	/// Caps the memory that crossValidate and repValidate may use to train folds concurrently.
+	/// Each concurrent fold is charged for its copy of the learner (measured by the size of its
+	/// serialized form) and for the lists of rows in its training and test sets. (Memory that
+	/// the learner only uses while it trains is not counted.) Pass 0 (the default) for no cap.
+	void setValidationMemory(size_t bytes) { m_validationMemory = bytes; }
 #endif // MIN_PREDICT
 
 	/// Returns a reference to the random number generator associated with this object.
@@ -209,6 +234,20 @@ protected:
 #ifndef MIN_PREDICT
 	/// This is the algorithm's implementation of transduction. (It is called by the transduce method.)
 	virtual std::unique_ptr<GMatrix> transduceInner(const GMatrix& features1, const GMatrix& labels1, const GMatrix& features2) = 0;
+
+	/// Returns true iff canValidateConcurrently returns true and the global thread pool has more
+	/// than one thread. Otherwise, validateFolds trains the folds one after another.
+	bool useConcurrentValidation();
+
+	/// Trains and tests each fold of features and labels, taken in each of the row orders in
+	/// orders, on this learner and on clones of it. The sum-squared error, the sum-absolute error,
+	/// and the number of test rows of fold f of order r are placed at index r * folds + f. If sae
+	/// holds a value on entry, each fold's sum-absolute error starts from it, since trainAndTest
+	/// is not required to set it. Each fold is trained after calling reseed with a seed drawn up
+	/// front, and this learner is reseeded afterward, so the results and the random state it is
+	/// left in do not depend on whether the folds ran concurrently.
+	/// Used by crossValidate and repValidate.
+	void validateFolds(const GMatrix& features, const GMatrix& labels, const std::vector<std::vector<size_t> >& orders, size_t folds, std::vector<double>& sse, std::vector<double>& sae, std::vector<size_t>& testRows);
 #endif // MIN_PREDICT
 };
 
@@ -236,6 +275,12 @@ public:
 	/// Marshal this object into a DOM that can be converted to a variety
 	/// of formats. (Implementations of this method should use baseDomNode.)
 	virtual GDomNode* serialize(GDom* pDoc) const = 0;
+
+	/// Returns a copy of this learner made by serializing it and loading it with GLearnerLoader,
+	/// or NULL if canValidateConcurrently returns false or this learner has not been trained.
+	/// Learners should only report that they can validate concurrently if their serialized
+	/// form includes every setting that affects training.
+	virtual GSupervisedLearner* newValidationClone() override;
 #endif // MIN_PREDICT
 
 	/// Returns true because fully supervised learners have an internal
@@ -264,6 +309,18 @@ public:
 	/// method.
 	virtual void predict(const GVec& in, GVec& out) = 0;
 
+	/// Predicts a label vector for each row of in, and stores it in the corresponding row of out.
+	/// If out does not already have in.rows() rows and a column for each label, it is resized
+	/// (which makes all of its columns continuous). The default implementation spreads blocks of
+	/// rows across GThreadPool::global() if canPredictConcurrently returns true, and calls predict
+	/// one row at a time otherwise. Learners that can predict many rows more efficiently than
+	/// one at a time override this method.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
+	/// Returns true iff predict may be called from several threads at once (because it does not
+	/// modify this object). The default is false.
+	virtual bool canPredictConcurrently() { return false; }
+
 #ifndef MIN_PREDICT
 	/// Evaluate pIn and compute a prediction for pOut. pOut is expected
 	/// to point to an array of GPrediction objects which have already been
@@ -317,6 +374,11 @@ protected:
 	/// (This is a helper-function used by precisionRecall.)
 	static void addInterpolatedFunction(double* pOut, size_t nOutVals, double* pIn, size_t nInVals);
 
+	/// Checks that in has the right number of columns for this model, and resizes out (if
+	/// necessary) to hold a prediction for each row of in. (This is a helper method used by
+	/// implementations of predictBatch.)
+	void prepareBatch(const GMatrix& in, GMatrix& out);
+
 	/// This is the implementation of the model's training algorithm. (This method is called by train).
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels) = 0;
 
@@ -505,6 +567,9 @@ public:
 #ifndef MIN_PREDICT
 	/// Throws an exception
 	virtual void trainSparse(GSparseMatrix& features, GMatrix& labels);
+
+	/// Seeds this filter and the learner it wraps
+	virtual void reseed(uint64_t seed) override;
 #endif // MIN_PREDICT
 };
 
@@ -533,6 +598,9 @@ using GFilter::prefilterLabels;
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistributionInner
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -582,6 +650,9 @@ using GFilter::prefilterLabels;
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -632,6 +703,9 @@ using GFilter::prefilterLabels;
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -650,6 +724,15 @@ using GFilter::prefilterLabels;
 	/// Returns a reference to a vector of prefiltered datasets. (This vector is populated by calling prefilterData.)
 	std::vector<GMatrix*>& data() { return m_prefilteredData; }
 
+#ifndef MIN_PREDICT
+	/// Returns true iff the base learner can validate concurrently
+	virtual bool canValidateConcurrently() override { return m_pOriginal->canValidateConcurrently(); }
+
+	/// Wraps a clone of the base learner in a new GAutoFilter, since the filters are rebuilt
+	/// whenever this is trained
+	virtual GSupervisedLearner* newValidationClone() override;
+#endif // MIN_PREDICT
+
 protected:
 	/// See the comment for GSupervisedLearner::trainInner
 	virtual void trainInner(const GMatrix& features, const GMatrix& labels);
@@ -691,6 +774,9 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// See the comment for GSupervisedLearner::predictBatch
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -747,6 +833,14 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+#ifndef MIN_PREDICT
+	/// Returns true. See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return true; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -784,6 +878,9 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
@@ -159,6 +159,10 @@ void GLearnerLib::loadData(GArgReader& args, std::unique_ptr<GMatrix>& hFeatures
 	{
 		data.loadArff(szFilename);
 	}
+	else if(_stricmp(input_type, "wbin") == 0)
+	{
+		data.load(szFilename);
+	}
 	else if(_stricmp(input_type, "csv") == 0)
 	{
 		GCSVParser parser;
@@ -469,12 +473,19 @@ GDecisionTree* GLearnerLib::InstantiateDecisionTree(GArgReader& args, GMatrix* p
 		else if(args.if_pop("-binary")){
 			pModel->useBinaryDivisions();
 		}
+		else if(args.if_pop("-histogram")){
+			pModel->useHistogramSplits(args.pop_uint());
+		}
 		else if(args.if_pop("-random")){
 			pModel->useRandomDivisions(args.pop_uint());
 		}else if(args.if_pop("-leafthresh")){
 			pModel->setLeafThresh(args.pop_uint());
 		}else if(args.if_pop("-maxlevels")){
 			pModel->setMaxLevels(args.pop_uint());
+		}else if(args.if_pop("-parallelnodes")){
+			pModel->setParallelNodeRows(args.pop_uint());
+		}else if(args.if_pop("-parallelattrs")){
+			pModel->setParallelAttrs(args.pop_uint());
 		}else{
 			throw Ex("Invalid option: ", args.peek());
 		}
@@ -482,6 +493,36 @@ GDecisionTree* GLearnerLib::InstantiateDecisionTree(GArgReader& args, GMatrix* p
 	return pModel;
 }
 
+GGradientBoostedTrees* GLearnerLib::InstantiateGradientBoostedTrees(GArgReader& args)
+{
+	GGradientBoostedTrees* pModel = new GGradientBoostedTrees();
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-trees"))
+			pModel->setMaxTrees(args.pop_uint());
+		else if(args.if_pop("-rate"))
+			pModel->setLearningRate(args.pop_double());
+		else if(args.if_pop("-rowsample"))
+			pModel->setRowSample(args.pop_double());
+		else if(args.if_pop("-colsample"))
+			pModel->setColSample(args.pop_double());
+		else if(args.if_pop("-validate"))
+		{
+			double portion = args.pop_double();
+			pModel->setValidation(portion, args.pop_uint());
+		}
+		else if(args.if_pop("-leafthresh"))
+			pModel->setLeafThresh(args.pop_uint());
+		else if(args.if_pop("-maxlevels"))
+			pModel->setMaxLevels(args.pop_uint());
+		else if(args.if_pop("-bins"))
+			pModel->setBins(args.pop_uint());
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	return pModel;
+}
+
 GGaussianProcess* GLearnerLib::InstantiateGaussianProcess(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels)
 {
 	GGaussianProcess* pModel = new GGaussianProcess();
@@ -616,6 +657,8 @@ GKNN* GLearnerLib::InstantiateKNN(GArgReader& args, GMatrix* pFeatures, GMatrix*
 			pModel->setInterpolationMethod(GKNN::Mean);
 		else if(args.if_pop("-scalefeatures"))
 			pModel->setOptimizeScaleFactors(true);
+		else if(args.if_pop("-approximate"))
+			pModel->useApproximateNeighbors(args.pop_uint());
 		else if(args.if_pop("-cosine"))
 			pModel->setMetric(new GCosineSimilarity(), true);
 		else if(args.if_pop("-pearson"))
@@ -759,6 +802,8 @@ GNeuralNetLearner* GLearnerLib::InstantiateNeuralNet(GArgReader& args, GMatrix*
 			size_t inPos = args.pop_uint();
 			pModel->nn().concat(instantiateBlock(args), inPos);
 		}
+		else if(args.if_pop("-float"))
+			pModel->nn().setSinglePrecision(true);
 /*		else if(args.if_pop("-learningrate"))
 			pModel->setLearningRate(args.pop_double());
 		else if(args.if_pop("-momentum"))
@@ -782,14 +827,19 @@ GRandomForest* GLearnerLib::InstantiateRandomForest(GArgReader& args)
 {
 	size_t trees = args.pop_uint();
 	size_t samples = 1;
+	size_t threads = INVALID_INDEX;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-samples"))
 			samples = args.pop_uint();
+		else if(args.if_pop("-threads"))
+			threads = args.pop_uint();
 		else
 			throw Ex("Invalid random forest option: ", args.peek());
 	}
-	return new GRandomForest(trees, samples);
+	GRandomForest* pModel = new GRandomForest(trees, samples);
+	pModel->setTrainThreads(threads);
+	return pModel;
 }
 
 GReservoirNet* GLearnerLib::InstantiateReservoirNet(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels)
@@ -896,6 +946,8 @@ GTransducer* GLearnerLib::InstantiateAlgorithm(GArgReader& args, GMatrix* pFeatu
 			pAlg = InstantiateDecisionTree(args, pFeatures, pLabels);
 		else if(args.if_pop("gaussianprocess"))
 			pAlg = InstantiateGaussianProcess(args, pFeatures, pLabels);
+		else if(args.if_pop("gbt"))
+			pAlg = InstantiateGradientBoostedTrees(args);
 		else if(args.if_pop("graphcuttransducer"))
 			pAlg = InstantiateGraphCutTransducer(args, pFeatures, pLabels);
 		else if(args.if_pop("hodgepodge"))
@@ -1109,12 +1161,7 @@ void GLearnerLib::predict(GArgReader& args)
 	pLabels->fill(0.0); // Wipe out the existing labels, just to be absolutely certain that we don't somehow accidentally let them influence the predictions
 
 	// Test
-	for(size_t i = 0; i < pFeatures->rows(); i++)
-	{
-		GVec& featureVec = pFeatures->row(i);
-		GVec& labelVec = pLabels->row(i);
-		pModeler->predict(featureVec, labelVec);
-	}
+	pModeler->predictBatch(*pFeatures, *pLabels);
 
 	// Print results
 	pLabels->print(cout);
@@ -1651,6 +1698,7 @@ void GLearnerLib::CrossValidate(GArgReader& args)
 	int reps = 5;
 	int folds = 2;
 	bool succinct = false;
+	size_t memoryMB = 0;
 	while(args.next_is_flag())
 	{
 		if(args.if_pop("-seed"))
@@ -1661,6 +1709,8 @@ void GLearnerLib::CrossValidate(GArgReader& args)
 			folds = args.pop_uint();
 		else if(args.if_pop("-succinct"))
 			succinct = true;
+		else if(args.if_pop("-memory"))
+			memoryMB = args.pop_uint();
 		else
 			throw Ex("Invalid crossvalidate option: ", args.peek());
 	}
@@ -1681,10 +1731,11 @@ void GLearnerLib::CrossValidate(GArgReader& args)
 	if(args.size() > 0)
 		throw Ex("Superfluous argument: ", args.peek());
 	pSupLearner->rand().setSeed(seed);
+	pSupLearner->setValidationMemory(memoryMB * 1024 * 1024);
 
 	// Test
 	cout.precision(8);
-	double sae;
+	double sae = 0.0;
 	double sse = pSupLearner->repValidate(*pFeatures, *pLabels, reps, folds, &sae, succinct ? NULL : CrossValidateCallback, pSupLearner);
 	if(succinct)
 		cout << to_str(sse / pFeatures->rows());
@@ -107,6 +107,8 @@ public:
 
 	static GGaussianProcess* InstantiateGaussianProcess(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels);
 
+	static GGradientBoostedTrees* InstantiateGradientBoostedTrees(GArgReader& args);
+
 	static GGraphCutTransducer* InstantiateGraphCutTransducer(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels);
 
 	static GBayesianModelCombination* InstantiateHodgePodge(GArgReader& args, GMatrix* pFeatures, GMatrix* pLabels);
@@ -52,6 +52,8 @@ GLinearRegressor::~GLinearRegressor()
 // virtual
 GDomNode* GLinearRegressor::serialize(GDom* pDoc) const
 {
+	if(!m_pBeta)
+		throw Ex("Attempted to serialize a model that has not been trained");
 	GDomNode* pNode = baseDomNode(pDoc, "GLinearRegressor");
 	pNode->addField(pDoc, "beta", m_pBeta->serialize(pDoc));
 	pNode->addField(pDoc, "epsilon", m_epsilon.serialize(pDoc));
@@ -192,6 +194,22 @@ void GLinearRegressor::predict(const GVec& in, GVec& out)
 	out += m_epsilon;
 }
 
+// virtual
+void GLinearRegressor::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	if(!m_pBeta)
+		throw Ex("Not trained yet");
+	GMatrix* pProduct = GMatrix::multiply(in, *m_pBeta, false, true);
+	std::unique_ptr<GMatrix> hProduct(pProduct);
+	for(size_t i = 0; i < in.rows(); i++)
+	{
+		GVec& o = out[i];
+		o.copy(pProduct->row(i));
+		o += m_epsilon;
+	}
+}
+
 // virtual
 void GLinearRegressor::clear()
 {
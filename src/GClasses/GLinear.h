@@ -74,6 +74,18 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& pIn, GVec& pOut);
 
+	/// Multiplies all of the rows by the coefficients at once, using the multithreaded
+	/// matrix multiply, and adds the offsets.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+#ifndef MIN_PREDICT
+	/// Returns true. See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return true; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& pIn, GPrediction* pOut);
 
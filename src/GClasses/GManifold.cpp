@@ -38,6 +38,7 @@
 #include "GDom.h"
 #include "GVec.h"
 #include "GHolders.h"
+#include <algorithm>
 #include <deque>
 #include <set>
 #include <map>
@@ -579,18 +580,19 @@ void GManifoldSculpting::calculateMetadata(const GMatrix* pData)
 		}
 
 		// Set up some some data structures that store the neighbors and distances of each point (and some other stuff)
+		vector<size_t> indices;
+		vector<double> dists;
+		pNF->findNearestAll(m_nNeighbors, indices, dists);
 		for(size_t i = 0; i < pData->rows(); i++)
 		{
 			stuff(i)->m_bAdjustable = true;
-			pNF->findNearest(m_nNeighbors, i);
-			pNF->sortNeighbors();
 			struct GManifoldSculptingNeighbor* pArrNeighbors = record(i);
 			for(size_t j = 0; j < m_nNeighbors; j++)
 			{
-				pArrNeighbors[j].m_nNeighbor = pNF->neighbor(j);
+				pArrNeighbors[j].m_nNeighbor = indices[i * m_nNeighbors + j];
 				m_goodNeighbors++;
 				pArrNeighbors[j].m_nNeighborsNeighborSlot = INVALID_INDEX;
-				pArrNeighbors[j].m_dDistance = sqrt(pNF->distance(j));
+				pArrNeighbors[j].m_dDistance = sqrt(dists[i * m_nNeighbors + j]);
 				m_dAveNeighborDist += pArrNeighbors[j].m_dDistance;
 			}
 		}
@@ -955,14 +957,13 @@ GMatrix* GIsomap::reduce(const GMatrix& in)
 
 	// Compute the distance matrix using the Floyd Warshall algorithm
 	GFloydWarshall graph(in.rows());
+	vector<size_t> indices;
+	vector<double> dists;
+	pNF->findNearestAll(m_neighborCount, indices, dists);
 	for(size_t i = 0; i < in.rows(); i++)
 	{
-		size_t nc = pNF->findNearest(m_neighborCount, i);
-		for(size_t j = 0; j < nc; j++)
-		{
-			double d = sqrt(pNF->distance(j));
-			graph.addDirectedEdge(i, pNF->neighbor(j), d);
-		}
+		for(size_t j = i * m_neighborCount; j < (i + 1) * m_neighborCount && indices[j] != INVALID_INDEX; j++)
+			graph.addDirectedEdge(i, indices[j], sqrt(dists[j]));
 	}
 	graph.compute();
 	if(!graph.isConnected())
@@ -1091,16 +1092,10 @@ void GLLEHelper::findNeighbors(GNeighborFinder* pNF)
 {
 	delete(m_pNeighbors);
 	m_pNeighbors = new size_t[m_nNeighbors * m_pInputData->rows()];
-	size_t* pHood = m_pNeighbors;
-	for(size_t i = 0; i < m_pInputData->rows(); i++)
-	{
-		size_t nc = pNF->findNearest(m_nNeighbors, i);
-		for(size_t j = 0; j < nc; j++)
-			pHood[j] = pNF->neighbor(j);
-		for(size_t j = nc; j < m_nNeighbors; j++)
-			pHood[j] = INVALID_INDEX;
-		pHood += m_nNeighbors;
-	}
+	vector<size_t> indices;
+	vector<double> dists;
+	pNF->findNearestAll(m_nNeighbors, indices, dists);
+	std::copy(indices.begin(), indices.end(), m_pNeighbors);
 }
 
 void GLLEHelper::computeWeights()
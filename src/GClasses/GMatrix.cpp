@@ -43,7 +43,15 @@
 #include <cmath>
 #include <set>
 #include <errno.h>
+#include <stdint.h>
 #include <memory>
+#include "GThread.h"
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define GMATRIX_X86_KERNELS
+#	include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#	include <arm_neon.h>
+#endif
 
 using std::vector;
 using std::string;
@@ -474,6 +482,9 @@ public:
 	GArffTokenizer(const char* pFile, size_t len) : GTokenizer(pFile, len),
 	m_whitespace("\t\n\r "), m_spaces(" \t"), m_space(" "), m_valEnd(",}\n"), m_valEnder(" ,\t}\n"), m_valHardEnder(",}\t\n"), m_argEnd(" \t\n{\r"), m_newline("\n"), m_commaNewlineTab(",\n\t") {}
 	virtual ~GArffTokenizer() {}
+
+	/// Sets the line number of the next character. (Used when the text is one piece of a bigger file.)
+	void setLine(size_t line) { m_line = line; }
 };
 
 GArffRelation::GArffRelation()
@@ -916,28 +927,30 @@ void GArffRelation::dropValue(size_t attr, int val)
 // ------------------------------------------------------------------
 
 GMatrix::GMatrix()
-: m_pRelation(&g_emptyRelation)
+: m_pRelation(&g_emptyRelation), m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 }
 
 GMatrix::GMatrix(GRelation* pRelation)
-: m_pRelation(pRelation)
+: m_pRelation(pRelation), m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 }
 
 GMatrix::GMatrix(size_t rowCount, size_t colCount)
+: m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 	m_pRelation = new GUniformRelation(colCount, 0);
 	newRows(rowCount);
 }
 
 GMatrix::GMatrix(vector<size_t>& attrValues)
+: m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 	m_pRelation = new GMixedRelation(attrValues);
 }
 
 GMatrix::GMatrix(const GMatrix& orig, size_t rowStart, size_t colStart, size_t rowCount, size_t colCount)
-: m_pRelation(NULL)
+: m_pRelation(NULL), m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 	copy(orig, rowStart, colStart, rowCount, colCount);
 }
@@ -949,6 +962,7 @@ GMatrix& GMatrix::operator=(const GMatrix& orig)
 }
 
 GMatrix::GMatrix(const GDomNode* pNode)
+: m_pSlabBuf(NULL), m_pSlab(NULL), m_stride(0), m_slabRows(0), m_slabUsed(0), m_contiguous(false), m_pMapping(NULL)
 {
 	m_pRelation = GRelation::deserialize(pNode->field("rel"));
 	GDomNode* pRows = pNode->field("vals");
@@ -1002,6 +1016,8 @@ void GMatrix::setRelation(GRelation* pRelation)
 {
 	if(pRelation && rows() > 0 && pRelation->size() != m_pRelation->size())
 		throw Ex("Existing data incompatible with new relation");
+	if(rows() == 0)
+		freeSlab(); // the stride may no longer fit
 	if(m_pRelation != pRelation)
 	{
 		if(m_pRelation != &g_emptyRelation)
@@ -1020,8 +1036,175 @@ void GMatrix::resize(size_t rowCount, size_t colCount)
 void GMatrix::flush()
 {
 	for(size_t i = 0; i < rows(); i++)
-		delete(m_rows[i]);
+	{
+		if(!isView(m_rows[i]))
+			delete(m_rows[i]);
+	}
 	m_rows.clear();
+	freeSlab();
+	for(size_t i = 0; i < m_retiredSlabs.size(); i++)
+		delete(m_retiredSlabs[i]);
+	m_retiredSlabs.clear();
+}
+
+void GMatrix::setContiguous(bool contiguous)
+{
+	if(contiguous)
+	{
+		if(!isContiguous() && rows() > 0)
+			packSlab(rows());
+		m_contiguous = true;
+	}
+	else
+	{
+		for(size_t i = 0; i < rows(); i++)
+			m_rows[i] = detachRow(m_rows[i]);
+		freeSlab();
+		m_contiguous = false;
+	}
+}
+
+bool GMatrix::isContiguous() const
+{
+	if(!m_contiguous)
+		return false;
+	if(m_rows.size() > m_slabRows)
+		return false;
+	size_t b = 0;
+	size_t start = 0;
+	for(size_t i = 0; i < m_rows.size(); i++)
+	{
+		while(i >= m_viewBlockEnds[b])
+			start = m_viewBlockEnds[b++];
+		if(m_rows[i] != m_viewBlocks[b] + (i - start))
+			return false;
+	}
+	return true;
+}
+
+bool GMatrix::isView(const GVec* pRow) const
+{
+	size_t start = 0;
+	for(size_t b = 0; b < m_viewBlocks.size(); b++)
+	{
+		if(pRow >= m_viewBlocks[b] && pRow < m_viewBlocks[b] + (m_viewBlockEnds[b] - start))
+			return true;
+		start = m_viewBlockEnds[b];
+	}
+	for(size_t i = 0; i < m_retiredSlabs.size(); i++)
+	{
+		if(m_retiredSlabs[i]->isView(pRow))
+			return true;
+	}
+	return false;
+}
+
+GVec* GMatrix::slabView(size_t i) const
+{
+	GAssert(i < m_slabRows);
+	size_t b = m_viewBlocks.size() - 1;
+	while(b > 0 && m_viewBlockEnds[b - 1] > i)
+		b--;
+	return m_viewBlocks[b] + (i - (b > 0 ? m_viewBlockEnds[b - 1] : 0));
+}
+
+GVec* GMatrix::detachRow(GVec* pRow) const
+{
+	if(isView(pRow))
+		return new GVec(*pRow);
+	return pRow;
+}
+
+void GMatrix::reserveSlab(size_t n)
+{
+	if(n <= m_slabRows)
+		return;
+	size_t stride = (m_slabRows > 0 ? m_stride : (cols() + 7) / 8 * 8);
+	double* pBuf = new double[n * stride + 8];
+	double* pSlab = (double*)(((size_t)pBuf + 63) & ~(size_t)63);
+	if(m_slabUsed > 0)
+		memcpy(pSlab, m_pSlab, sizeof(double) * m_slabUsed * stride);
+
+	// Point the existing views at the new block instead of replacing them, so references to rows stay valid
+	size_t start = 0;
+	for(size_t b = 0; b < m_viewBlocks.size(); b++)
+	{
+		GVec* pViews = m_viewBlocks[b];
+		for(size_t i = start; i < m_viewBlockEnds[b]; i++)
+			pViews[i - start].m_data = pSlab + i * stride;
+		start = m_viewBlockEnds[b];
+	}
+	GVec* pViews = new GVec[n - m_slabRows];
+	for(size_t i = m_slabRows; i < n; i++)
+		pViews[i - m_slabRows].m_data = pSlab + i * stride;
+	m_viewBlocks.push_back(pViews);
+	m_viewBlockEnds.push_back(n);
+
+	delete[] m_pSlabBuf;
+#ifndef MIN_PREDICT
+	delete(m_pMapping);
+#endif // MIN_PREDICT
+	m_pMapping = NULL;
+	m_pSlabBuf = pBuf;
+	m_pSlab = pSlab;
+	m_stride = stride;
+	m_slabRows = n;
+}
+
+void GMatrix::packSlab(size_t capacity)
+{
+	GAssert(capacity >= rows());
+	size_t c = cols();
+	size_t stride = (c + 7) / 8 * 8; // pad each row to a multiple of 64 bytes
+	double* pBuf = new double[capacity * stride + 8];
+	double* pSlab = (double*)(((size_t)pBuf + 63) & ~(size_t)63);
+	GVec* pViews = new GVec[capacity];
+	for(size_t i = 0; i < capacity; i++)
+		pViews[i].m_data = pSlab + i * stride;
+	for(size_t i = 0; i < m_rows.size(); i++)
+	{
+		GVec* pRow = m_rows[i];
+		pViews[i].m_size = c;
+		memcpy(pViews[i].m_data, pRow->data(), sizeof(double) * std::min(c, pRow->size()));
+		if(!isView(pRow))
+			delete(pRow);
+		m_rows[i] = &pViews[i];
+	}
+	freeSlab();
+	m_viewBlocks.push_back(pViews);
+	m_viewBlockEnds.push_back(capacity);
+	m_pSlabBuf = pBuf;
+	m_pSlab = pSlab;
+	m_stride = stride;
+	m_slabRows = capacity;
+	m_slabUsed = m_rows.size();
+}
+
+void GMatrix::freeSlab()
+{
+	size_t start = 0;
+	for(size_t b = 0; b < m_viewBlocks.size(); b++)
+	{
+		GVec* pViews = m_viewBlocks[b];
+		for(size_t i = start; i < m_viewBlockEnds[b]; i++)
+		{
+			pViews[i - start].m_data = NULL; // the views do not own their data
+			pViews[i - start].m_size = 0;
+		}
+		delete[] pViews;
+		start = m_viewBlockEnds[b];
+	}
+	m_viewBlocks.clear();
+	m_viewBlockEnds.clear();
+	delete[] m_pSlabBuf;
+#ifndef MIN_PREDICT
+	delete(m_pMapping);
+#endif // MIN_PREDICT
+	m_pSlabBuf = NULL;
+	m_pMapping = NULL;
+	m_pSlab = NULL;
+	m_slabRows = 0;
+	m_slabUsed = 0;
 }
 
 inline bool IsRealValue(const char* szValue)
@@ -1083,10 +1266,12 @@ double GMatrix_parseValue(GArffRelation* pRelation, size_t col, const char* szVa
 }
 
 #ifndef MIN_PREDICT
-void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
+// Parses the meta-data at the start of an ARFF file, and leaves tok at the start of the data section
+GArffRelation* GMatrix_parseArffHeader(GArffTokenizer& tok)
 {
 	// Parse the meta data
-	GArffRelation* pRelation = new GArffRelation();
+	std::unique_ptr<GArffRelation> hRelation(new GArffRelation());
+	GArffRelation* pRelation = hRelation.get();
 	while(true)
 	{
 		tok.skip(tok.m_whitespace);
@@ -1120,13 +1305,19 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 		else
 			throw Ex("Expected a '%' or a '@' at line ", to_str(tok.line()), ", col ", to_str(tok.col()));
 	}
+	return hRelation.release();
+}
 
-	flush();
-	setRelation(pRelation);
+// Parses up to maxRows rows of ARFF data. getRow is called once for each row that is found, and
+// returns the vector to fill. Returns the number of rows parsed.
+template<typename RowSource>
+size_t GMatrix_parseArffData(GArffTokenizer& tok, GArffRelation* pRelation, size_t maxRows, RowSource getRow)
+{
 	size_t colCount = pRelation->size();
+	size_t count = 0;
 	while(true)
 	{
-		if(rows() >= maxRows)
+		if(count >= maxRows)
 			break;
 		tok.skip(tok.m_whitespace);
 		char c = tok.peek();
@@ -1141,7 +1332,8 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 		{
 			// Parse ARFF sparse data format
 			tok.advance(1);
-			GVec& r = newRow();
+			GVec& r = getRow();
+			count++;
 			r.fill(0.0);
 			while(true)
 			{
@@ -1179,7 +1371,8 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 		else
 		{
 			// Parse ARFF dense data format
-			GVec& r = newRow();
+			GVec& r = getRow();
+			count++;
 			size_t column = 0;
 			while(true)
 			{
@@ -1210,17 +1403,234 @@ void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
 				throw Ex("Not enough values on line ", to_str(tok.line()), ", col ", to_str(tok.col()));
 		}
 	}
-	for(size_t i = 0; i < colCount; i++)
+	return count;
+}
+
+// String attributes are parsed as zeros, and are treated as continuous thereafter
+void GMatrix_finishArffRelation(GArffRelation* pRelation)
+{
+	for(size_t i = 0; i < pRelation->size(); i++)
 	{
 		if(pRelation->valueCount(i) == INVALID_INDEX)
 			pRelation->setAttrValueCount(i, 0);
 	}
 }
 
+// The size of the pieces that ARFF and CSV text is split into for parsing in parallel. (The unit
+// tests shrink this to exercise the boundaries.)
+static size_t g_arffChunkBytes = 1 << 22;
+
+// Returns true iff the line holds a row of ARFF data (that is, it is neither blank nor a comment)
+inline bool GMatrix_isArffRowLine(const char* pLine, size_t len)
+{
+	size_t i = 0;
+	while(i < len && (pLine[i] == ' ' || pLine[i] == '\t' || pLine[i] == '\r'))
+		i++;
+	return i < len && pLine[i] != '\n' && pLine[i] != '%';
+}
+
+// Counts the newlines in a piece of ARFF data, and the rows among the lines
+void GMatrix_countArffRows(const char* pText, size_t len, size_t& rowCount, size_t& lineCount)
+{
+	rowCount = 0;
+	lineCount = 0;
+	size_t pos = 0;
+	while(pos < len)
+	{
+		const char* pNewline = (const char*)memchr(pText + pos, '\n', len - pos);
+		size_t lineEnd = pNewline ? pNewline - pText : len;
+		if(GMatrix_isArffRowLine(pText + pos, lineEnd - pos))
+			rowCount++;
+		if(!pNewline)
+			break;
+		lineCount++;
+		pos = lineEnd + 1;
+	}
+}
+
+// Returns true iff the line is the "@DATA" line that ends the header of an ARFF file
+inline bool GMatrix_isArffDataLine(const char* pLine, size_t len)
+{
+	size_t i = 0;
+	while(i < len && (pLine[i] == ' ' || pLine[i] == '\t' || pLine[i] == '\r'))
+		i++;
+	return len - i >= 5 && pLine[i] == '@' && _strnicmp(pLine + i + 1, "data", 4) == 0 && (i + 5 == len || pLine[i + 5] <= ' ');
+}
+
+// Returns the offset of the first byte after the "@DATA" line, or len if there is none
+size_t GMatrix_findArffData(const char* pText, size_t len)
+{
+	size_t pos = 0;
+	while(pos < len)
+	{
+		const char* pNewline = (const char*)memchr(pText + pos, '\n', len - pos);
+		size_t lineEnd = pNewline ? pNewline - pText : len;
+		if(GMatrix_isArffDataLine(pText + pos, lineEnd - pos))
+			return pNewline ? lineEnd + 1 : len;
+		pos = lineEnd + 1;
+	}
+	return len;
+}
+
+// Splits text into pieces of about chunkBytes that each end with a newline (except maybe the last).
+// Piece i is [bounds[i], bounds[i + 1]).
+void GMatrix_splitLines(const char* pText, size_t len, size_t chunkBytes, vector<size_t>& bounds)
+{
+	bounds.clear();
+	bounds.push_back(0);
+	while(bounds.back() < len)
+	{
+		size_t end = std::min(len, bounds.back() + chunkBytes);
+		if(end < len)
+		{
+			const char* pNewline = (const char*)memchr(pText + end - 1, '\n', len - end + 1);
+			end = pNewline ? pNewline - pText + 1 : len;
+		}
+		bounds.push_back(end);
+	}
+}
+
+// Parses the data section of an ARFF file (which begins on line firstLine) into out, which must be empty.
+// The text is split at line boundaries into pieces, which are counted and then parsed in parallel
+// straight into their own rows of out.
+void GMatrix_parseArffChunks(const char* pText, size_t len, size_t firstLine, GArffRelation* pRelation, GMatrix& out, size_t maxRows)
+{
+	vector<size_t> bounds;
+	GMatrix_splitLines(pText, len, g_arffChunkBytes, bounds);
+	size_t chunks = bounds.size() - 1;
+	vector<size_t> rowCounts(chunks);
+	vector<size_t> lineCounts(chunks);
+	GThreadPool& pool = GThreadPool::global();
+	pool.parallelFor(0, chunks, [&](size_t i) {
+		GMatrix_countArffRows(pText + bounds[i], bounds[i + 1] - bounds[i], rowCounts[i], lineCounts[i]);
+	});
+
+	// Give each piece its own range of rows
+	vector<size_t> firstRow(chunks);
+	vector<size_t> startLine(chunks);
+	size_t total = 0;
+	for(size_t i = 0; i < chunks; i++)
+	{
+		firstRow[i] = total;
+		startLine[i] = firstLine;
+		total += rowCounts[i];
+		firstLine += lineCounts[i];
+	}
+	total = std::min(total, maxRows);
+	out.newRows(total);
+	pool.parallelFor(0, chunks, [&](size_t i) {
+		if(firstRow[i] >= total || rowCounts[i] == 0)
+			return;
+		size_t end = std::min(total, firstRow[i] + rowCounts[i]);
+		GArffTokenizer tok(pText + bounds[i], bounds[i + 1] - bounds[i]);
+		tok.setLine(startLine[i]);
+		size_t next = firstRow[i];
+		GMatrix_parseArffData(tok, pRelation, end - firstRow[i], [&]() -> GVec& {
+			if(next >= end)
+				throw Ex("Unexpected data on line ", to_str(tok.line()));
+			return out.row(next++);
+		});
+		if(next != end)
+			throw Ex("Expected more data near line ", to_str(tok.line()));
+	});
+}
+
+void GMatrix::parseArff(GArffTokenizer& tok, size_t maxRows)
+{
+	GArffRelation* pRelation = GMatrix_parseArffHeader(tok);
+	flush();
+	setRelation(pRelation);
+	GMatrix_parseArffData(tok, pRelation, maxRows, [this]() -> GVec& { return newRow(); });
+	GMatrix_finishArffRelation(pRelation);
+}
+
+void GMatrix::parseArff(const char* szFile, size_t nLen, size_t maxRows)
+{
+	if(nLen == 0)
+		nLen = strlen(szFile);
+	size_t dataStart = GMatrix_findArffData(szFile, nLen);
+	if(dataStart == 0)
+		throw Ex("Invalid ARFF file--contains no data");
+	GArffTokenizer tok(szFile, dataStart);
+	GArffRelation* pRelation = GMatrix_parseArffHeader(tok);
+	flush();
+	setRelation(pRelation);
+	size_t firstLine = 1 + std::count(szFile, szFile + dataStart, '\n');
+	GMatrix_parseArffChunks(szFile + dataStart, nLen - dataStart, firstLine, pRelation, *this, maxRows);
+	GMatrix_finishArffRelation(pRelation);
+}
+
+// static
+void GMatrix::streamArff(const char* szFilename, size_t batchSize, const std::function<void(GMatrix& batch)>& onBatch)
+{
+	if(batchSize < 1)
+		throw Ex("Expected a positive batch size");
+	std::ifstream in(szFilename, std::ios::in | std::ios::binary);
+	if(in.fail())
+		throw Ex("Error while trying to open the file, ", szFilename, ". ", strerror(errno));
+
+	// Parse the header
+	string text;
+	string line;
+	size_t lineNum = 1;
+	while(std::getline(in, line))
+	{
+		text += line;
+		text += '\n';
+		lineNum++;
+		if(GMatrix_isArffDataLine(line.c_str(), line.length()))
+			break;
+	}
+	if(text.length() == 0)
+		throw Ex("Invalid ARFF file--contains no data");
+	GArffTokenizer tok(text.c_str(), text.length());
+	std::unique_ptr<GArffRelation> hRelation(GMatrix_parseArffHeader(tok));
+
+	// The values are parsed with the original relation. The batches get a copy in which string attributes have become continuous.
+	GRelation* pBatchRelation = hRelation->clone();
+	GMatrix_finishArffRelation((GArffRelation*)pBatchRelation);
+	GMatrix batch(pBatchRelation);
+
+	// Parse the data, one batch of rows at a time
+	while(true)
+	{
+		text.clear();
+		size_t firstLine = lineNum;
+		size_t rowCount = 0;
+		while(rowCount < batchSize && std::getline(in, line))
+		{
+			text += line;
+			text += '\n';
+			lineNum++;
+			if(GMatrix_isArffRowLine(line.c_str(), line.length()))
+				rowCount++;
+		}
+		if(rowCount == 0)
+			break;
+		batch.flush();
+		GMatrix_parseArffChunks(text.c_str(), text.length(), firstLine, hRelation.get(), batch, INVALID_INDEX);
+		onBatch(batch);
+	}
+}
+
 void GMatrix::loadArff(const char* szFilename, size_t maxRows)
 {
-	GArffTokenizer tok(szFilename);
-	parseArff(tok, maxRows);
+	// Regular files are mapped into memory and parsed in parallel. Anything that cannot be mapped (such as a pipe) is streamed.
+	std::unique_ptr<GFileMapping> hMapping;
+	try
+	{
+		hMapping.reset(new GFileMapping(szFilename));
+	}
+	catch(const std::exception&)
+	{
+	}
+	if(hMapping && hMapping->size() > 0)
+		parseArff(hMapping->data(), hMapping->size(), maxRows);
+	else
+	{
+		GArffTokenizer tok(szFilename);
+		parseArff(tok, maxRows);
+	}
 }
 
 void GMatrix::loadRaw(const char* szFilename)
@@ -1249,6 +1659,8 @@ void GMatrix::load(const char* szFilename)
 			loadArff(szFilename);
 		else if(ext == "raw")
 			loadRaw(szFilename);
+		else if(ext == "wbin")
+			loadBinary(szFilename);
 		else
 			throw Ex("File type could not be determined.");
 	}
@@ -1273,11 +1685,110 @@ void GMatrix::saveRaw(const char* szFilename)
 	fout.close();
 }
 
-// static
-void GMatrix::parseArff(const char* szFile, size_t nLen, size_t maxRows)
+#define GMATRIX_BINARY_MAGIC "GMATBIN"
+#define GMATRIX_BINARY_VERSION 1
+#define GMATRIX_BINARY_BYTE_ORDER 0x01020304
+
+// The 64-byte header at the start of a file written by GMatrix::saveBinary
+struct GMatrixBinaryHeader
 {
-	GArffTokenizer tok(szFile, nLen);
-	parseArff(tok, maxRows);
+	char m_magic[8];
+	uint32_t m_version;
+	uint32_t m_byteOrder; // GMATRIX_BINARY_BYTE_ORDER, as the saving machine stores it
+	uint64_t m_rows;
+	uint64_t m_cols;
+	uint64_t m_stride; // doubles from the start of one row to the next
+	uint64_t m_relationBytes; // length of the JSON relation that follows the header
+	uint64_t m_dataOffset; // bytes from the start of the file to the first row (a multiple of 64)
+	uint64_t m_reserved;
+};
+
+void GMatrix::saveBinary(const char* szFilename) const
+{
+	GDom doc;
+	doc.setRoot(m_pRelation->serialize(&doc));
+	std::ostringstream os;
+	doc.writeJson(os);
+	string rel = os.str();
+
+	GMatrixBinaryHeader header;
+	memset(&header, '\0', sizeof(GMatrixBinaryHeader));
+	memcpy(header.m_magic, GMATRIX_BINARY_MAGIC, sizeof(GMATRIX_BINARY_MAGIC));
+	header.m_version = GMATRIX_BINARY_VERSION;
+	header.m_byteOrder = GMATRIX_BINARY_BYTE_ORDER;
+	header.m_rows = rows();
+	header.m_cols = cols();
+	header.m_stride = (cols() + 7) / 8 * 8;
+	header.m_relationBytes = rel.size();
+	header.m_dataOffset = (sizeof(GMatrixBinaryHeader) + rel.size() + 63) / 64 * 64;
+
+	std::ofstream fout(szFilename, std::ios::out | std::ios::binary);
+	if(fout.fail())
+		throw Ex("Error while trying to create the file, ", szFilename, ". ", strerror(errno));
+	fout.write((const char*)&header, sizeof(GMatrixBinaryHeader));
+	fout.write(rel.c_str(), rel.size());
+	vector<char> pad((size_t)header.m_dataOffset - sizeof(GMatrixBinaryHeader) - rel.size(), '\0');
+	if(pad.size() > 0)
+		fout.write(&pad[0], pad.size());
+	vector<double> buf((size_t)header.m_stride, 0.0);
+	for(size_t i = 0; i < rows(); i++)
+	{
+		memcpy(buf.data(), m_rows[i]->data(), sizeof(double) * cols());
+		fout.write((const char*)buf.data(), sizeof(double) * buf.size());
+	}
+	fout.close();
+	if(fout.fail())
+		throw Ex("Error while writing to the file, ", szFilename);
+}
+
+void GMatrix::loadBinary(const char* szFilename)
+{
+	std::unique_ptr<GFileMapping> hMapping(new GFileMapping(szFilename));
+	const GMatrixBinaryHeader* pHeader = (const GMatrixBinaryHeader*)hMapping->data();
+	if(hMapping->size() < sizeof(GMatrixBinaryHeader) || memcmp(pHeader->m_magic, GMATRIX_BINARY_MAGIC, sizeof(GMATRIX_BINARY_MAGIC)) != 0)
+		throw Ex("The file, ", szFilename, ", is not in the binary matrix format");
+	if(pHeader->m_byteOrder != GMATRIX_BINARY_BYTE_ORDER)
+		throw Ex("The file, ", szFilename, ", was saved on a machine with a different byte order");
+	if(pHeader->m_version != GMATRIX_BINARY_VERSION)
+		throw Ex("The file, ", szFilename, ", is in version ", to_str(pHeader->m_version), " of the binary matrix format, but only version ", to_str(GMATRIX_BINARY_VERSION), " is supported");
+	size_t r = (size_t)pHeader->m_rows;
+	size_t c = (size_t)pHeader->m_cols;
+	size_t stride = (size_t)pHeader->m_stride;
+	size_t relBytes = (size_t)pHeader->m_relationBytes;
+	size_t dataOffset = (size_t)pHeader->m_dataOffset;
+	size_t size = hMapping->size();
+	if(stride < c || dataOffset % 64 != 0 || relBytes > size || dataOffset < sizeof(GMatrixBinaryHeader) + relBytes || dataOffset > size ||
+		(r > 0 && (stride == 0 || (size - dataOffset) / sizeof(double) / r < stride)))
+		throw Ex("The file, ", szFilename, ", is truncated or corrupt");
+
+	// Only the relation is parsed. The rows are used where they lie in the file.
+	GDom doc;
+	doc.parseJson(hMapping->data() + sizeof(GMatrixBinaryHeader), relBytes);
+	GRelation* pRelation = GRelation::deserialize(doc.root());
+	if(pRelation->size() != c)
+	{
+		delete(pRelation);
+		throw Ex("The file, ", szFilename, ", is truncated or corrupt");
+	}
+	flush();
+	setRelation(pRelation);
+	double* pSlab = (double*)(hMapping->data() + dataOffset);
+	GVec* pViews = new GVec[r];
+	m_viewBlocks.push_back(pViews);
+	m_viewBlockEnds.push_back(r);
+	m_rows.resize(r);
+	for(size_t i = 0; i < r; i++)
+	{
+		pViews[i].m_data = pSlab + i * stride;
+		pViews[i].m_size = c;
+		m_rows[i] = &pViews[i];
+	}
+	m_pSlab = pSlab;
+	m_stride = stride;
+	m_slabRows = r;
+	m_slabUsed = r;
+	m_contiguous = true;
+	m_pMapping = hMapping.release();
 }
 
 size_t GMatrix::countUniqueValues(size_t column, size_t maxCount) const
@@ -1427,100 +1938,283 @@ void GMatrix::multiply(const GVec& vectorIn, GVec& vectorOut, bool transposeFirs
 	}
 }
 
-// static
-GMatrix* GMatrix::multiply(const GMatrix& a, const GMatrix& b, bool transposeA, bool transposeB)
+// Blocked matrix multiplication. C = op(A) * op(B) is computed one KC x NC block of op(B) at a time.
+// The block is packed into strips of GEMM_NR columns, and each MC x KC panel of op(A) is packed into
+// strips of GEMM_MR rows, so the micro-kernel reads both operands with unit stride regardless of
+// whether they are transposed. Row panels of C are independent jobs, so they are spread across threads.
+#define GEMM_MR 4
+#define GEMM_NR 8
+#define GEMM_KC 256
+#define GEMM_MC 96
+#define GEMM_NC 1024
+
+// Packs rows [i0, i0 + mc) and columns [k0, k0 + kc) of op(A) into strips of GEMM_MR rows.
+static void GMatrix_packA(const GMatrix& a, bool transpose, size_t i0, size_t mc, size_t k0, size_t kc, double* pBuf)
 {
-	if(transposeA)
+	for(size_t i = 0; i < mc; i += GEMM_MR)
 	{
-		if(transposeB)
+		size_t mr = std::min((size_t)GEMM_MR, mc - i);
+		if(transpose)
 		{
-			size_t dims = a.rows();
-			if((size_t)b.cols() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.rows();
-			size_t h = a.cols();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t k = 0; k < kc; k++)
 			{
-				GVec& r = pOut->row(y);
-				for(size_t x = 0; x < w; x++)
-				{
-					const GVec& pB = b[x];
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += a[i][y] * pB[i];
-					r[x] = sum;
-				}
+				const double* pRow = a[k0 + k].data() + i0 + i;
+				size_t r;
+				for(r = 0; r < mr; r++)
+					*(pBuf++) = pRow[r];
+				for( ; r < GEMM_MR; r++)
+					*(pBuf++) = 0.0;
 			}
-			return pOut;
 		}
 		else
 		{
-			size_t dims = a.rows();
-			if(b.rows() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.cols();
-			size_t h = a.cols();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			const double* pRows[GEMM_MR];
+			for(size_t r = 0; r < mr; r++)
+				pRows[r] = a[i0 + i + r].data() + k0;
+			for(size_t k = 0; k < kc; k++)
 			{
-				GVec& r = pOut->row(y);
-				for(size_t x = 0; x < w; x++)
-				{
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += a[i][y] * b[i][x];
-					r[x] = sum;
-				}
+				size_t r;
+				for(r = 0; r < mr; r++)
+					*(pBuf++) = pRows[r][k];
+				for( ; r < GEMM_MR; r++)
+					*(pBuf++) = 0.0;
 			}
-			return pOut;
 		}
 	}
-	else
+}
+
+// Packs rows [k0, k0 + kc) and columns [j0, j0 + nc) of op(B) into strips of GEMM_NR columns.
+static void GMatrix_packB(const GMatrix& b, bool transpose, size_t k0, size_t kc, size_t j0, size_t nc, double* pBuf)
+{
+	for(size_t j = 0; j < nc; j += GEMM_NR)
 	{
-		if(transposeB)
+		size_t nr = std::min((size_t)GEMM_NR, nc - j);
+		if(transpose)
 		{
-			size_t dims = (size_t)a.cols();
-			if((size_t)b.cols() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.rows();
-			size_t h = a.rows();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			const double* pRows[GEMM_NR];
+			for(size_t c = 0; c < nr; c++)
+				pRows[c] = b[j0 + j + c].data() + k0;
+			for(size_t k = 0; k < kc; k++)
 			{
-				GVec& r = pOut->row(y);
-				const GVec& pA = a[y];
-				for(size_t x = 0; x < w; x++)
-					r[x] = pA.dotProduct(b[x]);
+				size_t c;
+				for(c = 0; c < nr; c++)
+					*(pBuf++) = pRows[c][k];
+				for( ; c < GEMM_NR; c++)
+					*(pBuf++) = 0.0;
 			}
-			return pOut;
 		}
 		else
 		{
-			size_t dims = (size_t)a.cols();
-			if(b.rows() != dims)
-				throw Ex("dimension mismatch");
-			size_t w = b.cols();
-			size_t h = a.rows();
-			GMatrix* pOut = new GMatrix(h, w);
-			for(size_t y = 0; y < h; y++)
+			for(size_t k = 0; k < kc; k++)
 			{
-				GVec& r = pOut->row(y);
-				const GVec& pA = a[y];
-				for(size_t x = 0; x < w; x++)
-				{
-					double sum = 0;
-					for(size_t i = 0; i < dims; i++)
-						sum += pA[i] * b[i][x];
-					r[x] = sum;
-				}
+				const double* pRow = b[k0 + k].data() + j0 + j;
+				size_t c;
+				for(c = 0; c < nr; c++)
+					*(pBuf++) = pRow[c];
+				for( ; c < GEMM_NR; c++)
+					*(pBuf++) = 0.0;
 			}
-			return pOut;
 		}
 	}
 }
 
-GMatrix* GMatrix::transpose()
+// Multiplies a packed GEMM_MR x kc strip of A by a packed kc x GEMM_NR strip of B, and stores the product in pOut.
+static void GMatrix_microKernelPortable(size_t kc, const double* pA, const double* pB, double* pOut)
+{
+#if defined(__ARM_NEON) && defined(__aarch64__)
+	float64x2_t c[GEMM_MR][GEMM_NR / 2];
+	for(size_t r = 0; r < GEMM_MR; r++)
+	{
+		for(size_t q = 0; q < GEMM_NR / 2; q++)
+			c[r][q] = vdupq_n_f64(0.0);
+	}
+	for(size_t k = 0; k < kc; k++)
+	{
+		float64x2_t b[GEMM_NR / 2];
+		for(size_t q = 0; q < GEMM_NR / 2; q++)
+			b[q] = vld1q_f64(pB + 2 * q);
+		for(size_t r = 0; r < GEMM_MR; r++)
+		{
+			for(size_t q = 0; q < GEMM_NR / 2; q++)
+				c[r][q] = vfmaq_n_f64(c[r][q], b[q], pA[r]);
+		}
+		pA += GEMM_MR;
+		pB += GEMM_NR;
+	}
+	for(size_t r = 0; r < GEMM_MR; r++)
+	{
+		for(size_t q = 0; q < GEMM_NR / 2; q++)
+			vst1q_f64(pOut + r * GEMM_NR + 2 * q, c[r][q]);
+	}
+#else
+	double c[GEMM_MR * GEMM_NR];
+	for(size_t i = 0; i < GEMM_MR * GEMM_NR; i++)
+		c[i] = 0.0;
+	for(size_t k = 0; k < kc; k++)
+	{
+		for(size_t r = 0; r < GEMM_MR; r++)
+		{
+			double a = pA[r];
+			double* pC = c + r * GEMM_NR;
+			for(size_t j = 0; j < GEMM_NR; j++)
+				pC[j] += a * pB[j];
+		}
+		pA += GEMM_MR;
+		pB += GEMM_NR;
+	}
+	memcpy(pOut, c, sizeof(double) * GEMM_MR * GEMM_NR);
+#endif
+}
+
+#ifdef GMATRIX_X86_KERNELS
+// The x86 micro-kernels are compiled for their instruction sets with target attributes, and
+// GMatrix_pickMicroKernel chooses one at runtime, so builds without -march can use them.
+
+__attribute__((target("avx512f")))
+static void GMatrix_microKernelAvx512(size_t kc, const double* pA, const double* pB, double* pOut)
+{
+	__m512d c0 = _mm512_setzero_pd();
+	__m512d c1 = _mm512_setzero_pd();
+	__m512d c2 = _mm512_setzero_pd();
+	__m512d c3 = _mm512_setzero_pd();
+	for(size_t k = 0; k < kc; k++)
+	{
+		__m512d b = _mm512_loadu_pd(pB);
+		c0 = _mm512_fmadd_pd(_mm512_set1_pd(pA[0]), b, c0);
+		c1 = _mm512_fmadd_pd(_mm512_set1_pd(pA[1]), b, c1);
+		c2 = _mm512_fmadd_pd(_mm512_set1_pd(pA[2]), b, c2);
+		c3 = _mm512_fmadd_pd(_mm512_set1_pd(pA[3]), b, c3);
+		pA += GEMM_MR;
+		pB += GEMM_NR;
+	}
+	_mm512_storeu_pd(pOut, c0);
+	_mm512_storeu_pd(pOut + 8, c1);
+	_mm512_storeu_pd(pOut + 16, c2);
+	_mm512_storeu_pd(pOut + 24, c3);
+}
+
+__attribute__((target("avx2,fma")))
+static void GMatrix_microKernelAvx2(size_t kc, const double* pA, const double* pB, double* pOut)
+{
+	__m256d c00 = _mm256_setzero_pd();
+	__m256d c01 = _mm256_setzero_pd();
+	__m256d c10 = _mm256_setzero_pd();
+	__m256d c11 = _mm256_setzero_pd();
+	__m256d c20 = _mm256_setzero_pd();
+	__m256d c21 = _mm256_setzero_pd();
+	__m256d c30 = _mm256_setzero_pd();
+	__m256d c31 = _mm256_setzero_pd();
+	for(size_t k = 0; k < kc; k++)
+	{
+		__m256d b0 = _mm256_loadu_pd(pB);
+		__m256d b1 = _mm256_loadu_pd(pB + 4);
+		__m256d a = _mm256_broadcast_sd(pA);
+		c00 = _mm256_fmadd_pd(a, b0, c00);
+		c01 = _mm256_fmadd_pd(a, b1, c01);
+		a = _mm256_broadcast_sd(pA + 1);
+		c10 = _mm256_fmadd_pd(a, b0, c10);
+		c11 = _mm256_fmadd_pd(a, b1, c11);
+		a = _mm256_broadcast_sd(pA + 2);
+		c20 = _mm256_fmadd_pd(a, b0, c20);
+		c21 = _mm256_fmadd_pd(a, b1, c21);
+		a = _mm256_broadcast_sd(pA + 3);
+		c30 = _mm256_fmadd_pd(a, b0, c30);
+		c31 = _mm256_fmadd_pd(a, b1, c31);
+		pA += GEMM_MR;
+		pB += GEMM_NR;
+	}
+	_mm256_storeu_pd(pOut, c00);
+	_mm256_storeu_pd(pOut + 4, c01);
+	_mm256_storeu_pd(pOut + 8, c10);
+	_mm256_storeu_pd(pOut + 12, c11);
+	_mm256_storeu_pd(pOut + 16, c20);
+	_mm256_storeu_pd(pOut + 20, c21);
+	_mm256_storeu_pd(pOut + 24, c30);
+	_mm256_storeu_pd(pOut + 28, c31);
+}
+#endif // GMATRIX_X86_KERNELS
+
+typedef void (*GMatrix_microKernelFunc)(size_t kc, const double* pA, const double* pB, double* pOut);
+
+// Returns the fastest micro-kernel that this CPU supports
+static GMatrix_microKernelFunc GMatrix_pickMicroKernel()
+{
+#ifdef GMATRIX_X86_KERNELS
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return GMatrix_microKernelAvx512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return GMatrix_microKernelAvx2;
+#endif
+	return GMatrix_microKernelPortable;
+}
+
+
+// Computes one row panel of C for the block of op(B) that has been packed into pPackedB
+static void GMatrix_multiplyPanel(const GMatrix& a, bool transposeA, GMatrix& c, const double* pPackedB, size_t panel, size_t k0, size_t kc, size_t j0, size_t nc, double* pPackedA)
+{
+	size_t i0 = panel * GEMM_MC;
+	size_t mc = std::min((size_t)GEMM_MC, c.rows() - i0);
+	GMatrix_packA(a, transposeA, i0, mc, k0, kc, pPackedA);
+	static const GMatrix_microKernelFunc microKernel = GMatrix_pickMicroKernel();
+	double acc[GEMM_MR * GEMM_NR];
+	for(size_t j = 0; j < nc; j += GEMM_NR)
+	{
+		size_t nr = std::min((size_t)GEMM_NR, nc - j);
+		const double* pB = pPackedB + j * kc;
+		for(size_t i = 0; i < mc; i += GEMM_MR)
+		{
+			size_t mr = std::min((size_t)GEMM_MR, mc - i);
+			microKernel(kc, pPackedA + i * kc, pB, acc);
+			for(size_t r = 0; r < mr; r++)
+			{
+				double* pC = c[i0 + i + r].data() + j0 + j;
+				const double* pAcc = acc + r * GEMM_NR;
+				for(size_t cc = 0; cc < nr; cc++)
+					pC[cc] += pAcc[cc];
+			}
+		}
+	}
+}
+
+// static
+GMatrix* GMatrix::multiply(const GMatrix& a, const GMatrix& b, bool transposeA, bool transposeB)
+{
+	size_t h = transposeA ? a.cols() : a.rows();
+	size_t dims = transposeA ? a.rows() : a.cols();
+	size_t w = transposeB ? b.rows() : b.cols();
+	if((transposeB ? b.cols() : b.rows()) != dims)
+		throw Ex("dimension mismatch");
+	GMatrix* pOut = new GMatrix(h, w);
+	pOut->fill(0.0);
+	if(h == 0 || w == 0 || dims == 0)
+		return pOut;
+
+	// Only spread the work across threads when there is enough of it to pay for the threads
+	GThreadPool& pool = GThreadPool::global();
+	size_t panels = (h + GEMM_MC - 1) / GEMM_MC;
+	size_t threads = ((double)h * w * dims >= 4e6 ? pool.participants(panels) : 1);
+	std::vector<GVec> packedA(threads);
+	for(size_t i = 0; i < threads; i++)
+		packedA[i].resize(GEMM_MC * GEMM_KC);
+
+	GVec packedB(GEMM_KC * ((std::min((size_t)GEMM_NC, w) + GEMM_NR - 1) / GEMM_NR * GEMM_NR));
+	for(size_t k0 = 0; k0 < dims; k0 += GEMM_KC)
+	{
+		size_t kc = std::min((size_t)GEMM_KC, dims - k0);
+		for(size_t j0 = 0; j0 < w; j0 += GEMM_NC)
+		{
+			size_t nc = std::min((size_t)GEMM_NC, w - j0);
+			GMatrix_packB(b, transposeB, k0, kc, j0, nc, packedB.data());
+			pool.parallelForSlots(0, panels, [&](size_t panel, size_t slot) {
+				GMatrix_multiplyPanel(a, transposeA, *pOut, packedB.data(), panel, k0, kc, j0, nc, packedA[slot].data());
+			}, threads);
+		}
+	}
+	return pOut;
+}
+
+GMatrix* GMatrix::transpose() const
 {
 	size_t r = rows();
 	size_t c = (size_t)cols();
@@ -2509,6 +3203,15 @@ GMatrix* GMatrix::leastSignificantEigenVectors(size_t nCount, GRand* pRand)
 */
 GVec& GMatrix::newRow()
 {
+	if(m_contiguous)
+	{
+		if(m_slabUsed >= m_slabRows)
+			reserveSlab(std::max((size_t)16, m_slabRows * 2));
+		GVec* pView = slabView(m_slabUsed++);
+		pView->m_size = m_pRelation->size();
+		m_rows.push_back(pView);
+		return *pView;
+	}
 	GVec* pNewVec = new GVec(m_pRelation->size());
 	m_rows.push_back(pNewVec);
 	return *pNewVec;
@@ -2518,12 +3221,23 @@ void GMatrix::newColumns(size_t n)
 {
 	size_t oldSize = m_pRelation->size();
 	if(m_pRelation->type() == GRelation::UNIFORM)
-		setRelation(new GUniformRelation(m_pRelation->size() + n, m_pRelation->valueCount(0)));
+	{
+		// (setRelation would reject a relation of a different size while there are rows)
+		GRelation* pNewRelation = new GUniformRelation(oldSize + n, oldSize > 0 ? m_pRelation->valueCount(0) : 0);
+		if(m_pRelation != &g_emptyRelation)
+			delete(m_pRelation);
+		m_pRelation = pNewRelation;
+	}
 	else
 	{
 		for(size_t i = 0; i < n; i++)
 			((GMixedRelation*)m_pRelation)->addAttr(0);
 	}
+	if(m_contiguous)
+	{
+		packSlab(rows());
+		return;
+	}
 	for(size_t i = 0; i < rows(); i++)
 	{
 		GVec* pOld = m_rows[i];
@@ -2544,9 +3258,18 @@ void GMatrix::takeRow(GVec* pRow, size_t pos)
 		m_rows.push_back(pRow);
 }
 
+void GMatrix::borrowRows(const GMatrix& that)
+{
+	if(that.cols() != cols())
+		throw Ex("Mismatching size");
+	m_rows.assign(that.m_rows.begin(), that.m_rows.end());
+}
+
 void GMatrix::newRows(size_t nRows)
 {
-	reserve(m_rows.size() + nRows);
+	m_rows.reserve(m_rows.size() + nRows);
+	if(m_contiguous && m_slabUsed + nRows > m_slabRows)
+		reserveSlab(std::max(m_slabUsed + nRows, m_slabRows * 2));
 	for(size_t i = 0; i < nRows; i++)
 		newRow();
 }
@@ -2633,6 +3356,19 @@ void GMatrix::copyBlock(const GMatrix& source, size_t srcRow, size_t srcCol, siz
 			}
 		}
 	}
+	if(isContiguous() && source.isContiguous())
+	{
+		double* pDest = m_pSlab + destRow * m_stride + destCol;
+		const double* pSrc = source.m_pSlab + srcRow * source.m_stride + srcCol;
+		if(wid == cols() && wid == source.cols() && m_stride == source.m_stride && hgt > 0)
+			memmove(pDest, pSrc, ((hgt - 1) * m_stride + wid) * sizeof(double));
+		else
+		{
+			for(size_t i = 0; i < hgt; i++)
+				memcpy(pDest + i * m_stride, pSrc + i * source.m_stride, wid * sizeof(double));
+		}
+		return;
+	}
 	for(size_t i = 0; i < hgt; i++)
 		memcpy(row(destRow + i).data() + destCol, source[srcRow + i].data() + srcCol, wid * sizeof(double));
 }
@@ -2658,6 +3394,16 @@ void GMatrix::swapColumns(size_t nAttr1, size_t nAttr2)
 		return;
 	m_pRelation->swapAttributes(nAttr1, nAttr2);
 	size_t nCount = rows();
+	if(isContiguous())
+	{
+		double* pRow = m_pSlab;
+		for(size_t i = 0; i < nCount; i++)
+		{
+			std::swap(pRow[nAttr1], pRow[nAttr2]);
+			pRow += m_stride;
+		}
+		return;
+	}
 	for(size_t i = 0; i < nCount; i++)
 	{
 		GVec& r = row(i);
@@ -2682,29 +3428,51 @@ GVec* GMatrix::releaseRow(size_t index)
 	GVec* pRow = m_rows[index];
 	m_rows[index] = m_rows[last];
 	m_rows.pop_back();
-	return pRow;
+	return detachRow(pRow);
 }
 
 void GMatrix::deleteRow(size_t index)
 {
-	delete(releaseRow(index));
+	size_t last = m_rows.size() - 1;
+	GVec* pRow = m_rows[index];
+	m_rows[index] = m_rows[last];
+	m_rows.pop_back();
+	if(!isView(pRow))
+		delete(pRow);
 }
 
 GVec* GMatrix::releaseRowPreserveOrder(size_t index)
 {
 	GVec* pRow = m_rows[index];
 	m_rows.erase(m_rows.begin() + index);
-	return pRow;
+	return detachRow(pRow);
 }
 
 void GMatrix::deleteRowPreserveOrder(size_t index)
 {
-	delete(releaseRowPreserveOrder(index));
+	GVec* pRow = m_rows[index];
+	m_rows.erase(m_rows.begin() + index);
+	if(!isView(pRow))
+		delete(pRow);
 }
 
 void GMatrix::releaseAllRows()
 {
 	m_rows.clear();
+	if(m_slabUsed > 0)
+	{
+		// The released rows may still be in use, so rows added later go in a fresh slab
+		GMatrix* pRetired = new GMatrix();
+		std::swap(pRetired->m_pSlabBuf, m_pSlabBuf);
+		std::swap(pRetired->m_pSlab, m_pSlab);
+		pRetired->m_viewBlocks.swap(m_viewBlocks);
+		pRetired->m_viewBlockEnds.swap(m_viewBlockEnds);
+		std::swap(pRetired->m_slabRows, m_slabRows);
+		std::swap(pRetired->m_slabUsed, m_slabUsed);
+		std::swap(pRetired->m_pMapping, m_pMapping);
+		pRetired->m_stride = m_stride;
+		m_retiredSlabs.push_back(pRetired);
+	}
 }
 
 // static
@@ -2898,6 +3666,7 @@ void GMatrix::splitBySize(GMatrix& other, size_t nOtherRows)
 
 void GMatrix::mergeVert(GMatrix* pData, bool ignoreMismatchingName)
 {
+	pData->setContiguous(false); // the rows are about to change owners
 	if(relation().type() == GRelation::ARFF && pData->relation().type() == GRelation::ARFF)
 	{
 		// Make an value mapping for pData
@@ -3530,6 +4299,17 @@ void GMatrix::centerMeanAtOrigin()
 		if(relation().valueCount(i) != 0){ mean[i] = 0; }
 	}
 	//Subtract the new mean from all rows
+	if(isContiguous())
+	{
+		double* pRow = m_pSlab;
+		for(size_t i = 0; i < rows(); i++)
+		{
+			for(size_t j = 0; j < dims; j++)
+				pRow[j] -= mean[j];
+			pRow += m_stride;
+		}
+		return;
+	}
 	for(size_t i = 0; i < rows(); i++)
 		(*this)[i] -= mean;
 }
@@ -4126,7 +4906,7 @@ GVec* GMatrix::swapRow(size_t i, GVec* pNewRow)
 {
 	GVec* pRow = m_rows[i];
 	m_rows[i] = pNewRow;
-	return pRow;
+	return detachRow(pRow);
 }
 
 #ifndef MIN_PREDICT
@@ -4272,6 +5052,47 @@ void GMatrix_testMultiply()
 	delete(pB);
 }
 
+void GMatrix_testMultiplyBlocked(GRand& prng)
+{
+	// These sizes span several blocks and leave partial strips on every edge
+	size_t h = 101;
+	size_t d = 300;
+	size_t w = 1030;
+	GMatrix a(h, d);
+	a.fillUniform(prng, -1.0, 1.0);
+	GMatrix b(d, w);
+	b.fillUniform(prng, -1.0, 1.0);
+	GMatrix* pAT = a.transpose();
+	std::unique_ptr<GMatrix> hAT(pAT);
+	GMatrix* pBT = b.transpose();
+	std::unique_ptr<GMatrix> hBT(pBT);
+	GMatrix expected(h, w);
+	for(size_t i = 0; i < h; i++)
+	{
+		for(size_t j = 0; j < w; j++)
+		{
+			double sum = 0.0;
+			for(size_t k = 0; k < d; k++)
+				sum += a[i][k] * b[k][j];
+			expected[i][j] = sum;
+		}
+	}
+	for(size_t i = 0; i < 4; i++)
+	{
+		bool transA = (i & 1) != 0;
+		bool transB = (i & 2) != 0;
+		GMatrix* pC = GMatrix::multiply(transA ? *pAT : a, transB ? *pBT : b, transA, transB);
+		std::unique_ptr<GMatrix> hC(pC);
+		if(pC->rows() != h || pC->cols() != w)
+			throw Ex("wrong size");
+		for(size_t y = 0; y < h; y++)
+		{
+			if((*pC)[y].squaredDistance(expected[y]) > 1e-18)
+				throw Ex("wrong answer");
+		}
+	}
+}
+
 void GMatrix_testCholesky()
 {
 	GMatrix m1(3, 3);
@@ -4749,6 +5570,206 @@ void GMatrix_testImport()
 }
 
 // static
+void GMatrix_testContiguous(GRand& prng)
+{
+	GMatrix a(37, 5);
+	a.fillUniform(prng);
+	GMatrix b;
+	b.setContiguous(true);
+	b.resize(37, 5);
+	b.copyBlock(a);
+	if(!b.isContiguous() || ((size_t)b.data() & 63) != 0 || b.stride() != 8)
+		throw Ex("failed");
+	if(&b[36][0] != b.data() + 36 * b.stride() || !(b == a))
+		throw Ex("failed");
+
+	// Growing, reordering, and repacking must preserve the values
+	for(size_t i = 0; i < 100; i++)
+		a.newRow().fillUniform(prng);
+	GVec& firstRow = b[0];
+	GMatrix lent(0, 5);
+	lent.takeRow(&b[1]);
+	for(size_t i = 0; i < 100; i++)
+		b.newRow().copy(a[37 + i]);
+	if(!b.isContiguous() || &firstRow != &b[0] || firstRow.squaredDistance(a[0]) != 0.0 || lent[0].squaredDistance(a[1]) != 0.0)
+		throw Ex("failed"); // growing must not move the rows
+	lent.releaseAllRows();
+	b.shuffle(prng, &a);
+	if(b.isContiguous() || !(b == a))
+		throw Ex("failed");
+	b.setContiguous(true);
+	if(!b.isContiguous() || !(b == a))
+		throw Ex("failed");
+
+	// Bulk operations on the slab must match the per-row implementations
+	a.swapColumns(1, 3);
+	b.swapColumns(1, 3);
+	a.centerMeanAtOrigin();
+	b.centerMeanAtOrigin();
+	a.newColumns(5);
+	b.newColumns(5);
+	a.fill(1.0, 5, 5);
+	b.fill(1.0, 5, 5);
+	if(!b.isContiguous() || b.stride() != 16 || !(b == a))
+		throw Ex("failed");
+
+	// Rows that leave the matrix must be independent of the slab
+	GVec* pRow = b.releaseRow(3);
+	std::unique_ptr<GVec> hRow(pRow);
+	b.deleteRow(7);
+	b.setContiguous(false);
+	if(pRow->squaredDistance(a[3]) != 0.0 || b.rows() != a.rows() - 2 || b.contiguousMode())
+		throw Ex("failed");
+
+	// Rows added after releaseAllRows must not overwrite the released rows
+	GMatrix c;
+	c.setContiguous(true);
+	c.resize(20, 5);
+	c.fill(1.0);
+	GMatrix borrower(0, 5);
+	borrower.borrowRows(c);
+	c.releaseAllRows();
+	c.newRows(20);
+	c.fill(2.0);
+	if(!c.isContiguous() || borrower[0][0] != 1.0 || borrower[19][4] != 1.0)
+		throw Ex("failed");
+	borrower.releaseAllRows();
+}
+
+void GMatrix_testBinary()
+{
+	const char* file =
+	"@RELATION rel\n"
+	"@ATTRIBUTE 'attr 1' { 'y' , n }\n"
+	"@ATTRIBUTE attr2 real\n"
+	"@ATTRIBUTE attr3 { a, b, c }\n"
+	"@DATA\n"
+	"y, 3.25, c\n"
+	"n, -0.5, a\n"
+	"?, ?, b\n";
+	GMatrix orig;
+	orig.parseArff(file, strlen(file));
+	char szFilename[300];
+	GFile::tempFilename(szFilename);
+	strcat(szFilename, ".wbin");
+	orig.saveBinary(szFilename);
+	try
+	{
+		GMatrix m;
+		m.load(szFilename);
+		if(!m.isMapped() || !m.isContiguous() || !(m == orig))
+			throw Ex("failed");
+		std::ostringstream osOrig, osLoaded;
+		orig.print(osOrig);
+		m.print(osLoaded);
+		if(osOrig.str() != osLoaded.str())
+			throw Ex("The relation did not survive the round trip");
+
+		// Changes must stay in memory
+		m[0][1] = 7.0;
+		GMatrix m2;
+		m2.loadBinary(szFilename);
+		if(m2[0][1] != 3.25)
+			throw Ex("A change reached the file");
+
+		// Growing must copy the values out of the file
+		m2.newRow().copy(orig[1]);
+		if(m2.isMapped() || m2.rows() != 4 || m2[3][1] != -0.5 || m2[0][1] != 3.25)
+			throw Ex("failed");
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+}
+
+void GMatrix_testChunkedParsing(GRand& rand)
+{
+	// Make some data with comments, blank lines, sparse rows, and a last line with no newline
+	string arff = "@RELATION rel\n@ATTRIBUTE a1 { red, green, blue }\n@ATTRIBUTE a2 real\n@ATTRIBUTE a3 { x, y }\n@DATA\n";
+	string csv = "color,amount,flag\n";
+	const char* colors[] = { "red", "green", "blue" };
+	for(size_t i = 0; i < 200; i++)
+	{
+		size_t c = (size_t)rand.next(3);
+		string amount = to_str(rand.normal());
+		bool x = rand.next(2) == 0;
+		if(i % 17 == 0)
+			arff += "% a comment\n\n";
+		if(i % 23 == 0)
+			arff += "{1 " + amount + "}\n";
+		else
+			arff += string(colors[c]) + "," + amount + "," + (x ? "x" : "y") + "\n";
+		csv += string(colors[(i * 7 + c) % 3]) + "," + amount + "," + (x ? "x" : "y") + (i + 1 < 200 ? "\n" : "");
+	}
+
+	// Parse everything in one piece and then in many small ones
+	size_t chunkBytes = g_arffChunkBytes;
+	GMatrix serialArff, serialArffHead, serialCsv;
+	serialArff.parseArff(arff.c_str(), arff.length());
+	serialArffHead.parseArff(arff.c_str(), arff.length(), 50);
+	GCSVParser parser;
+	parser.columnNamesInFirstRow();
+	parser.parse(serialCsv, csv.c_str(), csv.length());
+	GMatrix chunkedArff, chunkedArffHead, chunkedCsv;
+	g_arffChunkBytes = 16;
+	try
+	{
+		chunkedArff.parseArff(arff.c_str(), arff.length());
+		chunkedArffHead.parseArff(arff.c_str(), arff.length(), 50);
+		parser.parse(chunkedCsv, csv.c_str(), csv.length());
+	}
+	catch(...)
+	{
+		g_arffChunkBytes = chunkBytes;
+		throw;
+	}
+	g_arffChunkBytes = chunkBytes;
+	if(serialArff.rows() != 200 || serialArffHead.rows() != 50 || serialCsv.rows() != 200)
+		throw Ex("wrong row count", to_str(serialArff.rows()), " ", to_str(serialArffHead.rows()) + " " + to_str(serialCsv.rows()));
+	if(serialCsv.relation().valueCount(0) != 3 || serialCsv.relation().valueCount(1) != 0)
+		throw Ex("wrong attribute types");
+
+	// The results must match exactly, including the order of nominal values in the CSV relation
+	std::ostringstream os1, os2, os3, os4, os5, os6;
+	serialArff.print(os1);
+	chunkedArff.print(os2);
+	serialArffHead.print(os3);
+	chunkedArffHead.print(os4);
+	serialCsv.print(os5);
+	chunkedCsv.print(os6);
+	if(os1.str() != os2.str() || os3.str() != os4.str() || os5.str() != os6.str())
+		throw Ex("chunked parsing did not match");
+
+	// Streaming batches must add up to the same thing
+	char szFilename[300];
+	GFile::tempFilename(szFilename);
+	strcat(szFilename, ".arff");
+	GFile::saveFile(arff.c_str(), arff.length(), szFilename);
+	try
+	{
+		GMatrix streamed(serialArff.relation().cloneMinimal());
+		size_t batches = 0;
+		GMatrix::streamArff(szFilename, 64, [&](GMatrix& batch) {
+			if(batch.rows() > 64 || batch.cols() != 3)
+				throw Ex("bad batch");
+			for(size_t i = 0; i < batch.rows(); i++)
+				streamed.newRow().copy(batch[i]);
+			batches++;
+		});
+		if(batches != 4 || !(streamed == serialArff))
+			throw Ex("streaming did not match");
+	}
+	catch(...)
+	{
+		GFile::deleteFile(szFilename);
+		throw;
+	}
+	GFile::deleteFile(szFilename);
+}
+
 void GMatrix::test()
 {
 	GRand prng(0);
@@ -4768,6 +5789,10 @@ void GMatrix::test()
 	GMatrix_testWilcoxon();
 	GMatrix_testBoundingSphere(prng);
 	GMatrix_testImport();
+	GMatrix_testContiguous(prng);
+	GMatrix_testMultiplyBlocked(prng);
+	GMatrix_testBinary();
+	GMatrix_testChunkedParsing(prng);
 }
 #endif // !MIN_PREDICT
 
@@ -4864,39 +5889,67 @@ public:
 	vector<const char*> m_elements;
 };
 
+// Holds an attribute until all of the columns have been converted
+class GCSVParser_Column
+{
+public:
+	string m_name;
+	size_t m_valueCount;
+	vector<const char*> m_values;
+
+	GCSVParser_Column() : m_valueCount(0) {}
+
+	void set(const string& name, size_t valueCount, vector<const char*>* pValues)
+	{
+		m_name = name;
+		m_valueCount = valueCount;
+		if(pValues)
+			m_values.swap(*pValues);
+	}
+};
+
 void GCSVParser::parse(GMatrix& outMatrix, const char* szFilename)
 {
+	// Mapping the file avoids copying it. (A missing newline at the end is handled by the parser.)
+	std::unique_ptr<GFileMapping> hMapping;
+	try
+	{
+		hMapping.reset(new GFileMapping(szFilename));
+	}
+	catch(const std::exception&)
+	{
+	}
+	if(hMapping.get() && hMapping->size() > 0)
+	{
+		parse(outMatrix, (const char*)hMapping->data(), hMapping->size());
+		return;
+	}
 	size_t nLen;
 	char* szFile = GFile::loadFile(szFilename, &nLen);
 	std::unique_ptr<char[]> hFile(szFile);
 	parse(outMatrix, szFile, nLen);
 }
 
-void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
+// Splits the lines of CSV text in [nPos, end) into elements. (nLine is the line number at nPos.) If
+// columnCount is INVALID_INDEX, it is determined from the first line of data.
+void GCSVParser_extract(const char* pFile, size_t nPos, size_t end, size_t nLine, char separator, bool columnNamesInFirstRow, bool tolerant, size_t& columnCount, size_t& nFirstDataLine, GHeap& heap, vector<ImportRow>& rows)
 {
-	// Extract the elements
-	GHeap heap(2048);
-	vector<ImportRow> rows;
-	size_t columnCount = INVALID_INDEX;
-	size_t nFirstDataLine = 1;
-	size_t nLine = 1;
-	size_t nPos = 0;
 	while(true)
 	{
 		// Skip Whitespace
-		while(nPos < len && pFile[nPos] <= ' ' && pFile[nPos] != m_separator)
+		while(nPos < end && pFile[nPos] <= ' ' && pFile[nPos] != separator)
 		{
 			if(pFile[nPos] == '\n')
 				nLine++;
 			nPos++;
 		}
-		if(nPos >= len)
+		if(nPos >= end)
 			break;
 
 		// Count the elements
-		if(columnCount == INVALID_INDEX && (!m_columnNamesInFirstRow || nLine > 1))
+		if(columnCount == INVALID_INDEX && (!columnNamesInFirstRow || nLine > 1))
 		{
-			if(m_separator == '\0')
+			if(separator == '\0')
 			{
 				// Elements are separated by an arbitrary amount of whitespace, element values contain no whitespace, and there are no missing elements
 				size_t i = nPos;
@@ -4904,11 +5957,11 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				while(true)
 				{
 					columnCount++;
-					while(i < len && pFile[i] > ' ')
+					while(i < end && pFile[i] > ' ')
 						i++;
-					while(i < len && pFile[i] <= ' ' && pFile[i] != '\n')
+					while(i < end && pFile[i] <= ' ' && pFile[i] != '\n')
 						i++;
-					if(pFile[i] == '\n')
+					if(i >= end || pFile[i] == '\n')
 						break;
 				}
 			}
@@ -4935,7 +5988,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 						quoquo = true;
 					else if(pFile[nPos + i] == '\'')
 						quo = true;
-					else if(pFile[nPos + i] == m_separator)
+					else if(pFile[nPos + i] == separator)
 						columnCount++;
 				}
 			}
@@ -4947,7 +6000,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		while(true)
 		{
 			// Skip Whitespace
-			while(nPos < len && pFile[nPos] <= ' ' && pFile[nPos] != m_separator)
+			while(nPos < end && pFile[nPos] <= ' ' && pFile[nPos] != separator)
 			{
 				if(pFile[nPos] == '\n')
 					break;
@@ -4956,7 +6009,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 
 			// Extract the element
 			size_t i, l;
-			if(m_separator == '\0')
+			if(separator == '\0')
 			{
 				for(l = 0; pFile[nPos + l] > ' '; l++)
 				{
@@ -4985,7 +6038,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 						quoquo = true;
 					else if(pFile[nPos + i] == '\'')
 						quo = true;
-					else if(pFile[nPos + i] == m_separator)
+					else if(pFile[nPos + i] == separator)
 						break;
 				}
 				if(quo)
@@ -5001,14 +6054,14 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 			if(row.m_elements.size() > columnCount)
 				break;
 			nPos += i;
-			if(nPos >= len || pFile[nPos] == '\n')
+			if(nPos >= end || pFile[nPos] == '\n')
 				break;
-			if(m_separator != '\0' && pFile[nPos] == m_separator)
+			if(separator != '\0' && pFile[nPos] == separator)
 				nPos++;
 		}
-		if(m_tolerant)
+		if(tolerant)
 		{
-			if(!m_columnNamesInFirstRow || nLine > 1)
+			if(!columnNamesInFirstRow || nLine > 1)
 			{
 				while(row.m_elements.size() < columnCount)
 					row.m_elements.push_back("?");
@@ -5021,11 +6074,64 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		}
 
 		// Move to next line
-		for(; nPos < len && pFile[nPos] != '\n'; nPos++)
+		for(; nPos < end && pFile[nPos] != '\n'; nPos++)
 		{
 		}
 		continue;
 	}
+}
+
+void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
+{
+	// Split the text at line boundaries into pieces
+	vector<size_t> bounds;
+	GMatrix_splitLines(pFile, len, g_arffChunkBytes, bounds);
+	size_t pieces = bounds.size() - 1;
+	vector<size_t> firstLines(pieces + 1);
+	firstLines[0] = 1;
+	GThreadPool& pool = GThreadPool::global();
+	pool.parallelFor(0, pieces, [&](size_t i) {
+		firstLines[i + 1] = std::count(pFile + bounds[i], pFile + bounds[i + 1], '\n');
+	});
+	for(size_t i = 0; i < pieces; i++)
+		firstLines[i + 1] += firstLines[i];
+
+	// Extract the elements. The pieces are done in order until the number of columns is known, and then in parallel.
+	vector<std::unique_ptr<GHeap> > heaps(pieces);
+	vector<vector<ImportRow> > pieceRows(pieces);
+	size_t columnCount = INVALID_INDEX;
+	size_t nFirstDataLine = 1;
+	auto extractPiece = [&](size_t i, size_t& colCount, size_t& firstDataLine) {
+		heaps[i].reset(new GHeap(2048));
+		size_t start = bounds[i];
+		size_t end = bounds[i + 1];
+		if(pFile[end - 1] == '\n')
+			GCSVParser_extract(pFile, start, end, firstLines[i], m_separator, m_columnNamesInFirstRow, m_tolerant, colCount, firstDataLine, *heaps[i], pieceRows[i]);
+		else
+		{
+			// The last line has no newline, so it is copied to make sure a null-terminator follows it
+			string tail(pFile + start, end - start);
+			GCSVParser_extract(tail.c_str(), 0, tail.length(), firstLines[i], m_separator, m_columnNamesInFirstRow, m_tolerant, colCount, firstDataLine, *heaps[i], pieceRows[i]);
+		}
+	};
+	size_t piece = 0;
+	while(piece < pieces && columnCount == INVALID_INDEX)
+		extractPiece(piece++, columnCount, nFirstDataLine);
+	pool.parallelFor(piece, pieces, [&](size_t i) {
+		size_t colCount = columnCount;
+		size_t firstDataLine = nFirstDataLine;
+		extractPiece(i, colCount, firstDataLine);
+	});
+	size_t total = 0;
+	for(size_t i = 0; i < pieces; i++)
+		total += pieceRows[i].size();
+	vector<ImportRow> rows(total);
+	for(size_t i = 0, r = 0; i < pieces; i++)
+	{
+		for(size_t j = 0; j < pieceRows[i].size(); j++)
+			rows[r++].m_elements.swap(pieceRows[i][j].m_elements);
+		vector<ImportRow>().swap(pieceRows[i]);
+	}
 	if(m_columnNamesInFirstRow && m_tolerant)
 	{
 		ImportRow& row = rows[0];
@@ -5035,6 +6141,8 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 
 	// Parse it all
 	size_t rowCount = rows.size();
+	if(m_columnNamesInFirstRow)
+		rowCount--;
 	outMatrix.flush();
 	GArffRelation* pRelation = new GArffRelation();
 	outMatrix.setRelation(pRelation);
@@ -5045,9 +6153,10 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 		pNewVec->resize(columnCount);
 	}
 	m_report.resize(columnCount);
-	if(m_columnNamesInFirstRow)
-		rowCount--;
-	for(size_t attr = 0; attr < columnCount; attr++)
+
+	// Each column is converted by one thread, so the nominal values keep the order in which they first appear
+	vector<GCSVParser_Column> columns(columnCount);
+	GThreadPool::global().parallelFor(0, columnCount, [&](size_t attr)
 	{
 		std::map<size_t, string>::iterator itFormat = m_formats.find(attr);
 		if(itFormat != m_formats.end())
@@ -5064,13 +6173,13 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				attrName += rows[0].m_elements[attr];
 				if(quot)
 					attrName += "\"";
-				pRelation->addAttribute(attrName.c_str(), 0, NULL);
+				columns[attr].set(attrName, 0, NULL);
 			}
 			else
 			{
 				string attrName = "attr";
 				attrName += to_str(attr);
-				pRelation->addAttribute(attrName.c_str(), 0, NULL);
+				columns[attr].set(attrName, 0, NULL);
 			}
 
 			size_t i = 0;
@@ -5110,7 +6219,7 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				m_report[attr] += firstErr;
 				m_report[attr] += "\".";
 			}
-			continue;
+			return;
 		}
 
 		// Determine if the attribute can be real
@@ -5155,13 +6264,13 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				attrName += rows[0].m_elements[attr];
 				if(quot)
 					attrName += "\"";
-				pRelation->addAttribute(attrName.c_str(), 0, NULL);
+				columns[attr].set(attrName, 0, NULL);
 			}
 			else
 			{
 				string attrName = "attr";
 				attrName += to_str(attr);
-				pRelation->addAttribute(attrName.c_str(), 0, NULL);
+				columns[attr].set(attrName, 0, NULL);
 			}
 			size_t i = 0;
 			for(size_t rowNum = m_columnNamesInFirstRow ? 1 : 0; rowNum < rows.size(); rowNum++)
@@ -5284,10 +6393,10 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				if(valueCount > m_maxVals)
 				{
 					attrName += "_aborted_due_to_too_many_vals";
-					pRelation->addAttribute(attrName.c_str(), valueCount, &values);
+					columns[attr].set(attrName, valueCount, &values);
 				}
 				else
-					pRelation->addAttribute(attrName.c_str(), valueCount, &values);
+					columns[attr].set(attrName, valueCount, &values);
 			}
 			else
 			{
@@ -5295,10 +6404,12 @@ void GCSVParser::parse(GMatrix& outMatrix, const char* pFile, size_t len)
 				attrName += to_str(attr);
 				if(valueCount > m_maxVals)
 					attrName += "_aborted_due_to_too_many_vals";
-				pRelation->addAttribute(attrName.c_str(), valueCount, &values);
+				columns[attr].set(attrName, valueCount, &values);
 			}
 		}
-	}
+	});
+	for(size_t attr = 0; attr < columnCount; attr++)
+		pRelation->addAttribute(columns[attr].m_name.c_str(), columns[attr].m_valueCount, &columns[attr].m_values);
 }
 
 
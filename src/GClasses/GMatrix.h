@@ -24,6 +24,7 @@
 #include <string>
 #include <algorithm>
 #include <iostream>
+#include <functional>
 
 #include "GError.h"
 #include "GVec.h"
@@ -45,6 +46,7 @@ class GRand;
 class GDom;
 class GDomNode;
 class GArffTokenizer;
+class GFileMapping;
 class GDistanceMetric;
 class GSimpleAssignment;
 class GDistanceMetric;
@@ -436,6 +438,16 @@ class GMatrix
 protected:
 	GRelation* m_pRelation;
 	std::vector<GVec*> m_rows;
+	double* m_pSlabBuf; // the allocation behind the contiguous slab (see setContiguous)
+	double* m_pSlab; // 64-byte-aligned start of the slab
+	std::vector<GVec*> m_viewBlocks; // the GVecs that view the slab rows, in blocks that are never moved while the slab grows
+	std::vector<size_t> m_viewBlockEnds; // m_viewBlocks[b] views the slab rows from m_viewBlockEnds[b - 1] (or 0) up to m_viewBlockEnds[b]
+	size_t m_stride; // number of doubles from the start of one slab row to the next
+	size_t m_slabRows; // number of rows the slab can hold
+	size_t m_slabUsed; // number of slab rows that have been handed out
+	bool m_contiguous;
+	GFileMapping* m_pMapping; // if non-NULL, the slab lives in this mapped file instead of m_pSlabBuf (see loadBinary)
+	std::vector<GMatrix*> m_retiredSlabs; // slabs whose rows were given up by releaseAllRows, kept until flush
 
 public:
 	/// \brief Makes an empty 0x0 matrix.
@@ -612,15 +624,37 @@ public:
 
 #ifndef MIN_PREDICT
 	/// \brief Loads an ARFF file and replaces the contents of this matrix with it.
+	///
+	/// The file is mapped into memory (rather than read), and its data section is split at line
+	/// boundaries into pieces that are parsed in parallel by GThreadPool::global().
 	void loadArff(const char* szFilename, size_t maxRows = (size_t)-1);
 
+	/// \brief Parses an ARFF file in batches of up to batchSize rows, so files that do not fit in
+	/// memory can still be processed.
+	///
+	/// onBatch is called with each batch in turn. (The batch matrix is reused, so it should not be
+	/// kept after onBatch returns.) Only one batch, and the text it came from, is held in memory at
+	/// a time. Each batch is parsed in parallel, in the same way as loadArff.
+	static void streamArff(const char* szFilename, size_t batchSize, const std::function<void(GMatrix& batch)>& onBatch);
+
 	/// \brief Loads a raw (binary) file and replaces the contents of this matrix with it.
 	void loadRaw(const char* szFilename);
 
-	/// \brief Loads a file and automatically detects ARFF or raw (binary)
+	/// \brief Maps a file in the binary format written by saveBinary into memory, and replaces
+	/// the contents of this matrix with it.
+	///
+	/// Nothing is parsed or copied. The matrix is left in contiguous mode (see setContiguous)
+	/// with its block pointing straight into the mapped file, so the operating system loads
+	/// pages only as the rows are touched. The mapping is copy-on-write: values may still be
+	/// changed, but the changes stay in memory and never reach the file. Operations that
+	/// reallocate the block (such as adding rows or columns) copy the data out of the file.
+	void loadBinary(const char* szFilename);
+
+	/// \brief Loads a file and automatically detects ARFF, raw (binary), or the format of saveBinary (.wbin)
 	void load(const char* szFilename);
 
 	/// \brief Parses an ARFF file and replaces the contents of this matrix with it.
+	/// (The data section is parsed in parallel, as in loadArff.)
 	void parseArff(const char* szFile, size_t nLen, size_t maxRows = (size_t)-1);
 
 	/// \brief Parses an ARFF file and replaces the contents of this matrix with it.
@@ -703,7 +737,41 @@ public:
 
 	/// \brief Allocates space for the specified number of patterns (to
 	/// avoid superfluous resizing)
-	void reserve(size_t n) { m_rows.reserve(n); }
+	void reserve(size_t n) { m_rows.reserve(n); if(m_contiguous) reserveSlab(n); }
+
+	/// \brief Sets the storage mode of this matrix.
+	///
+	/// When contiguous is true, the rows are packed (in their current order) into a single
+	/// 64-byte-aligned block of row-major memory, each row padded to a multiple of 64 bytes,
+	/// and rows added later are allocated from the same block. (So, for example, calling this
+	/// before loadArff parses the file directly into the block instead of allocating each row.)
+	/// row(i) and operator[] still work, but the GVec they return is a view into the block, so it
+	/// must not be resized. Adding rows may move the block, which invalidates pointers to the
+	/// values (such as those returned by data() or GVec::data()), but the GVec objects are never
+	/// moved, so references to rows (including rows lent to other matrices with takeRow or
+	/// borrowRows) stay valid. Rows that leave the matrix (releaseRow, swapRow, etc.) are returned as
+	/// independent copies. When contiguous is false, every row is moved into its own allocation.
+	void setContiguous(bool contiguous);
+
+	/// \brief Returns true iff new rows are allocated from a contiguous block. (See setContiguous.)
+	bool contiguousMode() const { return m_contiguous; }
+
+	/// \brief Returns true iff row i begins at data() + i * stride() for every row i.
+	/// Operations that reorder rows, such as shuffle or sort, make this false
+	/// until setContiguous(true) is called again.
+	bool isContiguous() const;
+
+	/// \brief Returns the contiguous block of values. (Only meaningful when isContiguous() returns true.)
+	double* data() { return m_pSlab; }
+
+	/// \brief Returns the contiguous block of values. (Only meaningful when isContiguous() returns true.)
+	const double* data() const { return m_pSlab; }
+
+	/// \brief Returns the number of doubles from the start of one row to the next in the contiguous block.
+	size_t stride() const { return m_stride; }
+
+	/// \brief Returns true iff the values of this matrix still live in a file mapped by loadBinary.
+	bool isMapped() const { return m_pMapping != NULL; }
 
 	/// \brief Returns the number of rows in the dataset
 	size_t rows() const { return m_rows.size(); }
@@ -714,6 +782,14 @@ public:
 
 	/// \brief Saves the dataset to a file in raw (binary) format
 	void saveRaw(const char* szFilename);
+
+	/// \brief Saves the dataset, with its relation, in a versioned binary format that loadBinary can
+	/// map into memory without parsing. (The conventional extension is ".wbin".)
+	///
+	/// The file begins with a 64-byte header, followed by the relation serialized as JSON. Then,
+	/// starting on a 64-byte boundary, come the rows, in the same padded layout as the block of a
+	/// contiguous matrix. The values are stored in the byte order of the machine that saved them.
+	void saveBinary(const char* szFilename) const;
 #endif // MIN_PREDICT
 
 	/// \brief Performs SVD on A, where A is this m-by-n matrix.
@@ -759,6 +835,12 @@ public:
 	/// If pos is specified, the new row will be inserted and the speicified position.
 	void takeRow(GVec* pRow, size_t pos = (size_t)-1);
 
+	/// \brief Abandons the rows in this matrix (like releaseAllRows), and then refers to the rows
+	/// in that, in the same order, without copying or taking ownership of them.
+	/// (This only copies the row pointers, so it is a cheap way to restore the order of a view
+	/// that was filled with takeRow and then permuted.)
+	void borrowRows(const GMatrix& that);
+
 	/// \brief Converts the matrix to reduced row echelon form
 	size_t toReducedRowEchelonForm();
 
@@ -785,7 +867,7 @@ public:
 	///         transposed. All columns in the returned dataset will be
 	///         continuous.  The caller is responsible for deleting the
 	///         returned dataset.
-	GMatrix* transpose();
+	GMatrix* transpose() const;
 
 	/// \brief Copies the data from pVector over this dataset.
 	///
@@ -867,6 +949,8 @@ public:
 	void flush();
 
 	/// \brief Abandons (leaks) all the rows in this matrix.
+	/// (Rows in the contiguous block are not leaked. They stay allocated until this matrix is flushed,
+	/// and rows added later go in a new block, so the released rows are never overwritten.)
 	void releaseAllRows();
 
 	/// \brief Randomizes the order of the rows.
@@ -1232,6 +1316,25 @@ protected:
 	double determinantHelper(size_t nEndRow, size_t* pColumnList);
 	void inPlaceSquareTranspose();
 	void singularValueDecompositionHelper(GMatrix** ppU, double** ppDiag, GMatrix** ppV, bool throwIfNoConverge, size_t maxIters);
+
+	/// Returns true iff pRow is one of the views into the contiguous block of this matrix.
+	bool isView(const GVec* pRow) const;
+
+	/// Returns the view of slab row i.
+	GVec* slabView(size_t i) const;
+
+	/// Returns pRow if this matrix does not own its storage, or an independent copy if it is a view.
+	GVec* detachRow(GVec* pRow) const;
+
+	/// Grows the contiguous block to hold at least n rows. Existing rows keep their positions.
+	void reserveSlab(size_t n);
+
+	/// Allocates a new contiguous block with room for the specified number of rows,
+	/// and moves every row (in its current order) into it.
+	void packSlab(size_t capacity);
+
+	/// Frees the contiguous block. (Views must already have been removed from m_rows.)
+	void freeSlab();
 };
 
 
@@ -28,11 +28,18 @@
 #include "GTransform.h"
 #include "GSparseMatrix.h"
 #include "GHolders.h"
+#include "GThread.h"
 #include <cmath>
 #include <memory>
+#include <vector>
 
 namespace GClasses {
 
+using std::vector;
+
+// The number of rows that each thread predicts at a time in GNaiveBayes::predictBatch
+#define NAIVEBAYES_BATCH_BLOCK_ROWS 256
+
 struct GNaiveBayesInputAttr
 {
 	size_t m_nValues;
@@ -143,23 +150,40 @@ struct GNaiveBayesOutputValue
 		m_nCount++;
 	}
 
+	// Returns the log of the probability that input n has a value that was seen "count" times with this output
+	double logLikelihood(size_t n, size_t count, double equivalentSampleSize)
+	{
+		return log(std::max(1e-300,
+				(
+					(double)count +
+					(equivalentSampleSize / m_pInputs[n]->m_nValues)
+				) /
+				(equivalentSampleSize + m_nCount)
+			));
+	}
+
 	double eval(const double* pInputVector, double equivalentSampleSize)
 	{
 		// The prior output probability
 		double dLogProb = log((double)m_nCount);
 
 		// The probability of inputs given this output
+		for(size_t n = 0; n < m_featureDims; n++)
+			dLogProb += logLikelihood(n, m_pInputs[n]->eval((int)pInputVector[n]), equivalentSampleSize);
+		return dLogProb;
+	}
+
+	// Writes the log prior, followed by the log-likelihood of every value of each input and then of an
+	// unknown value for that input, so that eval can be computed with table lookups.
+	void logTable(double* pTable, double equivalentSampleSize)
+	{
+		*(pTable++) = log((double)m_nCount);
 		for(size_t n = 0; n < m_featureDims; n++)
 		{
-			dLogProb += log(std::max(1e-300,
-					(
-						(double)m_pInputs[n]->eval((int)pInputVector[n]) +
-						(equivalentSampleSize / m_pInputs[n]->m_nValues)
-					) /
-					(equivalentSampleSize + m_nCount)
-				));
+			for(size_t i = 0; i < m_pInputs[n]->m_nValues; i++)
+				*(pTable++) = logLikelihood(n, m_pInputs[n]->m_pValueCounts[i], equivalentSampleSize);
+			*(pTable++) = logLikelihood(n, 0, equivalentSampleSize);
 		}
-		return dLogProb;
 	}
 };
 
@@ -229,6 +253,54 @@ struct GNaiveBayesOutputAttr
 			values[n] = m_pValues[n]->eval(pIn, equivalentSampleSize);
 		return (double)values.indexOfMax();
 	}
+
+	// Predicts column "col" of out for every row of in. The log-likelihood of each input value is
+	// computed once per output value, rather than once per row.
+	void predictBatch(const GMatrix& in, GMatrix& out, size_t col, double equivalentSampleSize)
+	{
+		if(m_nValueCount == 0)
+			throw Ex("Expected at least one output value");
+		GNaiveBayesInputAttr** pInputs = m_pValues[0]->m_pInputs;
+		size_t featureDims = m_pValues[0]->m_featureDims;
+		vector<size_t> offsets(featureDims);
+		size_t tableSize = 1;
+		for(size_t n = 0; n < featureDims; n++)
+		{
+			offsets[n] = tableSize;
+			tableSize += pInputs[n]->m_nValues + 1;
+		}
+		vector<double> table(tableSize * m_nValueCount);
+		for(size_t j = 0; j < m_nValueCount; j++)
+			m_pValues[j]->logTable(table.data() + j * tableSize, equivalentSampleSize);
+
+		size_t rows = in.rows();
+		size_t blocks = (rows + NAIVEBAYES_BATCH_BLOCK_ROWS - 1) / NAIVEBAYES_BATCH_BLOCK_ROWS;
+		GThreadPool::global().parallelFor(0, blocks, [&](size_t block)
+		{
+			GVec values(m_nValueCount);
+			vector<size_t> indexes(featureDims);
+			size_t end = std::min(rows, (block + 1) * NAIVEBAYES_BATCH_BLOCK_ROWS);
+			for(size_t i = block * NAIVEBAYES_BATCH_BLOCK_ROWS; i < end; i++)
+			{
+				const GVec& row = in[i];
+				for(size_t n = 0; n < featureDims; n++)
+				{
+					int v = (int)row[n];
+					size_t nValues = pInputs[n]->m_nValues;
+					indexes[n] = offsets[n] + ((v >= 0 && (size_t)v < nValues) ? (size_t)v : nValues);
+				}
+				for(size_t j = 0; j < m_nValueCount; j++)
+				{
+					const double* pTable = table.data() + j * tableSize;
+					double dLogProb = pTable[0];
+					for(size_t n = 0; n < featureDims; n++)
+						dLogProb += pTable[indexes[n]];
+					values[j] = dLogProb;
+				}
+				out[i][col] = (double)values.indexOfMax();
+			}
+		});
+	}
 };
 
 // --------------------------------------------------------------------
@@ -266,6 +338,8 @@ GNaiveBayes::~GNaiveBayes()
 // virtual
 GDomNode* GNaiveBayes::serialize(GDom* pDoc) const
 {
+	if(!m_pOutputs)
+		throw Ex("Attempted to serialize a model that has not been trained");
 	GDomNode* pNode = baseDomNode(pDoc, "GNaiveBayes");
 	pNode->addField(pDoc, "sampleCount", pDoc->newInt(m_nSampleCount));
 	pNode->addField(pDoc, "ess", pDoc->newDouble(m_equivalentSampleSize));
@@ -356,6 +430,16 @@ void GNaiveBayes::predict(const GVec& in, GVec& out)
 		out[n] = m_pOutputs[n]->predict(in.data(), m_equivalentSampleSize, &m_rand);
 }
 
+// virtual
+void GNaiveBayes::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	if(m_nSampleCount <= 0)
+		throw Ex("You must call train before you call eval");
+	for(size_t n = 0; n < m_pRelLabels->size(); n++)
+		m_pOutputs[n]->predictBatch(in, out, n, m_equivalentSampleSize);
+}
+
 void GNaiveBayes::autoTune(GMatrix& features, GMatrix& labels)
 {
 	// Find the best ess value
@@ -443,6 +527,28 @@ void GNaiveBayes_testMath()
 	pat[0] = 1; pat[1] = 2;
 	nb.predictDistribution(pat, &out);
 	GNaiveBayes_CheckResults(7.0/12.0, 3.0/7.0*2.0/7.0, 5.0/12.0, 3.0/5.0*0.0/5.0, &out);
+
+	// predictBatch should agree with predict, including for unknown values
+	nb.setEquivalentSampleSize(0.5);
+	GMatrix batch(0, 2);
+	for(int a = -1; a < 2; a++)
+	{
+		for(int b = -1; b < 3; b++)
+		{
+			GVec& row = batch.newRow();
+			row[0] = (double)a;
+			row[1] = (double)b;
+		}
+	}
+	GMatrix batchOut;
+	nb.predictBatch(batch, batchOut);
+	GVec single(1);
+	for(size_t i = 0; i < batch.rows(); i++)
+	{
+		nb.predict(batch[i], single);
+		if(batchOut[i][0] != single[0])
+			throw Ex("predictBatch disagrees with predict");
+	}
 }
 
 // static
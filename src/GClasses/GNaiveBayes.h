@@ -75,6 +75,19 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out);
 
+	/// Predicts every row of in. The log-likelihood of each feature value given each
+	/// class is computed once for the whole batch, and blocks of rows are spread across
+	/// the thread pool. See the comment for GSupervisedLearner::predictBatch.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out);
+
+	/// Returns true. See the comment for GSupervisedLearner::canPredictConcurrently.
+	virtual bool canPredictConcurrently() { return true; }
+
+#ifndef MIN_PREDICT
+	/// Returns true. See the comment for GTransducer::canValidateConcurrently.
+	virtual bool canValidateConcurrently() { return true; }
+#endif // MIN_PREDICT
+
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut);
 
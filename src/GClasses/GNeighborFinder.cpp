@@ -44,6 +44,8 @@
 #include "GPriorityQueue.h"
 #include <memory>
 #include "GSparseMatrix.h"
+#include "GThread.h"
+#include <algorithm>
 
 
 //using std::cerr;
@@ -59,6 +61,53 @@ using std::multimap;
 
 namespace GClasses {
 
+// Stores one neighborhood in the flattened layout used by findNearestAll: sorted from nearest to farthest, and padded out to k slots
+void GNeighborFinder_storeSorted(size_t k, const vector<size_t>& neighs, const vector<double>& dists, vector< pair<double, size_t> >& scratch, size_t* pOutIndices, double* pOutDists)
+{
+	scratch.clear();
+	for(size_t i = 0; i < neighs.size(); i++)
+		scratch.push_back(make_pair(dists[i], neighs[i]));
+	std::sort(scratch.begin(), scratch.end());
+	size_t i;
+	for(i = 0; i < scratch.size() && i < k; i++)
+	{
+		pOutIndices[i] = scratch[i].second;
+		pOutDists[i] = scratch[i].first;
+	}
+	for( ; i < k; i++)
+	{
+		pOutIndices[i] = INVALID_INDEX;
+		pOutDists[i] = 1e308;
+	}
+}
+
+// virtual
+void GNeighborFinder::findNearestAll(size_t k, std::vector<size_t>& outIndices, std::vector<double>& outDists)
+{
+	size_t n = m_pData->rows();
+	outIndices.resize(n * k);
+	outDists.resize(n * k);
+	if(k == 0)
+		return;
+	vector<size_t> neighs;
+	vector<double> dists;
+	vector< pair<double, size_t> > scratch;
+	for(size_t i = 0; i < n; i++)
+	{
+		size_t found = findNearest(k, i);
+		neighs.clear();
+		dists.clear();
+		for(size_t j = 0; j < found; j++)
+		{
+			neighs.push_back(neighbor(j));
+			dists.push_back(distance(j));
+		}
+		GNeighborFinder_storeSorted(k, neighs, dists, scratch, outIndices.data() + i * k, outDists.data() + i * k);
+	}
+}
+
+
+
 
 GNeighborGraph::GNeighborGraph(GNeighborFinder* pNF, bool own, size_t neighbors)
 : GNeighborFinder(pNF->data()), m_pNF(pNF), m_own(own)
@@ -111,15 +160,17 @@ GNeighborGraph::~GNeighborGraph()
 
 void GNeighborGraph::fillCacheNearest(size_t k)
 {
+	vector<size_t> indices;
+	vector<double> dists;
+	m_pNF->findNearestAll(k, indices, dists);
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
-		size_t neigh_count = m_pNF->findNearest(k, i);
 		m_neighs[i].clear();
 		m_dists[i].clear();
-		for(size_t j = 0; j < neigh_count; j++)
+		for(size_t j = i * k; j < (i + 1) * k && indices[j] != INVALID_INDEX; j++)
 		{
-			m_neighs[i].push_back(m_pNF->neighbor(j));
-			m_dists[i].push_back(m_pNF->distance(j));
+			m_neighs[i].push_back(indices[j]);
+			m_dists[i].push_back(dists[j]);
 		}
 	}
 }
@@ -353,6 +404,65 @@ GNeighborFinderGeneralizing::~GNeighborFinderGeneralizing()
 		delete(m_pMetric);
 }
 
+// virtual
+size_t GNeighborFinderGeneralizing::findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	// Ask for one extra neighbor in case the excluded point is among them
+	size_t found = findNearest(exclude == INVALID_INDEX ? k : k + 1, vec);
+	neighs.clear();
+	dists.clear();
+	for(size_t i = 0; i < found; i++)
+	{
+		if(neighbor(i) == exclude)
+			continue;
+		neighs.push_back(neighbor(i));
+		dists.push_back(distance(i));
+	}
+	if(neighs.size() > k)
+	{
+		size_t worst = 0;
+		for(size_t i = 1; i < dists.size(); i++)
+		{
+			if(dists[i] > dists[worst])
+				worst = i;
+		}
+		neighs[worst] = neighs.back();
+		dists[worst] = dists.back();
+		neighs.pop_back();
+		dists.pop_back();
+	}
+	return neighs.size();
+}
+
+void GNeighborFinderGeneralizing::findNearestAll(size_t k, const GMatrix& queries, bool excludeSelf, std::vector<size_t>& outIndices, std::vector<double>& outDists)
+{
+	size_t n = queries.rows();
+	outIndices.resize(n * k);
+	outDists.resize(n * k);
+	if(k == 0)
+		return;
+	GThreadPool& pool = GThreadPool::global();
+	size_t threads = isThreadSafe() ? pool.participants() : 1;
+	vector< vector<size_t> > neighs(threads);
+	vector< vector<double> > dists(threads);
+	vector< vector< pair<double, size_t> > > scratch(threads);
+	pool.parallelForSlots(0, n, [&](size_t i, size_t slot) {
+		findNearestReentrant(k, queries[i], excludeSelf ? i : INVALID_INDEX, neighs[slot], dists[slot]);
+		GNeighborFinder_storeSorted(k, neighs[slot], dists[slot], scratch[slot], outIndices.data() + i * k, outDists.data() + i * k);
+	}, threads);
+}
+
+// virtual
+void GNeighborFinderGeneralizing::findNearestAll(size_t k, std::vector<size_t>& outIndices, std::vector<double>& outDists)
+{
+	findNearestAll(k, *m_pData, true, outIndices, outDists);
+}
+
+void GNeighborFinderGeneralizing::findNearestAll(size_t k, const GMatrix& queries, std::vector<size_t>& outIndices, std::vector<double>& outDists)
+{
+	findNearestAll(k, queries, false, outIndices, outDists);
+}
+
 void GNeighborFinderGeneralizing::insertionSortNeighbors(size_t start, size_t end)
 {
 	for(size_t i = start + 1; i < end; i++)
@@ -452,14 +562,20 @@ void GBruteForceNeighborFinder::reoptimize()
 
 size_t GBruteForceNeighborFinder::findNearest(size_t k, const GVec& vec, size_t exclude)
 {
-	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
+	return findNearestReentrant(k, vec, exclude, m_neighs, m_dists);
+}
+
+// virtual
+size_t GBruteForceNeighborFinder::findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	GClosestNeighborFindingHelper helper(k, neighs, dists);
 	for(size_t i = 0; i < m_pData->rows(); i++)
 	{
 		if(i == exclude)
 			continue;
 		helper.TryPoint(i, m_pMetric->squaredDistance(vec, m_pData->row(i)));
 	}
-	return m_neighs.size();
+	return neighs.size();
 }
 
 size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec, size_t exclude)
@@ -506,9 +622,9 @@ size_t GBruteForceNeighborFinder::findWithinRadius(double squaredRadius, size_t
 
 // --------------------------------------------------------------------------------
 
-GSparseNeighborFinder::GSparseNeighborFinder(GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric)
+GSparseNeighborFinder::GSparseNeighborFinder(const GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric)
 : GNeighborFinderGeneralizing(pBogusData, new GRowDistance(), true),
-m_pData(pData),
+m_pCompressed(new GCSRMatrix(*pData)),
 m_pSparseMetric(pMetric),
 m_ownSparseMetric(ownMetric)
 {
@@ -516,6 +632,7 @@ m_ownSparseMetric(ownMetric)
 
 GSparseNeighborFinder::~GSparseNeighborFinder()
 {
+	delete(m_pCompressed);
 	if(m_ownSparseMetric)
 		delete(m_pSparseMetric);
 }
@@ -531,10 +648,9 @@ size_t GSparseNeighborFinder::findNearest(size_t k, const GVec& vec)
 	m_neighs.clear();
 	m_dists.clear();
 	multimap<double,size_t> priority_queue;
-	for(size_t i = 0; i < m_pData->rows(); i++)
+	for(size_t i = 0; i < m_pCompressed->rows(); i++)
 	{
-		map<size_t,double>& row = m_pData->row(i);
-		double similarity = m_pSparseMetric->similarity(row, vec);
+		double similarity = m_pSparseMetric->similarity(m_pCompressed->row(i), vec);
 		priority_queue.insert(pair<double,size_t>(similarity, i));
 		if(priority_queue.size() > k)
 			priority_queue.erase(priority_queue.begin());
@@ -550,16 +666,15 @@ size_t GSparseNeighborFinder::findNearest(size_t k, const GVec& vec)
 // virtual
 size_t GSparseNeighborFinder::findNearest(size_t k, size_t index)
 {
-	map<size_t,double>& vec = m_pData->row(index);
+	GSparseRow vec = m_pCompressed->row(index);
 	m_neighs.clear();
 	m_dists.clear();
 	multimap<double,size_t> priority_queue;
-	for(size_t i = 0; i < m_pData->rows(); i++)
+	for(size_t i = 0; i < m_pCompressed->rows(); i++)
 	{
 		if(i == index)
 			continue;
-		map<size_t,double>& row = m_pData->row(i);
-		double similarity = m_pSparseMetric->similarity(row, vec);
+		double similarity = m_pSparseMetric->similarity(m_pCompressed->row(i), vec);
 		priority_queue.insert(pair<double,size_t>(similarity, i));
 		if(priority_queue.size() > k)
 			priority_queue.erase(priority_queue.begin());
@@ -589,22 +704,18 @@ size_t GSparseNeighborFinder::findWithinRadius(double squaredRadius, size_t inde
 class GKdNode
 {
 protected:
-	double m_minDist;
-	double* m_pOffset;
 	size_t m_dims;
 
 public:
+	size_t m_label; // the label that all of the points under this node share, or INVALID_INDEX (see GKdTree::labelNodes)
+
 	GKdNode(size_t dims)
+	: m_dims(dims), m_label(INVALID_INDEX)
 	{
-		m_dims = dims;
-		m_pOffset = new double[dims];
-		GVec::setAll(m_pOffset, 0.0, dims);
-		m_minDist = 0;
 	}
 
 	virtual ~GKdNode()
 	{
-		delete[] m_pOffset;
 	}
 
 	virtual bool IsLeaf() = 0;
@@ -618,31 +729,10 @@ public:
 
 	virtual void Rename(GKdTree* pTree, size_t oldIndex, size_t newIndex, double* pRow) = 0;
 
-	double GetMinDist()
-	{
-		return m_minDist;
-	}
-
 	size_t GetDims()
 	{
 		return m_dims;
 	}
-
-	void CopyOffset(GKdNode* pParent)
-	{
-		memcpy(m_pOffset, pParent->m_pOffset, sizeof(double) * m_dims);
-		m_minDist = pParent->m_minDist;
-	}
-
-	void AdjustOffset(size_t attr, double offset, const GVec& scaleFactors)
-	{
-		if(offset > m_pOffset[attr])
-		{
-			m_minDist -= (m_pOffset[attr] * m_pOffset[attr] * scaleFactors[attr] * scaleFactors[attr]);
-			m_pOffset[attr] = offset;
-			m_minDist += (m_pOffset[attr] * m_pOffset[attr] * scaleFactors[attr] * scaleFactors[attr]);
-		}
-	}
 };
 
 
@@ -997,114 +1087,255 @@ GKdNode* GKdTree::buildTree(size_t count, size_t* pIndexes)
 	return new GKdInteriorNode(dims, pLess, greaterOrEqual, count, attr, pivot);
 }
 
-class KdTree_Compare_Nodes_Functor
+// The state of one kd-tree query. Each queued node carries its own offset vector (the distance
+// from the query to the node's region along each attribute), so the nodes are never modified,
+// and several threads may search the same tree at once.
+class GKdTreeSearch
 {
 public:
-	bool operator() (GKdNode* pA, GKdNode* pB) const
+	struct Entry
+	{
+		GKdNode* m_pNode;
+		double m_minDist;
+		size_t m_offset; // the position of this entry's offset vector in m_offsets
+	};
+
+protected:
+	struct CompareEntries
 	{
-		double a = pA->GetMinDist();
-		double b = pB->GetMinDist();
-		return (a > b);
+		bool operator() (const Entry& a, const Entry& b) const
+		{
+			return a.m_minDist > b.m_minDist;
+		}
+	};
+
+	size_t m_dims;
+	priority_queue<Entry, vector<Entry>, CompareEntries> m_queue;
+	vector<double> m_offsets;
+	vector<size_t> m_freeOffsets;
+
+public:
+	GKdTreeSearch(GKdNode* pRoot, size_t dims)
+	: m_dims(dims)
+	{
+		Entry e;
+		e.m_pNode = pRoot;
+		e.m_minDist = 0.0;
+		e.m_offset = newOffset(INVALID_INDEX);
+		m_queue.push(e);
+	}
+
+	bool empty() const { return m_queue.empty(); }
+
+	const Entry& top() const { return m_queue.top(); }
+
+	Entry pop()
+	{
+		Entry e = m_queue.top();
+		m_queue.pop();
+		return e;
+	}
+
+	/// Recycles the offset vector of an entry that will not be expanded
+	void release(const Entry& e)
+	{
+		m_freeOffsets.push_back(e.m_offset);
+	}
+
+	/// Queues the two children of an interior node
+	void expand(const Entry& e, GKdTree& tree, const GVec& vec, const GVec& scaleFactors)
+	{
+		GKdInteriorNode* pParent = (GKdInteriorNode*)e.m_pNode;
+		size_t attr;
+		double pivot;
+		pParent->GetDivision(&attr, &pivot);
+		Entry less;
+		less.m_pNode = pParent->GetLess();
+		Entry greaterOrEqual;
+		greaterOrEqual.m_pNode = pParent->GetGreaterOrEqual();
+
+		// The child on the same side as the query inherits the parent's offsets. The other child is at least as far as the pivot.
+		bool ge = tree.isGreaterOrEqual(vec.data(), attr, pivot);
+		Entry& near = ge ? greaterOrEqual : less;
+		Entry& far = ge ? less : greaterOrEqual;
+		near.m_minDist = e.m_minDist;
+		near.m_offset = e.m_offset;
+		far.m_offset = newOffset(e.m_offset);
+		far.m_minDist = e.m_minDist;
+		double* pOffset = m_offsets.data() + far.m_offset;
+		double offset = ge ? vec[attr] - pivot : pivot - vec[attr];
+		if(offset > pOffset[attr])
+		{
+			far.m_minDist -= (pOffset[attr] * pOffset[attr] * scaleFactors[attr] * scaleFactors[attr]);
+			pOffset[attr] = offset;
+			far.m_minDist += (pOffset[attr] * pOffset[attr] * scaleFactors[attr] * scaleFactors[attr]);
+		}
+		m_queue.push(less);
+		m_queue.push(greaterOrEqual);
+	}
+
+protected:
+	/// Returns the position of a new offset vector, initialized with a copy of the one at src (or zeros if src is INVALID_INDEX)
+	size_t newOffset(size_t src)
+	{
+		size_t pos;
+		if(m_freeOffsets.size() > 0)
+		{
+			pos = m_freeOffsets.back();
+			m_freeOffsets.pop_back();
+		}
+		else
+		{
+			pos = m_offsets.size();
+			m_offsets.resize(pos + m_dims);
+		}
+		if(src == INVALID_INDEX)
+			std::fill(m_offsets.begin() + pos, m_offsets.begin() + pos + m_dims, 0.0);
+		else
+			std::copy(m_offsets.begin() + src, m_offsets.begin() + src + m_dims, m_offsets.begin() + pos);
+		return pos;
 	}
 };
 
 size_t GKdTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 {
-	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
-	KdTree_Compare_Nodes_Functor comparator;
-	priority_queue< GKdNode*, vector<GKdNode*>, KdTree_Compare_Nodes_Functor > q(comparator);
-	q.push(m_pRoot);
-	while(q.size() > 0)
+	return findNearestReentrant(k, vec, nExclude, m_neighs, m_dists);
+}
+
+// virtual
+size_t GKdTree::findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	GClosestNeighborFindingHelper helper(k, neighs, dists);
+	GKdTreeSearch search(m_pRoot, m_pData->cols());
+	while(!search.empty())
 	{
-		GKdNode* pNode = q.top();
-		q.pop();
-		if(pNode->GetMinDist() >= helper.GetWorstDist())
+		GKdTreeSearch::Entry e = search.pop();
+		if(e.m_minDist >= helper.GetWorstDist())
 			break;
-		if(pNode->IsLeaf())
+		if(e.m_pNode->IsLeaf())
 		{
-			double squaredDist;
-			vector<size_t>* pIndexes = ((GKdLeafNode*)pNode)->GetIndexes();
+			vector<size_t>* pIndexes = ((GKdLeafNode*)e.m_pNode)->GetIndexes();
 			size_t count = pIndexes->size();
 			for(size_t i = 0; i < count; i++)
 			{
 				size_t index = (*pIndexes)[i];
-				if(index == nExclude)
+				if(index == exclude)
 					continue;
-				const GVec& pCand = m_pData->row(index);
-				squaredDist = m_pMetric->squaredDistance(vec, pCand);
-				helper.TryPoint(index, squaredDist);
+				helper.TryPoint(index, m_pMetric->squaredDistance(vec, m_pData->row(index)));
 			}
+			search.release(e);
 		}
 		else
+			search.expand(e, *this, vec, m_pMetric->scaleFactors());
+	}
+	return neighs.size();
+}
+
+// Sets the label of pNode and its descendants, and returns the label of pNode
+static size_t GKdTree_labelNodes(GKdNode* pNode, const size_t* pLabels)
+{
+	if(pNode->IsLeaf())
+	{
+		vector<size_t>* pIndexes = ((GKdLeafNode*)pNode)->GetIndexes();
+		size_t label = INVALID_INDEX;
+		for(size_t i = 0; i < pIndexes->size(); i++)
 		{
-			size_t attr;
-			double pivot;
-			GKdInteriorNode* pParent = (GKdInteriorNode*)pNode;
-			pParent->GetDivision(&attr, &pivot);
-			GKdNode* pLess = pParent->GetLess();
-			pLess->CopyOffset(pParent);
-			GKdNode* pGreaterOrEqual = pParent->GetGreaterOrEqual();
-			pGreaterOrEqual->CopyOffset(pParent);
-			if(isGreaterOrEqual(vec.data(), attr, pivot))
-				pLess->AdjustOffset(attr, vec[attr] - pivot, m_pMetric->scaleFactors());
-			else
-				pGreaterOrEqual->AdjustOffset(attr, pivot - vec[attr], m_pMetric->scaleFactors());
-			q.push(pLess);
-			q.push(pGreaterOrEqual);
+			size_t l = pLabels[(*pIndexes)[i]];
+			if(i == 0)
+				label = l;
+			else if(l != label)
+			{
+				label = INVALID_INDEX;
+				break;
+			}
 		}
+		pNode->m_label = label;
 	}
-	return m_neighs.size();
+	else
+	{
+		size_t a = GKdTree_labelNodes(((GKdInteriorNode*)pNode)->GetLess(), pLabels);
+		size_t b = GKdTree_labelNodes(((GKdInteriorNode*)pNode)->GetGreaterOrEqual(), pLabels);
+		pNode->m_label = (a == b ? a : INVALID_INDEX);
+	}
+	return pNode->m_label;
+}
+
+void GKdTree::labelNodes(const size_t* pLabels)
+{
+	GKdTree_labelNodes(m_pRoot, pLabels);
+}
+
+size_t GKdTree::findNearestWithDifferentLabel(const GVec& vec, const size_t* pLabels, size_t label, double squaredBound, double* pSquaredDist)
+{
+	size_t best = INVALID_INDEX;
+	double bestDist = squaredBound;
+	GKdTreeSearch search(m_pRoot, m_pData->cols());
+	while(!search.empty())
+	{
+		GKdTreeSearch::Entry e = search.pop();
+		if(e.m_minDist >= bestDist)
+			break;
+		if(e.m_pNode->m_label == label)
+		{
+			// Every point under this node has the query's label
+			search.release(e);
+			continue;
+		}
+		if(e.m_pNode->IsLeaf())
+		{
+			vector<size_t>* pIndexes = ((GKdLeafNode*)e.m_pNode)->GetIndexes();
+			size_t count = pIndexes->size();
+			for(size_t i = 0; i < count; i++)
+			{
+				size_t index = (*pIndexes)[i];
+				if(pLabels[index] == label)
+					continue;
+				double d = m_pMetric->squaredDistance(vec, m_pData->row(index));
+				if(d < bestDist)
+				{
+					best = index;
+					bestDist = d;
+				}
+			}
+			search.release(e);
+		}
+		else
+			search.expand(e, *this, vec, m_pMetric->scaleFactors());
+	}
+	*pSquaredDist = bestDist;
+	return best;
 }
 
 size_t GKdTree::findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude)
 {
 	m_neighs.clear();
 	m_dists.clear();
-	KdTree_Compare_Nodes_Functor comparator;
-	priority_queue< GKdNode*, vector<GKdNode*>, KdTree_Compare_Nodes_Functor > q(comparator);
-	q.push(m_pRoot);
-	while(q.size() > 0)
+	GKdTreeSearch search(m_pRoot, m_pData->cols());
+	while(!search.empty())
 	{
-		GKdNode* pNode = q.top();
-		q.pop();
-		if(pNode->GetMinDist() > squaredRadius)
+		GKdTreeSearch::Entry e = search.pop();
+		if(e.m_minDist > squaredRadius)
 			break;
-		if(pNode->IsLeaf())
+		if(e.m_pNode->IsLeaf())
 		{
-			double squaredDist;
-			vector<size_t>* pIndexes = ((GKdLeafNode*)pNode)->GetIndexes();
+			vector<size_t>* pIndexes = ((GKdLeafNode*)e.m_pNode)->GetIndexes();
 			size_t count = pIndexes->size();
 			for(size_t i = 0; i < count; i++)
 			{
 				size_t index = (*pIndexes)[i];
 				if(index == nExclude)
 					continue;
-				const GVec& pCand = m_pData->row(index);
-				squaredDist = m_pMetric->squaredDistance(vec, pCand);
+				double squaredDist = m_pMetric->squaredDistance(vec, m_pData->row(index));
 				if(squaredDist <= squaredRadius)
 				{
 					m_neighs.push_back(index);
 					m_dists.push_back(squaredDist);
 				}
 			}
+			search.release(e);
 		}
 		else
-		{
-			size_t attr;
-			double pivot;
-			GKdInteriorNode* pParent = (GKdInteriorNode*)pNode;
-			pParent->GetDivision(&attr, &pivot);
-			GKdNode* pLess = pParent->GetLess();
-			pLess->CopyOffset(pParent);
-			GKdNode* pGreaterOrEqual = pParent->GetGreaterOrEqual();
-			pGreaterOrEqual->CopyOffset(pParent);
-			if(isGreaterOrEqual(vec.data(), attr, pivot))
-				pLess->AdjustOffset(attr, vec[attr] - pivot, m_pMetric->scaleFactors());
-			else
-				pGreaterOrEqual->AdjustOffset(attr, pivot - vec[attr], m_pMetric->scaleFactors());
-			q.push(pLess);
-			q.push(pGreaterOrEqual);
-		}
+			search.expand(e, *this, vec, m_pMetric->scaleFactors());
 	}
 	return m_neighs.size();
 }
@@ -1309,6 +1540,57 @@ void GKdTree_testThatItDoesntLookFar()
 #	define TEST_PATTERNS 1000
 #	define TEST_NEIGHBORS 24
 
+void GKdTree_testFindNearestAll()
+{
+	GRand rand(0);
+	GMatrix data(300, 3);
+	for(size_t i = 0; i < data.rows(); i++)
+		data[i].fillNormal(rand);
+	GMatrix queries(50, 3);
+	for(size_t i = 0; i < queries.rows(); i++)
+		queries[i].fillNormal(rand);
+	const size_t k = 7;
+	GBruteForceNeighborFinder bf(&data);
+	GKdTree kd(&data);
+	GBallTree ball(&data);
+	GNeighborGraph graph(&bf, false, k);
+	for(size_t pass = 0; pass < 2; pass++)
+	{
+		const GMatrix& q = (pass == 0 ? data : queries);
+		vector<size_t> kdIndices, ballIndices, graphIndices;
+		vector<double> kdDists, ballDists, graphDists;
+		if(pass == 0)
+		{
+			kd.findNearestAll(k, kdIndices, kdDists);
+			ball.findNearestAll(k, ballIndices, ballDists);
+			graph.findNearestAll(k, graphIndices, graphDists);
+		}
+		else
+		{
+			kd.findNearestAll(k, q, kdIndices, kdDists);
+			ball.findNearestAll(k, q, ballIndices, ballDists);
+		}
+		if(kdIndices.size() != q.rows() * k || ballDists.size() != q.rows() * k)
+			throw Ex("wrong size");
+		for(size_t i = 0; i < q.rows(); i++)
+		{
+			size_t nc = (pass == 0 ? bf.findNearest(k, i) : bf.findNearest(k, q[i]));
+			bf.sortNeighbors();
+			if(nc != k)
+				throw Ex("found unexpected number of neighbors");
+			for(size_t j = 0; j < k; j++)
+			{
+				if(kdIndices[i * k + j] != bf.neighbor(j) || ballIndices[i * k + j] != bf.neighbor(j))
+					throw Ex("wrong neighbor");
+				if(std::abs(kdDists[i * k + j] - bf.distance(j)) > 1e-12 || std::abs(ballDists[i * k + j] - bf.distance(j)) > 1e-12)
+					throw Ex("wrong distance");
+				if(pass == 0 && graphIndices[i * k + j] != bf.neighbor(j))
+					throw Ex("wrong neighbor from the cached graph");
+			}
+		}
+	}
+}
+
 // static
 void GKdTree::test()
 {
@@ -1380,6 +1662,8 @@ void GKdTree::test()
 				throw Ex("Neighbors out of order");
 		}
 	}
+
+	GKdTree_testFindNearestAll();
 }
 #endif // !NO_TEST_CODE
 
@@ -1671,7 +1955,13 @@ GBallNode* GBallTree::buildTree(size_t count, size_t* pIndexes)
 
 size_t GBallTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 {
-	GClosestNeighborFindingHelper helper(k, m_neighs, m_dists);
+	return findNearestReentrant(k, vec, nExclude, m_neighs, m_dists);
+}
+
+// virtual
+size_t GBallTree::findNearestReentrant(size_t k, const GVec& vec, size_t nExclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	GClosestNeighborFindingHelper helper(k, neighs, dists);
 	GSimplePriorityQueue<GBallNode*> q;
 	q.insert(m_pRoot, m_pRoot->distance(m_pMetric, vec));
 	while(q.size() > 0)
@@ -1698,7 +1988,7 @@ size_t GBallTree::findNearest(size_t k, const GVec& vec, size_t nExclude)
 			q.insert(pInt->m_pRight, pInt->m_pRight->distance(m_pMetric, vec));
 		}
 	}
-	return m_neighs.size();
+	return neighs.size();
 }
 
 size_t GBallTree::findWithinRadius(double squaredRadius, const GVec& vec, size_t nExclude)
@@ -1814,6 +2104,534 @@ void GBallTree::test()
 
 
 
+// --------------------------------------------------------------------------------------------------------
+
+// Marks the points that one thread's HNSW search has already visited. Each search bumps the epoch instead of clearing the marks.
+class GHnswVisited
+{
+public:
+	std::vector<unsigned int> m_marks;
+	unsigned int m_epoch;
+
+	GHnswVisited() : m_epoch(0)
+	{
+	}
+
+	void reset(size_t n)
+	{
+		if(m_marks.size() < n)
+			m_marks.resize(n, 0);
+		if(++m_epoch == 0)
+		{
+			std::fill(m_marks.begin(), m_marks.end(), 0);
+			m_epoch = 1;
+		}
+	}
+
+	/// Returns false if i was already visited
+	bool visit(size_t i)
+	{
+		if(m_marks[i] == m_epoch)
+			return false;
+		m_marks[i] = m_epoch;
+		return true;
+	}
+};
+
+static thread_local GHnswVisited g_hnswVisited;
+
+GHnswNeighborFinder::GHnswNeighborFinder(const GMatrix* pData, GDistanceMetric* pMetric, bool ownMetric, size_t m, size_t efConstruction, size_t seed)
+: GNeighborFinderGeneralizing(pData, pMetric, ownMetric),
+m_m(std::max((size_t)2, m)),
+m_efConstruction(std::max(efConstruction, m)),
+m_efSearch(50),
+m_entry(INVALID_INDEX),
+m_maxLevel(0),
+m_pRand(new GRand(seed))
+{
+	build();
+}
+
+GHnswNeighborFinder::GHnswNeighborFinder(const GDomNode* pNode, const GMatrix* pData, GDistanceMetric* pMetric, bool ownMetric)
+: GNeighborFinderGeneralizing(pData, pMetric, ownMetric),
+m_pRand(new GRand(0))
+{
+	m_m = (size_t)pNode->field("m")->asInt();
+	m_efConstruction = (size_t)pNode->field("efc")->asInt();
+	m_efSearch = (size_t)pNode->field("efs")->asInt();
+	long long entry = pNode->field("entry")->asInt();
+	m_entry = (entry < 0 ? INVALID_INDEX : (size_t)entry);
+	m_maxLevel = (size_t)pNode->field("top")->asInt();
+	GDomListIterator itPoints(pNode->field("points"));
+	if(itPoints.remaining() != m_pData->rows())
+		throw Ex("The serialized graph has ", to_str(itPoints.remaining()), " points, but the data has ", to_str(m_pData->rows()), " rows");
+	m_links.resize(itPoints.remaining());
+	for(size_t i = 0; itPoints.current(); itPoints.advance(), i++)
+	{
+		GDomListIterator itLayers(itPoints.current());
+		m_links[i].resize(itLayers.remaining());
+		for(size_t j = 0; itLayers.current(); itLayers.advance(), j++)
+		{
+			vector<size_t>& links = m_links[i][j];
+			GDomListIterator itLinks(itLayers.current());
+			links.reserve(itLinks.remaining());
+			for( ; itLinks.current(); itLinks.advance())
+			{
+				size_t n = (size_t)itLinks.current()->asInt();
+				if(n >= m_links.size())
+					throw Ex("Link out of range");
+				links.push_back(n);
+			}
+		}
+	}
+
+	// Every link must lead to a point that has the layer it is on, and the entry must be a point on the top layer
+	if(m_entry == INVALID_INDEX ? m_links.size() > 0 : (m_entry >= m_links.size() || m_links[m_entry].size() != m_maxLevel + 1))
+		throw Ex("The entry point does not match the top layer of the serialized graph");
+	for(size_t i = 0; i < m_links.size(); i++)
+	{
+		if(m_links[i].size() > m_maxLevel + 1) // (points that were never inserted have no layers)
+			throw Ex("Point ", to_str(i), " has ", to_str(m_links[i].size()), " layers, but the graph has ", to_str(m_maxLevel + 1));
+		for(size_t j = 0; j < m_links[i].size(); j++)
+		{
+			const vector<size_t>& links = m_links[i][j];
+			for(size_t l = 0; l < links.size(); l++)
+			{
+				if(m_links[links[l]].size() <= j)
+					throw Ex("Point ", to_str(i), " links to point ", to_str(links[l]), " on layer ", to_str(j), ", which that point does not have");
+			}
+		}
+	}
+}
+
+// virtual
+GHnswNeighborFinder::~GHnswNeighborFinder()
+{
+	delete(m_pRand);
+}
+
+GDomNode* GHnswNeighborFinder::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->addField(pDoc, "m", pDoc->newInt(m_m));
+	pNode->addField(pDoc, "efc", pDoc->newInt(m_efConstruction));
+	pNode->addField(pDoc, "efs", pDoc->newInt(m_efSearch));
+	pNode->addField(pDoc, "entry", pDoc->newInt(m_entry == INVALID_INDEX ? -1 : (long long)m_entry));
+	pNode->addField(pDoc, "top", pDoc->newInt(m_maxLevel));
+	GDomNode* pPoints = pNode->addField(pDoc, "points", pDoc->newList());
+	for(size_t i = 0; i < m_links.size(); i++)
+	{
+		GDomNode* pLayers = pPoints->addItem(pDoc, pDoc->newList());
+		for(size_t j = 0; j < m_links[i].size(); j++)
+		{
+			GDomNode* pLinks = pLayers->addItem(pDoc, pDoc->newList());
+			const vector<size_t>& links = m_links[i][j];
+			for(size_t l = 0; l < links.size(); l++)
+				pLinks->addItem(pDoc, pDoc->newInt(links[l]));
+		}
+	}
+	return pNode;
+}
+
+// virtual
+void GHnswNeighborFinder::reoptimize()
+{
+	build();
+}
+
+size_t GHnswNeighborFinder::drawLevel()
+{
+	double u = std::max(1e-300, m_pRand->uniform());
+	return std::min((size_t)31, (size_t)std::floor(-std::log(u) / std::log((double)m_m)));
+}
+
+void GHnswNeighborFinder::build()
+{
+	size_t n = m_pData->rows();
+	m_links.clear();
+	m_links.resize(n);
+	m_entry = INVALID_INDEX;
+	m_maxLevel = 0;
+	if(n == 0)
+		return;
+
+	// The levels are drawn up front so they do not depend on the order in which the threads insert points.
+	// (The links still do, so the graph is only reproducible when the pool has a single participant.)
+	vector<size_t> levels(n);
+	for(size_t i = 0; i < n; i++)
+	{
+		levels[i] = drawLevel();
+		m_links[i].resize(levels[i] + 1);
+	}
+	insert(0, levels[0], NULL, NULL);
+	GThreadPool& pool = GThreadPool::global();
+	if(pool.participants() < 2)
+	{
+		for(size_t i = 1; i < n; i++)
+			insert(i, levels[i], NULL, NULL);
+	}
+	else
+	{
+		std::unique_ptr<std::mutex[]> locks(new std::mutex[n]);
+		std::mutex entryLock;
+		pool.parallelFor(1, n, [&](size_t i) { insert(i, levels[i], locks.get(), &entryLock); });
+	}
+}
+
+void GHnswNeighborFinder::insert(size_t index)
+{
+	if(index >= m_pData->rows())
+		throw Ex("index out of range");
+	if(index >= m_links.size())
+		m_links.resize(index + 1);
+	if(m_links[index].size() > 0)
+		throw Ex("Point ", to_str(index), " is already in the graph");
+	size_t level = drawLevel();
+	m_links[index].resize(level + 1);
+	insert(index, level, NULL, NULL);
+}
+
+void GHnswNeighborFinder::insert(size_t index, size_t level, std::mutex* pLocks, std::mutex* pEntryLock)
+{
+	// The entry lock is only held while reading or updating the entry point
+	size_t entry;
+	size_t maxLevel;
+	{
+		std::unique_lock<std::mutex> entryLock;
+		if(pEntryLock)
+			entryLock = std::unique_lock<std::mutex>(*pEntryLock);
+		if(m_entry == INVALID_INDEX)
+		{
+			m_entry = index;
+			m_maxLevel = level;
+			return;
+		}
+		entry = m_entry;
+		maxLevel = m_maxLevel;
+	}
+
+	// Descend greedily to the top layer of the new point
+	const GVec& vec = m_pData->row(index);
+	vector<pair<double, size_t> > ep;
+	ep.push_back(make_pair(m_pMetric->squaredDistance(vec, m_pData->row(entry)), entry));
+	vector<pair<double, size_t> > found;
+	for(size_t lc = maxLevel; lc > level; lc--)
+	{
+		searchLayer(vec, ep, 1, lc, found, pLocks);
+		ep.swap(found);
+	}
+
+	// Link it into each layer from there down
+	vector<size_t> chosen;
+	vector<pair<double, size_t> > candidates;
+	for(size_t lc = std::min(level, maxLevel) + 1; lc-- > 0; )
+	{
+		searchLayer(vec, ep, m_efConstruction, lc, found, pLocks);
+		selectNeighbors(found, m_m, chosen);
+		{
+			std::unique_lock<std::mutex> lock;
+			if(pLocks)
+				lock = std::unique_lock<std::mutex>(pLocks[index]);
+			m_links[index][lc] = chosen;
+		}
+		size_t maxLinks = (lc == 0 ? 2 * m_m : m_m);
+		for(size_t i = 0; i < chosen.size(); i++)
+		{
+			size_t neigh = chosen[i];
+			std::unique_lock<std::mutex> lock;
+			if(pLocks)
+				lock = std::unique_lock<std::mutex>(pLocks[neigh]);
+			vector<size_t>& links = m_links[neigh][lc];
+			links.push_back(index);
+			if(links.size() > maxLinks)
+			{
+				// Prune the neighbor's links, measuring from the neighbor
+				const GVec& nv = m_pData->row(neigh);
+				candidates.clear();
+				for(size_t j = 0; j < links.size(); j++)
+					candidates.push_back(make_pair(m_pMetric->squaredDistance(nv, m_pData->row(links[j])), links[j]));
+				std::sort(candidates.begin(), candidates.end());
+				selectNeighbors(candidates, maxLinks, links);
+			}
+		}
+		ep.swap(found);
+	}
+	if(level > maxLevel)
+	{
+		// Another thread may have raised the top layer since it was read
+		std::unique_lock<std::mutex> entryLock;
+		if(pEntryLock)
+			entryLock = std::unique_lock<std::mutex>(*pEntryLock);
+		if(level > m_maxLevel)
+		{
+			m_entry = index;
+			m_maxLevel = level;
+		}
+	}
+}
+
+void GHnswNeighborFinder::searchLayer(const GVec& vec, vector<pair<double, size_t> >& entry, size_t ef, size_t level, vector<pair<double, size_t> >& out, std::mutex* pLocks)
+{
+	GHnswVisited& visited = g_hnswVisited;
+	visited.reset(m_links.size());
+	priority_queue<pair<double, size_t>, vector<pair<double, size_t> >, std::greater<pair<double, size_t> > > candidates; // nearest on top
+	priority_queue<pair<double, size_t> > results; // farthest on top
+	for(size_t i = 0; i < entry.size(); i++)
+	{
+		if(!visited.visit(entry[i].second))
+			continue;
+		candidates.push(entry[i]);
+		results.push(entry[i]);
+		if(results.size() > ef)
+			results.pop();
+	}
+	vector<size_t> copy;
+	while(!candidates.empty())
+	{
+		pair<double, size_t> cand = candidates.top();
+		if(results.size() >= ef && cand.first > results.top().first)
+			break;
+		candidates.pop();
+
+		// While other threads are inserting, the links are copied under the lock
+		const vector<size_t>* pLinks;
+		if(pLocks)
+		{
+			std::lock_guard<std::mutex> lock(pLocks[cand.second]);
+			copy = m_links[cand.second][level];
+			pLinks = &copy;
+		}
+		else
+			pLinks = &m_links[cand.second][level];
+		for(size_t i = 0; i < pLinks->size(); i++)
+		{
+			size_t n = (*pLinks)[i];
+			if(!visited.visit(n))
+				continue;
+			double d = m_pMetric->squaredDistance(vec, m_pData->row(n));
+			if(results.size() < ef || d < results.top().first)
+			{
+				candidates.push(make_pair(d, n));
+				results.push(make_pair(d, n));
+				if(results.size() > ef)
+					results.pop();
+			}
+		}
+	}
+	out.resize(results.size());
+	for(size_t i = results.size(); i-- > 0; )
+	{
+		out[i] = results.top();
+		results.pop();
+	}
+}
+
+void GHnswNeighborFinder::selectNeighbors(vector<pair<double, size_t> >& candidates, size_t max, vector<size_t>& out)
+{
+	// Keep a candidate only if it is closer to the point than to any candidate already kept, so the links
+	// spread out in different directions. The pruned candidates fill any room that is left.
+	out.clear();
+	vector<size_t> pruned;
+	for(size_t i = 0; i < candidates.size() && out.size() < max; i++)
+	{
+		const GVec& cv = m_pData->row(candidates[i].second);
+		bool diverse = true;
+		for(size_t j = 0; j < out.size(); j++)
+		{
+			if(m_pMetric->squaredDistance(cv, m_pData->row(out[j])) < candidates[i].first)
+			{
+				diverse = false;
+				break;
+			}
+		}
+		if(diverse)
+			out.push_back(candidates[i].second);
+		else
+			pruned.push_back(candidates[i].second);
+	}
+	for(size_t i = 0; i < pruned.size() && out.size() < max; i++)
+		out.push_back(pruned[i]);
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearest(size_t k, size_t index)
+{
+	return findNearestReentrant(k, m_pData->row(index), index, m_neighs, m_dists);
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearest(size_t k, const GVec& vec)
+{
+	return findNearestReentrant(k, vec, INVALID_INDEX, m_neighs, m_dists);
+}
+
+// virtual
+size_t GHnswNeighborFinder::findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists)
+{
+	neighs.clear();
+	dists.clear();
+	if(m_entry == INVALID_INDEX || k == 0)
+		return 0;
+	vector<pair<double, size_t> > ep;
+	ep.push_back(make_pair(m_pMetric->squaredDistance(vec, m_pData->row(m_entry)), m_entry));
+	vector<pair<double, size_t> > found;
+	for(size_t lc = m_maxLevel; lc > 0; lc--)
+	{
+		searchLayer(vec, ep, 1, lc, found, NULL);
+		ep.swap(found);
+	}
+	searchLayer(vec, ep, std::max(m_efSearch, k + (exclude == INVALID_INDEX ? 0 : 1)), 0, found, NULL);
+	for(size_t i = 0; i < found.size() && neighs.size() < k; i++)
+	{
+		if(found[i].second == exclude)
+			continue;
+		neighs.push_back(found[i].second);
+		dists.push_back(found[i].first);
+	}
+	return neighs.size();
+}
+
+// virtual
+size_t GHnswNeighborFinder::findWithinRadius(double squaredRadius, size_t index)
+{
+	findWithinRadius(squaredRadius, m_pData->row(index));
+	for(size_t i = 0; i < m_neighs.size(); i++)
+	{
+		if(m_neighs[i] == index)
+		{
+			m_neighs.erase(m_neighs.begin() + i);
+			m_dists.erase(m_dists.begin() + i);
+			break;
+		}
+	}
+	return m_neighs.size();
+}
+
+// virtual
+size_t GHnswNeighborFinder::findWithinRadius(double squaredRadius, const GVec& vec)
+{
+	m_neighs.clear();
+	m_dists.clear();
+	for(size_t i = 0; i < m_pData->rows(); i++)
+	{
+		double d = m_pMetric->squaredDistance(vec, m_pData->row(i));
+		if(d <= squaredRadius)
+		{
+			m_neighs.push_back(i);
+			m_dists.push_back(d);
+		}
+	}
+	return m_neighs.size();
+}
+
+#ifndef NO_TEST_CODE
+double GHnswNeighborFinder_recall(GHnswNeighborFinder& hnsw, const GMatrix& data, size_t k)
+{
+	GBruteForceNeighborFinder bf((GMatrix*)&data);
+	size_t hits = 0;
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		bf.findNearest(k, i);
+		std::set<size_t> truth;
+		for(size_t j = 0; j < k; j++)
+			truth.insert(bf.neighbor(j));
+		if(hnsw.findNearest(k, i) != k)
+			throw Ex("Expected ", to_str(k), " neighbors");
+		for(size_t j = 0; j < k; j++)
+		{
+			if(hnsw.neighbor(j) == i)
+				throw Ex("A point should not be its own neighbor");
+			if(j > 0 && hnsw.distance(j) < hnsw.distance(j - 1))
+				throw Ex("The neighbors should be sorted");
+			if(truth.find(hnsw.neighbor(j)) != truth.end())
+				hits++;
+		}
+	}
+	return (double)hits / (data.rows() * k);
+}
+
+// static
+void GHnswNeighborFinder::test()
+{
+	GRand rand(0);
+	GMatrix data(600, 16);
+	for(size_t i = 0; i < data.rows(); i++)
+		data[i].fillNormal(rand);
+	const size_t k = 10;
+
+	// Build all at once
+	GHnswNeighborFinder hnsw(&data, NULL, false, 12, 100);
+	hnsw.setEfSearch(64);
+	double recall = GHnswNeighborFinder_recall(hnsw, data, k);
+	if(recall < 0.95)
+		throw Ex("Poor recall: ", to_str(recall));
+
+	// Build incrementally
+	GMatrix grow(0, data.cols());
+	for(size_t i = 0; i < 300; i++)
+		grow.newRow().copy(data[i]);
+	GHnswNeighborFinder inc(&grow, NULL, false, 12, 100);
+	inc.setEfSearch(64);
+	for(size_t i = 300; i < data.rows(); i++)
+	{
+		grow.newRow().copy(data[i]);
+		inc.insert(i);
+	}
+	recall = GHnswNeighborFinder_recall(inc, grow, k);
+	if(recall < 0.95)
+		throw Ex("Poor recall after inserting: ", to_str(recall));
+
+	// Round-trip through a DOM
+	GDom doc;
+	doc.setRoot(hnsw.serialize(&doc));
+	GHnswNeighborFinder loaded(doc.root(), &data);
+	for(size_t i = 0; i < data.rows(); i += 7)
+	{
+		hnsw.findNearest(k, i);
+		loaded.findNearest(k, i);
+		for(size_t j = 0; j < k; j++)
+		{
+			if(hnsw.neighbor(j) != loaded.neighbor(j))
+				throw Ex("The deserialized graph gave different results");
+		}
+	}
+
+	// A graph whose top layer does not match its entry point must be rejected
+	GDom badDoc;
+	GDomNode* pBad = hnsw.serialize(&badDoc);
+	pBad->addField(&badDoc, "top", badDoc.newInt(pBad->field("top")->asInt() + 1));
+	bool threw = false;
+	try
+	{
+		GHnswNeighborFinder bad(pBad, &data);
+	}
+	catch(const std::exception&)
+	{
+		threw = true;
+	}
+	if(!threw)
+		throw Ex("The inconsistent graph should have been rejected");
+
+	// The batch query should agree with the single queries
+	vector<size_t> indices;
+	vector<double> dists;
+	hnsw.findNearestAll(k, indices, dists);
+	for(size_t i = 0; i < data.rows(); i += 13)
+	{
+		hnsw.findNearest(k, i);
+		for(size_t j = 0; j < k; j++)
+		{
+			if(indices[i * k + j] != hnsw.neighbor(j))
+				throw Ex("findNearestAll disagrees with findNearest");
+		}
+	}
+}
+#endif // !NO_TEST_CODE
+
+
+
+
+
 
 
 
@@ -23,6 +23,7 @@
 #include "GMatrix.h"
 #include <vector>
 #include <map>
+#include <mutex>
 
 namespace GClasses {
 
@@ -36,8 +37,11 @@ class GDistanceMetric;
 class GSupervisedLearner;
 class GRandomIndexIterator;
 class GSparseMatrix;
+class GCSRMatrix;
 class GSparseSimilarity;
 class GNeighborFinderGeneralizing;
+class GDom;
+class GDomNode;
 
 
 /// Finds the k-nearest neighbors of any vector in a dataset.
@@ -83,6 +87,13 @@ public:
 	/// Returns the distance to the ith neighbor of the last point passed to "findNearest".
 	/// (Behavior is undefined if findNearest has not yet been called.)
 	virtual double distance(size_t i) = 0;
+
+	/// Finds the k-nearest neighbors of every point in the dataset (not counting the point itself).
+	/// outIndices and outDists are resized to data()->rows() * k. The neighbors of point i are stored
+	/// at positions [i * k, i * k + k), sorted from nearest to farthest. If fewer than k neighbors
+	/// were found, the remaining slots hold INVALID_INDEX and a distance of 1e308.
+	/// This default implementation calls findNearest for each point.
+	virtual void findNearestAll(size_t k, std::vector<size_t>& outIndices, std::vector<double>& outDists);
 };
 
 
@@ -208,6 +219,24 @@ public:
 	/// See the comment for GNeighborFinder::distance
 	virtual double distance(size_t i) { return m_dists[i]; }
 
+	/// Returns true iff findNearestReentrant may be called from several threads at once.
+	virtual bool isThreadSafe() { return false; }
+
+	/// Finds the k-nearest neighbors of vec, skipping the point with index exclude (pass INVALID_INDEX
+	/// to skip none), and stores them in the caller's neighs and dists instead of in this object.
+	/// The results are not sorted. If isThreadSafe returns true, this method does not modify this object,
+	/// so several threads may query it at once, as long as none of them changes it or its data.
+	/// The default implementation calls findNearest and copies the results.
+	virtual size_t findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
+	/// See the comment for GNeighborFinder::findNearestAll. If isThreadSafe returns true, the points
+	/// are spread across the threads of GThreadPool::global().
+	virtual void findNearestAll(size_t k, std::vector<size_t>& outIndices, std::vector<double>& outDists);
+
+	/// Finds the k-nearest neighbors (in the dataset) of each row in queries, and stores them in the same
+	/// layout as the other findNearestAll. Queries are not excluded from their own neighborhoods.
+	void findNearestAll(size_t k, const GMatrix& queries, std::vector<size_t>& outIndices, std::vector<double>& outDists);
+
 	/// Returns the metric
 	GDistanceMetric *metric() { return m_pMetric; }
 
@@ -217,6 +246,9 @@ public:
 protected:
 	/// A helper method used by sortNeighbors when the remaining portion to sort is small.
 	void insertionSortNeighbors(size_t start, size_t end);
+
+	/// A helper method that implements both versions of findNearestAll.
+	void findNearestAll(size_t k, const GMatrix& queries, bool excludeSelf, std::vector<size_t>& outIndices, std::vector<double>& outDists);
 };
 
 
@@ -243,6 +275,12 @@ public:
 	/// See the comment for GNeighborFinderGeneralizing::findWithinRadius
 	virtual size_t findWithinRadius(double squaredRadius, const GVec& vector);
 
+	/// Returns true. See the comment for GNeighborFinderGeneralizing::isThreadSafe.
+	virtual bool isThreadSafe() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestReentrant
+	virtual size_t findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
 protected:
 	size_t findNearest(size_t k, const GVec& vec, size_t exclude);
 	size_t findWithinRadius(double squaredRadius, const GVec& vec, size_t exclude);
@@ -252,20 +290,23 @@ protected:
 
 
 /// Finds neighbors by measuring the distance to all points using a sparse distance metric.
+/// The searches iterate over a compressed (CSR) copy of the data that is made when this object
+/// is constructed. No reference to the original data is kept, so if the data changes, make a new finder.
 class GSparseNeighborFinder : public GNeighborFinderGeneralizing
 {
 protected:
-	GSparseMatrix* m_pData;
+	GCSRMatrix* m_pCompressed;
 	GSparseSimilarity* m_pSparseMetric;
 	bool m_ownSparseMetric;
 
 public:
-	/// pData is the sparse dataset in which you want to find neighbors.
+	/// pData is the sparse dataset in which you want to find neighbors. It is copied into compressed form,
+	/// so the caller may modify or delete it afterward.
 	/// pBogusData must be a pointer to a valid dense dataset that will be ignored. (Obviously, this is a hack that should be cleaned up.)
 	/// neighborCount is the number of neighbors that you want to find.
 	/// pMetric is the similarity metric to use in finding neighbors. Higher similarity indicates closer neighbors.
 	/// ownMetric specifies whether this object should delete pMetric when it is deleted.
-	GSparseNeighborFinder(GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric = false);
+	GSparseNeighborFinder(const GSparseMatrix* pData, GMatrix* pBogusData, GSparseSimilarity* pMetric, bool ownMetric = false);
 	virtual ~GSparseNeighborFinder();
 
 	/// This is a no-op method in this class.
@@ -322,12 +363,30 @@ public:
 	/// See the comment for GNeighborFinderGeneralizing::findWithinRadius
 	size_t findWithinRadius(double squaredRadius, const GVec& vector);
 
+	/// Returns true. See the comment for GNeighborFinderGeneralizing::isThreadSafe.
+	virtual bool isThreadSafe() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestReentrant
+	virtual size_t findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
 	/// Specify the max number of point-vectors to store in each leaf node.
 	void setMaxLeafSize(size_t n) { m_maxLeafSize = n; }
 
 	/// Returns the root node of the kd-tree.
 	GKdNode* root() { return m_pRoot; }
 
+	/// Records in each node the label that all of the points under it share (or that they differ),
+	/// so findNearestWithDifferentLabel can skip whole subtrees. pLabels holds one label for each
+	/// row of the data. Call this again whenever the labels change.
+	void labelNodes(const size_t* pLabels);
+
+	/// Finds the point nearest to vec whose label in pLabels differs from label. (labelNodes must have
+	/// been called with the same labels.) Returns its index and stores its squared distance in
+	/// *pSquaredDist, or returns INVALID_INDEX if there is no such point closer than squaredBound.
+	/// This does not modify the tree, so several threads may call it at
+	/// once. (This is the query that Boruvka's minimum spanning tree algorithm needs.)
+	size_t findNearestWithDifferentLabel(const GVec& vec, const size_t* pLabels, size_t label, double squaredBound, double* pSquaredDist);
+
 	/// Build the tree
 	GKdNode* buildTree(size_t count, size_t* pIndexes);
 
@@ -393,6 +452,12 @@ public:
 	/// See the comment for GNeighborFinderGeneralizing::findWithinRadius
 	virtual size_t findWithinRadius(double squaredRadius, const GVec& vec);
 
+	/// Returns true. See the comment for GNeighborFinderGeneralizing::isThreadSafe.
+	virtual bool isThreadSafe() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestReentrant
+	virtual size_t findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
 	/// Specify the max number of point-vectors to store in each leaf node.
 	void setMaxLeafSize(size_t n) { m_maxLeafSize = n; }
 
@@ -428,6 +493,102 @@ protected:
 
 
 
+/// An approximate neighbor finder based on a Hierarchical Navigable Small World (HNSW) graph.
+/// Each point is linked to roughly m nearby points on each of a random number of layers, where
+/// higher layers are exponentially sparser. A query descends greedily through the upper layers, then
+/// performs a best-first search of the bottom layer. Unlike GKdTree and GBallTree, its query time stays
+/// far below brute force in high-dimensional spaces, at the cost of occasionally missing a true neighbor.
+/// (See Malkov and Yashunin, "Efficient and robust approximate nearest neighbor search using
+/// Hierarchical Navigable Small World graphs".)
+class GHnswNeighborFinder : public GNeighborFinderGeneralizing
+{
+protected:
+	size_t m_m; // the number of links per point on the upper layers (twice this many on the bottom layer)
+	size_t m_efConstruction;
+	size_t m_efSearch;
+	size_t m_entry;
+	size_t m_maxLevel;
+	std::vector<std::vector<std::vector<size_t> > > m_links; // [point][layer] -> neighbors
+	GRand* m_pRand;
+
+public:
+	/// Builds a graph of all the rows in pData. m is the number of links kept for each point on each layer
+	/// (more links give better recall but use more memory), and efConstruction is the size of the
+	/// candidate list used while building (bigger is slower to build but gives a better graph).
+	/// The construction is spread across the threads of GThreadPool::global(), so the links depend on
+	/// the order in which the threads insert points. (The same seed gives the same graph only when the
+	/// pool has a single participant.)
+	GHnswNeighborFinder(const GMatrix* pData, GDistanceMetric* pMetric = NULL, bool ownMetric = false, size_t m = 16, size_t efConstruction = 200, size_t seed = 0);
+
+	/// Loads a graph that was serialized from a finder over the same data.
+	/// Throws if the layers or links in the graph are inconsistent.
+	GHnswNeighborFinder(const GDomNode* pNode, const GMatrix* pData, GDistanceMetric* pMetric = NULL, bool ownMetric = false);
+
+	virtual ~GHnswNeighborFinder();
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif
+
+	/// Marshals the graph (but not the data or the metric) into a DOM.
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Sets the size of the candidate list used when answering queries. This is the knob that trades
+	/// recall for speed. It is never smaller than the number of neighbors requested. (The default is 50.)
+	void setEfSearch(size_t ef) { m_efSearch = ef; }
+
+	/// Returns the size of the candidate list used when answering queries.
+	size_t efSearch() { return m_efSearch; }
+
+	/// Rebuilds the graph from all of the rows in the dataset.
+	virtual void reoptimize();
+
+	/// Adds a point to the graph. This method assumes you have already added the corresponding
+	/// row to the dataset that was used to construct this object. It may not be called while
+	/// other threads are querying this object.
+	void insert(size_t index);
+
+	/// See the comment for GNeighborFinder::findNearest
+	virtual size_t findNearest(size_t k, size_t index);
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearest
+	virtual size_t findNearest(size_t k, const GVec& vec);
+
+	/// Finds the neighbors within the specified radius by measuring the distance to every point.
+	/// (Unlike findNearest, this is exact.)
+	virtual size_t findWithinRadius(double squaredRadius, size_t index);
+
+	/// See the comment for GNeighborFinderGeneralizing::findWithinRadius. This is exact.
+	virtual size_t findWithinRadius(double squaredRadius, const GVec& vec);
+
+	/// Returns true. See the comment for GNeighborFinderGeneralizing::isThreadSafe.
+	virtual bool isThreadSafe() { return true; }
+
+	/// See the comment for GNeighborFinderGeneralizing::findNearestReentrant
+	virtual size_t findNearestReentrant(size_t k, const GVec& vec, size_t exclude, std::vector<size_t>& neighs, std::vector<double>& dists);
+
+protected:
+	/// Builds the graph from all the rows in the dataset
+	void build();
+
+	/// Draws a random layer for a new point
+	size_t drawLevel();
+
+	/// Links a point into the graph. If pLocks is non-NULL, it holds one mutex per point, and other threads may be inserting at the same time.
+	void insert(size_t index, size_t level, std::mutex* pLocks, std::mutex* pEntryLock);
+
+	/// Returns up to ef points near vec on the specified layer, starting from the points in entry.
+	/// The result is sorted from nearest to farthest.
+	void searchLayer(const GVec& vec, std::vector<std::pair<double, size_t> >& entry, size_t ef, size_t level, std::vector<std::pair<double, size_t> >& out, std::mutex* pLocks);
+
+	/// Chooses up to max links from candidates (sorted from nearest to farthest) that point in diverse directions.
+	void selectNeighbors(std::vector<std::pair<double, size_t> >& candidates, size_t max, std::vector<size_t>& out);
+};
+
+
+
+
 /// This uses "betweeenness centrality" to find the shortcuts in a table of neighbors and replaces them with INVALID_INDEX.
 class GShortcutPruner
 {
@@ -47,6 +47,7 @@
 #include "GBlock.h"
 #include "GOptimizer.h"
 #include "GString.h"
+#include "GThread.h"
 
 using std::vector;
 
@@ -331,6 +332,132 @@ void GLayer::updateGradient(GContextLayer& ctx, const GVec& input, const GVec& o
 	}
 }
 
+void GLayer::forwardPropBatch(GContextLayer& ctx, const GMatrix& input, GMatrix& output) const
+{
+	GMatrix in;
+	GMatrix out;
+	size_t outPos = 0;
+	size_t comp = 0;
+	size_t recurrents = 0;
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		const GBlock& b = block(i);
+		if(b.isRecurrent() && ctx.m_recurrentBatches.size() == 0)
+			throw Ex("Recurrent blocks only support batch propagation through GContextSequenceBatch");
+		bool whole = (b.inPos() == 0 && b.inputs() == input.cols() && b.outputs() == output.cols());
+		if(!whole)
+		{
+			in.copyCols(input, b.inPos(), b.inputs());
+			out.resize(input.rows(), b.outputs());
+		}
+		const GMatrix& bIn = whole ? input : in;
+		GMatrix& bOut = whole ? output : out;
+		if(b.type() == GBlock::block_neuralnet)
+		{
+			GContextNeuralNet* pCompContext = ctx.m_components[comp++];
+			b.forwardPropBatch(*pCompContext, bIn, bOut);
+		}
+		else if(b.isRecurrent())
+			ctx.m_recurrentBatches[recurrents++]->forwardProp(bIn, bOut);
+		else
+			b.forwardPropBatch(ctx, bIn, bOut);
+		if(!whole)
+			output.copyBlock(out, 0, 0, out.rows(), out.cols(), 0, outPos, false);
+		outPos += b.outputs();
+	}
+}
+
+void GLayer::backPropBatch(GContextLayer& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
+{
+	GMatrix in;
+	GMatrix out;
+	GMatrix blame;
+	GMatrix upBlame;
+	size_t outPos = 0;
+	size_t comp = 0;
+	size_t recurrents = 0;
+	inBlame.fill(0.0);
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		const GBlock& b = block(i);
+		if(b.isRecurrent() && ctx.m_recurrentBatches.size() == 0)
+			throw Ex("Recurrent blocks only support batch propagation through GContextSequenceBatch");
+		bool whole = (b.inPos() == 0 && b.inputs() == input.cols() && b.outputs() == output.cols());
+		if(!whole)
+		{
+			in.copyCols(input, b.inPos(), b.inputs());
+			out.copyCols(output, outPos, b.outputs());
+			blame.copyCols(outBlame, outPos, b.outputs());
+			upBlame.resize(outBlame.rows(), b.inputs());
+			upBlame.fill(0.0);
+		}
+		const GMatrix& bIn = whole ? input : in;
+		const GMatrix& bOut = whole ? output : out;
+		const GMatrix& bBlame = whole ? outBlame : blame;
+		GMatrix& bUpBlame = whole ? inBlame : upBlame;
+		if(b.type() == GBlock::block_neuralnet)
+		{
+			GContextNeuralNet* pCompContext = ctx.m_components[comp++];
+			b.backPropBatch(*pCompContext, bIn, bOut, bBlame, bUpBlame);
+		}
+		else if(b.isRecurrent())
+			ctx.m_recurrentBatches[recurrents++]->backProp(bBlame, bUpBlame);
+		else
+			b.backPropBatch(ctx, bIn, bOut, bBlame, bUpBlame);
+		if(!whole)
+		{
+			for(size_t r = 0; r < inBlame.rows(); r++)
+			{
+				GVecWrapper vwInBlame(inBlame[r].data() + b.inPos(), b.inputs());
+				vwInBlame.vec() += upBlame[r];
+			}
+		}
+		outPos += b.outputs();
+	}
+}
+
+void GLayer::updateGradientBatch(GContextLayer& ctx, const GMatrix& input, const GMatrix& outBlame, GVec &gradient) const
+{
+	GMatrix in;
+	GMatrix blame;
+	GVecWrapper vwGradient;
+	size_t gradPos = 0;
+	size_t outPos = 0;
+	size_t comp = 0;
+	size_t recurrents = 0;
+	for(size_t i = 0; i < blockCount(); i++)
+	{
+		const GBlock& b = block(i);
+		size_t wc = b.weightCount();
+		if(b.isRecurrent() && ctx.m_recurrentBatches.size() == 0)
+			throw Ex("Recurrent blocks only support batch propagation through GContextSequenceBatch");
+		if(wc > 0)
+		{
+			bool whole = (b.inPos() == 0 && b.inputs() == input.cols() && b.outputs() == outBlame.cols());
+			if(!whole)
+			{
+				in.copyCols(input, b.inPos(), b.inputs());
+				blame.copyCols(outBlame, outPos, b.outputs());
+			}
+			const GMatrix& bIn = whole ? input : in;
+			const GMatrix& bBlame = whole ? outBlame : blame;
+			vwGradient.setData(gradient.data() + gradPos, wc);
+			if(b.type() == GBlock::block_neuralnet)
+				b.updateGradientBatch(*ctx.m_components[comp], bIn, bBlame, vwGradient.vec());
+			else if(b.isRecurrent())
+				ctx.m_recurrentBatches[recurrents]->updateGradient(vwGradient.vec());
+			else
+				b.updateGradientBatch(ctx, bIn, bBlame, vwGradient.vec());
+		}
+		if(b.type() == GBlock::block_neuralnet)
+			comp++;
+		else if(b.isRecurrent())
+			recurrents++;
+		outPos += b.outputs();
+		gradPos += wc;
+	}
+}
+
 void GLayer::step(double learningRate, const GVec &gradient)
 {
 	GConstVecWrapper vwGradient;
@@ -374,6 +501,8 @@ GContextLayer::~GContextLayer()
 {
 	for(size_t i = 0; i < m_recurrents.size(); i++)
 		delete(m_recurrents[i]);
+	for(size_t i = 0; i < m_recurrentBatches.size(); i++)
+		delete(m_recurrentBatches[i]);
 	for(size_t i = 0; i < m_components.size(); i++)
 		delete(m_components[i]);
 }
@@ -396,6 +525,26 @@ void GContextLayer::resetState()
 			pRecContext->resetState();
 		}
 	}
+	for(size_t i = 0; i < m_recurrentBatches.size(); i++)
+		m_recurrentBatches[i]->resetState();
+}
+
+void GContextLayer::beginSequences(size_t sequences)
+{
+	if(m_recurrentBatches.size() != m_recurrents.size() || (m_recurrentBatches.size() > 0 && m_recurrentBatches[0]->m_sequences != sequences))
+	{
+		for(size_t i = 0; i < m_recurrentBatches.size(); i++)
+			delete(m_recurrentBatches[i]);
+		m_recurrentBatches.clear();
+		for(size_t i = 0; i < m_layer.blockCount(); i++)
+		{
+			const GBlock* b = &m_layer.block(i);
+			if(b->isRecurrent())
+				m_recurrentBatches.push_back(new GContextRecurrentBatch(m_rand, *(GBlockRecurrent*)b, sequences));
+		}
+	}
+	for(size_t i = 0; i < m_recurrentBatches.size(); i++)
+		m_recurrentBatches[i]->resetState();
 }
 
 
@@ -407,12 +556,12 @@ void GContextLayer::resetState()
 
 
 GNeuralNet::GNeuralNet()
-: GBlock(), m_weightCount(0)
+: GBlock(), m_weightCount(0), m_singlePrecision(false)
 {
 }
 
 GNeuralNet::GNeuralNet(GDomNode* pNode)
-: GBlock(pNode), m_weightCount(0)
+: GBlock(pNode), m_weightCount(0), m_singlePrecision(false)
 {
 	GDomNode* pLayers = pNode->field("layers");
 	GDomListIterator it(pLayers);
@@ -421,6 +570,9 @@ GNeuralNet::GNeuralNet(GDomNode* pNode)
 		m_layers.push_back(new GLayer(it.current()));
 		it.advance();
 	}
+	GDomNode* pSingle = pNode->fieldIfExists("single");
+	if(pSingle)
+		m_singlePrecision = pSingle->asBool();
 }
 
 // virtual
@@ -436,6 +588,8 @@ GDomNode* GNeuralNet::serialize(GDom* pDoc) const
 	GDomNode* pLayers = pNode->addField(pDoc, "layers", pDoc->newList());
 	for(size_t i = 0; i < m_layers.size(); i++)
 		pLayers->addItem(pDoc, m_layers[i]->serialize(pDoc));
+	if(m_singlePrecision)
+		pNode->addField(pDoc, "single", pDoc->newBool(true));
 	return pNode;
 }
 
@@ -476,6 +630,8 @@ void GNeuralNet::add(GBlock* pBlock)
 	GLayer* pNewLayer = new GLayer();
 	m_layers.push_back(pNewLayer);
 	pNewLayer->add(pBlock);
+	if(m_singlePrecision)
+		pBlock->setSinglePrecision(true);
 }
 
 void GNeuralNet::concat(GBlock* pBlock, size_t inPos)
@@ -483,6 +639,91 @@ void GNeuralNet::concat(GBlock* pBlock, size_t inPos)
 	GAssert(m_weightCount == 0, "weights were counted before all blocks were added");
 	GLayer* pLastLayer = m_layers[m_layers.size() - 1];
 	pLastLayer->add(pBlock, inPos);
+	if(m_singlePrecision)
+		pBlock->setSinglePrecision(true);
+}
+
+void GNeuralNet::setSinglePrecision(bool single)
+{
+	m_singlePrecision = single;
+	for(size_t i = 0; i < m_layers.size(); i++)
+	{
+		GLayer& l = *m_layers[i];
+		for(size_t j = 0; j < l.blockCount(); j++)
+			l.block(j).setSinglePrecision(single);
+	}
+}
+
+void GNeuralNet::quantize(const GMatrix& sample)
+{
+	if(sample.cols() != inputs())
+		throw Ex("Mismatching number of inputs. Sample has ", GClasses::to_str(sample.cols()), ". Neural net expects ", GClasses::to_str(inputs()));
+	if(containsRecurrentBlocks())
+		throw Ex("Networks with recurrent blocks cannot be quantized");
+	GRand rand(0);
+	std::unique_ptr<GMatrix> hActivation;
+	const GMatrix* pIn = &sample;
+	for(size_t i = 0; i < m_layers.size(); i++)
+	{
+		// Calibrate each block on the range of its inputs
+		GLayer& l = *m_layers[i];
+		for(size_t j = 0; j < l.blockCount(); j++)
+		{
+			GBlock& b = l.block(j);
+			if(b.type() == block_neuralnet)
+			{
+				GMatrix sub;
+				sub.copyCols(*pIn, b.inPos(), b.inputs());
+				((GNeuralNet&)b).quantize(sub);
+			}
+			else if(b.weightCount() > 0)
+			{
+				double mag = 0.0;
+				for(size_t r = 0; r < pIn->rows(); r++)
+				{
+					const GVec& row = (*pIn)[r];
+					for(size_t k = b.inPos(); k < b.inPos() + b.inputs(); k++)
+						mag = std::max(mag, std::abs(row[k]));
+				}
+				b.quantizeWeights(mag);
+			}
+		}
+
+		// Propagate the sample through the quantized layer, so later layers see the activations they will see at inference time
+		if(i + 1 < m_layers.size())
+		{
+			GContextLayer* pCtx = l.newContext(rand);
+			std::unique_ptr<GContextLayer> hCtx(pCtx);
+			GMatrix* pOut = new GMatrix(pIn->rows(), l.outputs());
+			l.forwardPropBatch(*pCtx, *pIn, *pOut);
+			hActivation.reset(pOut);
+			pIn = pOut;
+		}
+	}
+}
+
+void GNeuralNet::dequantize()
+{
+	for(size_t i = 0; i < m_layers.size(); i++)
+	{
+		GLayer& l = *m_layers[i];
+		for(size_t j = 0; j < l.blockCount(); j++)
+			l.block(j).dequantize();
+	}
+}
+
+bool GNeuralNet::quantized() const
+{
+	for(size_t i = 0; i < m_layers.size(); i++)
+	{
+		const GLayer& l = *m_layers[i];
+		for(size_t j = 0; j < l.blockCount(); j++)
+		{
+			if(l.block(j).quantized())
+				return true;
+		}
+	}
+	return false;
 }
 
 void GNeuralNet::resize(size_t inputs, size_t outputs)
@@ -527,6 +768,15 @@ void GNeuralNet::resize(size_t inputs, size_t outputs)
 		throw Ex("The last layer outputs ", GClasses::to_str(inCount), " values, but ", GClasses::to_str(outputs), " were expected");
 }
 
+void GContextLayer::resizeBatch(size_t rows)
+{
+	if(m_activationBatch.rows() != rows || m_activationBatch.cols() != m_layer.outputs())
+	{
+		m_activationBatch.resize(rows, m_layer.outputs());
+		m_blameBatch.resize(rows, m_layer.outputs());
+	}
+}
+
 void GNeuralNet::init(size_t inputs, size_t outputs, GRand& rand)
 {
 	resize(inputs, outputs);
@@ -608,6 +858,82 @@ void GNeuralNet::updateGradient(GContext& ctx, const GVec &input, const GVec& ou
 	GAssert(gradPos == weightCount());
 }
 
+bool GNeuralNet::containsRecurrentBlocks() const
+{
+	for(size_t i = 0; i < layerCount(); i++)
+	{
+		const GLayer& l = layer(i);
+		for(size_t j = 0; j < l.blockCount(); j++)
+		{
+			const GBlock& b = l.block(j);
+			if(b.isRecurrent())
+				return true;
+			if(b.type() == GBlock::block_neuralnet && ((const GNeuralNet&)b).containsRecurrentBlocks())
+				return true;
+		}
+	}
+	return false;
+}
+
+void GNeuralNet::forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const
+{
+	GAssert(input.cols() == layer(0).inputs());
+	GAssert(output.cols() == outputLayer().outputs() && output.rows() == input.rows());
+	const GMatrix* pInput = &input;
+	GContextNeuralNet* pContext = (GContextNeuralNet*)&ctx;
+	size_t lastLayer = pContext->m_layers.size() - 1;
+	for(size_t i = 0; i < lastLayer; i++)
+	{
+		GContextLayer* pLayer = pContext->m_layers[i];
+		pLayer->resizeBatch(input.rows());
+		pLayer->m_layer.forwardPropBatch(*pLayer, *pInput, pLayer->m_activationBatch);
+		pInput = &pLayer->m_activationBatch;
+	}
+	GContextLayer* pLayer = pContext->m_layers[lastLayer];
+	pLayer->m_layer.forwardPropBatch(*pLayer, *pInput, output);
+}
+
+void GNeuralNet::backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const
+{
+	const GMatrix* pOutput = &output;
+	const GMatrix* pOutBlame = &outBlame;
+	GContextNeuralNet* pContext = (GContextNeuralNet*)&ctx;
+	for(size_t i = pContext->m_layers.size() - 1; i > 0; i--)
+	{
+		GContextLayer* pLayer = pContext->m_layers[i];
+		GContextLayer* pPrevLayer = pContext->m_layers[i - 1];
+		pLayer->m_layer.backPropBatch(*pLayer, pPrevLayer->m_activationBatch, *pOutput, *pOutBlame, pPrevLayer->m_blameBatch);
+		pOutput = &pPrevLayer->m_activationBatch;
+		pOutBlame = &pPrevLayer->m_blameBatch;
+	}
+	if(&inBlame != &outBlame)
+	{
+		GContextLayer* pLayer = pContext->m_layers[0];
+		pLayer->m_layer.backPropBatch(*pLayer, input, *pOutput, *pOutBlame, inBlame);
+	}
+}
+
+void GNeuralNet::updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const
+{
+	const GMatrix* pInput = &input;
+	size_t gradPos = 0;
+	GVecWrapper vwGradient;
+	GContextNeuralNet* pContext = (GContextNeuralNet*)&ctx;
+	size_t lastLayer = pContext->m_layers.size() - 1;
+	for(size_t i = 0; i <= lastLayer; i++)
+	{
+		GContextLayer* pLayer = pContext->m_layers[i];
+		size_t wc = pLayer->m_layer.weightCount();
+		vwGradient.setData(gradient.data() + gradPos, wc);
+		GAssert(gradPos + wc <= gradient.size());
+		const GMatrix& blame = (i == lastLayer ? outBlame : pLayer->m_blameBatch);
+		pLayer->m_layer.updateGradientBatch(*pLayer, *pInput, blame, vwGradient.vec());
+		pInput = &pLayer->m_activationBatch;
+		gradPos += wc;
+	}
+	GAssert(gradPos == weightCount());
+}
+
 void GNeuralNet::step(double learningRate, const GVec &gradient)
 {
 	GConstVecWrapper vwGradient;
@@ -680,6 +1006,7 @@ void GNeuralNet::copyStructure(const GNeuralNet* pOther)
 		GDomNode* pNode = pOther->m_layers[i]->serialize(&doc);
 		m_layers.push_back(new GLayer(pNode));
 	}
+	m_singlePrecision = pOther->m_singlePrecision;
 }
 
 void GNeuralNet::resetWeights(GRand& rand)
@@ -1100,6 +1427,113 @@ void GContextNeuralNet::resetState()
 
 
 
+GContextSequenceBatch::GContextSequenceBatch(GRand& rand, const GNeuralNet& nn, size_t sequences)
+: GContext(rand),
+m_nn(nn),
+m_pContext(nn.newContext(rand)),
+m_sequences(sequences),
+m_steps(0),
+m_inBlame(sequences, nn.layer(0).inputs())
+{
+	for(size_t i = 0; i < m_pContext->layerCount(); i++)
+	{
+		m_pContext->layer(i).beginSequences(sequences);
+		m_blames.push_back(new GMatrix(sequences, nn.layer(i).outputs()));
+	}
+}
+
+GContextSequenceBatch::~GContextSequenceBatch()
+{
+	for(size_t i = 0; i < m_inputs.size(); i++)
+		delete(m_inputs[i]);
+	for(size_t i = 0; i < m_activations.size(); i++)
+		delete(m_activations[i]);
+	for(size_t i = 0; i < m_blames.size(); i++)
+		delete(m_blames[i]);
+	delete(m_pContext);
+}
+
+void GContextSequenceBatch::resetState()
+{
+	for(size_t i = 0; i < m_pContext->layerCount(); i++)
+	{
+		GContextLayer& ctx = m_pContext->layer(i);
+		for(size_t j = 0; j < ctx.m_recurrentBatches.size(); j++)
+			ctx.m_recurrentBatches[j]->resetState();
+	}
+	m_steps = 0;
+}
+
+void GContextSequenceBatch::beginWindow()
+{
+	for(size_t i = 0; i < m_pContext->layerCount(); i++)
+	{
+		GContextLayer& ctx = m_pContext->layer(i);
+		for(size_t j = 0; j < ctx.m_recurrentBatches.size(); j++)
+			ctx.m_recurrentBatches[j]->beginWindow();
+	}
+	m_steps = 0;
+}
+
+const GMatrix& GContextSequenceBatch::forwardProp(const GMatrix& input, const std::vector<bool>& active)
+{
+	GAssert(input.rows() == m_sequences && input.cols() == m_nn.layer(0).inputs() && active.size() == m_sequences);
+	size_t layers = m_pContext->layerCount();
+	if(m_inputs.size() <= m_steps)
+	{
+		m_inputs.push_back(new GMatrix(m_sequences, input.cols()));
+		for(size_t i = 0; i < layers; i++)
+			m_activations.push_back(new GMatrix(m_sequences, m_nn.layer(i).outputs()));
+	}
+	m_inputs[m_steps]->copyBlock(input, 0, 0, INVALID_INDEX, INVALID_INDEX, 0, 0, false);
+	const GMatrix* pIn = m_inputs[m_steps];
+	for(size_t i = 0; i < layers; i++)
+	{
+		GContextLayer& ctx = m_pContext->layer(i);
+		for(size_t j = 0; j < ctx.m_recurrentBatches.size(); j++)
+			ctx.m_recurrentBatches[j]->beginStep(active);
+		GMatrix* pOut = m_activations[m_steps * layers + i];
+		ctx.m_layer.forwardPropBatch(ctx, *pIn, *pOut);
+		pIn = pOut;
+	}
+	m_steps++;
+	return *pIn;
+}
+
+void GContextSequenceBatch::backProp(size_t step, const GMatrix& outBlame, GVec& gradient)
+{
+	GAssert(step < m_steps && gradient.size() == m_nn.weightCount());
+	size_t layers = m_pContext->layerCount();
+	const GMatrix* pBlame = &outBlame;
+	size_t gradPos = m_nn.weightCount();
+	GVecWrapper vwGradient;
+	for(size_t i = layers; i-- > 0; )
+	{
+		GContextLayer& ctx = m_pContext->layer(i);
+		for(size_t j = 0; j < ctx.m_recurrentBatches.size(); j++)
+			ctx.m_recurrentBatches[j]->setStep(step);
+		const GMatrix& in = (i > 0 ? *m_activations[step * layers + i - 1] : *m_inputs[step]);
+		GMatrix& inBlame = (i > 0 ? *m_blames[i - 1] : m_inBlame);
+
+		// The first layer only needs to backpropagate if its recurrent blocks carry blame to earlier steps
+		if(i > 0 || ctx.m_recurrentBatches.size() > 0)
+			ctx.m_layer.backPropBatch(ctx, in, *m_activations[step * layers + i], *pBlame, inBlame);
+		size_t wc = ctx.m_layer.weightCount();
+		gradPos -= wc;
+		vwGradient.setData(gradient.data() + gradPos, wc);
+		ctx.m_layer.updateGradientBatch(ctx, in, *pBlame, vwGradient.vec());
+		pBlame = &inBlame;
+	}
+	GAssert(gradPos == 0);
+}
+
+
+
+
+
+
+
+
 
 
 GNeuralNetLearner::GNeuralNetLearner()
@@ -1196,6 +1630,55 @@ void GNeuralNetLearner::predict(const GVec& in, GVec& out)
 	m_nn.forwardProp(opt.context(), in, out);
 }
 
+#define NN_BATCH_BLOCK_ROWS 128
+
+// virtual
+void GNeuralNetLearner::predictBatch(const GMatrix& in, GMatrix& out)
+{
+	prepareBatch(in, out);
+	if(m_nn.containsRecurrentBlocks())
+	{
+		for(size_t i = 0; i < in.rows(); i++)
+			predict(in[i], out[i]);
+		return;
+	}
+
+	// Each slot gets its own context, generator, and staging matrices, so the threads share only the (read-only) weights
+	GThreadPool& pool = GThreadPool::global();
+	size_t slots = pool.participants();
+	std::vector<std::unique_ptr<GRand> > rands;
+	std::vector<std::unique_ptr<GContextNeuralNet> > contexts;
+	std::vector<std::unique_ptr<GMatrix> > inBufs;
+	std::vector<std::unique_ptr<GMatrix> > outBufs;
+	for(size_t i = 0; i < slots; i++)
+	{
+		rands.emplace_back(new GRand(0));
+		contexts.emplace_back(m_nn.newContext(*rands.back()));
+		inBufs.emplace_back(new GMatrix());
+		outBufs.emplace_back(new GMatrix());
+	}
+	size_t rows = in.rows();
+	size_t blocks = (rows + NN_BATCH_BLOCK_ROWS - 1) / NN_BATCH_BLOCK_ROWS;
+	pool.parallelForSlots(0, blocks, [&](size_t block, size_t slot)
+	{
+		size_t start = block * NN_BATCH_BLOCK_ROWS;
+		size_t end = std::min(rows, start + NN_BATCH_BLOCK_ROWS);
+		GMatrix& x = *inBufs[slot];
+		GMatrix& y = *outBufs[slot];
+		rands[slot]->setSeed(block); // so the results do not depend on the number of threads
+		if(x.rows() != end - start)
+		{
+			x.resize(end - start, in.cols());
+			y.resize(end - start, out.cols());
+		}
+		for(size_t i = start; i < end; i++)
+			x[i - start].copy(in[i]);
+		m_nn.forwardPropBatch(*contexts[slot], x, y);
+		for(size_t i = start; i < end; i++)
+			out[i].copy(y[i - start]);
+	});
+}
+
 // virtual
 void GNeuralNetLearner::beginIncrementalLearningInner(const GRelation& featureRel, const GRelation& labelRel)
 {
@@ -1519,6 +2002,477 @@ void GNeuralNet_testTransformWeights(GRand& prng)
 			throw Ex("transformWeights failed");
 	}
 }
+void GNeuralNet_testBatch(GRand& prng)
+{
+	// Make a network with a convolutional layer, and a layer with two blocks side-by-side
+	GNeuralNet nn;
+	nn.add(new GBlockConvolutional2D(5, 5, 2, 3, 3, 2));
+	nn.add(new GBlockLinear(6));
+	nn.add(new GBlockTanh(3));
+	nn.concat(new GBlockLinear(2, 3), 3);
+	nn.add(new GBlockLinear(2));
+	nn.init(50, 2, prng);
+	nn.perturbWeights(prng, 0.5);
+	GContextNeuralNet* pCtxBatch = nn.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtxBatch(pCtxBatch);
+	GContextNeuralNet* pCtx = nn.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+
+	// Propagate a batch (7 is deliberately not a multiple of the tile size)
+	size_t batchSize = 7;
+	GMatrix x(batchSize, 50);
+	x.fillUniform(prng, -1.0, 1.0);
+	GMatrix blame(batchSize, 2);
+	blame.fillUniform(prng, -1.0, 1.0);
+	GMatrix y(batchSize, 2);
+	GMatrix inBlame(batchSize, 50);
+	GVec grad(nn.weightCount());
+	grad.fill(0.0);
+	nn.forwardPropBatch(*pCtxBatch, x, y);
+	nn.backPropBatch(*pCtxBatch, x, y, blame, inBlame);
+	nn.updateGradientBatch(*pCtxBatch, x, blame, grad);
+
+	// Make sure it matches propagating one sample at a time
+	GVec gradSum(nn.weightCount());
+	gradSum.fill(0.0);
+	GVec g(nn.weightCount());
+	GVec inB(50);
+	for(size_t i = 0; i < batchSize; i++)
+	{
+		nn.forwardProp(*pCtx, x[i], pCtx->predBuf());
+		if(pCtx->predBuf().squaredDistance(y[i]) > 1e-20)
+			throw Ex("forwardPropBatch disagrees with forwardProp");
+		pCtx->blameBuf().copy(blame[i]);
+		nn.backProp(*pCtx, x[i], pCtx->predBuf(), pCtx->blameBuf(), inB);
+		if(inB.squaredDistance(inBlame[i]) > 1e-20)
+			throw Ex("backPropBatch disagrees with backProp");
+		g.fill(0.0);
+		nn.updateGradient(*pCtx, x[i], pCtx->blameBuf(), g);
+		gradSum += g;
+	}
+	if(gradSum.squaredDistance(grad) > 1e-18)
+		throw Ex("updateGradientBatch disagrees with updateGradient");
+}
+
+
+void GNeuralNet_testSinglePrecision(GRand& prng)
+{
+	// Blocks added after the mode is set should also use it
+	GNeuralNet nnEmpty;
+	nnEmpty.setSinglePrecision(true);
+	nnEmpty.add(new GBlockLinear(3));
+	if(!nnEmpty.layer(0).block(0).singlePrecision())
+		throw Ex("Single-precision mode was not applied to a block added later");
+
+	GNeuralNet nn;
+	nn.add(new GBlockLinear(12), new GBlockTanh(), new GBlockLinear(3), new GBlockTanh());
+	nn.init(20, 3, prng);
+	GNeuralNet nnSingle;
+	nnSingle.copyStructure(&nn);
+	nnSingle.copyWeights(&nn);
+	nnSingle.setSinglePrecision(true);
+	if(!nnSingle.singlePrecision() || !nnSingle.layer(0).block(0).singlePrecision() || !nnSingle.layer(2).block(0).singlePrecision())
+		throw Ex("Single-precision mode was not applied to every linear block");
+	GContextNeuralNet* pCtx = nn.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+	GContextNeuralNet* pCtxSingle = nnSingle.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtxSingle(pCtxSingle);
+
+	for(size_t pass = 0; pass < 2; pass++)
+	{
+		// Single-precision propagation should closely match double precision
+		GMatrix x(6, 20);
+		x.fillUniform(prng, -1.0, 1.0);
+		GMatrix y(6, 3);
+		nnSingle.forwardPropBatch(*pCtxSingle, x, y);
+		GVec inBlame(20);
+		GVec inBlameSingle(20);
+		for(size_t i = 0; i < x.rows(); i++)
+		{
+			nn.forwardProp(*pCtx, x[i], pCtx->predBuf());
+			nnSingle.forwardProp(*pCtxSingle, x[i], pCtxSingle->predBuf());
+			if(pCtxSingle->predBuf().squaredDistance(y[i]) > 1e-20)
+				throw Ex("Single-precision forwardPropBatch disagrees with forwardProp");
+			if(pCtx->predBuf().squaredDistance(pCtxSingle->predBuf()) > 1e-10)
+				throw Ex("Single-precision forwardProp is not close to double precision");
+			pCtx->blameBuf().fill(1.0);
+			pCtxSingle->blameBuf().fill(1.0);
+			inBlame.fill(0.0);
+			inBlameSingle.fill(0.0);
+			nn.backProp(*pCtx, x[i], pCtx->predBuf(), pCtx->blameBuf(), inBlame);
+			nnSingle.backProp(*pCtxSingle, x[i], pCtxSingle->predBuf(), pCtxSingle->blameBuf(), inBlameSingle);
+			if(inBlame.squaredDistance(inBlameSingle) > 1e-10)
+				throw Ex("Single-precision backProp is not close to double precision");
+		}
+
+		// Taking a step should refresh the single-precision weights
+		GVec step(nn.weightCount());
+		step.fillNormal(prng, 0.3);
+		nn.step(1.0, step);
+		nnSingle.step(1.0, step);
+	}
+
+	// Writing through the mutable accessors should refresh the single-precision weights before the next propagation
+	GVec probe(20);
+	probe.fillUniform(prng, -1.0, 1.0);
+	((GBlockLinear&)nn.layer(2).block(0)).bias()[1] += 0.5;
+	((GBlockLinear&)nnSingle.layer(2).block(0)).bias()[1] += 0.5;
+	((GBlockLinear&)nn.layer(0).block(0)).weights()[3][7] -= 0.25;
+	((GBlockLinear&)nnSingle.layer(0).block(0)).weights()[3][7] -= 0.25;
+	nn.forwardProp(*pCtx, probe, pCtx->predBuf());
+	nnSingle.forwardProp(*pCtxSingle, probe, pCtxSingle->predBuf());
+	if(pCtx->predBuf().squaredDistance(pCtxSingle->predBuf()) > 1e-10)
+		throw Ex("Single-precision weights went stale after a write through weights() or bias()");
+
+	// The mode should survive serialization, and the master weights should not lose precision
+	GDom doc;
+	GNeuralNet nnLoaded(nnSingle.serialize(&doc));
+	if(!nnLoaded.singlePrecision() || !nnLoaded.layer(2).block(0).singlePrecision())
+		throw Ex("Single-precision mode was not deserialized");
+	GVec w(nn.weightCount());
+	GVec wLoaded(nn.weightCount());
+	nn.weightsToVector(w.data());
+	nnLoaded.weightsToVector(wLoaded.data());
+	if(w.squaredDistance(wLoaded) != 0.0)
+		throw Ex("Serializing in single-precision mode lost precision in the master weights");
+	nnLoaded.setSinglePrecision(false);
+	if(nnLoaded.layer(0).block(0).singlePrecision())
+		throw Ex("Single-precision mode was not turned off");
+}
+
+
+void GNeuralNet_testQuantize(GRand& prng)
+{
+	// Use the outputs of the unquantized network as the labels, so the loss is entirely due to quantization
+	GNeuralNet nn;
+	nn.add(new GBlockLinear(16), new GBlockTanh(), new GBlockLinear(3));
+	nn.init(40, 3, prng);
+	GMatrix x(200, 40);
+	x.fillUniform(prng, -1.0, 1.0);
+	GMatrix y(200, 3);
+	GContextNeuralNet* pCtx = nn.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+	nn.forwardPropBatch(*pCtx, x, y);
+	double energy = 0.0;
+	for(size_t i = 0; i < y.rows(); i++)
+		energy += y[i].squaredMagnitude();
+	nn.quantize(x);
+	if(!nn.quantized() || !nn.layer(0).block(0).quantized() || nn.layer(1).block(0).quantized())
+		throw Ex("Expected only the linear blocks to be quantized");
+	double loss = nn.measureLoss(x, y);
+	if(loss > 1e-3 * energy)
+		throw Ex("Quantization lost too much accuracy. Loss: ", to_str(loss), ", energy: ", to_str(energy));
+
+	// The quantized weights should round-trip through serialization exactly
+	GDom doc;
+	GNeuralNet nnLoaded(nn.serialize(&doc));
+	GContextNeuralNet* pCtxLoaded = nnLoaded.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtxLoaded(pCtxLoaded);
+	GMatrix yQuant(200, 3);
+	nn.forwardPropBatch(*pCtx, x, yQuant);
+	for(size_t i = 0; i < 10; i++)
+	{
+		nnLoaded.forwardProp(*pCtxLoaded, x[i], pCtxLoaded->predBuf());
+		if(pCtxLoaded->predBuf().squaredDistance(yQuant[i]) != 0.0)
+			throw Ex("The deserialized quantized model disagrees with the original");
+	}
+
+	// int8 weights that do not fit the block should be rejected
+	GBlockLinear wide(3, 4);
+	wide.resetWeights(prng);
+	wide.quantizeWeights(1.0);
+	GBlockLinear narrow(2, 4);
+	GDomNode* pNarrow = narrow.serialize(&doc);
+	pNarrow->addField(&doc, "int8", wide.serialize(&doc)->field("int8"));
+	bool rejected = false;
+	try
+	{
+		GBlockLinear mismatched(pNarrow);
+	}
+	catch(const std::exception&)
+	{
+		rejected = true;
+	}
+	if(!rejected)
+		throw Ex("Mismatched int8 weights were not rejected");
+
+	// Dequantizing should restore the exact double-precision behavior
+	nn.dequantize();
+	if(nn.quantized() || nn.measureLoss(x, y) > 1e-20)
+		throw Ex("dequantize did not restore the original weights");
+
+	// Quantize a convolutional network
+	GNeuralNet cnn;
+	GBlockConvolutional2D* pConv = new GBlockConvolutional2D(6, 6, 2, 3, 3, 4);
+	pConv->setPadding(1);
+	cnn.add(pConv, new GBlockTanh(), new GBlockLinear(2));
+	cnn.init(72, 2, prng);
+	GMatrix cx(40, 72);
+	cx.fillUniform(prng, -1.0, 1.0);
+	GMatrix cy(40, 2);
+	GContextNeuralNet* pCtxConv = cnn.newContext(prng);
+	std::unique_ptr<GContextNeuralNet> hCtxConv(pCtxConv);
+	cnn.forwardPropBatch(*pCtxConv, cx, cy);
+	energy = 0.0;
+	for(size_t i = 0; i < cy.rows(); i++)
+		energy += cy[i].squaredMagnitude();
+	cnn.quantize(cx);
+	if(!cnn.layer(0).block(0).quantized())
+		throw Ex("Expected the convolutional block to be quantized");
+	loss = cnn.measureLoss(cx, cy);
+	if(loss > 1e-3 * energy)
+		throw Ex("Quantization lost too much accuracy in a convolutional network. Loss: ", to_str(loss), ", energy: ", to_str(energy));
+	GMatrix cyQuant(40, 2);
+	cnn.forwardPropBatch(*pCtxConv, cx, cyQuant);
+	for(size_t i = 0; i < 5; i++)
+	{
+		cnn.forwardProp(*pCtxConv, cx[i], pCtxConv->predBuf());
+		if(pCtxConv->predBuf().squaredDistance(cyQuant[i]) > 1e-24)
+			throw Ex("Quantized forwardPropBatch disagrees with forwardProp");
+	}
+}
+
+void GNeuralNet_testConvolutionAlgorithms(GRand& prng)
+{
+	// width, height, channels, kernel width, kernel height, kernels, padding, stride, interlaced
+	size_t geometries[][9] = {
+		{ 7, 6, 3, 3, 3, 4, 0, 1, 1 }, // Winograd with odd output dimensions
+		{ 6, 6, 2, 3, 3, 3, 1, 1, 0 }, // Winograd with padding and planar images
+		{ 5, 7, 2, 3, 3, 2, 3, 1, 1 }, // Too much padding for Winograd to propagate blame backward
+		{ 9, 9, 2, 5, 3, 3, 1, 2, 1 }, // Only im2col applies
+	};
+	for(size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++)
+	{
+		size_t* p = geometries[g];
+		GNeuralNet nn;
+		GBlockConvolutional2D* pConv = new GBlockConvolutional2D(p[0], p[1], p[2], p[3], p[4], p[5]);
+		pConv->setPadding(p[6]);
+		pConv->setStride(p[7]);
+		pConv->setInterlaced(p[8] != 0);
+		nn.add(pConv);
+		nn.init(pConv->inputs(), pConv->outputs(), prng);
+		nn.perturbWeights(prng, 0.5);
+		GContextNeuralNet* pCtx = nn.newContext(prng);
+		std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+		size_t batchSize = 3;
+		GMatrix x(batchSize, pConv->inputs());
+		x.fillUniform(prng, -1.0, 1.0);
+		GMatrix blame(batchSize, pConv->outputs());
+		blame.fillUniform(prng, -1.0, 1.0);
+
+		// Use the nested loops as the reference
+		GMatrix yRef(batchSize, pConv->outputs());
+		GMatrix inBlameRef(batchSize, pConv->inputs());
+		GVec gradRef(nn.weightCount());
+		gradRef.fill(0.0);
+		pConv->setAlgorithm(GBlockConvolutional2D::conv_direct);
+		for(size_t i = 0; i < batchSize; i++)
+		{
+			nn.forwardProp(*pCtx, x[i], yRef[i]);
+			pCtx->blameBuf().copy(blame[i]);
+			nn.backProp(*pCtx, x[i], yRef[i], pCtx->blameBuf(), inBlameRef[i]);
+			nn.updateGradient(*pCtx, x[i], pCtx->blameBuf(), gradRef);
+		}
+
+		GBlockConvolutional2D::Algorithm algs[] = { GBlockConvolutional2D::conv_im2col, GBlockConvolutional2D::conv_winograd, GBlockConvolutional2D::conv_auto };
+		for(size_t a = 0; a < 3; a++)
+		{
+			pConv->setAlgorithm(algs[a]);
+
+			// One sample at a time
+			GVec grad(nn.weightCount());
+			grad.fill(0.0);
+			GVec inB(pConv->inputs());
+			for(size_t i = 0; i < batchSize; i++)
+			{
+				nn.forwardProp(*pCtx, x[i], pCtx->predBuf());
+				if(pCtx->predBuf().squaredDistance(yRef[i]) > 1e-20)
+					throw Ex("forwardProp disagrees with the direct convolution in geometry ", to_str(g), ", algorithm ", to_str(a));
+				pCtx->blameBuf().copy(blame[i]);
+				nn.backProp(*pCtx, x[i], yRef[i], pCtx->blameBuf(), inB);
+				if(inB.squaredDistance(inBlameRef[i]) > 1e-20)
+					throw Ex("backProp disagrees with the direct convolution in geometry ", to_str(g), ", algorithm ", to_str(a));
+				nn.updateGradient(*pCtx, x[i], pCtx->blameBuf(), grad);
+			}
+			if(grad.squaredDistance(gradRef) > 1e-18)
+				throw Ex("updateGradient disagrees with the direct convolution in geometry ", to_str(g), ", algorithm ", to_str(a));
+
+			// The whole batch at once
+			GMatrix y(batchSize, pConv->outputs());
+			GMatrix inBlame(batchSize, pConv->inputs());
+			grad.fill(0.0);
+			nn.forwardPropBatch(*pCtx, x, y);
+			nn.backPropBatch(*pCtx, x, y, blame, inBlame);
+			nn.updateGradientBatch(*pCtx, x, blame, grad);
+			for(size_t i = 0; i < batchSize; i++)
+			{
+				if(y[i].squaredDistance(yRef[i]) > 1e-20 || inBlame[i].squaredDistance(inBlameRef[i]) > 1e-20)
+					throw Ex("Batch propagation disagrees with the direct convolution in geometry ", to_str(g), ", algorithm ", to_str(a));
+			}
+			if(grad.squaredDistance(gradRef) > 1e-18)
+				throw Ex("updateGradientBatch disagrees with the direct convolution in geometry ", to_str(g), ", algorithm ", to_str(a));
+		}
+
+		// Writing through kernels() or bias() should refresh the cached Winograd kernels
+		pConv->setAlgorithm(GBlockConvolutional2D::conv_winograd);
+		nn.forwardProp(*pCtx, x[0], pCtx->predBuf());
+		pConv->kernels()[0][1] += 0.5;
+		pConv->bias()[0] -= 0.25;
+		GVec yCached(pConv->outputs());
+		nn.forwardProp(*pCtx, x[0], yCached);
+		pConv->setAlgorithm(GBlockConvolutional2D::conv_direct);
+		nn.forwardProp(*pCtx, x[0], pCtx->predBuf());
+		if(yCached.squaredDistance(pCtx->predBuf()) > 1e-20)
+			throw Ex("The cached kernels went stale after a write through kernels() or bias() in geometry ", to_str(g));
+	}
+}
+
+// Propagates the sequences through ctx together, in windows of the specified number of steps, and returns half the sum-squared error.
+// If pOutputs is not NULL, the outputs are stored in it.
+double GNeuralNet_sequenceError(GContextSequenceBatch& ctx, const std::vector<const GMatrix*>& features, const std::vector<const GMatrix*>& labels, size_t window, std::vector<GMatrix*>* pOutputs)
+{
+	size_t length = 0;
+	for(size_t i = 0; i < features.size(); i++)
+		length = std::max(length, features[i]->rows());
+	GMatrix in(features.size(), features[0]->cols());
+	std::vector<bool> active(features.size());
+	double sse = 0.0;
+	ctx.resetState();
+	for(size_t t = 0; t < length; t++)
+	{
+		if(t % window == 0)
+			ctx.beginWindow();
+		for(size_t i = 0; i < features.size(); i++)
+		{
+			active[i] = (t < features[i]->rows());
+			if(active[i])
+				in[i].copy((*features[i])[t]);
+			else
+				in[i].fill(1e6); // The padding should have no effect
+		}
+		const GMatrix& out = ctx.forwardProp(in, active);
+		for(size_t i = 0; i < features.size(); i++)
+		{
+			if(!active[i])
+				continue;
+			sse += out[i].squaredDistance((*labels[i])[t]);
+			if(pOutputs)
+				(*(*pOutputs)[i])[t].copy(out[i]);
+		}
+	}
+	return 0.5 * sse;
+}
+
+void GNeuralNet_testSequenceBatch(GRand& prng)
+{
+	size_t lengths[] = { 5, 3, 4 };
+	size_t sequences = sizeof(lengths) / sizeof(lengths[0]);
+	for(size_t type = 0; type < 2; type++)
+	{
+		GNeuralNet nn;
+		nn.add(new GBlockLinear(3), new GBlockTanh());
+		if(type == 0)
+			nn.add(new GBlockLSTM(3));
+		else
+			nn.add(new GBlockGRU(3));
+		nn.add(new GBlockLinear(2));
+		nn.init(2, 2, prng);
+		nn.perturbWeights(prng, 0.5);
+		std::vector<std::unique_ptr<GMatrix> > hMatrices;
+		std::vector<const GMatrix*> features;
+		std::vector<const GMatrix*> labels;
+		std::vector<GMatrix*> outputs;
+		for(size_t i = 0; i < sequences; i++)
+		{
+			GMatrix* pF = new GMatrix(lengths[i], 2);
+			hMatrices.emplace_back(pF);
+			pF->fillUniform(prng, -1.0, 1.0);
+			features.push_back(pF);
+			GMatrix* pL = new GMatrix(lengths[i], 2);
+			hMatrices.emplace_back(pL);
+			pL->fillUniform(prng, -1.0, 1.0);
+			labels.push_back(pL);
+			outputs.push_back(new GMatrix(lengths[i], 2));
+			hMatrices.emplace_back(outputs.back());
+		}
+		GContextSequenceBatch ctx(prng, nn, sequences);
+
+		// The masked batch should produce the same outputs as each sequence by itself, with or without truncation
+		GContextNeuralNet* pCtx = nn.newContext(prng);
+		std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+		size_t windows[] = { 5, 2 };
+		for(size_t w = 0; w < 2; w++)
+		{
+			GNeuralNet_sequenceError(ctx, features, labels, windows[w], &outputs);
+			for(size_t i = 0; i < sequences; i++)
+			{
+				pCtx->resetState();
+				for(size_t t = 0; t < lengths[i]; t++)
+				{
+					nn.forwardProp(*pCtx, (*features[i])[t], pCtx->predBuf());
+					if(pCtx->predBuf().squaredDistance((*outputs[i])[t]) > 1e-20)
+						throw Ex("Batched sequences disagree with single sequences in ", nn.layer(2).block(0).name());
+				}
+			}
+		}
+
+		// Check the gradient of a whole window against finite differences
+		GVec gradient(nn.weightCount());
+		gradient.fill(0.0);
+		GNeuralNet_sequenceError(ctx, features, labels, 5, NULL);
+		GMatrix blame(sequences, 2);
+		for(size_t t = 5; t-- > 0; )
+		{
+			for(size_t i = 0; i < sequences; i++)
+			{
+				if(t < lengths[i])
+				{
+					blame[i].copy((*labels[i])[t]);
+					blame[i] -= ctx.output(t)[i];
+				}
+				else
+					blame[i].fill(0.0);
+			}
+			ctx.backProp(t, blame, gradient);
+		}
+		GVec weights(nn.weightCount());
+		nn.weightsToVector(weights.data());
+		double epsilon = 1e-6;
+		for(size_t j = 0; j < weights.size(); j++)
+		{
+			double w = weights[j];
+			weights[j] = w + epsilon;
+			nn.vectorToWeights(weights.data());
+			double errPlus = GNeuralNet_sequenceError(ctx, features, labels, 5, NULL);
+			weights[j] = w - epsilon;
+			nn.vectorToWeights(weights.data());
+			double errMinus = GNeuralNet_sequenceError(ctx, features, labels, 5, NULL);
+			weights[j] = w;
+			double expected = (errMinus - errPlus) / (2.0 * epsilon);
+			if(std::abs(gradient[j] - expected) > 1e-6 * std::max(1.0, std::abs(expected)))
+				throw Ex("The gradient of weight ", to_str(j), " in ", nn.layer(2).block(0).name(), " is ", to_str(gradient[j]), ", but finite differences say ", to_str(expected));
+		}
+		nn.vectorToWeights(weights.data());
+
+		// Train to output the previous input with truncated windows
+		GSGDOptimizer optimizer(nn, prng);
+		optimizer.setLearningRate(0.1);
+		for(size_t i = 0; i < sequences; i++)
+		{
+			GMatrix* pL = (GMatrix*)labels[i];
+			pL->fill(0.0);
+			for(size_t t = 1; t < lengths[i]; t++)
+				(*pL)[t].copy((*features[i])[t - 1]);
+		}
+		double before = GNeuralNet_sequenceError(ctx, features, labels, 5, NULL);
+		for(size_t iter = 0; iter < 300; iter++)
+			optimizer.optimizeSequences(features, labels, 2);
+		double after = GNeuralNet_sequenceError(ctx, features, labels, 5, NULL);
+		if(after > 0.5 * before)
+			throw Ex("Training with truncated windows did not reduce the error enough in ", nn.layer(2).block(0).name(), ": ", to_str(before), " -> ", to_str(after));
+	}
+}
+
 /*
 #define NN_TEST_DIMS 5
 
@@ -1707,6 +2661,11 @@ void GNeuralNetLearner::test()
 	GNeuralNet_testBinaryClassification(&prng);
 	GNeuralNet_testNormalizeInput(prng);
 	GNeuralNet_testTransformWeights(prng);
+	GNeuralNet_testBatch(prng);
+	GNeuralNet_testSinglePrecision(prng);
+	GNeuralNet_testQuantize(prng);
+	GNeuralNet_testConvolutionAlgorithms(prng);
+	GNeuralNet_testSequenceBatch(prng);
 //	GNeuralNet_testConvolutionalLayer2D(prng);
 //	GNeuralNet_testInvertAndSwap(prng);
 //	GNeuralNet_testCompressFeatures(prng);
@@ -115,6 +115,15 @@ public:
 	/// Updates the gradient for the layer that was used to construct this object.
 	void updateGradient(GContextLayer& ctx, const GVec& input, const GVec& outBlame, GVec &gradient) const;
 
+	/// Feeds a batch of inputs (one sample per row) forward through this layer.
+	void forwardPropBatch(GContextLayer& ctx, const GMatrix& input, GMatrix& output) const;
+
+	/// Backpropagates a batch of blame rows through this layer.
+	void backPropBatch(GContextLayer& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const;
+
+	/// Adds the gradient, summed over every row in the batch, to gradient.
+	void updateGradientBatch(GContextLayer& ctx, const GMatrix& input, const GMatrix& outBlame, GVec &gradient) const;
+
 	/// Take a step to descend the gradient by updating the weights.
 	void step(double learningRate, const GVec &gradient);
 };
@@ -134,7 +143,10 @@ public:
 	const GLayer& m_layer;
 	GVec m_activation;
 	GVec m_blame;
+	GMatrix m_activationBatch;
+	GMatrix m_blameBatch;
 	std::vector<GContextRecurrent*> m_recurrents;
+	std::vector<GContextRecurrentBatch*> m_recurrentBatches; // Only allocated by beginSequences
 	std::vector<GContextNeuralNet*> m_components;
 
 protected:
@@ -145,6 +157,15 @@ public:
 
 	/// See the comment for GContext::resetState.
 	virtual void resetState() override;
+
+	/// Ensures that the batch buffers have the specified number of rows.
+	/// (They are only reallocated when the batch size changes.)
+	void resizeBatch(size_t rows);
+
+	/// Prepares the recurrent blocks in this layer to propagate the specified number of
+	/// sequences in lockstep with forwardPropBatch, and sets them to the starting state.
+	/// (This is called by GContextSequenceBatch.)
+	void beginSequences(size_t sequences);
 };
 
 
@@ -161,6 +182,7 @@ class GNeuralNet : public GBlock
 protected:
 	size_t m_weightCount;
 	std::vector<GLayer*> m_layers;
+	bool m_singlePrecision;
 
 public:
 	GNeuralNet();
@@ -209,6 +231,32 @@ public:
 	GLayer& outputLayer() { return *m_layers[m_layers.size() - 1]; }
 	const GLayer& outputLayer() const { return *m_layers[m_layers.size() - 1]; }
 
+	/// Specifies whether every block in this network (including blocks added later, and blocks
+	/// in embedded networks) should propagate with single-precision copies of its weights.
+	/// This can be applied to a deserialized model to convert it, and is preserved by serialize.
+	virtual void setSinglePrecision(bool single) override;
+
+	/// Returns true iff this network was put in single-precision mode.
+	virtual bool singlePrecision() const override { return m_singlePrecision; }
+
+	/// Prepares this network for fast inference by quantizing the weights of its linear and
+	/// convolutional blocks to int8 (post-training quantization). sample should be representative
+	/// of the inputs the network will see. It is propagated layer by layer, through the already
+	/// quantized layers, to measure the range of the inputs to each block. The int8 weights are
+	/// serialized with the model. Recurrent networks are not supported.
+	void quantize(const GMatrix& sample);
+
+	/// Discards the int8 weights of every block.
+	virtual void dequantize() override;
+
+	/// Returns true iff any block in this network forward-propagates with int8 weights.
+	virtual bool quantized() const override;
+
+	/// Returns true iff any layer of this network, or of any network embedded within it,
+	/// contains a recurrent block. (The state of recurrent blocks carries over from one
+	/// sample to the next, so such networks must process samples one at a time, in order.)
+	bool containsRecurrentBlocks() const;
+
 	/// Returns a string representation of this object
 	virtual std::string to_str() const override;
 
@@ -335,6 +383,17 @@ public:
 
 	/// Updates the gradient.
 	virtual void updateGradient(GContext& ctx, const GVec &x, const GVec& outBlame, GVec& inBlame) const override;
+
+	/// Evaluates a batch of inputs (one sample per row), computes the corresponding rows of output.
+	virtual void forwardPropBatch(GContext& ctx, const GMatrix& input, GMatrix& output) const override;
+
+	/// Evaluates a batch of outBlame rows, computes the corresponding rows of inBlame.
+	/// As a special case, if &inBlame == &outBlame, then inBlame will not be computed.
+	virtual void backPropBatch(GContext& ctx, const GMatrix& input, const GMatrix& output, const GMatrix& outBlame, GMatrix& inBlame) const override;
+
+	/// Adds the gradient, summed over every row in the batch, to gradient.
+	/// (Assumes forwardPropBatch and backPropBatch were just called with this context.)
+	virtual void updateGradientBatch(GContext& ctx, const GMatrix& input, const GMatrix& outBlame, GVec& gradient) const override;
 };
 
 
@@ -374,6 +433,58 @@ public:
 
 
 
+/// Propagates a batch of sequences through a GNeuralNet in lockstep. Each call to forwardProp
+/// advances every sequence one step, so the recurrent blocks evaluate their gates for all of
+/// the sequences with batch products. Row i of every matrix belongs to sequence i.
+/// Training uses truncated backpropagation through time: call beginWindow, forwardProp each
+/// step of the window, then backProp each step in reverse order. The recurrent state carries
+/// from one window to the next. Only recurrent blocks in the top-level layers are supported.
+class GContextSequenceBatch : public GContext
+{
+protected:
+	const GNeuralNet& m_nn;
+	GContextNeuralNet* m_pContext;
+	size_t m_sequences;
+	size_t m_steps; // The number of steps in the current window
+	std::vector<GMatrix*> m_inputs; // m_inputs[step] holds the input at a step of the current window
+	std::vector<GMatrix*> m_activations; // m_activations[step * layerCount + layer] holds the output of a layer at a step
+	std::vector<GMatrix*> m_blames; // m_blames[layer] holds the blame on the output of a layer at the step being backpropagated
+	GMatrix m_inBlame;
+
+public:
+	GContextSequenceBatch(GRand& rand, const GNeuralNet& nn, size_t sequences);
+	virtual ~GContextSequenceBatch();
+
+	/// Returns the number of sequences that propagate together
+	size_t sequences() const { return m_sequences; }
+
+	/// Returns the number of steps in the current window
+	size_t steps() const { return m_steps; }
+
+	/// Sets every sequence to the starting state, and begins a new window.
+	virtual void resetState() override;
+
+	/// Begins a new window of truncated backpropagation through time. The recurrent state
+	/// reached at the end of the previous window is kept, but blame will not flow back into it.
+	void beginWindow();
+
+	/// Advances the sequences one step, and returns the output of the network.
+	/// Only the sequences marked in active advance. (Pass any values in the other rows of input.)
+	const GMatrix& forwardProp(const GMatrix& input, const std::vector<bool>& active);
+
+	/// Returns the output of the network at the specified step of the current window.
+	const GMatrix& output(size_t step) const { return *m_activations[step * m_pContext->layerCount() + m_pContext->layerCount() - 1]; }
+
+	/// Backpropagates outBlame from the output at the specified step, and adds the gradient of
+	/// that step to gradient. Steps must be visited in reverse order, starting with the last one.
+	/// (The rows of outBlame for sequences that were not active at the step should be zero.)
+	void backProp(size_t step, const GMatrix& outBlame, GVec& gradient);
+};
+
+
+
+
+
 /// A thin wrapper around a GNeuralNet that implements the GIncrementalLearner interface.
 class GNeuralNetLearner : public GIncrementalLearner
 {
@@ -410,6 +521,11 @@ public:
 	/// See the comment for GSupervisedLearner::predict
 	virtual void predict(const GVec& in, GVec& out) override;
 
+	/// Forward-propagates blocks of rows through the network with GNeuralNet::forwardPropBatch,
+	/// one context per thread. If the network contains recurrent blocks, the rows are
+	/// predicted one at a time, in order, because each prediction advances the recurrent state.
+	virtual void predictBatch(const GMatrix& in, GMatrix& out) override;
+
 #ifndef MIN_PREDICT
 	/// See the comment for GSupervisedLearner::predictDistribution
 	virtual void predictDistribution(const GVec& in, GPrediction* pOut) override;
@@ -21,8 +21,10 @@
 #include "GNeuralNet.h"
 #include "GVec.h"
 #include "GRand.h"
+#include "GThread.h"
 #include <string.h>
 #include <math.h>
+#include <memory>
 
 namespace GClasses {
 
@@ -88,11 +90,18 @@ GNeuralNetOptimizer::GNeuralNetOptimizer(GNeuralNet& model, GRand& rand, GObject
   m_model(model),
   m_pContext(nullptr),
   m_rand(rand),
-  m_batchSize(1), m_batchesPerEpoch(INVALID_INDEX), m_epochs(100), m_windowSize(100), m_minImprovement(0.002), m_learningRate(0.05)
+  m_batchSize(1), m_batchesPerEpoch(INVALID_INDEX), m_epochs(100), m_windowSize(100), m_minImprovement(0.002), m_learningRate(0.05),
+  m_batchThreads(1),
+  m_pSequenceContext(nullptr)
 {}
 
 GNeuralNetOptimizer::~GNeuralNetOptimizer()
 {
+	for(size_t i = 0; i < m_batchContexts.size(); i++)
+		delete(m_batchContexts[i]);
+	for(size_t i = 0; i < m_batchRands.size(); i++)
+		delete(m_batchRands[i]);
+	delete(m_pSequenceContext);
 	delete(m_pContext);
 	delete(m_objective);
 }
@@ -120,11 +129,95 @@ void GNeuralNetOptimizer::optimizeIncremental(const GVec &feat, const GVec &lab)
 	descendGradient(m_learningRate);
 }
 
+// virtual
+void GNeuralNetOptimizer::accumulateBatchGradient(const GVec& sum, size_t count)
+{
+	throw Ex("This optimizer does not implement accumulateBatchGradient");
+}
+
+bool GNeuralNetOptimizer::useBatchGradient(size_t batchSize) const
+{
+	return m_batchThreads > 1 && batchSize > 1 && accumulatesBatchGradients() && !m_model.containsRecurrentBlocks();
+}
+
+// Resizes m unless it already has the specified shape
+static void GNeuralNetOptimizer_fit(GMatrix& m, size_t rows, size_t cols)
+{
+	if(m.rows() != rows || m.cols() != cols)
+		m.resize(rows, cols);
+}
+
+void GNeuralNetOptimizer::computeBatchGradient(const GMatrix& features, const GMatrix& labels, const std::vector<size_t>& rows)
+{
+	GContextNeuralNet& ctx0 = context(); // makes sure the optimizer's own buffers are allocated
+	size_t slices = std::max((size_t)1, std::min(m_batchThreads, rows.size()));
+	while(m_batchContexts.size() + 1 < slices)
+	{
+		m_batchRands.push_back(new GRand(m_rand.next()));
+		m_batchContexts.push_back(m_model.newContext(*m_batchRands.back()));
+	}
+	while(m_batchGradients.size() < slices)
+	{
+		m_batchGradients.emplace_back(m_model.weightCount());
+		m_batchInputs.emplace_back();
+		m_batchPredictions.emplace_back();
+		m_batchBlames.emplace_back();
+	}
+
+	// Each slice propagates its rows together with its own context, and accumulates its own gradient.
+	// (The first slice uses the optimizer's own context, so a single slice needs no extra contexts.)
+	size_t outputs = m_model.outputLayer().outputs();
+	GThreadPool& pool = GThreadPool::global();
+	pool.parallelFor(0, slices, [&](size_t k)
+	{
+		GContextNeuralNet& ctx = (k == 0 ? ctx0 : *m_batchContexts[k - 1]);
+		size_t begin = k * rows.size() / slices;
+		size_t count = (k + 1) * rows.size() / slices - begin;
+		GMatrix& x = m_batchInputs[k];
+		GMatrix& pred = m_batchPredictions[k];
+		GMatrix& blame = m_batchBlames[k];
+		GNeuralNetOptimizer_fit(x, count, features.cols());
+		GNeuralNetOptimizer_fit(pred, count, outputs);
+		GNeuralNetOptimizer_fit(blame, count, outputs);
+		for(size_t i = 0; i < count; i++)
+			x[i].copy(features[rows[begin + i]]);
+		m_model.forwardPropBatch(ctx, x, pred);
+		for(size_t i = 0; i < count; i++)
+			m_objective->calculateOutputLayerBlame(pred[i], labels[rows[begin + i]], blame[i]);
+		m_model.backPropBatch(ctx, x, pred, blame, blame); // The last two parameters are deliberately the same, indicating not to compute the input blame
+		GVec& gradient = m_batchGradients[k];
+		gradient.fill(0.0);
+		m_model.updateGradientBatch(ctx, x, blame, gradient);
+	}, slices);
+
+	// Sum the slice gradients pairwise. Each round halves the number of partial sums.
+	for(size_t stride = 1; stride < slices; stride *= 2)
+	{
+		pool.parallelFor(0, (slices + 2 * stride - 1) / (2 * stride), [&](size_t pair)
+		{
+			size_t a = pair * 2 * stride;
+			if(a + stride < slices)
+				m_batchGradients[a] += m_batchGradients[a + stride];
+		}, slices);
+	}
+	accumulateBatchGradient(m_batchGradients[0], rows.size());
+}
+
 void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &labels, size_t start, size_t batchSize)
 {
 	GAssert(features.cols() == m_model.layer(0).inputs() && labels.cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
-	for(size_t i = 0; i < batchSize; ++i)
-		computeGradient(features[start + i], labels[start + i]);
+	if(useBatchGradient(batchSize))
+	{
+		m_batchRows.resize(batchSize);
+		for(size_t i = 0; i < batchSize; ++i)
+			m_batchRows[i] = start + i;
+		computeBatchGradient(features, labels, m_batchRows);
+	}
+	else
+	{
+		for(size_t i = 0; i < batchSize; ++i)
+			computeGradient(features[start + i], labels[start + i]);
+	}
 	descendGradient(m_learningRate / batchSize);
 }
 
@@ -137,10 +230,23 @@ void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &
 {
 	GAssert(features.cols() == m_model.layer(0).inputs() && labels.cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
 	size_t j;
-	for(size_t i = 0; i < batchSize; ++i)
+	if(useBatchGradient(batchSize))
+	{
+		m_batchRows.resize(batchSize);
+		for(size_t i = 0; i < batchSize; ++i)
+		{
+			if(!ii.next(j)) ii.reset(), ii.next(j);
+			m_batchRows[i] = j;
+		}
+		computeBatchGradient(features, labels, m_batchRows);
+	}
+	else
 	{
-		if(!ii.next(j)) ii.reset(), ii.next(j);
-		computeGradient(features[j], labels[j]);
+		for(size_t i = 0; i < batchSize; ++i)
+		{
+			if(!ii.next(j)) ii.reset(), ii.next(j);
+			computeGradient(features[j], labels[j]);
+		}
 	}
 	descendGradient(m_learningRate / batchSize);
 }
@@ -150,6 +256,76 @@ void GNeuralNetOptimizer::optimizeBatch(const GMatrix &features, const GMatrix &
 	optimizeBatch(features, labels, ii, m_batchSize);
 }
 
+void GNeuralNetOptimizer::optimizeSequences(const std::vector<const GMatrix*>& features, const std::vector<const GMatrix*>& labels, size_t window)
+{
+	if(features.size() == 0 || features.size() != labels.size())
+		throw Ex("Expected the same number of feature and label sequences");
+	size_t sequences = features.size();
+	size_t length = 0;
+	for(size_t i = 0; i < sequences; i++)
+	{
+		if(features[i]->rows() != labels[i]->rows())
+			throw Ex("Sequence ", to_str(i), " has ", to_str(features[i]->rows()), " rows of features, but ", to_str(labels[i]->rows()), " rows of labels");
+		GAssert(features[i]->cols() == m_model.layer(0).inputs() && labels[i]->cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
+		length = std::max(length, features[i]->rows());
+	}
+	if(window == 0)
+		window = length;
+	if(!accumulatesBatchGradients())
+		throw Ex("optimizeSequences requires an optimizer that implements accumulateBatchGradient");
+	context(); // makes sure the optimizer's own buffers are allocated
+	if(!m_pSequenceContext || m_pSequenceContext->sequences() != sequences)
+	{
+		delete(m_pSequenceContext);
+		m_pSequenceContext = new GContextSequenceBatch(m_rand, m_model, sequences);
+		m_sequenceGradient.resize(m_model.weightCount());
+	}
+	GContextSequenceBatch& ctx = *m_pSequenceContext;
+	ctx.resetState();
+	GMatrix in(sequences, m_model.layer(0).inputs());
+	GMatrix blame(sequences, m_model.outputLayer().outputs());
+	std::vector<bool> active(sequences);
+	for(size_t start = 0; start < length; start += window)
+	{
+		// Propagate all of the sequences through the window together
+		size_t end = std::min(length, start + window);
+		ctx.beginWindow();
+		for(size_t t = start; t < end; t++)
+		{
+			for(size_t i = 0; i < sequences; i++)
+			{
+				active[i] = (t < features[i]->rows());
+				if(active[i])
+					in[i].copy((*features[i])[t]);
+				else
+					in[i].fill(0.0);
+			}
+			ctx.forwardProp(in, active);
+		}
+
+		// Backpropagate from the last step of the window to the first
+		size_t count = 0;
+		m_sequenceGradient.fill(0.0);
+		for(size_t t = end; t-- > start; )
+		{
+			const GMatrix& pred = ctx.output(t - start);
+			for(size_t i = 0; i < sequences; i++)
+			{
+				if(t < labels[i]->rows())
+				{
+					m_objective->calculateOutputLayerBlame(pred[i], (*labels[i])[t], blame[i]);
+					count++;
+				}
+				else
+					blame[i].fill(0.0);
+			}
+			ctx.backProp(t - start, blame, m_sequenceGradient);
+		}
+		accumulateBatchGradient(m_sequenceGradient, count);
+		descendGradient(m_learningRate / count);
+	}
+}
+
 void GNeuralNetOptimizer::optimize(const GMatrix &features, const GMatrix &labels)
 {
 	GAssert(features.cols() == m_model.layer(0).inputs() && labels.cols() == m_model.outputLayer().outputs(), "Features/labels size mismatch!");
@@ -222,6 +398,214 @@ double GNeuralNetOptimizer::sumLoss(const GMatrix &features, const GMatrix &labe
 	return sum;
 }
 
+#ifndef MIN_PREDICT
+void GNeuralNetOptimizer_testMakeData(GRand& rand, GMatrix& features, GMatrix& labels)
+{
+	features.resize(60, 3);
+	labels.resize(60, 2);
+	for(size_t i = 0; i < features.rows(); i++)
+	{
+		for(size_t j = 0; j < 3; j++)
+			features[i][j] = rand.normal();
+		labels[i][0] = tanh(features[i][0] - 0.5 * features[i][1]);
+		labels[i][1] = 0.3 * features[i][2] * features[i][0];
+	}
+}
+
+void GNeuralNetOptimizer_testMakeNet(GNeuralNet& nn, GRand& rand)
+{
+	nn.add(new GBlockLinear(6), new GBlockTanh(), new GBlockLinear(2));
+	nn.init(3, 2, rand);
+}
+
+double GNeuralNetOptimizer_testMaxDiff(const GNeuralNet& a, const GNeuralNet& b)
+{
+	GVec wa(a.weightCount());
+	GVec wb(b.weightCount());
+	a.weightsToVector(wa.data());
+	b.weightsToVector(wb.data());
+	double d = 0.0;
+	for(size_t i = 0; i < wa.size(); i++)
+		d = std::max(d, fabs(wa[i] - wb[i]));
+	return d;
+}
+
+// Plain stochastic gradient descent that only implements the per-sample interface
+class GNeuralNetOptimizerTestSGD : public GNeuralNetOptimizer
+{
+public:
+	GVec m_gradient;
+
+	GNeuralNetOptimizerTestSGD(GNeuralNet& model, GRand& rand) : GNeuralNetOptimizer(model, rand) {}
+
+	virtual void prepareForOptimizing() override
+	{
+		m_gradient.resize(m_model.weightCount());
+		m_gradient.fill(0.0);
+	}
+
+	virtual void computeGradient(const GVec& feat, const GVec& lab) override
+	{
+		GContextNeuralNet& ctx = context();
+		m_model.forwardProp_training(ctx, feat, ctx.predBuf());
+		m_objective->calculateOutputLayerBlame(ctx.predBuf(), lab, ctx.blameBuf());
+		m_model.backProp(ctx, feat, ctx.predBuf(), ctx.blameBuf(), ctx.blameBuf());
+		m_model.updateGradient(ctx, feat, ctx.blameBuf(), m_gradient);
+	}
+
+	virtual void descendGradient(double learningRate) override
+	{
+		m_model.step(learningRate, m_gradient);
+		m_gradient.fill(0.0);
+	}
+};
+
+// static
+void GNeuralNetOptimizer::test()
+{
+	GRand rand(0);
+	GMatrix features, labels;
+	GNeuralNetOptimizer_testMakeData(rand, features, labels);
+
+	// With full momentum and a fresh gradient, the serial and data-parallel batch gradients are both the sum over the batch
+	GNeuralNet serialNet;
+	GNeuralNetOptimizer_testMakeNet(serialNet, rand);
+	GNeuralNet parallelNet;
+	GNeuralNetOptimizer_testMakeNet(parallelNet, rand);
+	parallelNet.copyWeights(&serialNet);
+	GSGDOptimizer serial(serialNet, rand);
+	serial.setMomentum(1.0);
+	serial.optimizeBatch(features, labels, 0, 24);
+	GSGDOptimizer parallel(parallelNet, rand);
+	parallel.setMomentum(1.0);
+	parallel.setBatchThreads(5);
+	parallel.optimizeBatch(features, labels, 0, 24);
+	if(GNeuralNetOptimizer_testMaxDiff(serialNet, parallelNet) > 1e-9)
+		throw Ex("Data-parallel batch gradient does not match the serial one");
+
+	// Propagating the batch all at once gives the same gradient as computing it one sample at a time
+	GNeuralNet batchNet, sampleNet;
+	GNeuralNetOptimizer_testMakeNet(batchNet, rand);
+	GNeuralNetOptimizer_testMakeNet(sampleNet, rand);
+	sampleNet.copyWeights(&batchNet);
+	GSGDOptimizer batchOpt(batchNet, rand);
+	batchOpt.setMomentum(1.0);
+	batchOpt.setBatchThreads(2);
+	GSGDOptimizer sampleOpt(sampleNet, rand);
+	sampleOpt.setMomentum(1.0);
+	for(size_t i = 0; i + 20 <= features.rows(); i += 20)
+	{
+		batchOpt.optimizeBatch(features, labels, i, 20);
+		for(size_t j = i; j < i + 20; j++)
+			sampleOpt.computeGradient(features[j], labels[j]);
+		sampleOpt.descendGradient(sampleOpt.learningRate() / 20);
+	}
+	if(GNeuralNetOptimizer_testMaxDiff(batchNet, sampleNet) > 1e-9)
+		throw Ex("The batch gradient does not match the per-sample one");
+
+	// By default, every optimizer still folds its batches in one sample at a time
+	for(size_t kind = 0; kind < 3; kind++)
+	{
+		GNeuralNet defNet, refNet;
+		GNeuralNetOptimizer_testMakeNet(defNet, rand);
+		GNeuralNetOptimizer_testMakeNet(refNet, rand);
+		refNet.copyWeights(&defNet);
+		std::unique_ptr<GNeuralNetOptimizer> hDef, hRef;
+		if(kind == 0)
+		{
+			GSGDOptimizer* pDef = new GSGDOptimizer(defNet, rand);
+			pDef->setMomentum(0.9);
+			hDef.reset(pDef);
+			GSGDOptimizer* pRef = new GSGDOptimizer(refNet, rand);
+			pRef->setMomentum(0.9);
+			hRef.reset(pRef);
+		}
+		else if(kind == 1)
+		{
+			hDef.reset(new GAdamOptimizer(defNet, rand));
+			hRef.reset(new GAdamOptimizer(refNet, rand));
+		}
+		else
+		{
+			hDef.reset(new GRMSPropOptimizer(defNet, rand));
+			hRef.reset(new GRMSPropOptimizer(refNet, rand));
+		}
+		for(size_t i = 0; i + 20 <= features.rows(); i += 20)
+		{
+			hDef->optimizeBatch(features, labels, i, 20);
+			for(size_t j = i; j < i + 20; j++)
+				hRef->computeGradient(features[j], labels[j]);
+			hRef->descendGradient(hRef->learningRate() / 20);
+		}
+		if(GNeuralNetOptimizer_testMaxDiff(defNet, refNet) != 0.0)
+			throw Ex("The default batch update does not match the per-sample one");
+	}
+
+	// An optimizer without accumulateBatchGradient still gets its batches one sample at a time
+	GNeuralNet plainNet, loopNet;
+	GNeuralNetOptimizer_testMakeNet(plainNet, rand);
+	GNeuralNetOptimizer_testMakeNet(loopNet, rand);
+	loopNet.copyWeights(&plainNet);
+	GNeuralNetOptimizerTestSGD plainOpt(plainNet, rand);
+	plainOpt.setBatchThreads(4);
+	GNeuralNetOptimizerTestSGD loopOpt(loopNet, rand);
+	for(size_t i = 0; i + 20 <= features.rows(); i += 20)
+	{
+		plainOpt.optimizeBatch(features, labels, i, 20);
+		for(size_t j = i; j < i + 20; j++)
+			loopOpt.computeGradient(features[j], labels[j]);
+		loopOpt.descendGradient(loopOpt.learningRate() / 20);
+	}
+	if(GNeuralNetOptimizer_testMaxDiff(plainNet, loopNet) != 0.0)
+		throw Ex("The per-sample fallback does not match calling computeGradient");
+
+	// The number of slices only changes the order of the summation
+	GNeuralNet a, b;
+	GNeuralNetOptimizer_testMakeNet(a, rand);
+	GNeuralNetOptimizer_testMakeNet(b, rand);
+	b.copyWeights(&a);
+	GSGDOptimizer optA(a, rand);
+	optA.setBatchThreads(2);
+	GSGDOptimizer optB(b, rand);
+	optB.setBatchThreads(7);
+	for(size_t i = 0; i + 20 <= features.rows(); i += 20)
+	{
+		optA.optimizeBatch(features, labels, i, 20);
+		optB.optimizeBatch(features, labels, i, 20);
+	}
+	if(GNeuralNetOptimizer_testMaxDiff(a, b) > 1e-9)
+		throw Ex("Data-parallel batch gradients depend on the number of slices");
+
+	// Every optimizer should still make progress in data-parallel mode
+	for(size_t kind = 0; kind < 3; kind++)
+	{
+		GNeuralNet nn;
+		GNeuralNetOptimizer_testMakeNet(nn, rand);
+		GNeuralNetOptimizer* pOpt;
+		if(kind == 0)
+			pOpt = new GSGDOptimizer(nn, rand);
+		else if(kind == 1)
+			pOpt = new GAdamOptimizer(nn, rand);
+		else
+			pOpt = new GRMSPropOptimizer(nn, rand);
+		std::unique_ptr<GNeuralNetOptimizer> hOpt(pOpt);
+		pOpt->setBatchThreads(4);
+		pOpt->setBatchSize(10);
+		pOpt->setLearningRate(kind == 0 ? 0.05 : 0.01);
+		pOpt->optimizeBatch(features, labels, 0, 10);
+		double before = pOpt->sumLoss(features, labels);
+		for(size_t epoch = 0; epoch < 60; epoch++)
+		{
+			for(size_t i = 0; i + 10 <= features.rows(); i += 10)
+				pOpt->optimizeBatch(features, labels, i, 10);
+		}
+		double after = pOpt->sumLoss(features, labels);
+		if(after > 0.5 * before)
+			throw Ex("Data-parallel training did not reduce the loss. Before: ", to_str(before), ", after: ", to_str(after));
+	}
+}
+#endif // MIN_PREDICT
+
 
 
 
@@ -256,6 +640,12 @@ void GSGDOptimizer::descendGradient(double learningRate)
 	m_model.step(learningRate, m_gradient);
 }
 
+void GSGDOptimizer::accumulateBatchGradient(const GVec& sum, size_t count)
+{
+	m_gradient *= m_momentum;
+	m_gradient += sum;
+}
+
 
 
 
@@ -278,6 +668,8 @@ void GAdamOptimizer::prepareForOptimizing()
 	m_deltas.resize(m_gradient.size());
 	m_sqdeltas.resize(m_gradient.size());
 	m_gradient.fill(0.0);
+	m_deltas.fill(0.0);
+	m_sqdeltas.fill(0.0);
 }
 
 void GAdamOptimizer::computeGradient(const GVec& feat, const GVec& lab)
@@ -299,6 +691,22 @@ void GAdamOptimizer::computeGradient(const GVec& feat, const GVec& lab)
 	}
 }
 
+void GAdamOptimizer::accumulateBatchGradient(const GVec& sum, size_t count)
+{
+	// The moments are updated once with the mean gradient of the batch
+	double scale = 1.0 / count;
+	m_correct1 *= m_beta1;
+	m_correct2 *= m_beta2;
+	for(size_t i = 0; i < sum.size(); i++)
+	{
+		double g = scale * sum[i];
+		m_deltas[i] *= m_beta1;
+		m_deltas[i] += (1.0 - m_beta1) * g;
+		m_sqdeltas[i] *= m_beta2;
+		m_sqdeltas[i] += (1.0 - m_beta2) * (g * g);
+	}
+}
+
 void GAdamOptimizer::descendGradient(double learningRate)
 {
 	double alpha1 = 1.0 / (1.0 - m_correct1);
@@ -341,6 +749,12 @@ void GRMSPropOptimizer::computeGradient(const GVec& feat, const GVec& lab)
 	m_model.updateGradient(ctx, feat, ctx.blameBuf(), m_gradient);
 }
 
+void GRMSPropOptimizer::accumulateBatchGradient(const GVec& sum, size_t count)
+{
+	m_gradient *= m_momentum;
+	m_gradient += sum;
+}
+
 void GRMSPropOptimizer::descendGradient(double learningRate)
 {
 	for(size_t i = 0; i < m_meanSquare.size(); ++i)
@@ -32,6 +32,7 @@ class GAction;
 class GRand;
 class GNeuralNet;
 class GContextNeuralNet;
+class GContextSequenceBatch;
 
 
 /// A loss function used to train a differentiable function.
@@ -88,10 +89,29 @@ protected:
 	double m_minImprovement;
 	double m_learningRate;
 
+	// buffers for batches (one of each per slice, except that the first slice uses m_pContext)
+	size_t m_batchThreads;
+	std::vector<GRand*> m_batchRands;
+	std::vector<GContextNeuralNet*> m_batchContexts;
+	std::vector<GVec> m_batchGradients;
+	std::vector<GMatrix> m_batchInputs;
+	std::vector<GMatrix> m_batchPredictions;
+	std::vector<GMatrix> m_batchBlames;
+	std::vector<size_t> m_batchRows;
+
+	// buffers for batches of sequences
+	GContextSequenceBatch* m_pSequenceContext;
+	GVec m_sequenceGradient;
+
 public:
 	GNeuralNetOptimizer(GNeuralNet& model, GRand& rand, GObjective* objective = NULL);
 	virtual ~GNeuralNetOptimizer();
 
+#ifndef MIN_PREDICT
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif // MIN_PREDICT
+
 	/// Returns the default context for training the model.
 	/// (Note: It is allocated lazily. This should not be called before layers are added to the model.
 	/// For multi-threaded optimization, a separate context should be allocated for each thread.)
@@ -120,6 +140,14 @@ public:
 	/// Update and apply the gradient for a single batch in randomized order.
 	virtual void optimizeBatch(const GMatrix &features, const GMatrix &labels, GRandomIndexIterator &ii, size_t batchSize);
 	void optimizeBatch(const GMatrix &features, const GMatrix &labels, GRandomIndexIterator &ii);
+
+	/// Trains with truncated backpropagation through time on a batch of sequences. Sequence i
+	/// consists of the rows of *features[i] and *labels[i]. All of the sequences advance in
+	/// lockstep, so the recurrent blocks evaluate their gates for the whole batch at once.
+	/// Sequences that are shorter than the longest one are masked after they end. The weights
+	/// step once per window of the specified number of steps, and the recurrent state carries
+	/// from one window to the next. (If window is 0, each sequence is one window.)
+	void optimizeSequences(const std::vector<const GMatrix*>& features, const std::vector<const GMatrix*>& labels, size_t window);
 	
 	// convenience training methods
 	
@@ -154,6 +182,39 @@ public:
 
 	void setLearningRate(double l) { m_learningRate = l; }
 	double learningRate() const { return m_learningRate; }
+
+	/// Specifies to compute the gradient of each batch in a data-parallel manner. The batch is
+	/// divided into this many contiguous slices. Each slice is evaluated on the global thread pool
+	/// with its own context and gradient buffer, and the slice gradients are summed pairwise before
+	/// the step. The results depend on this value, but not on the number of hardware threads.
+	/// In this mode, each slice is propagated through the network all at once (see
+	/// GNeuralNet::forwardPropBatch), and the optimizer folds the gradient of the whole batch into
+	/// its state once per batch (see accumulateBatchGradient), instead of once per sample, so
+	/// momentum and moment estimates are updated per batch. Pass 0 or 1 (the default) to give each
+	/// batch to computeGradient one sample at a time. Batches of one sample, networks with
+	/// recurrent blocks, and optimizers that do not implement accumulateBatchGradient always go
+	/// through computeGradient.
+	void setBatchThreads(size_t threads) { m_batchThreads = threads; }
+	size_t batchThreads() const { return m_batchThreads; }
+
+protected:
+	/// Returns true iff this optimizer implements accumulateBatchGradient. The default is false,
+	/// which gives every batch to computeGradient one sample at a time (and makes optimizeSequences
+	/// throw), so optimizers that predate batch gradients keep working unchanged.
+	virtual bool accumulatesBatchGradients() const { return false; }
+
+	/// Folds the sum of the gradients of count samples, all evaluated with the current weights,
+	/// into the gradient that descendGradient will step along. This is how batches take the place
+	/// of calling computeGradient once per sample. It is only called when accumulatesBatchGradients
+	/// returns true. The default throws.
+	virtual void accumulateBatchGradient(const GVec& sum, size_t count);
+
+	/// Returns true iff a batch of the specified size should be computed with computeBatchGradient
+	bool useBatchGradient(size_t batchSize) const;
+
+	/// Computes the gradient of the batch made of the specified rows of features and labels with
+	/// batch propagation, one slice per context, and passes the sum to accumulateBatchGradient.
+	void computeBatchGradient(const GMatrix& features, const GMatrix& labels, const std::vector<size_t>& rows);
 };
 
 
@@ -175,6 +236,13 @@ public:
 	void setMomentum(double m) { m_momentum = m; }
 	double momentum() const { return m_momentum; }
 
+protected:
+	/// Returns true
+	virtual bool accumulatesBatchGradients() const override { return true; }
+
+	/// See the comment for GNeuralNetOptimizer::accumulateBatchGradient
+	virtual void accumulateBatchGradient(const GVec& sum, size_t count) override;
+
 private:
 	GVec m_gradient;
 	double m_momentum;
@@ -205,6 +273,13 @@ public:
 	void setEpsilon(double e) { m_epsilon = e; }
 	double epsilon() const { return m_epsilon; }
 
+protected:
+	/// Returns true
+	virtual bool accumulatesBatchGradients() const override { return true; }
+
+	/// See the comment for GNeuralNetOptimizer::accumulateBatchGradient
+	virtual void accumulateBatchGradient(const GVec& sum, size_t count) override;
+
 private:
 	GVec m_gradient, m_deltas, m_sqdeltas;
 	double m_correct1, m_correct2, m_beta1, m_beta2, m_epsilon;
@@ -232,6 +307,13 @@ public:
 	void setGamma(double g) { m_gamma = g; }
 	double gamma() const { return m_gamma; }
 
+protected:
+	/// Returns true
+	virtual bool accumulatesBatchGradients() const override { return true; }
+
+	/// See the comment for GNeuralNetOptimizer::accumulateBatchGradient
+	virtual void accumulateBatchGradient(const GVec& sum, size_t count) override;
+
 private:
 	GVec m_gradient, m_meanSquare;
 	double m_momentum, m_gamma, m_epsilon;
@@ -38,6 +38,7 @@
 #include "GLearner.h"
 #include "GLearnerLib.h"
 #include "usage.h"
+#include "GThread.h"
 #include <memory>
 
 using std::map;
@@ -921,12 +922,41 @@ void GDenseClusterRecommender::test()
 
 
 GMatrixFactorization::GMatrixFactorization(size_t intrinsicDims)
-: GCollaborativeFilter(), m_intrinsicDims(intrinsicDims), m_regularizer(0.01), m_pP(NULL), m_pQ(NULL), m_pPMask(NULL), m_pQMask(NULL), m_pPWeights(NULL), m_pQWeights(NULL), m_nonNeg(false), m_minIters(1), m_decayRate(0.97)
+: GCollaborativeFilter(), m_intrinsicDims(intrinsicDims), m_regularizer(0.01), m_pP(NULL), m_pQ(NULL), m_pPMask(NULL), m_pQMask(NULL), m_pPWeights(NULL), m_pQWeights(NULL), m_nonNeg(false), m_minIters(1), m_decayRate(0.97), m_strata(0), m_float32(false)
 {
 }
 
+// Copies the rows of a matrix, one after another, into a flat vector
+template<typename T>
+void GMatrixFactorization_flatten(const GMatrix& m, std::vector<T>& flat)
+{
+	flat.resize(m.rows() * m.cols());
+	T* pOut = flat.data();
+	for(size_t i = 0; i < m.rows(); i++)
+	{
+		const GVec& row = m[i];
+		for(size_t j = 0; j < m.cols(); j++)
+			*(pOut++) = (T)row[j];
+	}
+}
+
+// Copies a flat vector into a new matrix with the specified number of columns
+template<typename T>
+GMatrix* GMatrixFactorization_unflatten(const std::vector<T>& flat, size_t cols)
+{
+	GMatrix* pM = new GMatrix(flat.size() / cols, cols);
+	const T* pIn = flat.data();
+	for(size_t i = 0; i < pM->rows(); i++)
+	{
+		GVec& row = pM->row(i);
+		for(size_t j = 0; j < cols; j++)
+			row[j] = *(pIn++);
+	}
+	return pM;
+}
+
 GMatrixFactorization::GMatrixFactorization(const GDomNode* pNode, GLearnerLoader& ll)
-: GCollaborativeFilter(pNode, ll)
+: GCollaborativeFilter(pNode, ll), m_strata(0), m_float32(false)
 {
 	m_regularizer = pNode->field("reg")->asDouble();
 	m_minIters = (size_t)pNode->field("mi")->asInt();
@@ -956,6 +986,17 @@ GMatrixFactorization::GMatrixFactorization(const GDomNode* pNode, GLearnerLoader
 	if(m_pP->cols() != m_pQ->cols())
 		throw Ex("Mismatching matrix sizes");
 	m_intrinsicDims = m_pP->cols() - 1;
+	GDomNode* pFloat32 = pNode->fieldIfExists("f32");
+	if(pFloat32 && pFloat32->asBool())
+	{
+		m_float32 = true;
+		GMatrixFactorization_flatten(*m_pP, m_p32);
+		GMatrixFactorization_flatten(*m_pQ, m_q32);
+		delete(m_pP);
+		m_pP = NULL;
+		delete(m_pQ);
+		m_pQ = NULL;
+	}
 }
 
 // virtual
@@ -976,8 +1017,19 @@ GDomNode* GMatrixFactorization::serialize(GDom* pDoc) const
 	pNode->addField(pDoc, "reg", pDoc->newDouble(m_regularizer));
 	pNode->addField(pDoc, "mi", pDoc->newInt(m_minIters));
 	pNode->addField(pDoc, "dr", pDoc->newDouble(m_decayRate));
-	pNode->addField(pDoc, "p", m_pP->serialize(pDoc));
-	pNode->addField(pDoc, "q", m_pQ->serialize(pDoc));
+	if(m_p32.size() > 0)
+	{
+		std::unique_ptr<GMatrix> hP(GMatrixFactorization_unflatten(m_p32, m_intrinsicDims + 1));
+		std::unique_ptr<GMatrix> hQ(GMatrixFactorization_unflatten(m_q32, m_intrinsicDims + 1));
+		pNode->addField(pDoc, "p", hP->serialize(pDoc));
+		pNode->addField(pDoc, "q", hQ->serialize(pDoc));
+		pNode->addField(pDoc, "f32", pDoc->newBool(true));
+	}
+	else
+	{
+		pNode->addField(pDoc, "p", m_pP->serialize(pDoc));
+		pNode->addField(pDoc, "q", m_pQ->serialize(pDoc));
+	}
 	if(m_pPMask)
 	{
 		pNode->addField(pDoc, "pm", m_pPMask->serialize(pDoc));
@@ -1047,8 +1099,59 @@ void GMatrixFactorization::clampItems(const GMatrix& data, size_t offset)
 	}
 }
 
+GMatrix* GMatrixFactorization::getP()
+{
+	if(!m_pP && m_p32.size() > 0)
+		m_pP = GMatrixFactorization_unflatten(m_p32, m_intrinsicDims + 1);
+	return m_pP;
+}
+
+GMatrix* GMatrixFactorization::getQ()
+{
+	if(!m_pQ && m_q32.size() > 0)
+		m_pQ = GMatrixFactorization_unflatten(m_q32, m_intrinsicDims + 1);
+	return m_pQ;
+}
+
+// Predicts a rating from a user's preference vector and an item's weight vector
+template<typename T>
+inline double GMatrixFactorization_predict(const T* p, const T* q, size_t dims)
+{
+	double pred = (double)p[0] + (double)q[0];
+	for(size_t i = 1; i <= dims; i++)
+		pred += (double)p[i] * (double)q[i];
+	return pred;
+}
+
+// Returns the sum-squared error of flattened factors on the specified ratings. (Partial sums
+// are added in a fixed order, so the result does not depend on the number of threads.)
+template<typename T>
+double GMatrixFactorization_sse(const GMatrix& data, const std::vector<T>& p, const std::vector<T>& q, size_t dims)
+{
+	size_t blockSize = 4096;
+	size_t blocks = (data.rows() + blockSize - 1) / blockSize;
+	std::vector<double> sums(blocks);
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t b) {
+		double sse = 0.0;
+		size_t end = std::min(data.rows(), (b + 1) * blockSize);
+		for(size_t i = b * blockSize; i < end; i++)
+		{
+			const GVec& vec = data[i];
+			double err = vec[2] - GMatrixFactorization_predict(p.data() + (size_t)vec[0] * (dims + 1), q.data() + (size_t)vec[1] * (dims + 1), dims);
+			sse += (err * err);
+		}
+		sums[b] = sse;
+	});
+	double sse = 0.0;
+	for(size_t b = 0; b < blocks; b++)
+		sse += sums[b];
+	return sse;
+}
+
 double GMatrixFactorization::validate(GMatrix& data)
 {
+	if(m_p32.size() > 0)
+		return GMatrixFactorization_sse(data, m_p32, m_q32, m_intrinsicDims);
 	double sse = 0;
 	for(size_t i = 0; i < data.rows(); i++)
 	{
@@ -1100,11 +1203,101 @@ void GMatrixFactorization_absValues(double* pVec, size_t dims)
 	}
 }
 
+// Performs one step of stochastic gradient descent on a single rating
+template<typename T>
+inline void GMatrixFactorization_sgdStep(T* p, T* q, double rating, size_t dims, double learningRate, double regularizer, bool nonNeg)
+{
+	double err = rating - GMatrixFactorization_predict(p, q, dims);
+	q[0] += (T)(learningRate * (err - regularizer * q[0]));
+	p[0] += (T)(learningRate * (err - regularizer * p[0]));
+	for(size_t i = 1; i <= dims; i++)
+	{
+		double qi = q[i];
+		q[i] += (T)(learningRate * (err * p[i] - regularizer * qi));
+		p[i] += (T)(learningRate * (err * qi - regularizer * p[i]));
+		if(nonNeg)
+		{
+			q[i] = std::max((T)0, q[i]);
+			p[i] = std::max((T)0, p[i]);
+		}
+	}
+}
+
+template<typename T>
+void GMatrixFactorization::trainStratified(GMatrix& data, std::vector<T>& p, std::vector<T>& q)
+{
+	size_t stride = m_intrinsicDims + 1;
+	size_t strata = std::max((size_t)1, m_strata);
+
+	// Assign the users and items to strata at random, and sort the ratings into blocks
+	std::vector<size_t> userStratum(p.size() / stride);
+	for(size_t i = 0; i < userStratum.size(); i++)
+		userStratum[i] = (size_t)m_rand.next(strata);
+	std::vector<size_t> itemStratum(q.size() / stride);
+	for(size_t i = 0; i < itemStratum.size(); i++)
+		itemStratum[i] = (size_t)m_rand.next(strata);
+	std::vector< std::vector<size_t> > blocks(strata * strata);
+	for(size_t i = 0; i < data.rows(); i++)
+	{
+		const GVec& vec = data[i];
+		blocks[userStratum[(size_t)vec[0]] * strata + itemStratum[(size_t)vec[1]]].push_back(i);
+	}
+	uint64_t seed = m_rand.next();
+
+	// Train
+	GThreadPool& pool = GThreadPool::global();
+	double prevErr = 1e10;
+	double learningRate = 0.01;
+	size_t epochs = 0;
+	while(learningRate >= 0.001)
+	{
+		std::vector<T> backupP(p);
+		std::vector<T> backupQ(q);
+		for(size_t iter = 0; iter < m_minIters; iter++)
+		{
+			// In each pass, block (s, s + shift) touches only users in stratum s and items in stratum s + shift, so the blocks cannot conflict
+			for(size_t shift = 0; shift < strata; shift++)
+			{
+				pool.parallelFor(0, strata, [&](size_t s) {
+					std::vector<size_t>& block = blocks[s * strata + (s + shift) % strata];
+					GRand rand(seed + (epochs * strata + shift) * strata + s);
+					for(size_t i = block.size(); i > 1; i--)
+						std::swap(block[i - 1], block[(size_t)rand.next(i)]);
+					for(size_t i = 0; i < block.size(); i++)
+					{
+						const GVec& vec = data[block[i]];
+						T* pp = p.data() + (size_t)vec[0] * stride;
+						T* qq = q.data() + (size_t)vec[1] * stride;
+						GMatrixFactorization_sgdStep(pp, qq, vec[2], m_intrinsicDims, learningRate, m_regularizer, m_nonNeg);
+					}
+				});
+			}
+			epochs++;
+		}
+
+		// Stopping criteria (the same as the serial schedule)
+		double rsse = sqrt(GMatrixFactorization_sse(data, p, q, m_intrinsicDims));
+		if(rsse >= 1e-12 && 1.0 - (rsse / prevErr) >= 0.001) {} else // This awkward if/else structure causes "nan" to be handled in a useful way
+		{
+			if(rsse <= prevErr) {} else // This awkward if/else structure causes "nan" to be handled in a useful way
+			{
+				// We didn't even get better, so restore from backup
+				p.swap(backupP);
+				q.swap(backupQ);
+			}
+			learningRate *= m_decayRate; // decay the learning rate
+		}
+		prevErr = rsse;
+	}
+}
+
 // virtual
 void GMatrixFactorization::train(GMatrix& data)
 {
 	size_t users, items;
 	GCollaborativeFilter_dims(data, &users, &items);
+	m_p32.clear();
+	m_q32.clear();
 
 	// Initialize P and Q with small random values
 	delete(m_pP);
@@ -1127,6 +1320,35 @@ void GMatrixFactorization::train(GMatrix& data)
 			GMatrixFactorization_absValues(m_pQ->row(i).data() + 1, m_intrinsicDims);
 	}
 
+	// Use the stratified schedule if requested
+	if(m_strata > 0 || m_float32)
+	{
+		if(m_pPMask || m_pQMask)
+			throw Ex("Clamped elements are only supported by the serial schedule with double-precision factors");
+		if(m_float32)
+		{
+			GMatrixFactorization_flatten(*m_pP, m_p32);
+			GMatrixFactorization_flatten(*m_pQ, m_q32);
+			delete(m_pP);
+			m_pP = NULL;
+			delete(m_pQ);
+			m_pQ = NULL;
+			trainStratified(data, m_p32, m_q32);
+		}
+		else
+		{
+			std::vector<double> p, q;
+			GMatrixFactorization_flatten(*m_pP, p);
+			GMatrixFactorization_flatten(*m_pQ, q);
+			trainStratified(data, p, q);
+			delete(m_pP);
+			m_pP = GMatrixFactorization_unflatten(p, colsP);
+			delete(m_pQ);
+			m_pQ = GMatrixFactorization_unflatten(q, colsP);
+		}
+		return;
+	}
+
 	// Make a shallow copy of the data (so we can shuffle it)
 	GMatrix dataCopy(data.relation().clone());
 	GReleaseDataHolder hDataCopy(&dataCopy);
@@ -1237,6 +1459,13 @@ void GMatrixFactorization::train(GMatrix& data)
 // virtual
 double GMatrixFactorization::predict(size_t user, size_t item)
 {
+	if(m_p32.size() > 0)
+	{
+		size_t stride = m_intrinsicDims + 1;
+		if(user >= m_p32.size() / stride || item >= m_q32.size() / stride)
+			return 0.0;
+		return GMatrixFactorization_predict(m_p32.data() + user * stride, m_q32.data() + item * stride, m_intrinsicDims);
+	}
 	if(!m_pP)
 		throw Ex("Not trained yet");
 	if(user >= m_pP->rows() || item >= m_pQ->rows())
@@ -1266,8 +1495,9 @@ void GMatrixFactorization_vectorToRatings(const GVec& vec, size_t dims, GMatrix&
 // virtual
 void GMatrixFactorization::impute(GVec& vec, size_t dims)
 {
-	if(!m_pP)
+	if(!m_pP && m_p32.size() == 0)
 		throw Ex("Not trained yet");
+	getQ(); // (This is a no-op unless the factors are stored in single precision)
 
 	// Convert the vector to a set of ratings
 	GMatrix data(0, 3);
@@ -1341,6 +1571,41 @@ void GMatrixFactorization::test()
 	GMatrixFactorization rec(3);
 	rec.setRegularizer(0.002);
 	rec.basicTest(0.17);
+
+	// The stratified schedule
+	GMatrixFactorization rec2(3);
+	rec2.setRegularizer(0.002);
+	rec2.setStrata(4);
+	rec2.basicTest(0.18);
+
+	// Single-precision factors must give the same model every time, and survive serialization
+	GRand rand(0);
+	GMatrix data(0, 3);
+	GCF_basicTest_makeData(data, rand);
+	double preds[2];
+	for(size_t i = 0; i < 2; i++)
+	{
+		GMatrixFactorization rec3(3);
+		rec3.setRegularizer(0.002);
+		rec3.setStrata(3);
+		rec3.useFloat32();
+		rec3.rand().setSeed(1234);
+		rec3.train(data);
+		preds[i] = rec3.predict(2, 5);
+		if(i == 1)
+		{
+			GDom doc;
+			doc.setRoot(rec3.serialize(&doc));
+			GLearnerLoader ll;
+			GMatrixFactorization rec4(doc.root(), ll);
+			if(std::abs(rec4.predict(2, 5) - preds[1]) > 1e-6)
+				throw Ex("Serialization failed");
+			if(rec4.getP()->rows() != rec3.getP()->rows())
+				throw Ex("Wrong number of users");
+		}
+	}
+	if(preds[0] != preds[1])
+		throw Ex("Not reproducible");
 }
 #endif
 
@@ -352,6 +352,10 @@ protected:
 	bool m_nonNeg;
 	size_t m_minIters;
 	double m_decayRate;
+	size_t m_strata;
+	bool m_float32;
+	std::vector<float> m_p32; // The user factors, one row after another, when they are stored in single precision
+	std::vector<float> m_q32; // The item factors, one row after another, when they are stored in single precision
 
 public:
 	/// General-purpose constructor
@@ -385,6 +389,19 @@ public:
 	/// Constrain all non-bias weights to be non-negative during training.
 	void nonNegative() { m_nonNeg = true; }
 
+	/// Train with a stratified schedule that can run in parallel. Users and items are each
+	/// divided at random into the specified number of strata, which splits the ratings into
+	/// strata x strata blocks. Each epoch is done in strata passes, and in each pass a set of
+	/// blocks that share no users and no items is trained concurrently on GThreadPool::global().
+	/// The result depends only on the random seed and the number of strata (not on the number of
+	/// threads), so training is reproducible. Use at least as many strata as cores. 0 (the default)
+	/// selects the original serial schedule, which is the only one that supports clamped elements.
+	void setStrata(size_t strata) { m_strata = strata; }
+
+	/// Store the factors in single precision, which halves their memory and the memory traffic
+	/// of training. This implies the stratified schedule (with one stratum if setStrata was not called).
+	void useFloat32(bool b = true) { m_float32 = b; }
+
 	/// See the comment for GCollaborativeFilter::train
 	virtual void train(GMatrix& data);
 
@@ -394,17 +411,19 @@ public:
 	/// See the comment for GCollaborativeFilter::impute
 	virtual void impute(GVec& vec, size_t dims);
 
-	/// Returns the matrix of user preference vectors
-	GMatrix* getP() { return m_pP; }
+	/// Returns the matrix of user preference vectors. (If the factors are stored in single
+	/// precision, they are converted to a GMatrix when this is first called.)
+	GMatrix* getP();
 
-	/// Returns the matrix of item weight vectors
-	GMatrix* getQ() { return m_pQ; }
+	/// Returns the matrix of item weight vectors. (If the factors are stored in single
+	/// precision, they are converted to a GMatrix when this is first called.)
+	GMatrix* getQ();
 
 	/// Returns the matrix of user preference vectors, and gives ownership to the caller.
-	GMatrix* dropP() { GMatrix* tmp = m_pP; m_pP = NULL; return tmp; }
+	GMatrix* dropP() { GMatrix* tmp = getP(); m_pP = NULL; return tmp; }
 
 	/// Returns the matrix of item weight vectors, and gives ownership to the caller.
-	GMatrix* dropQ() { GMatrix* tmp = m_pQ; m_pQ = NULL; return tmp; }
+	GMatrix* dropQ() { GMatrix* tmp = getQ(); m_pQ = NULL; return tmp; }
 
 	/// See the comment for GCollaborativeFilter::serialize
 	virtual GDomNode* serialize(GDom* pDoc) const;
@@ -426,6 +445,10 @@ protected:
 
 	void clampP(size_t i);
 	void clampQ(size_t i);
+
+	/// Trains the flattened factors p and q with the stratified schedule
+	template<typename T>
+	void trainStratified(GMatrix& data, std::vector<T>& p, std::vector<T>& q);
 };
 
 
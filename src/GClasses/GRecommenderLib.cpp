@@ -141,6 +141,8 @@ void GRecommenderLib::loadData(GMatrix& data, const char* szFilename)
 	}
 	else if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		data.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		data.load(szFilename);
 	else
 		throw Ex("Unsupported file format: ", szFilename + pd.extStart);
 }
@@ -320,6 +322,10 @@ GMatrixFactorization* GRecommenderLib::InstantiateMatrixFactorization(GArgReader
 			pModel->setDecayRate(args.pop_double());
 		else if(args.if_pop("-nonneg"))
 			pModel->nonNegative();
+		else if(args.if_pop("-strata"))
+			pModel->setStrata(args.pop_uint());
+		else if(args.if_pop("-float32"))
+			pModel->useFloat32();
 		else if(args.if_pop("-clampusers"))
 		{
 			GMatrix tmp;
@@ -27,6 +27,7 @@
 #include "GHolders.h"
 #include <fstream>
 #include "GDom.h"
+#include "GThread.h"
 #include <cmath>
 #include <set>
 #include <memory>
@@ -128,30 +129,8 @@ void GSparseMatrix::multiply(double scalar)
 
 GMatrix* GSparseMatrix::multiply(GMatrix* pThat, bool transposeThat)
 {
-	// Transpose pThat if necessary
-	GMatrix* pOther = pThat;
-	std::unique_ptr<GMatrix> hOther;
-	if(!transposeThat)
-	{
-		pOther = pThat->transpose();
-		hOther.reset(pOther);
-	}
-	if(pOther->cols() != cols())
-		throw Ex("Matrices have incompatible sizes");
-
-	// Do the multiplying
-	GMatrix* pResult = new GMatrix(rows(), pOther->rows());
-	for(size_t r = 0; r < rows(); r++)
-	{
-		SparseVec& a = row(r);
-		GVec& out = pResult->row(r);
-		for(size_t c = 0; c < pOther->rows(); c++)
-		{
-			GVec& b = pOther->row(c);
-			out[c] = GSparseVec::dotProduct(a, b);
-		}
-	}
-	return pResult;
+	GCSRMatrix csr(*this);
+	return csr.multiply(*pThat, transposeThat);
 }
 
 GMatrix* GSparseMatrix::firstPrincipalComponents(size_t k, GRand& rand)
@@ -918,6 +897,356 @@ void GSparseMatrix::test()
 
 
 
+// --------------------------------------------------------------------------
+
+double GSparseRow::dotProduct(const GVec& dense) const
+{
+	double sum = 0.0;
+	for(size_t i = 0; i < m_size; i++)
+		sum += m_pValues[i] * dense[m_pIndexes[i]];
+	return sum;
+}
+
+// The number of rows in each piece of work that the kernels hand to the thread pool
+#define CSR_BLOCK_ROWS 256
+
+void GCSRMatrix_checkCols(size_t cols)
+{
+	if(cols > (size_t)(unsigned int)-1)
+		throw Ex("Too many columns for the compressed form");
+}
+
+GCSRMatrix::GCSRMatrix(const GSparseMatrix& that)
+: m_cols(that.cols()), m_defaultValue(that.defaultValue())
+{
+	GCSRMatrix_checkCols(m_cols);
+	m_rowStarts.resize(that.rows() + 1);
+	size_t pos = 0;
+	for(size_t i = 0; i < that.rows(); i++)
+	{
+		m_rowStarts[i] = pos;
+		pos += that.rowNonDefValues(i);
+	}
+	m_rowStarts[that.rows()] = pos;
+	m_indexes.resize(pos);
+	m_values.resize(pos);
+	pos = 0;
+	for(size_t i = 0; i < that.rows(); i++)
+	{
+		for(GSparseMatrix::Iter it = that.rowBegin(i); it != that.rowEnd(i); it++)
+		{
+			m_indexes[pos] = (unsigned int)it->first;
+			m_values[pos] = it->second;
+			pos++;
+		}
+	}
+}
+
+GCSRMatrix::GCSRMatrix(size_t cols, std::vector<size_t>& rowStarts, std::vector<unsigned int>& indexes, std::vector<double>& values, double defaultValue)
+: m_cols(cols), m_defaultValue(defaultValue)
+{
+	GCSRMatrix_checkCols(m_cols);
+	if(rowStarts.size() < 1 || rowStarts[0] != 0 || rowStarts.back() != indexes.size() || indexes.size() != values.size())
+		throw Ex("Inconsistent arrays");
+	m_rowStarts.swap(rowStarts);
+	m_indexes.swap(indexes);
+	m_values.swap(values);
+}
+
+GCSRMatrix::GCSRMatrix(const GDomNode* pNode)
+{
+	m_defaultValue = pNode->field("def")->asDouble();
+	m_cols = (size_t)pNode->field("cols")->asInt();
+	GCSRMatrix_checkCols(m_cols);
+
+	// Count the elements, so the arrays can be allocated just once
+	GDomNode* pRows = pNode->field("rows");
+	size_t pos = 0;
+	m_rowStarts.push_back(0);
+	for(GDomListIterator it1(pRows); it1.current(); it1.advance())
+	{
+		GDomListIterator it2(it1.current());
+		if(it2.remaining() % 2 != 0)
+			throw Ex("Expected an even number of items in the list");
+		pos += it2.remaining() / 2;
+		m_rowStarts.push_back(pos);
+	}
+	m_indexes.resize(pos);
+	m_values.resize(pos);
+
+	// Copy the elements. Rows are sorted, since they may not have been serialized in order.
+	size_t r = 0;
+	for(GDomListIterator it1(pRows); it1.current(); it1.advance())
+	{
+		size_t start = m_rowStarts[r];
+		pos = start;
+		bool sorted = true;
+		for(GDomListIterator it2(it1.current()); it2.current(); it2.advance())
+		{
+			size_t col = (size_t)it2.current()->asInt();
+			if(col >= m_cols)
+				throw Ex("Column index out of range");
+			it2.advance();
+			m_indexes[pos] = (unsigned int)col;
+			m_values[pos] = it2.current()->asDouble();
+			if(pos > start && m_indexes[pos - 1] >= m_indexes[pos])
+				sorted = false;
+			pos++;
+		}
+		if(!sorted)
+		{
+			std::vector<std::pair<unsigned int,double> > elements;
+			for(size_t i = start; i < pos; i++)
+				elements.push_back(std::make_pair(m_indexes[i], m_values[i]));
+			std::sort(elements.begin(), elements.end());
+			for(size_t i = start; i < pos; i++)
+			{
+				m_indexes[i] = elements[i - start].first;
+				m_values[i] = elements[i - start].second;
+			}
+		}
+		r++;
+	}
+}
+
+GCSRMatrix::~GCSRMatrix()
+{
+}
+
+GDomNode* GCSRMatrix::serialize(GDom* pDoc) const
+{
+	GDomNode* pNode = pDoc->newObj();
+	pNode->addField(pDoc, "def", pDoc->newDouble(m_defaultValue));
+	pNode->addField(pDoc, "cols", pDoc->newInt(m_cols));
+	GDomNode* pRows = pNode->addField(pDoc, "rows", pDoc->newList());
+	for(size_t i = 0; i < rows(); i++)
+	{
+		GDomNode* pElements = pRows->addItem(pDoc, pDoc->newList());
+		for(size_t j = m_rowStarts[i]; j < m_rowStarts[i + 1]; j++)
+		{
+			pElements->addItem(pDoc, pDoc->newInt(m_indexes[j]));
+			pElements->addItem(pDoc, pDoc->newDouble(m_values[j]));
+		}
+	}
+	return pNode;
+}
+
+double GCSRMatrix::get(size_t r, size_t c) const
+{
+	GAssert(r < rows() && c < m_cols); // out of range
+	const unsigned int* pBegin = m_indexes.data() + m_rowStarts[r];
+	const unsigned int* pEnd = m_indexes.data() + m_rowStarts[r + 1];
+	const unsigned int* pIt = std::lower_bound(pBegin, pEnd, (unsigned int)c);
+	if(pIt == pEnd || *pIt != c)
+		return m_defaultValue;
+	return m_values[pIt - m_indexes.data()];
+}
+
+void GCSRMatrix::fullRow(GVec& outFullRow, size_t r) const
+{
+	outFullRow.resize(m_cols);
+	outFullRow.fill(m_defaultValue);
+	for(size_t j = m_rowStarts[r]; j < m_rowStarts[r + 1]; j++)
+		outFullRow[m_indexes[j]] = m_values[j];
+}
+
+GCSRMatrix* GCSRMatrix::transpose() const
+{
+	// Count the elements in each column
+	std::vector<size_t> colStarts(m_cols + 1, 0);
+	for(size_t j = 0; j < m_indexes.size(); j++)
+		colStarts[m_indexes[j] + 1]++;
+	for(size_t c = 0; c < m_cols; c++)
+		colStarts[c + 1] += colStarts[c];
+
+	// Scatter the elements into their columns. Visiting the rows in order keeps each column sorted.
+	std::vector<unsigned int> indexes(m_indexes.size());
+	std::vector<double> values(m_values.size());
+	std::vector<size_t> next(colStarts.begin(), colStarts.end() - 1);
+	GCSRMatrix_checkCols(rows());
+	for(size_t r = 0; r < rows(); r++)
+	{
+		for(size_t j = m_rowStarts[r]; j < m_rowStarts[r + 1]; j++)
+		{
+			size_t pos = next[m_indexes[j]]++;
+			indexes[pos] = (unsigned int)r;
+			values[pos] = m_values[j];
+		}
+	}
+	return new GCSRMatrix(rows(), colStarts, indexes, values, m_defaultValue);
+}
+
+GSparseMatrix* GCSRMatrix::toSparseMatrix() const
+{
+	GSparseMatrix* pResult = new GSparseMatrix(rows(), m_cols, m_defaultValue);
+	for(size_t r = 0; r < rows(); r++)
+	{
+		SparseVec& row = pResult->row(r);
+		for(size_t j = m_rowStarts[r]; j < m_rowStarts[r + 1]; j++)
+			row.insert(row.end(), std::make_pair((size_t)m_indexes[j], m_values[j]));
+	}
+	return pResult;
+}
+
+void GCSRMatrix::multiply(const GVec& x, GVec& y) const
+{
+	if(x.size() != m_cols)
+		throw Ex("Expected a vector of size ", to_str(m_cols), ". Got ", to_str(x.size()));
+	y.resize(rows());
+	size_t blocks = (rows() + CSR_BLOCK_ROWS - 1) / CSR_BLOCK_ROWS;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t block) {
+		size_t end = std::min(rows(), (block + 1) * CSR_BLOCK_ROWS);
+		for(size_t r = block * CSR_BLOCK_ROWS; r < end; r++)
+			y[r] = row(r).dotProduct(x);
+	});
+}
+
+void GCSRMatrix::multiplyTranspose(const GVec& x, GVec& y) const
+{
+	if(x.size() != rows())
+		throw Ex("Expected a vector of size ", to_str(rows()), ". Got ", to_str(x.size()));
+	GThreadPool& pool = GThreadPool::global();
+	size_t blocks = (rows() + CSR_BLOCK_ROWS - 1) / CSR_BLOCK_ROWS;
+	GMatrix sums(pool.participants(blocks), m_cols);
+	sums.fill(0.0);
+	pool.parallelForSlots(0, blocks, [&](size_t block, size_t slot) {
+		GVec& sum = sums[slot];
+		size_t end = std::min(rows(), (block + 1) * CSR_BLOCK_ROWS);
+		for(size_t r = block * CSR_BLOCK_ROWS; r < end; r++)
+		{
+			double a = x[r];
+			for(size_t j = m_rowStarts[r]; j < m_rowStarts[r + 1]; j++)
+				sum[m_indexes[j]] += m_values[j] * a;
+		}
+	}, blocks);
+	y.resize(m_cols);
+	y.fill(0.0);
+	for(size_t i = 0; i < sums.rows(); i++)
+		y += sums[i];
+}
+
+GMatrix* GCSRMatrix::multiply(const GMatrix& that, bool transposeThat) const
+{
+	// Each output row is a weighted sum of rows of that, so that is transposed if necessary to make those rows contiguous
+	const GMatrix* pOther = &that;
+	std::unique_ptr<GMatrix> hOther;
+	if(transposeThat)
+	{
+		hOther.reset(that.transpose());
+		pOther = hOther.get();
+	}
+	if(pOther->rows() != m_cols)
+		throw Ex("Matrices have incompatible sizes");
+
+	// Do the multiplying
+	size_t outCols = pOther->cols();
+	GMatrix* pResult = new GMatrix(rows(), outCols);
+	std::unique_ptr<GMatrix> hResult(pResult);
+	size_t blocks = (rows() + CSR_BLOCK_ROWS - 1) / CSR_BLOCK_ROWS;
+	GThreadPool::global().parallelFor(0, blocks, [&](size_t block) {
+		size_t end = std::min(rows(), (block + 1) * CSR_BLOCK_ROWS);
+		for(size_t r = block * CSR_BLOCK_ROWS; r < end; r++)
+		{
+			double* pOut = pResult->row(r).data();
+			GVec::setAll(pOut, 0.0, outCols);
+			for(size_t j = m_rowStarts[r]; j < m_rowStarts[r + 1]; j++)
+			{
+				const double* pIn = pOther->row(m_indexes[j]).data();
+				double a = m_values[j];
+				for(size_t k = 0; k < outCols; k++)
+					pOut[k] += a * pIn[k];
+			}
+		}
+	});
+	return hResult.release();
+}
+
+#ifndef NO_TEST_CODE
+// static
+void GCSRMatrix::test()
+{
+	GRand prng(0);
+	for(size_t i = 0; i < 20; i++)
+	{
+		size_t h = (size_t)prng.next(600) + 1;
+		size_t w = (size_t)prng.next(40) + 1;
+		GSparseMatrix sm(h, w);
+		for(size_t j = 0; j < 3 * h; j++)
+			sm.set((size_t)prng.next(h), (size_t)prng.next(w), prng.normal());
+		GCSRMatrix csr(sm);
+		if(csr.nonDefValues() > 3 * h)
+			throw Ex("too many elements");
+		GMatrix* pFull = sm.toFullMatrix();
+		std::unique_ptr<GMatrix> hFull(pFull);
+
+		// Element access, transposition, and conversion
+		for(size_t j = 0; j < 20; j++)
+		{
+			size_t r = (size_t)prng.next(h);
+			size_t c = (size_t)prng.next(w);
+			if(csr.get(r, c) != sm.get(r, c))
+				throw Ex("wrong value");
+		}
+		GCSRMatrix* pT = csr.transpose();
+		std::unique_ptr<GCSRMatrix> hT(pT);
+		GSparseMatrix* pTSparse = pT->toSparseMatrix();
+		std::unique_ptr<GSparseMatrix> hTSparse(pTSparse);
+		GMatrix* pTFull = pTSparse->toFullMatrix();
+		std::unique_ptr<GMatrix> hTFull(pTFull);
+		GMatrix* pFullT = pFull->transpose();
+		std::unique_ptr<GMatrix> hFullT(pFullT);
+		if(pTFull->sumSquaredDifference(*pFullT) != 0.0)
+			throw Ex("transpose failed");
+
+		// Serialization
+		GDom doc;
+		doc.setRoot(sm.serialize(&doc));
+		GCSRMatrix csr2(doc.root());
+		GVec r1, r2;
+		for(size_t r = 0; r < h; r++)
+		{
+			csr2.fullRow(r1, r);
+			if(r1.squaredDistance((*pFull)[r]) != 0.0)
+				throw Ex("deserialization failed");
+		}
+
+		// Sparse-vector and sparse-matrix products
+		GVec x(w);
+		x.fillNormal(prng);
+		GVec y;
+		csr.multiply(x, y);
+		GVec yExpected(h);
+		pFull->multiply(x, yExpected);
+		if(y.squaredDistance(yExpected) > 1e-18 * h)
+			throw Ex("SpMV failed");
+		GVec z(h);
+		z.fillNormal(prng);
+		GVec zOut;
+		csr.multiplyTranspose(z, zOut);
+		GVec zExpected(w);
+		pFull->multiply(z, zExpected, true);
+		if(zOut.squaredDistance(zExpected) > 1e-18 * w)
+			throw Ex("transposed SpMV failed");
+		size_t k = (size_t)prng.next(10) + 1;
+		GMatrix b(w, k);
+		b.fillNormal(prng);
+		GMatrix* pProd = csr.multiply(b, false);
+		std::unique_ptr<GMatrix> hProd(pProd);
+		GMatrix* pExpected = GMatrix::multiply(*pFull, b, false, false);
+		std::unique_ptr<GMatrix> hExpected(pExpected);
+		if(pProd->sumSquaredDifference(*pExpected) > 1e-18 * h * k)
+			throw Ex("SpMM failed");
+		GMatrix* bT = b.transpose();
+		std::unique_ptr<GMatrix> hBT(bT);
+		GMatrix* pProd2 = sm.multiply(bT, true);
+		std::unique_ptr<GMatrix> hProd2(pProd2);
+		if(pProd2->sumSquaredDifference(*pExpected) > 1e-18 * h * k)
+			throw Ex("transposed SpMM failed");
+	}
+}
+#endif // !NO_TEST_CODE
+
+
 
 
 // static
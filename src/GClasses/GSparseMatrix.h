@@ -31,6 +31,7 @@ class GRand;
 class GDomNode;
 class GDom;
 class GVec;
+class GCSRMatrix;
 
 typedef std::map<size_t,double> SparseVec;
 
@@ -65,7 +66,7 @@ public:
 	GDomNode* serialize(GDom* pDoc) const;
 
 	/// Returns the default value--the common value that is not stored.
-	double defaultValue() { return m_defaultValue; }
+	double defaultValue() const { return m_defaultValue; }
 
 	/// Returns the number of rows (as if this matrix were dense)
 	size_t rows() const { return m_rows.size(); }
@@ -88,7 +89,7 @@ public:
 	SparseVec& row(size_t i) { return m_rows[i]; }
 
 	/// Returns the number of non-default-valued elements in the specified row.
-	size_t rowNonDefValues(size_t i) { return m_rows[i].size(); }
+	size_t rowNonDefValues(size_t i) const { return m_rows[i].size(); }
 
 	/// Returns the value at the specified position in the matrix. Returns the
 	/// default value if no element is stored at that position.
@@ -131,6 +132,8 @@ public:
 
 	/// Multiplies this sparse matrix by pThat dense matrix, and returns the resulting dense matrix.
 	/// If transposeThat is true, then it multiplies by the transpose of pThat.
+	/// (This converts to a GCSRMatrix and uses its parallel kernel. If you multiply by the
+	/// same sparse matrix more than once, it is faster to convert it yourself.)
 	GMatrix* multiply(GMatrix* pThat, bool transposeThat);
 
 	/// Swaps the two specified columns. (This method is a lot slower than swapRows.)
@@ -178,6 +181,151 @@ protected:
 	void singularValueDecompositionHelper(GSparseMatrix** ppU, double** ppDiag, GSparseMatrix** ppV, bool throwIfNoConverge, size_t maxIters);
 };
 
+/// A read-only view of one row of a GCSRMatrix. It can be iterated just like a SparseVec.
+/// That is, each element is a pair, such that first is the column, and second is the value.
+class GSparseRow
+{
+public:
+	class Iter
+	{
+	protected:
+		const unsigned int* m_pIndex;
+		const double* m_pValue;
+		mutable std::pair<size_t,double> m_pair;
+
+	public:
+		Iter(const unsigned int* pIndex, const double* pValue) : m_pIndex(pIndex), m_pValue(pValue) {}
+
+		Iter& operator++() { m_pIndex++; m_pValue++; return *this; }
+		Iter operator++(int) { Iter tmp(*this); m_pIndex++; m_pValue++; return tmp; }
+		bool operator==(const Iter& that) const { return m_pIndex == that.m_pIndex; }
+		bool operator!=(const Iter& that) const { return m_pIndex != that.m_pIndex; }
+
+		/// Returns a pair, such that first is the column, and second is the value. (The pair
+		/// belongs to this iterator, and is only valid until the iterator is dereferenced again.)
+		const std::pair<size_t,double>& operator*() const { m_pair.first = *m_pIndex; m_pair.second = *m_pValue; return m_pair; }
+		const std::pair<size_t,double>* operator->() const { return &operator*(); }
+
+		/// Returns the column of the current element
+		size_t index() const { return *m_pIndex; }
+
+		/// Returns the value of the current element
+		double value() const { return *m_pValue; }
+	};
+	typedef Iter const_iterator;
+
+protected:
+	const unsigned int* m_pIndexes;
+	const double* m_pValues;
+	size_t m_size;
+
+public:
+	GSparseRow(const unsigned int* pIndexes, const double* pValues, size_t size)
+	: m_pIndexes(pIndexes), m_pValues(pValues), m_size(size)
+	{
+	}
+
+	/// Returns the number of stored elements in this row
+	size_t size() const { return m_size; }
+
+	/// Returns the column indexes of the stored elements, in ascending order
+	const unsigned int* indexes() const { return m_pIndexes; }
+
+	/// Returns the values of the stored elements
+	const double* values() const { return m_pValues; }
+
+	Iter begin() const { return Iter(m_pIndexes, m_pValues); }
+	Iter end() const { return Iter(m_pIndexes + m_size, m_pValues + m_size); }
+
+	/// Computes the dot product of this row with a dense vector
+	double dotProduct(const GVec& dense) const;
+};
+
+
+/// An immutable sparse matrix in compressed sparse row (CSR) form. The stored elements of all
+/// the rows are kept in two flat arrays, one of column indexes and one of values, in row order.
+/// This costs 12 bytes per stored element, where GSparseMatrix costs a tree node per element.
+/// The compressed sparse column (CSC) form of a matrix is the CSR form of its transpose,
+/// so call transpose to obtain it.
+class GCSRMatrix
+{
+protected:
+	size_t m_cols;
+	double m_defaultValue;
+	std::vector<size_t> m_rowStarts; // rows + 1 offsets into m_indexes and m_values
+	std::vector<unsigned int> m_indexes;
+	std::vector<double> m_values;
+
+public:
+	/// Converts from the map form.
+	GCSRMatrix(const GSparseMatrix& that);
+
+	/// Takes the contents of the three arrays (which are left empty). Row i holds the elements
+	/// from rowStarts[i] to rowStarts[i + 1]. The indexes within each row must be ascending.
+	GCSRMatrix(size_t cols, std::vector<size_t>& rowStarts, std::vector<unsigned int>& indexes, std::vector<double>& values, double defaultValue = 0.0);
+
+	/// Deserializes a sparse matrix that was serialized by GSparseMatrix::serialize or GCSRMatrix::serialize.
+	/// (No map form is built along the way.)
+	GCSRMatrix(const GDomNode* pNode);
+
+	~GCSRMatrix();
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif
+
+	/// Serializes this object in the same format as GSparseMatrix::serialize
+	GDomNode* serialize(GDom* pDoc) const;
+
+	/// Returns the default value--the common value that is not stored.
+	double defaultValue() const { return m_defaultValue; }
+
+	/// Returns the number of rows (as if this matrix were dense)
+	size_t rows() const { return m_rowStarts.size() - 1; }
+
+	/// Returns the number of columns (as if this matrix were dense)
+	size_t cols() const { return m_cols; }
+
+	/// Returns the number of stored elements
+	size_t nonDefValues() const { return m_values.size(); }
+
+	/// Returns the specified row
+	GSparseRow row(size_t i) const { return GSparseRow(m_indexes.data() + m_rowStarts[i], m_values.data() + m_rowStarts[i], m_rowStarts[i + 1] - m_rowStarts[i]); }
+
+	/// Returns the number of non-default-valued elements in the specified row.
+	size_t rowNonDefValues(size_t i) const { return m_rowStarts[i + 1] - m_rowStarts[i]; }
+
+	/// Returns the value at the specified position in the matrix. Returns the
+	/// default value if no element is stored at that position.
+	double get(size_t row, size_t col) const;
+
+	/// Copies a row into a non-sparse vector
+	void fullRow(GVec& outFullRow, size_t row) const;
+
+	/// Returns the transpose of this matrix. (This is also the CSC form of this matrix.)
+	GCSRMatrix* transpose() const;
+
+	/// Converts to the map form
+	GSparseMatrix* toSparseMatrix() const;
+
+	/// Computes y = Ax, where A is this matrix. The rows are divided among the threads of
+	/// GThreadPool::global(). Only the stored elements contribute, as if the default value were 0.
+	void multiply(const GVec& x, GVec& y) const;
+
+	/// Computes y = A^T x, where A is this matrix. Each thread accumulates into its own vector,
+	/// and these are summed at the end. (If you do this often, it is faster to call
+	/// multiply on the transpose.)
+	void multiplyTranspose(const GVec& x, GVec& y) const;
+
+	/// Multiplies this sparse matrix by a dense matrix, and returns the resulting dense matrix.
+	/// If transposeThat is true, then it multiplies by the transpose of that. The rows of the
+	/// result are divided among the threads of GThreadPool::global(). Only the stored elements
+	/// contribute, as if the default value were 0.
+	GMatrix* multiply(const GMatrix& that, bool transposeThat) const;
+};
+
+
 /// Provides static methods for operating on sparse vectors
 class GSparseVec
 {
@@ -20,6 +20,8 @@
 #include "GThread.h"
 #include "GError.h"
 #include <time.h>
+#include <chrono>
+#include <deque>
 #ifdef WINDOWS
 #	include <windows.h>
 #else
@@ -103,25 +105,23 @@ static inline unsigned int testAndSet(volatile long* pDWord)
 
 void GSpinLock::lock(const char* szWhoHoldsTheLock)
 {
-#ifdef _DEBUG
+#ifdef WINDOWS
+#	ifdef _DEBUG
 	time_t t;
 	time_t tStartTime = time(&t);
 	time_t tCurrentTime;
-#endif // _DEBUG
-
-#ifdef WINDOWS
+#	endif // _DEBUG
 	while(testAndSet(&m_dwLocked))
-#else
-	while(0!=pthread_mutex_trylock(&m_mutex))
-#endif
 	{
-#ifdef _DEBUG
+#	ifdef _DEBUG
 		tCurrentTime = time(&t);
 		GAssert(tCurrentTime - tStartTime < 10); // Blocked for 10 seconds!
-#endif // _DEBUG
+#	endif // _DEBUG
 		GThread::sleep(0);
 	}
-#ifndef WINDOWS
+#else
+	if(pthread_mutex_lock(&m_mutex) != 0)
+		throw Ex("Failed to take the lock");
 	m_dwLocked = 1;
 #endif
 #ifdef _DEBUG
@@ -250,25 +250,91 @@ void GSpinLock::test()
 
 
 
-void GWorkerThread::pump()
+class GThreadPoolQueue
 {
-	while(m_keepAlive)
+public:
+	std::mutex m_mutex;
+	std::deque<std::function<void()> > m_tasks;
+};
+
+// Identifies the pool and deque that belong to the current thread, if it is a worker
+static thread_local GThreadPool* g_pCurrentPool = NULL;
+static thread_local size_t g_currentWorker = 0;
+
+GTaskGroup::GTaskGroup(GThreadPool& pool)
+: m_pool(pool), m_outstanding(0)
+{
+}
+
+GTaskGroup::~GTaskGroup()
+{
+	try
 	{
-		size_t jobId = m_master.nextJob(this);
-		if(jobId == INVALID_INDEX)
-			GThread::sleep(m_boredom & (~3)); // The "&(~3)" makes it so values < 4 will evaluate to 0, which just yields
-		else
+		wait();
+	}
+	catch(...)
+	{
+		// An exception that nobody waited for is dropped
+	}
+}
+
+void GTaskGroup::run(const std::function<void()>& task)
+{
+	if(m_pool.threadCount() == 0)
+	{
+		try
 		{
-#ifdef _DEBUG
-			m_working = true;
-#endif
-			doJob(jobId);
-#ifdef _DEBUG
-			m_working = false;
-#endif
+			task();
+		}
+		catch(...)
+		{
+			if(!m_pError)
+				m_pError = std::current_exception();
+		}
+		return;
+	}
+	m_outstanding++;
+	m_pool.push([this, task]()
+	{
+		try
+		{
+			task();
+		}
+		catch(...)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if(!m_pError)
+				m_pError = std::current_exception();
 		}
+		finishTask();
+	});
+}
+
+void GTaskGroup::finishTask()
+{
+	// The decrement happens under the lock so wait cannot return (and the group cannot be destroyed) while this is still in progress
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(--m_outstanding == 0)
+		m_done.notify_all();
+}
+
+void GTaskGroup::wait()
+{
+	while(m_outstanding.load() > 0)
+	{
+		// Help with queued tasks rather than sitting idle. (This also keeps nested waits from deadlocking.)
+		if(m_pool.runOneTask())
+			continue;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait_for(lock, std::chrono::milliseconds(1), [this]() { return m_outstanding.load() == 0; });
+	}
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if(m_pError)
+	{
+		std::exception_ptr pError = m_pError;
+		m_pError = nullptr;
+		std::rethrow_exception(pError);
 	}
-	delete(this);
 }
 
 
@@ -276,99 +342,269 @@ void GWorkerThread::pump()
 
 
 
-GMasterThread::GMasterThread()
-: m_job(0), m_jobCount(0), m_pMasterLock(NULL)
+GThreadPool::GThreadPool(size_t threads)
+: m_pending(0), m_sleeping(0), m_stop(false)
 {
+	for(size_t i = 0; i <= threads; i++)
+		m_queues.push_back(new GThreadPoolQueue());
+	m_threads.reserve(threads);
+	for(size_t i = 0; i < threads; i++)
+		m_threads.push_back(std::thread(&GThreadPool::pump, this, i));
 }
 
-GMasterThread::~GMasterThread()
+GThreadPool::~GThreadPool()
 {
-	for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
 	{
-		if(m_pMasterLock)
-		{
-			GAssert(!(*it)->m_working); // A worker is still working on a job!
-			(*it)->m_keepAlive = false; // The worker thread will delete the worker object
-		}
-		else
-			delete(*it);
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_stop = true;
 	}
-	delete(m_pMasterLock);
+	m_wake.notify_all();
+	for(size_t i = 0; i < m_threads.size(); i++)
+		m_threads[i].join();
+
+	// Tasks left in the shared deque of a pool with no workers are performed now
+	std::function<void()> task;
+	while(take(task))
+		task();
+	for(size_t i = 0; i < m_queues.size(); i++)
+		delete(m_queues[i]);
 }
 
-void GMasterThread::addWorker(GWorkerThread* pWorker)
+// static
+GThreadPool& GThreadPool::global()
 {
-	if(m_pMasterLock)
-		throw Ex("Sorry, workers may not be added after jobs have already been performed.");
-	m_workers.push_back(pWorker);
+	static GThreadPool pool((size_t)std::max(1u, std::thread::hardware_concurrency()) - 1);
+	return pool;
 }
 
-void GMasterThread::doJobs(size_t jobCount)
+void GThreadPool::push(const std::function<void()>& task)
 {
-	// Update the number of available jobs
+	size_t q = (g_pCurrentPool == this ? g_currentWorker : m_threads.size());
+	{
+		std::lock_guard<std::mutex> lock(m_queues[q]->m_mutex);
+		m_queues[q]->m_tasks.push_back(task);
+	}
+	m_pending++;
+
+	// A worker counts itself as sleeping before it checks m_pending, so either it sees this task or we see it sleeping
+	if(m_sleeping.load() > 0)
 	{
-		GSpinLockHolder lockHolder(m_pMasterLock, "GMasterThread::reset");
-		m_job = 0;
-		m_jobCount = jobCount;
-		m_activeWorkers = m_workers.size();
-		for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
-			(*it)->m_boredom = 0;
+		std::lock_guard<std::mutex> lock(m_sleepMutex);
+		m_wake.notify_one();
 	}
+}
 
-	// Make sure there are workers to perform the jobs
-	if(!m_pMasterLock)
+bool GThreadPool::take(std::function<void()>& task)
+{
+	if(m_pending.load() == 0)
+		return false;
+	size_t shared = m_threads.size();
+	size_t self = (g_pCurrentPool == this ? g_currentWorker : shared);
+	for(size_t i = 0; i < m_queues.size(); i++)
 	{
-		if(m_workers.size() < 2)
+		size_t q = (self + i) % m_queues.size();
+		GThreadPoolQueue& queue = *m_queues[q];
+		std::lock_guard<std::mutex> lock(queue.m_mutex);
+		if(queue.m_tasks.empty())
+			continue;
+
+		// Workers take their newest task (it is most likely to be warm in the cache) and steal the oldest task from others
+		if(q == self && q != shared)
 		{
-			// Just do the jobs now
-			if(m_workers.size() == 0)
-				throw Ex("There are no worker threads. addWorker must be called at least once before you call doJobs.");
-			GWorkerThread* pWorker = m_workers[0];
-			while(m_job < m_jobCount)
-				pWorker->doJob(m_job++);
-			m_activeWorkers = 0;
+			task = std::move(queue.m_tasks.back());
+			queue.m_tasks.pop_back();
 		}
 		else
 		{
-			// Spawn a thread for each worker
-			m_pMasterLock = new GSpinLock();
-			for(vector<GWorkerThread*>::iterator it = m_workers.begin(); it != m_workers.end(); it++)
-				GThread::spawnThread(spawnWorker, *it);
+			task = std::move(queue.m_tasks.front());
+			queue.m_tasks.pop_front();
+		}
+		m_pending--;
+		return true;
+	}
+	return false;
+}
+
+bool GThreadPool::runOneTask()
+{
+	std::function<void()> task;
+	if(!take(task))
+		return false;
+	task();
+	return true;
+}
+
+void GThreadPool::pump(size_t index)
+{
+	g_pCurrentPool = this;
+	g_currentWorker = index;
+	std::function<void()> task;
+	while(true)
+	{
+		if(take(task))
+		{
+			task();
+			task = nullptr;
+			continue;
 		}
+		std::unique_lock<std::mutex> lock(m_sleepMutex);
+		m_sleeping++;
+		m_wake.wait(lock, [this]() { return m_stop || m_pending.load() > 0; });
+		m_sleeping--;
+		if(m_stop && m_pending.load() == 0)
+			break;
 	}
+	g_pCurrentPool = NULL;
+}
+
+void GThreadPool::parallelFor(size_t begin, size_t end, const std::function<void(size_t)>& body, size_t maxThreads)
+{
+	parallelForSlots(begin, end, [&body](size_t i, size_t slot) { body(i); }, maxThreads);
+}
 
-	// Sleep until all jobs are done
-	while(m_activeWorkers > 0)
+void GThreadPool::parallelForSlots(size_t begin, size_t end, const std::function<void(size_t i, size_t slot)>& body, size_t maxThreads)
+{
+	if(end <= begin)
+		return;
+	size_t count = end - begin;
+	size_t threads = std::min(participants(maxThreads), count);
+	if(threads < 2)
 	{
-		if(m_jobCount > 20)
-			GThread::sleep(0); // todo: maybe sleep a little longer if there are a lot of jobs
+		for(size_t i = begin; i < end; i++)
+			body(i, 0);
+		return;
 	}
-	GAssert(m_job >= m_jobCount);
+
+	// Each participant claims small chunks of the range until it is used up, so uneven jobs still balance
+	size_t chunk = std::max((size_t)1, count / (threads * 4));
+	std::atomic<size_t> next(begin);
+	auto work = [&](size_t slot)
+	{
+		try
+		{
+			while(true)
+			{
+				size_t start = next.fetch_add(chunk);
+				if(start >= end)
+					break;
+				size_t stop = std::min(end, start + chunk);
+				for(size_t i = start; i < stop; i++)
+					body(i, slot);
+			}
+		}
+		catch(...)
+		{
+			next.store(end); // tell the others to stop
+			throw;
+		}
+	};
+	GTaskGroup group(*this);
+	for(size_t slot = 1; slot < threads; slot++)
+		group.run([&work, slot]() { work(slot); });
+	work(0);
+	group.wait();
 }
 
-size_t GMasterThread::nextJob(GWorkerThread* pWorker)
+#ifndef NO_TEST_CODE
+void GThreadPool_testPool(GThreadPool& pool)
 {
-	GSpinLockHolder lockHolder(m_pMasterLock, "GMasterThread::nextJob");
-	if(m_job < m_jobCount)
+	// Every index should be visited exactly once
+	const size_t n = 1000;
+	std::vector<std::atomic<size_t> > visits(n);
+	for(size_t i = 0; i < n; i++)
+		visits[i] = 0;
+	pool.parallelFor(0, n, [&](size_t i) { visits[i]++; });
+	for(size_t i = 0; i < n; i++)
+	{
+		if(visits[i] != 1)
+			throw Ex("parallelFor visited an index the wrong number of times");
+	}
+
+	// No two concurrent calls should share a slot
+	size_t slots = pool.participants(3);
+	std::vector<std::atomic<size_t> > busy(slots);
+	for(size_t i = 0; i < slots; i++)
+		busy[i] = 0;
+	std::atomic<size_t> collisions(0);
+	std::atomic<size_t> sum(0);
+	pool.parallelForSlots(0, n, [&](size_t i, size_t slot) {
+		if(slot >= slots)
+		{
+			collisions++;
+			return;
+		}
+		if(busy[slot]++ != 0)
+			collisions++;
+		sum += i;
+		busy[slot]--;
+	}, 3);
+	if(collisions != 0)
+		throw Ex("slots were shared");
+	if(sum != n * (n - 1) / 2)
+		throw Ex("wrong sum");
+
+	// Nested loops should not deadlock
+	std::atomic<size_t> nested(0);
+	pool.parallelFor(0, 20, [&](size_t i) {
+		pool.parallelFor(0, 50, [&](size_t j) { nested++; });
+	});
+	if(nested != 1000)
+		throw Ex("nested parallelFor failed");
+
+	// Futures
+	std::future<size_t> f = pool.submit([]() { return (size_t)42; });
+	if(f.get() != 42)
+		throw Ex("wrong future value");
+	std::future<void> g = pool.submit([]() { throw Ex("expected"); });
+	bool threw = false;
+	try
+	{
+		g.get();
+	}
+	catch(const std::exception&)
+	{
+		threw = true;
+	}
+	if(!threw)
+		throw Ex("The future should have rethrown the exception");
+
+	// Exceptions should propagate out of task groups and loops
+	threw = false;
+	try
+	{
+		GTaskGroup group(pool);
+		for(size_t i = 0; i < 10; i++)
+			group.run([i]() { if(i == 7) throw Ex("expected"); });
+		group.wait();
+	}
+	catch(const std::exception&)
 	{
-		pWorker->m_boredom = 0;
-		return m_job++;
+		threw = true;
 	}
-	else
+	if(!threw)
+		throw Ex("The task group should have rethrown the exception");
+	threw = false;
+	try
 	{
-		if(pWorker->m_boredom == 0 && m_activeWorkers > 0)
-			m_activeWorkers--;
-		pWorker->m_boredom = std::min((size_t)100, (pWorker->m_boredom + 1) * 3 / 2);
-		return INVALID_INDEX;
+		pool.parallelFor(0, n, [](size_t i) { if(i == 500) throw Ex("expected"); });
 	}
+	catch(const std::exception&)
+	{
+		threw = true;
+	}
+	if(!threw)
+		throw Ex("parallelFor should have rethrown the exception");
 }
 
 // static
-unsigned int GMasterThread::spawnWorker(void* pWorkerObject)
+void GThreadPool::test()
 {
-	((GWorkerThread*)pWorkerObject)->pump();
-	return 0;
+	GThreadPool serial(0);
+	GThreadPool_testPool(serial);
+	GThreadPool pool(3);
+	GThreadPool_testPool(pool);
 }
+#endif // !NO_TEST_CODE
 
 
 } // namespace GClasses
@@ -21,6 +21,17 @@
 #define __GTHREAD_H__
 
 #include "GError.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 #ifndef WINDOWS
 #	include <pthread.h>
 #	include <unistd.h>
@@ -59,7 +70,7 @@ public:
 
 
 
-/// On Windows, this implements a spin-lock. On Linux, this wraps pthread_mutex.
+/// On Windows, this implements a spin-lock. On Linux, this wraps pthread_mutex, and lock blocks until the mutex is available.
 class GSpinLock
 {
 protected:
@@ -113,93 +124,113 @@ public:
 
 
 
-class GMasterThread;
+class GThreadPool;
+class GThreadPoolQueue;
 
-/// An abstract class for performing jobs.
-/// The idea is that you should be able to write the code to perform the jobs,
-/// then use it in either a serial or parallel manner.
-/// The class you write, that inherits from this one, will typically
-/// have additional constructor parameters that pass in any values or data
-/// necessary to define the jobs.
-class GWorkerThread
+/// Runs a set of tasks on a GThreadPool and waits for all of them to finish.
+/// If any task throws, the first exception is rethrown by wait. The destructor
+/// also waits, so tasks may safely refer to variables on the caller's stack.
+class GTaskGroup
 {
+protected:
+	GThreadPool& m_pool;
+	std::atomic<size_t> m_outstanding;
+	std::mutex m_mutex;
+	std::condition_variable m_done;
+	std::exception_ptr m_pError;
+
 public:
-	volatile bool m_keepAlive;
-	size_t m_boredom; // don't change this value without taking the master lock
-	GMasterThread& m_master;
-#ifdef _DEBUG
-	volatile bool m_working; // this exists only to support a debug assert
-#endif
+	GTaskGroup(GThreadPool& pool);
+	~GTaskGroup();
+
+	/// Queues a task. If the pool has no worker threads, the task is performed immediately.
+	void run(const std::function<void()>& task);
+
+	/// Blocks until every task added with run has finished. While it waits, the calling
+	/// thread helps by performing queued tasks, so it is safe to wait from inside a task.
+	/// Rethrows the first exception thrown by a task, if any.
+	void wait();
 
-	GWorkerThread(GMasterThread& master) : m_keepAlive(true), m_boredom(0), m_master(master) {}
-	virtual ~GWorkerThread() {}
-
-	/// This method is called by the master thread. Users should not need to call it. It pulls jobs
-	/// from the master thread (by calling nextJob()) and does them as long as m_keepAlive is true.
-	/// If the master returns INVALID_INDEX for the job id, it goes to sleep for a short time.
-	/// (Each time it receives INVALID_INDEX, it becomes more bored, and so sleeps a little longer,
-	/// up to a maximum nap of 100ms. When it receives a job, the boredom counter resets to 0.)
-	/// When m_keepAlive is set to false, this method will delete this object and exit.
-	void pump();
-
-	/// This method should be implemented to perform the job indicated
-	/// by the specified id. (The job ids range from 0 to jobCount-1.)
-	/// The implementing class should be designed such that jobId is sufficient
-	/// for it to obtain any information that it needs to do the job.
-	/// Also, this method is also reponsible to report the results in a
-	/// thread-safe manner. Here is an example of how to take a lock in order to do
-	/// something critical:
-	/// GSpinLockHolder lockHolder(m_master.getLock(), "MyWorkerThread::doJob");
-	/// (Note that this assumes the master will never be deleted while a worker is doing a job.)
-	virtual void doJob(size_t jobId) = 0;
+protected:
+	void finishTask();
 };
 
 
-/// Manages a pool of GWorkerThread objects. To use this class,
-/// first call addWorker one or more times. Then, call doJobs.
-class GMasterThread
+/// A pool of threads with a work-stealing scheduler. Each worker owns a deque of tasks.
+/// It pops from the back of its own deque, and when that is empty it steals from the
+/// front of the others. Idle workers block on a condition variable instead of polling.
+/// Most code should just use GThreadPool::global(), so all components share one set of threads.
+class GThreadPool
 {
+friend class GTaskGroup;
 protected:
-	size_t m_job;
-	size_t m_jobCount;
-	std::vector<GWorkerThread*> m_workers;
-	GSpinLock* m_pMasterLock;
-	volatile size_t m_activeWorkers;
+	std::vector<std::thread> m_threads;
+	std::vector<GThreadPoolQueue*> m_queues; // one per worker, plus one for tasks queued by other threads
+	std::atomic<size_t> m_pending;
+	std::atomic<size_t> m_sleeping;
+	std::mutex m_sleepMutex;
+	std::condition_variable m_wake;
+	bool m_stop;
 
 public:
-	GMasterThread();
-
-	/// Note that all worker threads reference the master, so it is not okay to delete the
-	/// master while a worker is still doing a job.
-	~GMasterThread();
-
-	/// Adds a worker to the pool. Takes ownership of the worker object.
-	void addWorker(GWorkerThread* pWorker);
-
-	/// Perform some jobs. The job ids will range from 0 to jobCount-1.
-	/// If no workers have been added, throws an exception.
-	/// If only one worker has been added, that worker performs all of the
-	/// jobs in the same thread as the master (so no new threads are spawned).
-	/// If two or more workers have been added to the pool, the jobs will be
-	/// performed by those workers in separate threads.
-	/// This method does not return until all the jobs are done.
-	void doJobs(size_t jobCount);
-
-	/// This method is called by worker threads to obtain the next available job.
-	/// Calling it is a contract to complete the job. Returns INVALID_INDEX if
-	/// there are no more jobs to do. In that case, the worker thread should terminate.
-	/// (This method is already synchronized, so you do not need to take a lock
-	/// before calling it.)
-	size_t nextJob(GWorkerThread* pWorkerWhoWantsAJob);
-
-	/// Returns a pointer to the master lock. (If there is only one worker, then there
-	/// are no worker threads, and this method will return NULL. Note that GSpinLockHolder
-	/// checks for NULL, so it provides a good way to take the lock.)
-	GSpinLock* getLock() { return m_pMasterLock; }
+	/// Spawns the specified number of worker threads. If threads is 0, no threads are spawned
+	/// and every task is performed in the thread that submits or waits for it.
+	GThreadPool(size_t threads);
+
+	/// Finishes any queued tasks, then joins the worker threads.
+	~GThreadPool();
+
+#ifndef NO_TEST_CODE
+	/// Performs unit tests for this class. Throws an exception if there is a failure.
+	static void test();
+#endif // !NO_TEST_CODE
+
+	/// Returns a pool shared by the whole process. It has one fewer worker than the
+	/// number of hardware threads, since the thread that waits for a job also helps perform it.
+	static GThreadPool& global();
+
+	/// Returns the number of worker threads in this pool.
+	size_t threadCount() const { return m_threads.size(); }
+
+	/// Returns the number of threads (including the caller) that parallelFor would use
+	/// with the specified cap.
+	size_t participants(size_t maxThreads = INVALID_INDEX) const { return std::max((size_t)1, std::min(maxThreads, m_threads.size() + 1)); }
+
+	/// Calls body(i) for every i in [begin, end), spreading the calls across at most
+	/// maxThreads threads (including the calling thread). Returns when all the calls are done.
+	/// If any call throws, the first exception is rethrown.
+	void parallelFor(size_t begin, size_t end, const std::function<void(size_t)>& body, size_t maxThreads = INVALID_INDEX);
+
+	/// Like parallelFor, except body also receives a slot number in [0, participants(maxThreads)).
+	/// No two concurrent calls share a slot, so the caller can give each slot its own scratch buffers.
+	void parallelForSlots(size_t begin, size_t end, const std::function<void(size_t i, size_t slot)>& body, size_t maxThreads = INVALID_INDEX);
+
+	/// Queues a function and returns a future for its result.
+	template<typename F>
+	std::future<typename std::result_of<F()>::type> submit(F f)
+	{
+		typedef typename std::result_of<F()>::type R;
+		std::shared_ptr<std::packaged_task<R()> > pTask(new std::packaged_task<R()>(f));
+		std::future<R> result = pTask->get_future();
+		if(m_threads.size() == 0)
+			(*pTask)();
+		else
+			push([pTask]() { (*pTask)(); });
+		return result;
+	}
 
 protected:
-	/// This is a helper function that spawns a worker thread
-	static unsigned int spawnWorker(void* pWorkerObject);
+	/// Adds a task to the deque of the calling worker, or to the shared deque if the caller is not one of this pool's workers.
+	void push(const std::function<void()>& task);
+
+	/// Takes one queued task, preferring the calling worker's own deque. Returns false if there are none.
+	bool take(std::function<void()>& task);
+
+	/// Performs one queued task, if there is one. Returns false if there were none.
+	bool runOneTask();
+
+	/// The main loop of each worker thread
+	void pump(size_t index);
 };
 
 
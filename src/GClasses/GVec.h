@@ -40,6 +40,7 @@ class GVec
 {
 friend class GVecWrapper;
 friend class GConstVecWrapper;
+friend class GMatrix;
 protected:
 	double* m_data;
 	size_t m_size;
@@ -230,9 +230,24 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-random [draws]=1", "Use random divisions (instead of divisions that reduce entropy). Random divisions make the algorithm train faster, and also increase model variance, so it is better suited for ensembles, "
 			"but random divisions also make the decision tree more vulnerable to problems with irrelevant features. [draws] is typically 1, but if you specify a larger value, it will pick the best out of the specified number of random draws.");
 		pOpts->add("-binary", "Use binary divisions. For nominal attributes with more than 2 categorical values, one specific value will be separated from all others at each division.");
+		pOpts->add("-histogram [bins]=256", "Find the divisions from histograms of quantized features. Each feature is divided once into at most [bins]-1 quantile bins, and the splits are found from per-node label histograms instead of by repeatedly dividing the data. This is much faster with big datasets. It implies -binary. [bins] must be from 3 to 256.");
 		pOpts->add("-leafthresh [n]=1", "When building the tree, if the number of samples is <= this value, it will stop trying to divide the data and will create a leaf node. The default value is 1. For noisy data, larger values may be advantageous.");
 		pOpts->add("-maxlevels [n]=5", "When building the tree, if the depth (the length of the path from the root to the node currently being formed, including the root and the currently forming node) is [n], it will stop trying to divide the data and will create a "
 			"leaf node.  This means that there will be at most [n]-1 splits before a decision is made.  This crudely limits overfitting, and so can be helpful on small data sets.  It can also make the resulting trees easier to interpret.  If set to 0, then there is no maximum (which is the default).");
+		pOpts->add("-parallelnodes [rows]=10000", "Build the branches below any node with at least [rows] training rows concurrently. The tree does not depend on the number of threads, but it differs from the one that is built without this option.");
+		pOpts->add("-parallelattrs [n]=64", "Evaluate the candidate attributes of a node in parallel when there are at least [n] of them. This helps with very wide data. (Histogram divisions always evaluate the attributes in parallel.)");
+	}
+	{
+		UsageNode* pGBT = pRoot->add("gbt <options>", "Gradient-boosted regression trees. Each round fits a histogram-based decision tree to the gradient of the loss (squared error for continuous labels, softmax cross-entropy for nominal labels).");
+		UsageNode* pOpts = pGBT->add("<options>");
+		pOpts->add("-trees [n]=100", "The maximum number of boosting rounds.");
+		pOpts->add("-rate [r]=0.1", "The learning rate (shrinkage) that scales the contribution of each tree.");
+		pOpts->add("-rowsample [p]=1.0", "The portion of the training rows (drawn without replacement) that each tree is fit with.");
+		pOpts->add("-colsample [p]=1.0", "The portion of the features that each tree may divide on.");
+		pOpts->add("-validate [p] [patience]", "Hold out the portion [p] of the training data, and stop when the loss on it has not improved for [patience] rounds. The trees after the best round are discarded.");
+		pOpts->add("-leafthresh [n]=20", "Rows at or below this count are not divided further.");
+		pOpts->add("-maxlevels [n]=7", "The maximum depth of each tree, including the root and the leaf.");
+		pOpts->add("-bins [n]=256", "The number of histogram bins per feature. Must be from 3 to 256.");
 	}
 	{
 		UsageNode* pGP = pRoot->add("gaussianprocess <options>", "A Gaussian process model.");
@@ -265,6 +280,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pOpts->add("-nonormalize", "Specify not to normalize the scale of continuous features. (The default is to normalize by dividing by 2 times the deviation in that attribute.)");
 		pOpts->add("-equalweight", "Give equal weight to every neighbor. (The default is to use linear weighting for continuous features, and sqared linear weighting for nominal features.");
 		pOpts->add("-scalefeatures", "Use a hill-climbing algorithm on the training set to scale the feature dimensions in order to give more accurate results. This increases training time, but also improves accuracy and robustness to irrelevant features.");
+		pOpts->add("-approximate [ef]", "Find the neighbors with an approximate HNSW graph instead of an exact kd-tree. This is much faster with large or high-dimensional training sets, but occasionally misses a true neighbor. ef is the size of the candidate list used by each query. Bigger values are more accurate, but slower. (50 is a reasonable value.)");
 		pOpts->add("-pearson", "Use Pearson's correlation coefficient to evaluate the similarity between sparse vectors. (Only compatible with sparse training.)");
 		pOpts->add("-cosine", "Use the cosine method to evaluate the similarity between sparse vectors. (Only compatible with sparse training.)");
 	}
@@ -310,6 +326,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pAdd->add("softroot", "A softroot nonlinearity block");
 		pAdd->add("tanh", "A softroot nonlinearity block");
 		pOpts->add("-concat [inpos] [block]", "Concatenate a block to the last block in this neural net.");
+		pOpts->add("-float", "Propagate with single-precision copies of the weights in linear blocks. The weights are still trained and stored in double precision, and this setting is saved with the model.");
 /*		pOpts->add("-learningrate [value]=0.1", "Specify a value for the learning rate. The default is 0.1");
 		pOpts->add("-momentum [value]=0.0", "Specifies a value for the momentum. The default is 0.0");
 		pOpts->add("-windowepochs [value]=200", "Specifies the number of training epochs that are performed before the stopping criteria is tested again. Bigger values will result in a more stable stopping criteria. Smaller values will check the stopping criteria more frequently.");
@@ -334,6 +351,7 @@ UsageNode* makeAlgorithmUsageTree()
 		pRF->add("[trees]=50", "Specify the number of trees in the random forest");
 		UsageNode* pOpts = pRF->add("<options>");
 		pOpts->add("-samples [n]=1", "Specify the number of randomly-drawn attributes to evaluate. The one that maximizes information gain will be chosen for the decision boundary. If [n] is 1, then the divisions are completely random. Larger values will decrease the randomness.");
+		pOpts->add("-threads [n]", "Specify the maximum number of threads that grow trees concurrently. The default is to use all of the hardware threads. The trained forest does not depend on this value.");
 	}
 	{
 		UsageNode* pRes = pRoot->add("reservoir <options>", "A reservoir network.");
@@ -467,7 +485,12 @@ UsageNode* makeAudioUsageTree()
 UsageNode* makeClusterUsageTree()
 {
 	UsageNode* pRoot = new UsageNode("waffles_cluster [command]", "Cluster data.");
-	pRoot->add("agglomerative [dataset] [clusters]", "Performs single-link agglomerative clustering. Outputs the cluster id for each row.");
+	{
+		UsageNode* pAgg = pRoot->add("agglomerative [dataset] [clusters] <options>", "Performs hierarchical agglomerative clustering. Outputs the cluster id for each row.");
+		pAgg->add("[dataset]=in.arff", "The filename of a dataset to cluster.");
+		UsageNode* pOpts = pAgg->add("<options>");
+		pOpts->add("-linkage [type]=single", "Specify how to measure the distance between clusters. [type] may be \"single\" (the closest members), \"complete\" (the farthest members), \"average\" (the mean distance between members), or \"ward\" (the increase in the sum-squared error). Complete and average linkage need memory proportional to the square of the number of rows.");
+	}
 	{
 		UsageNode* pFKM = pRoot->add("fuzzykmeans [dataset] [clusters] <options>", "Performs fuzzy k-means clustering. Outputs the cluster id for each row. This algorithm is specified in Li, D. and Deogun, J. and Spaulding, W. and Shuart, B., Towards missing data imputation: A study of fuzzy K-means clustering method, In Rough Sets and Current Trends in Computing, Springer, pages 573--579, 2004.");
 		pFKM->add("[dataset]=in.arff", "The filename of a dataset to cluster.");
@@ -482,9 +505,26 @@ UsageNode* makeClusterUsageTree()
 		UsageNode* pOpts = pKM->add("<options>");
 		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
 		pOpts->add("-reps [n]=1", "Cluster the data [n] times, and return the clustering that minimizes the sum-squared-distance between each row and its corresponding centroid.");
+		pOpts->add("-accelerate", "Use Hamerly's bounds to skip most of the distance computations. The clustering is the same, but it is much faster when there are many clusters.");
+	}
+	{
+		UsageNode* pKMed = pRoot->add("kmedoids [dataset] [clusters] <options>", "Performs k-medoids clustering with the BUILD and FastPAM1 swap steps. Outputs the cluster id for each row.");
+		pKMed->add("[dataset]=in.arff", "The filename of a dataset to cluster.");
+		UsageNode* pOpts = pKMed->add("<options>");
+		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
+		pOpts->add("-clara [samples] [size]", "Use CLARA, which clusters [samples] random samples of [size] rows each, and keeps the medoids that do best on all of the rows. This is much faster when there are many rows. 5 samples of 40+2k rows is a common choice.");
+		pOpts->add("-cache [n]=0", "Cache the distances from up to [n] rows to every row, so that they need not be computed again in each swap step.");
 	}
 	{
-		pRoot->add("kmedoids [dataset] [clusters]", "Performs k-medoids clustering. Outputs the cluster id for each row.");
+		UsageNode* pMBKM = pRoot->add("minibatchkmeans [dataset] [clusters] <options>", "Performs mini-batch k-means clustering. The centroids are seeded with k-means++ on a sample of the rows, and then each step moves them toward a small batch of rows. Outputs the cluster id for each row.");
+		pMBKM->add("[dataset]=in.arff", "The filename of a dataset to cluster.");
+		UsageNode* pOpts = pMBKM->add("<options>");
+		pOpts->add("-seed [value]=0", "Specify a seed for the random number generator.");
+		pOpts->add("-batchsize [n]=1024", "The number of rows in each mini-batch.");
+		pOpts->add("-iters [n]=100", "The number of mini-batch steps to take. (Ignored with -stream.)");
+		pOpts->add("-samplesize [n]=100000", "The maximum number of rows to seed the centroids with.");
+		pOpts->add("-parallelseeding", "Seed with k-means|| instead of k-means++. It needs fewer passes over the sample when there are many clusters.");
+		pOpts->add("-stream [passes]", "Do not load the dataset into memory. Instead, stream the ARFF file [passes] times (at least 1), treating each batch of consecutive rows as one mini-batch, and then stream it once more to print the cluster of each row. The rows of the file should be in random order.");
 	}
 	{
 		pRoot->add("usage", "Print usage information.");
@@ -537,6 +577,8 @@ UsageNode* makeCollaborativeFilterUsageTree()
 		pOpts->add("-miniters [value]=1", "Specify a the minimum number of iterations to train the model before checking its validation error. This ensures that model does at least a certain amount of training before converging.");
 		pOpts->add("-decayrate [value]=0.97", "Specify a decay rate in the range of (0-1) for the learning rate parameter. Value closer to 1 will cause the rate the decay slower while rate closer to 0 cause the a faster decay.");
 		pOpts->add("-nonneg", "Constrain all non-bias weights to be non-negative");
+		pOpts->add("-strata [n]", "Train with a stratified schedule that runs in parallel. Users and items are each divided into [n] groups, and in each pass [n] blocks of ratings that share no users or items are trained concurrently. The result does not depend on the number of threads. [n] should be at least the number of cores. (Not compatible with -clampusers or -clampitems.)");
+		pOpts->add("-float32", "Store the factors in single precision. This halves the memory they need. (Implies the stratified schedule.)");
 	}
 	{
 		UsageNode* pNLPCA = pRoot->add("nlpca [intrinsic] <options>", "A non-linear PCA collaborative-filtering algorithm. This algorithm was published in Scholz, M. Kaplan, F. Guy, C. L. Kopka, J. Selbig, J., Non-linear PCA: a missing data approach, In Bioinformatics,"
@@ -1124,6 +1166,7 @@ UsageNode* makeLearnUsageTree()
 		pOpts->add("-reps [value]=5", "Specify the number of repetitions to perform. If not specified, the default is 5.");
 		pOpts->add("-folds [value]=2", "Specify the number of folds to use. If not specified, the default is 2.");
 		pOpts->add("-succinct", "Just report the average mean squared error. Do not report results at each fold.");
+		pOpts->add("-memory [megabytes]=1024", "Limit the number of folds that are trained concurrently, so that their copies of the learner and their lists of training and test rows fit within approximately this many megabytes. (Folds are only trained concurrently with algorithms that support it, on machines with more than one hardware thread. This limit does not change the results. If not specified, there is no limit.)");
 		pCV->add("[dataset]=data.arff", "The filename of a dataset.");
 		UsageNode* pDO = pCV->add("<data_opts>");
 		pDO->add("-labels [attr_list]=0", "Specify which attributes to use as labels. (If not specified, the default is to use the last attribute for the label.) [attr_list] is a comma-separated list of zero-indexed columns. A hypen may be used to specify a range of columns.  A '*' preceding a value means to index from the right instead of the left. For example, \"0,2-5\" refers to columns 0, 2, 3, 4, and 5. \"*0\" refers to the last column. \"0-*1\" refers to all but the last column.");
@@ -1874,6 +1917,11 @@ UsageNode* makeTransformUsageTree()
 		pSC->add("[col1]=0", "A zero-indexed column number.");
 		pSC->add("[col2]=1", "A zero-indexed column number.");
 	}
+	{
+		UsageNode* pToBinary = pRoot->add("tobinary [dataset] [filename]", "Saves the dataset in the binary \".wbin\" format. All of the tools load a \".wbin\" file by mapping it into memory, so nothing has to be parsed. This is much faster than ARFF for big datasets that will be loaded several times.");
+		pToBinary->add("[dataset]=in.arff", "The filename of a dataset.");
+		pToBinary->add("[filename]=out.wbin", "The name of the file to write.");
+	}
 	{
 		UsageNode* pTransition = pRoot->add("transition [action-sequence] [state-sequence] <options>", "Given a sequence of actions and a sequence of states (each in separate datasets), this generates a single dataset to map from action-state pairs to the next state. This would be useful for generating the data to train a transition function.");
 		UsageNode* pOpts = pTransition->add("<options>");
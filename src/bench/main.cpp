@@ -0,0 +1,681 @@
+/*
+  The contents of this file are dedicated by all of its authors, including
+
+    Michael S. Gashler,
+    anonymous contributors,
+
+  to the public domain (http://creativecommons.org/publicdomain/zero/1.0/).
+
+  Note that some moral obligations still exist in the absence of legal ones.
+  For example, it would still be dishonest to deliberately misrepresent the
+  origin of a work. Although we impose no legal requirements to obtain a
+  license, it is beseeming for those who build on the works of others to
+  give back useful improvements, or pay it forward in their own field. If
+  you would like to cite us, a published paper about Waffles can be found
+  at http://jmlr.org/papers/volume12/gashler11a/gashler11a.pdf. If you find
+  our code to be useful, the Waffles team would love to hear how you use it.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include "../GClasses/GApp.h"
+#include "../GClasses/GBlock.h"
+#include "../GClasses/GCluster.h"
+#include "../GClasses/GError.h"
+#include "../GClasses/GFile.h"
+#include "../GClasses/GMatrix.h"
+#include "../GClasses/GNeighborFinder.h"
+#include "../GClasses/GNeuralNet.h"
+#include "../GClasses/GRand.h"
+#include "../GClasses/GTime.h"
+
+using namespace GClasses;
+using std::cout;
+using std::cerr;
+
+void showUsage(const char* appName)
+{
+	cout << "Usage: " << appName << " [command] <options>\n";
+	cout << "\n";
+	cout << "Commands:\n";
+	cout << "  usage                Print this message.\n";
+	cout << "  gemm <options>       Time GMatrix::multiply against a naive triple loop\n";
+	cout << "                       for all four transpose combinations.\n";
+	cout << "    -size [n]          Multiply two n-by-n matrices. (Default 512.)\n";
+	cout << "    -reps [r]          Report the best of r repetitions. (Default 3.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout << "  conv <options>       Time the convolution algorithms of GBlockConvolutional2D\n";
+	cout << "                       (direct loops, im2col, and Winograd) on representative image\n";
+	cout << "                       sizes, for forward propagation, backpropagation, and the gradient.\n";
+	cout << "    -batch [n]         The number of images in each batch. (Default 8.)\n";
+	cout << "    -reps [r]          Report the best of r repetitions. (Default 3. The direct\n";
+	cout << "                       loops, which are the reference point, are only timed once.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout << "  recurrent <options>  Time LSTM and GRU networks propagating each sequence by itself\n";
+	cout << "                       against propagating a batch of sequences in lockstep, for\n";
+	cout << "                       prediction and for training with truncated windows.\n";
+	cout << "    -sequences [n]     The number of sequences. (Default 32.)\n";
+	cout << "    -length [l]        The number of steps in each sequence. (Default 100.)\n";
+	cout << "    -window [w]        The number of steps in each training window. (Default 4.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout << "  inference <options>  Time the forward propagation of linear and convolutional networks\n";
+	cout << "                       with double-precision, float, and int8 weights, one sample at a\n";
+	cout << "                       time and in batches. (Only linear blocks have a float mode.)\n";
+	cout << "    -batch [n]         The number of samples. (Default 64.)\n";
+	cout << "    -reps [r]          Report the best of r repetitions. (Default 3.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout << "  knn <options>        Time GHnswNeighborFinder against brute force on random\n";
+	cout << "                       normal data, and report its recall at several efSearch values.\n";
+	cout << "    -rows [n]          The number of points. (Default 20000.)\n";
+	cout << "    -dims [d]          The number of dimensions. (Default 64.)\n";
+	cout << "    -k [k]             The number of neighbors to find. (Default 10.)\n";
+	cout << "    -queries [q]       The number of queries. (Default 500.)\n";
+	cout << "    -m [m]             The number of links per point. (Default 16.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout << "  kmeans <options>     Time GKMeans with and without Hamerly's bounds on random\n";
+	cout << "                       blobs, and count the rows that the two assign differently.\n";
+	cout << "    -rows [n]          The number of points. (Default 100000.)\n";
+	cout << "    -dims [d]          The number of dimensions. (Default 16.)\n";
+	cout << "    -k [k]             The number of clusters. (Default 32.)\n";
+	cout << "    -seed [s]          Seed the random number generator. (Default 0.)\n";
+	cout.flush();
+}
+
+/// The textbook product, used as the reference point for gemm.
+void naiveMultiply(const GMatrix& a, const GMatrix& b, GMatrix& out, bool transposeA, bool transposeB)
+{
+	size_t h = transposeA ? a.cols() : a.rows();
+	size_t w = transposeB ? b.rows() : b.cols();
+	size_t dims = transposeA ? a.rows() : a.cols();
+	out.resize(h, w);
+	for(size_t i = 0; i < h; i++)
+	{
+		GVec& o = out[i];
+		for(size_t j = 0; j < w; j++)
+		{
+			double sum = 0.0;
+			for(size_t k = 0; k < dims; k++)
+				sum += (transposeA ? a[k][i] : a[i][k]) * (transposeB ? b[j][k] : b[k][j]);
+			o[j] = sum;
+		}
+	}
+}
+
+void gemm(GArgReader& args)
+{
+	size_t n = 512;
+	size_t reps = 3;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-size"))
+			n = args.pop_uint();
+		else if(args.if_pop("-reps"))
+			reps = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(n < 1 || reps < 1)
+		throw Ex("Expected a positive size and repetition count");
+	GRand rand(seed);
+	GMatrix a(n, n);
+	GMatrix b(n, n);
+	for(size_t i = 0; i < n; i++)
+	{
+		a[i].fillNormal(rand);
+		b[i].fillNormal(rand);
+	}
+	double flops = 2.0 * (double)n * (double)n * (double)n;
+	cout << "n=" << n << ", best of " << reps << " repetitions\n";
+	cout << "transpose\tnaive (s)\tnaive GFLOP/s\tblocked (s)\tblocked GFLOP/s\tspeedup\tmax error\n";
+	for(size_t combo = 0; combo < 4; combo++)
+	{
+		bool transposeA = (combo & 2) != 0;
+		bool transposeB = (combo & 1) != 0;
+		GMatrix reference;
+		double naiveBest = 1e308;
+		for(size_t r = 0; r < reps; r++)
+		{
+			double start = GTime::seconds();
+			naiveMultiply(a, b, reference, transposeA, transposeB);
+			naiveBest = std::min(naiveBest, GTime::seconds() - start);
+		}
+		std::unique_ptr<GMatrix> hProduct;
+		double blockedBest = 1e308;
+		for(size_t r = 0; r < reps; r++)
+		{
+			double start = GTime::seconds();
+			hProduct.reset(GMatrix::multiply(a, b, transposeA, transposeB));
+			blockedBest = std::min(blockedBest, GTime::seconds() - start);
+		}
+		double maxErr = 0.0;
+		for(size_t i = 0; i < n; i++)
+		{
+			for(size_t j = 0; j < n; j++)
+				maxErr = std::max(maxErr, std::abs((*hProduct)[i][j] - reference[i][j]));
+		}
+		cout << (transposeA ? "T" : "N") << (transposeB ? "T" : "N") << "\t\t";
+		cout << naiveBest << "\t" << (flops * 1e-9 / naiveBest) << "\t";
+		cout << blockedBest << "\t" << (flops * 1e-9 / blockedBest) << "\t";
+		cout << (naiveBest / blockedBest) << "\t" << maxErr << "\n";
+		cout.flush();
+	}
+}
+
+void conv(GArgReader& args)
+{
+	size_t batch = 8;
+	size_t reps = 3;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-batch"))
+			batch = args.pop_uint();
+		else if(args.if_pop("-reps"))
+			reps = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(batch < 1 || reps < 1)
+		throw Ex("Expected a positive batch size and repetition count");
+	GRand rand(seed);
+
+	// width/height, channels, kernels, kernel size (all with enough padding to preserve the image size)
+	size_t geometries[][4] = {
+		{ 28, 1, 16, 3 },
+		{ 32, 16, 32, 3 },
+		{ 32, 16, 32, 5 },
+		{ 64, 16, 16, 3 },
+		{ 16, 64, 64, 3 },
+	};
+	GBlockConvolutional2D::Algorithm algs[] = { GBlockConvolutional2D::conv_direct, GBlockConvolutional2D::conv_im2col, GBlockConvolutional2D::conv_winograd };
+	const char* passNames[] = { "forward", "backward", "gradient" };
+	cout << "batch=" << batch << ", best of " << reps << " repetitions\n";
+	cout << "image\t\tkernels\tpass\t\tdirect (s)\tim2col (s)\tspeedup\twinograd (s)\tspeedup\tmax error\n";
+	for(size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++)
+	{
+		size_t size = geometries[g][0];
+		size_t channels = geometries[g][1];
+		size_t kernels = geometries[g][2];
+		size_t kSize = geometries[g][3];
+		GNeuralNet nn;
+		GBlockConvolutional2D* pConv = new GBlockConvolutional2D(size, size, channels, kSize, kSize, kernels);
+		pConv->setPadding(kSize / 2);
+		nn.add(pConv);
+		nn.init(pConv->inputs(), pConv->outputs(), rand);
+		nn.perturbWeights(rand, 0.1);
+		GContextNeuralNet* pCtx = nn.newContext(rand);
+		std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+		GMatrix x(batch, pConv->inputs());
+		x.fillUniform(rand, -1.0, 1.0);
+		GMatrix blame(batch, pConv->outputs());
+		blame.fillUniform(rand, -1.0, 1.0);
+		GMatrix y(batch, pConv->outputs());
+		GMatrix inBlame(batch, pConv->inputs());
+		GVec grad(nn.weightCount());
+
+		double times[3][3];
+		double maxErr[3] = { 0.0, 0.0, 0.0 };
+		GMatrix yRef, inBlameRef;
+		GVec gradRef;
+		for(size_t a = 0; a < 3; a++)
+		{
+			pConv->setAlgorithm(algs[a]);
+			bool winogradFallsBack = (algs[a] == GBlockConvolutional2D::conv_winograd && kSize != 3);
+			for(size_t pass = 0; pass < 3; pass++)
+			{
+				double best = 1e308;
+				for(size_t r = 0; r < (a == 0 ? 1 : reps); r++)
+				{
+					double start = GTime::seconds();
+					if(pass == 0)
+						nn.forwardPropBatch(*pCtx, x, y);
+					else if(pass == 1)
+						nn.backPropBatch(*pCtx, x, y, blame, inBlame);
+					else
+					{
+						grad.fill(0.0);
+						nn.updateGradientBatch(*pCtx, x, blame, grad);
+					}
+					best = std::min(best, GTime::seconds() - start);
+				}
+				times[a][pass] = winogradFallsBack ? -1.0 : best;
+			}
+			if(a == 0)
+			{
+				yRef.copy(y);
+				inBlameRef.copy(inBlame);
+				gradRef.copy(grad);
+			}
+			else
+			{
+				for(size_t i = 0; i < batch; i++)
+				{
+					for(size_t j = 0; j < y.cols(); j++)
+						maxErr[0] = std::max(maxErr[0], std::abs(y[i][j] - yRef[i][j]));
+					for(size_t j = 0; j < inBlame.cols(); j++)
+						maxErr[1] = std::max(maxErr[1], std::abs(inBlame[i][j] - inBlameRef[i][j]));
+				}
+				for(size_t j = 0; j < grad.size(); j++)
+					maxErr[2] = std::max(maxErr[2], std::abs(grad[j] - gradRef[j]));
+			}
+		}
+		for(size_t pass = 0; pass < 3; pass++)
+		{
+			cout << size << "x" << size << "x" << channels << "\t" << kernels << "@" << kSize << "x" << kSize << "\t" << passNames[pass] << "\t";
+			cout << times[0][pass] << "\t" << times[1][pass] << "\t" << (times[0][pass] / times[1][pass]) << "\t";
+			if(times[2][pass] < 0.0)
+				cout << "n/a\t\tn/a\t";
+			else
+				cout << times[2][pass] << "\t" << (times[0][pass] / times[2][pass]) << "\t";
+			cout << maxErr[pass] << "\n";
+			cout.flush();
+		}
+	}
+}
+
+void recurrent(GArgReader& args)
+{
+	size_t sequences = 32;
+	size_t length = 100;
+	size_t window = 4;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-sequences"))
+			sequences = args.pop_uint();
+		else if(args.if_pop("-length"))
+			length = args.pop_uint();
+		else if(args.if_pop("-window"))
+			window = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(sequences < 1 || length < 1 || window < 1)
+		throw Ex("Expected a positive number of sequences, length, and window");
+	GRand rand(seed);
+	std::vector<std::unique_ptr<GMatrix> > hMatrices;
+	std::vector<const GMatrix*> features;
+	std::vector<const GMatrix*> labels;
+	for(size_t i = 0; i < sequences; i++)
+	{
+		GMatrix* pF = new GMatrix(length, 8);
+		hMatrices.emplace_back(pF);
+		pF->fillUniform(rand, -1.0, 1.0);
+		features.push_back(pF);
+		GMatrix* pL = new GMatrix(length, 2);
+		hMatrices.emplace_back(pL);
+		pL->fillUniform(rand, -1.0, 1.0);
+		labels.push_back(pL);
+	}
+
+	size_t unitCounts[] = { 32, 128 };
+	cout << "sequences=" << sequences << ", length=" << length << ", window=" << window << "\n";
+	cout << "block\tunits\tpass\t\tsingle (s)\tbatched (s)\tspeedup\tmax error\n";
+	for(size_t type = 0; type < 2; type++)
+	{
+		for(size_t u = 0; u < sizeof(unitCounts) / sizeof(unitCounts[0]); u++)
+		{
+			size_t units = unitCounts[u];
+			GNeuralNet nn;
+			nn.add(new GBlockLinear(units));
+			if(type == 0)
+				nn.add(new GBlockLSTM(units));
+			else
+				nn.add(new GBlockGRU(units));
+			nn.add(new GBlockLinear(2));
+			nn.init(8, 2, rand);
+			GContextNeuralNet* pCtx = nn.newContext(rand);
+			std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+			GContextSequenceBatch batchCtx(rand, nn, sequences);
+			const char* name = (type == 0 ? "LSTM" : "GRU");
+
+			// Predict one sequence at a time, then all of them together
+			GMatrix single(sequences * length, 2);
+			double start = GTime::seconds();
+			for(size_t i = 0; i < sequences; i++)
+			{
+				pCtx->resetState();
+				for(size_t t = 0; t < length; t++)
+					nn.forwardProp(*pCtx, (*features[i])[t], single[i * length + t]);
+			}
+			double singleTime = GTime::seconds() - start;
+			GMatrix in(sequences, 8);
+			std::vector<bool> active(sequences, true);
+			double maxErr = 0.0;
+			start = GTime::seconds();
+			batchCtx.resetState();
+			for(size_t t = 0; t < length; t++)
+			{
+				batchCtx.beginWindow();
+				for(size_t i = 0; i < sequences; i++)
+					in[i].copy((*features[i])[t]);
+				const GMatrix& out = batchCtx.forwardProp(in, active);
+				for(size_t i = 0; i < sequences; i++)
+				{
+					for(size_t j = 0; j < 2; j++)
+						maxErr = std::max(maxErr, std::abs(out[i][j] - single[i * length + t][j]));
+				}
+			}
+			double batchTime = GTime::seconds() - start;
+			cout << name << "\t" << units << "\tpredict\t\t" << singleTime << "\t" << batchTime << "\t" << (singleTime / batchTime) << "\t" << maxErr << "\n";
+
+			// Train one sequence at a time, then all of them together
+			GSGDOptimizer optimizer(nn, rand);
+			optimizer.setLearningRate(0.001);
+			start = GTime::seconds();
+			for(size_t i = 0; i < sequences; i++)
+			{
+				optimizer.resetState();
+				for(size_t t = 0; t < length; t++)
+					optimizer.optimizeIncremental((*features[i])[t], (*labels[i])[t]);
+			}
+			singleTime = GTime::seconds() - start;
+			start = GTime::seconds();
+			optimizer.optimizeSequences(features, labels, window);
+			batchTime = GTime::seconds() - start;
+			cout << name << "\t" << units << "\ttrain\t\t" << singleTime << "\t" << batchTime << "\t" << (singleTime / batchTime) << "\tn/a\n";
+			cout.flush();
+		}
+	}
+}
+
+void inference(GArgReader& args)
+{
+	size_t batch = 64;
+	size_t reps = 3;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-batch"))
+			batch = args.pop_uint();
+		else if(args.if_pop("-reps"))
+			reps = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(batch < 1 || reps < 1)
+		throw Ex("Expected a positive batch size and repetition count");
+	GRand rand(seed);
+
+	// Linear blocks are given by their size. Convolutional blocks are given by width/height,
+	// channels, kernels, and kernel size (with enough padding to preserve the image size).
+	size_t linearSizes[] = { 256, 1024, 4096 };
+	size_t convGeometries[][4] = {
+		{ 28, 1, 16, 3 },
+		{ 32, 16, 32, 3 },
+	};
+	size_t linearCount = sizeof(linearSizes) / sizeof(linearSizes[0]);
+	size_t netCount = linearCount + sizeof(convGeometries) / sizeof(convGeometries[0]);
+	const char* passNames[] = { "single", "batch" };
+	cout << "batch=" << batch << ", best of " << reps << " repetitions, int8 kernel: " << GQuantizedWeights::kernelName() << "\n";
+	cout << "network\t\t\tpass\tdouble (s)\tfloat (s)\tspeedup\tint8 (s)\tspeedup\tint8 max error\n";
+	for(size_t n = 0; n < netCount; n++)
+	{
+		GNeuralNet nn;
+		size_t inputs, outputs;
+		std::string name;
+		if(n < linearCount)
+		{
+			inputs = outputs = linearSizes[n];
+			nn.add(new GBlockLinear(outputs));
+			name = to_str(inputs) + "x" + to_str(outputs) + " linear\t";
+		}
+		else
+		{
+			size_t* g = convGeometries[n - linearCount];
+			GBlockConvolutional2D* pConv = new GBlockConvolutional2D(g[0], g[0], g[1], g[3], g[3], g[2]);
+			pConv->setPadding(g[3] / 2);
+			nn.add(pConv);
+			inputs = pConv->inputs();
+			outputs = pConv->outputs();
+			name = to_str(g[0]) + "x" + to_str(g[0]) + "x" + to_str(g[1]) + " " + to_str(g[2]) + "@" + to_str(g[3]) + "x" + to_str(g[3]);
+		}
+		nn.init(inputs, outputs, rand);
+		GContextNeuralNet* pCtx = nn.newContext(rand);
+		std::unique_ptr<GContextNeuralNet> hCtx(pCtx);
+		GMatrix x(batch, inputs);
+		x.fillUniform(rand, -1.0, 1.0);
+		GMatrix y(batch, outputs);
+		GMatrix yRef;
+
+		double times[3][2];
+		double maxErr = 0.0;
+		for(size_t mode = 0; mode < 3; mode++)
+		{
+			if(mode == 1)
+			{
+				if(n >= linearCount)
+				{
+					times[1][0] = times[1][1] = -1.0;
+					continue;
+				}
+				nn.setSinglePrecision(true);
+			}
+			else if(mode == 2)
+			{
+				nn.setSinglePrecision(false);
+				nn.quantize(x);
+			}
+			for(size_t pass = 0; pass < 2; pass++)
+			{
+				double best = 1e308;
+				for(size_t r = 0; r < reps; r++)
+				{
+					double start = GTime::seconds();
+					if(pass == 0)
+					{
+						for(size_t i = 0; i < batch; i++)
+							nn.forwardProp(*pCtx, x[i], y[i]);
+					}
+					else
+						nn.forwardPropBatch(*pCtx, x, y);
+					best = std::min(best, GTime::seconds() - start);
+				}
+				times[mode][pass] = best;
+			}
+			if(mode == 0)
+				yRef.copy(y);
+			else if(mode == 2)
+			{
+				for(size_t i = 0; i < batch; i++)
+				{
+					for(size_t j = 0; j < outputs; j++)
+						maxErr = std::max(maxErr, std::abs(y[i][j] - yRef[i][j]));
+				}
+			}
+		}
+		for(size_t pass = 0; pass < 2; pass++)
+		{
+			cout << name << "\t" << passNames[pass] << "\t" << times[0][pass] << "\t";
+			if(times[1][pass] < 0.0)
+				cout << "n/a\t\tn/a\t";
+			else
+				cout << times[1][pass] << "\t" << (times[0][pass] / times[1][pass]) << "\t";
+			cout << times[2][pass] << "\t" << (times[0][pass] / times[2][pass]) << "\t" << maxErr << "\n";
+			cout.flush();
+		}
+	}
+}
+
+void knn(GArgReader& args)
+{
+	size_t rows = 20000;
+	size_t dims = 64;
+	size_t k = 10;
+	size_t queries = 500;
+	size_t m = 16;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-rows"))
+			rows = args.pop_uint();
+		else if(args.if_pop("-dims"))
+			dims = args.pop_uint();
+		else if(args.if_pop("-k"))
+			k = args.pop_uint();
+		else if(args.if_pop("-queries"))
+			queries = args.pop_uint();
+		else if(args.if_pop("-m"))
+			m = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(rows <= k || dims < 1 || k < 1 || queries < 1)
+		throw Ex("Expected more rows than neighbors, and positive dims, k, and queries");
+	GRand rand(seed);
+	GMatrix data(rows, dims);
+	for(size_t i = 0; i < rows; i++)
+		data[i].fillNormal(rand);
+	GMatrix q(queries, dims);
+	for(size_t i = 0; i < queries; i++)
+		q[i].fillNormal(rand);
+
+	// The exact answers
+	GBruteForceNeighborFinder bf(&data);
+	std::vector<size_t> truth(queries * k);
+	double start = GTime::seconds();
+	for(size_t i = 0; i < queries; i++)
+	{
+		bf.findNearest(k, q[i]);
+		bf.sortNeighbors();
+		for(size_t j = 0; j < k; j++)
+			truth[i * k + j] = bf.neighbor(j);
+	}
+	double bfTime = GTime::seconds() - start;
+
+	start = GTime::seconds();
+	GHnswNeighborFinder hnsw(&data, NULL, false, m);
+	double buildTime = GTime::seconds() - start;
+	cout << "rows=" << rows << ", dims=" << dims << ", k=" << k << ", queries=" << queries << ", m=" << m << "\n";
+	cout << "HNSW build time: " << buildTime << " s\n";
+	cout << "brute force: " << ((double)queries / bfTime) << " queries/s\n";
+	cout << "efSearch\tqueries/s\tspeedup\trecall\n";
+	size_t efs[] = { 10, 20, 50, 100, 200, 400 };
+	for(size_t e = 0; e < sizeof(efs) / sizeof(size_t); e++)
+	{
+		if(efs[e] < k)
+			continue;
+		hnsw.setEfSearch(efs[e]);
+		size_t hits = 0;
+		start = GTime::seconds();
+		for(size_t i = 0; i < queries; i++)
+		{
+			size_t found = hnsw.findNearest(k, q[i]);
+			for(size_t j = 0; j < found; j++)
+			{
+				if(std::find(truth.begin() + i * k, truth.begin() + (i + 1) * k, hnsw.neighbor(j)) != truth.begin() + (i + 1) * k)
+					hits++;
+			}
+		}
+		double t = GTime::seconds() - start;
+		cout << efs[e] << "\t\t" << ((double)queries / t) << "\t" << (bfTime / t) << "\t" << ((double)hits / (queries * k)) << "\n";
+		cout.flush();
+	}
+}
+
+void kmeans(GArgReader& args)
+{
+	size_t rows = 100000;
+	size_t dims = 16;
+	size_t k = 32;
+	size_t seed = 0;
+	while(args.next_is_flag())
+	{
+		if(args.if_pop("-rows"))
+			rows = args.pop_uint();
+		else if(args.if_pop("-dims"))
+			dims = args.pop_uint();
+		else if(args.if_pop("-k"))
+			k = args.pop_uint();
+		else if(args.if_pop("-seed"))
+			seed = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+	if(rows < k || dims < 1 || k < 1)
+		throw Ex("Expected at least as many rows as clusters, and positive dims and k");
+	GRand rand(seed);
+	GMatrix centers(k, dims);
+	for(size_t i = 0; i < k; i++)
+	{
+		centers[i].fillNormal(rand);
+		centers[i] *= 4.0;
+	}
+	GMatrix data(rows, dims);
+	for(size_t i = 0; i < rows; i++)
+	{
+		data[i].fillNormal(rand);
+		data[i] += centers[(size_t)rand.next(k)];
+	}
+	cout << "rows=" << rows << ", dims=" << dims << ", k=" << k << "\n";
+	cout << "bounds\ttime (s)\tspeedup\tdifferent rows\n";
+	double times[2];
+	std::unique_ptr<GKMeans> models[2];
+	for(size_t pass = 0; pass < 2; pass++)
+	{
+		GRand r(seed + 1);
+		models[pass].reset(new GKMeans(k, &r));
+		models[pass]->setAccelerate(pass == 1);
+		double start = GTime::seconds();
+		models[pass]->cluster(&data);
+		times[pass] = GTime::seconds() - start;
+		size_t different = 0;
+		for(size_t i = 0; i < rows; i++)
+		{
+			if(models[pass]->whichCluster(i) != models[0]->whichCluster(i))
+				different++;
+		}
+		cout << (pass == 1 ? "yes" : "no") << "\t" << times[pass] << "\t" << (times[0] / times[pass]) << "\t" << different << "\n";
+		cout.flush();
+	}
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef _DEBUG
+	GApp::enableFloatingPointExceptions();
+#endif
+	int ret = 0;
+	PathData pd;
+	GFile::parsePath(argv[0], &pd);
+	const char* appName = argv[0] + pd.fileStart;
+	GArgReader args(argc, argv);
+	args.pop_string(); // advance past the app name
+	try
+	{
+		if(args.size() < 1) throw Ex("Expected a command");
+		else if(args.if_pop("usage")) showUsage(appName);
+		else if(args.if_pop("gemm")) gemm(args);
+		else if(args.if_pop("conv")) conv(args);
+		else if(args.if_pop("recurrent")) recurrent(args);
+		else if(args.if_pop("inference")) inference(args);
+		else if(args.if_pop("knn")) knn(args);
+		else if(args.if_pop("kmeans")) kmeans(args);
+		else throw Ex("Unrecognized command: ", args.peek());
+	}
+	catch(const std::exception& e)
+	{
+		cerr << e.what() << "\n\n";
+		showUsage(appName);
+		ret = 1;
+	}
+	return ret;
+}
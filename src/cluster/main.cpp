@@ -70,6 +70,8 @@ void loadData(GMatrix& m, const char* szFilename)
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		m.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		m.load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -98,8 +100,31 @@ void agglomerativeclusterer(GArgReader& args)
 	loadData(data, args.pop_string());
 	int clusters = args.pop_uint();
 
+	// Parse Options
+	GAgglomerativeClusterer::Linkage linkage = GAgglomerativeClusterer::Single;
+	while(args.size() > 0)
+	{
+		if(args.if_pop("-linkage"))
+		{
+			const char* szLinkage = args.pop_string();
+			if(_stricmp(szLinkage, "single") == 0)
+				linkage = GAgglomerativeClusterer::Single;
+			else if(_stricmp(szLinkage, "complete") == 0)
+				linkage = GAgglomerativeClusterer::Complete;
+			else if(_stricmp(szLinkage, "average") == 0)
+				linkage = GAgglomerativeClusterer::Average;
+			else if(_stricmp(szLinkage, "ward") == 0)
+				linkage = GAgglomerativeClusterer::Ward;
+			else
+				throw Ex("Unrecognized linkage: ", szLinkage);
+		}
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+
 	// Do the clustering
 	GAgglomerativeClusterer clusterer(clusters);
+	clusterer.setLinkage(linkage);
 	GMatrix* pOut = clusterer.reduce(data);
 	std::unique_ptr<GMatrix> hOut(pOut);
 	pOut->print(cout);
@@ -148,12 +173,15 @@ void kmeans(GArgReader& args)
 	// Parse Options
 	unsigned int nSeed = getpid() * (unsigned int)time(NULL);
 	size_t reps = 1;
+	bool accelerate = false;
 	while(args.size() > 0)
 	{
 		if(args.if_pop("-seed"))
 			nSeed = args.pop_uint();
 		else if(args.if_pop("-reps"))
 			reps = args.pop_uint();
+		else if(args.if_pop("-accelerate"))
+			accelerate = true;
 		else
 			throw Ex("Invalid option: ", args.peek());
 	}
@@ -162,11 +190,77 @@ void kmeans(GArgReader& args)
 	GRand prng(nSeed);
 	GKMeans clusterer(clusters, &prng);
 	clusterer.setReps(reps);
+	clusterer.setAccelerate(accelerate);
 	GMatrix* pOut = clusterer.reduce(data);
 	std::unique_ptr<GMatrix> hOut(pOut);
 	pOut->print(cout);
 }
 
+void minibatchkmeans(GArgReader& args)
+{
+	// Parse params
+	const char* szFilename = args.pop_string();
+	int clusters = args.pop_uint();
+	unsigned int nSeed = getpid() * (unsigned int)time(NULL);
+	size_t batchSize = 1024;
+	size_t iters = 100;
+	size_t sampleSize = 100000;
+	GMiniBatchKMeans::Seeding seeding = GMiniBatchKMeans::KMeansPlusPlus;
+	size_t passes = 0;
+	while(args.size() > 0)
+	{
+		if(args.if_pop("-seed"))
+			nSeed = args.pop_uint();
+		else if(args.if_pop("-batchsize"))
+			batchSize = args.pop_uint();
+		else if(args.if_pop("-iters"))
+			iters = args.pop_uint();
+		else if(args.if_pop("-samplesize"))
+			sampleSize = args.pop_uint();
+		else if(args.if_pop("-parallelseeding"))
+			seeding = GMiniBatchKMeans::KMeansParallel;
+		else if(args.if_pop("-stream"))
+		{
+			passes = args.pop_uint();
+			if(passes == 0)
+				throw Ex("-stream expects at least 1 pass");
+		}
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+
+	// Do the clustering
+	GRand prng(nSeed);
+	GMiniBatchKMeans clusterer(clusters, &prng);
+	clusterer.setBatchSize(batchSize);
+	clusterer.setIters(iters);
+	clusterer.setSampleSize(sampleSize);
+	clusterer.setSeeding(seeding);
+	if(passes == 0)
+	{
+		GMatrix data;
+		loadData(data, szFilename);
+		GMatrix* pOut = clusterer.reduce(data);
+		std::unique_ptr<GMatrix> hOut(pOut);
+		pOut->print(cout);
+	}
+	else
+	{
+		// Stream the file through the clusterer, then stream it again to print the cluster of each row
+		clusterer.clusterStream(szFilename, passes);
+		GUniformRelation rel(1, clusters);
+		rel.print(cout);
+		GMatrix::streamArff(szFilename, batchSize, [&](GMatrix& batch)
+		{
+			for(size_t i = 0; i < batch.rows(); i++)
+			{
+				double c = (double)clusterer.nearestCentroid(batch[i]);
+				rel.printRow(cout, &c, ',');
+			}
+		});
+	}
+}
+
 void kmedoids(GArgReader& args)
 {
 	// Load the file and params
@@ -174,8 +268,32 @@ void kmedoids(GArgReader& args)
 	loadData(data, args.pop_string());
 	int clusters = args.pop_uint();
 
+	// Parse Options
+	unsigned int nSeed = getpid() * (unsigned int)time(NULL);
+	size_t claraSamples = 0;
+	size_t claraSampleSize = 0;
+	size_t cacheColumns = 0;
+	while(args.size() > 0)
+	{
+		if(args.if_pop("-seed"))
+			nSeed = args.pop_uint();
+		else if(args.if_pop("-clara"))
+		{
+			claraSamples = args.pop_uint();
+			claraSampleSize = args.pop_uint();
+		}
+		else if(args.if_pop("-cache"))
+			cacheColumns = args.pop_uint();
+		else
+			throw Ex("Invalid option: ", args.peek());
+	}
+
 	// Do the clustering
+	GRand prng(nSeed);
 	GKMedoids clusterer(clusters);
+	clusterer.setCacheSize(cacheColumns);
+	if(claraSamples > 0)
+		clusterer.setClara(claraSamples, claraSampleSize, &prng);
 	GMatrix* pOut = clusterer.reduce(data);
 	std::unique_ptr<GMatrix> hOut(pOut);
 	pOut->print(cout);
@@ -245,6 +363,7 @@ int main(int argc, char *argv[])
 		else if(args.if_pop("fuzzykmeans")) fuzzykmeans(args);
 		else if(args.if_pop("kmeans")) kmeans(args);
 		else if(args.if_pop("kmedoids")) kmedoids(args);
+		else if(args.if_pop("minibatchkmeans")) minibatchkmeans(args);
 		else throw Ex("Unrecognized command: ", args.peek());
 	}
 	catch(const std::exception& e)
@@ -62,6 +62,8 @@ GMatrix* loadData(const char* szFilename)
 	vector<size_t> ambiguousCols;
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		pData->loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		pData->load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -183,6 +183,8 @@ void loadDataWithSwitches(GMatrix& data, GArgReader& args, size_t& pLabelDims,
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		data.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		data.load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -272,6 +274,8 @@ GMatrix* loadData(const char* szFilename)
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		m.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		m.load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
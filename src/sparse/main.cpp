@@ -72,6 +72,8 @@ void loadData(GMatrix& data, const char* szFilename)
 	GFile::parsePath(szFilename, &pd);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		data.loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		data.load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
 	{
 		GCSVParser parser;
@@ -241,12 +243,12 @@ void multiplyDense(GArgReader& args)
 	// Load the sparse matrix
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pA;
-	std::unique_ptr<GSparseMatrix> hA(nullptr);
+	GCSRMatrix* pA;
+	std::unique_ptr<GCSRMatrix> hA(nullptr);
 	{
 		GDom doc;
 		doc.loadJson(args.pop_string());
-		pA = new GSparseMatrix(doc.root());
+		pA = new GCSRMatrix(doc.root());
 		hA.reset(pA);
 	}
 
@@ -264,7 +266,7 @@ void multiplyDense(GArgReader& args)
 			throw Ex("Invalid option: ", args.peek());
 	}
 
-	GMatrix* pResult = pA->multiply(&b, transpose);
+	GMatrix* pResult = pA->multiply(b, transpose);
 	std::unique_ptr<GMatrix> hResult(pResult);
 	pResult->print(cout);
 }
@@ -342,12 +344,12 @@ void predict(GArgReader& args)
 	// Load the sparse features
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pData;
-	std::unique_ptr<GSparseMatrix> hData(nullptr);
+	GCSRMatrix* pData;
+	std::unique_ptr<GCSRMatrix> hData(nullptr);
 	{
 		GDom doc2;
 		doc2.loadJson(args.pop_string());
-		pData = new GSparseMatrix(doc2.root());
+		pData = new GCSRMatrix(doc2.root());
 		hData.reset(pData);
 	}
 
@@ -387,12 +389,12 @@ void test(GArgReader& args)
 	// Load the sparse features
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pData;
-	std::unique_ptr<GSparseMatrix> hData(nullptr);
+	GCSRMatrix* pData;
+	std::unique_ptr<GCSRMatrix> hData(nullptr);
 	{
 		GDom doc2;
 		doc2.loadJson(args.pop_string());
-		pData = new GSparseMatrix(doc2.root());
+		pData = new GCSRMatrix(doc2.root());
 		hData.reset(pData);
 	}
 
@@ -436,18 +438,18 @@ void transpose(GArgReader& args)
 	// Load the sparse matrix
 	if(args.size() < 1)
 		throw Ex("No dataset specified.");
-	GSparseMatrix* pA;
-	std::unique_ptr<GSparseMatrix> hA(nullptr);
+	GCSRMatrix* pA;
+	std::unique_ptr<GCSRMatrix> hA(nullptr);
 	{
 		GDom doc;
 		doc.loadJson(args.pop_string());
-		pA = new GSparseMatrix(doc.root());
+		pA = new GCSRMatrix(doc.root());
 		hA.reset(pA);
 	}
 
 	// Transpose it
-	GSparseMatrix* pB = pA->transpose();
-	std::unique_ptr<GSparseMatrix> hB(pB);
+	GCSRMatrix* pB = pA->transpose();
+	std::unique_ptr<GCSRMatrix> hB(pB);
 
 	// Print it
 	{
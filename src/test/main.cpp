@@ -910,9 +910,11 @@ public:
 		runTest("GBrandesBetweenness", GBrandesBetweennessCentrality::test);
 		runTest("GBucket", GBucket::test);
 		runTest("GCategoricalSamplerBatch", GCategoricalSamplerBatch::test);
+		runTest("GCompiledForest", GCompiledForest::test);
 		runTest("GCompressor", GCompressor::test);
 		runTest("GCoordVectorIterator", GCoordVectorIterator::test);
 		runTest("GCrypto", GCrypto::test);
+		runTest("GCSRMatrix", GCSRMatrix::test);
 		runTest("GCycleCut", GCycleCut::test);
 		runTest("GDecisionTree", GDecisionTree::test);
 		runTest("GDiff", GDiff::test);
@@ -923,14 +925,18 @@ public:
 		runTest("GFloydWarshall", GFloydWarshall::test);
 		runTest("GFourier", GFourier::test);
 		runTest("GGaussianProcess", GGaussianProcess::test);
+		runTest("GGradientBoostedTrees", GGradientBoostedTrees::test);
 		runTest("GGraphCut", GGraphCut::test);
 		runTest("GHashTable", GHashTable::test);
 		runTest("GHiddenMarkovModel", GHiddenMarkovModel::test);
 		runTest("GHillClimber", GHillClimber::test);
+		runTest("GHnswNeighborFinder", GHnswNeighborFinder::test);
 		runTest("GIncrementalTransform", GIncrementalTransform::test);
 		runTest("GInstanceRecommender", GInstanceRecommender::test);
 		runTest("GKdTree", GKdTree::test);
 		runTest("GKeyPair", GKeyPair::test);
+		runTest("GKMeans", GKMeans::test);
+		runTest("GKMedoids", GKMedoids::test);
 		runTest("GKNN", GKNN::test);
 		runTest("GLinearDistribution", GLinearDistribution::test);
 		runTest("GLinearProgramming", GLinearProgramming::test);
@@ -941,12 +947,14 @@ public:
 		runTest("GMatrix::parseArff quoting", test_parsearff_quoting);
 		runTest("GMatrixFactorization", GMatrixFactorization::test);
 		runTest("GMeanMarginsTree", GMeanMarginsTree::test);
+		runTest("GMiniBatchKMeans", GMiniBatchKMeans::test);
 		runTest("GMixtureOfGaussians", GMixtureOfGaussians::test);
 		runTest("GMomentumGreedySearch", GMomentumGreedySearch::test);
 		runTest("GNaiveBayes", GNaiveBayes::test);
 		runTest("GNaiveInstance", GNaiveInstance::test);
 		runTest("GNeuralDecomposition", GNeuralDecomposition::test);
 		runTest("GNeuralNetLearner", GNeuralNetLearner::test);
+		runTest("GNeuralNetOptimizer", GNeuralNetOptimizer::test);
 //		runTest("GNonlinearPCA", GNonlinearPCA::test);
 		runTest("GPackageServer", GPackageServer::test);
 		runTest("GPolynomial", GPolynomial::test);
@@ -970,6 +978,7 @@ public:
 		runTest("GSubImageFinder", GSubImageFinder::test);
 		runTest("GSubImageFinder2", GSubImageFinder2::test);
 		runTest("GSupervisedLearner", GSupervisedLearner::test);
+		runTest("GThreadPool", GThreadPool::test);
 		runTest("GVec", GVec::test);
 
 		// Test whether we can find and execute the command-line tools
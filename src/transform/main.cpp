@@ -160,6 +160,8 @@ GMatrix* loadData(const char* szFilename)
 	Holder<GMatrix> hData(pData);
 	if(_stricmp(szFilename + pd.extStart, ".arff") == 0)
 		pData->loadArff(szFilename);
+	else if(_stricmp(szFilename + pd.extStart, ".wbin") == 0)
+		pData->load(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".raw") == 0)
 		pData->loadRaw(szFilename);
 	else if(_stricmp(szFilename + pd.extStart, ".csv") == 0)
@@ -2266,6 +2268,13 @@ void wilcoxon(GArgReader& args)
 	cout << p << "\n";
 }
 
+void tobinary(GArgReader& args)
+{
+	GMatrix* pData = loadData(args.pop_string());
+	Holder<GMatrix> hData(pData);
+	pData->saveBinary(args.pop_string());
+}
+
 void toraw(GArgReader& args)
 {
 	GMatrix* pData = loadData(args.pop_string());
@@ -2403,6 +2412,7 @@ int main(int argc, char *argv[])
 		else if(args.if_pop("squaredDistance")) squaredDistance(args);
 		else if(args.if_pop("swapcolumns")) SwapAttributes(args);
 		else if(args.if_pop("threshold")) threshold(args);
+		else if(args.if_pop("tobinary")) tobinary(args);
 		else if(args.if_pop("toraw")) toraw(args);
 		else if(args.if_pop("transition")) transition(args);
 		else if(args.if_pop("transpose")) Transpose(args);
@@ -59,6 +59,10 @@ void LoadData(GArgReader &args, std::unique_ptr<GMatrix> &hOutput)
 	{
 		data.loadArff(szFilename);
 	}
+	else if(_stricmp(input_type, "wbin") == 0)
+	{
+		data.load(szFilename);
+	}
 	else if(_stricmp(input_type, "csv") == 0)
 	{
 		GCSVParser parser;